@@ -58,11 +58,21 @@ c
 */
 
 #include "kin.h"
+#include "libkin.h"
 #include <iostream.h>
 #include <fstream.h>
+#include <strstream.h>
 #include <iomanip.h>
 #include <string.h>
+#include <stdio.h>
+#include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #ifndef DEBUG_TIMESTEP
 #define DEBUG_TIMESTEP 0
@@ -74,58 +84,119 @@ c
 #define LINE 72
 #define DEC8 8
 #define FRAC 16
+#define REACTION_ROWS 8          // vfor, vbak, k1_reac .. k6_reac
 
 
 /*
 *
 **
-* Initializes some of the 'big' matrices used
+* Initializes some of the 'big' matrices used, one row per time step
+* of the longest piece and one column per species ( reaction ). The
+* rows of xspec come with the run ( allocateRows ), kin_solver_observe
+* needs only a few ( ringRows )
 */
-int initializeBigMatrices()
+int KinSolver::initializeBigMatrices()
 {
-xspec = new double* [ MAX_NUMBER_TIME_STEPS + 10 ];
+timeRows = true_numberOfTimeSteps + 10;
+if( timeRows < MIN_numberOfTimeSteps + 10 ) {
+timeRows = MIN_numberOfTimeSteps + 10;
+}
+
+xspec = new double* [ timeRows ];
 if( xspec == 0 ) {
 cerr << "ERROR: Unable to allocate memory for xspec!" << endl;
 return 1;
 }
-for( int i = 0; i < ( MAX_NUMBER_TIME_STEPS + 10 ); i++ ) {
-xspec[ i ] = new double[ MAX_NUMBER_SPECIES + 1 ];
-if( xspec[ i ] == 0 ) {
-cerr << "ERROR: Unable to allocate memory for xspec[ " << i;
-cerr << " ]!" << endl;
-return 1;
-}
+for( int i = 0; i < timeRows; i++ ) {
+xspec[ i ] = 0;
 }
 
 #ifndef OPTIMIZE
-//xreac = new (double*) [ MAX_NUMBER_REACTIONS + 1 ];
-xreac = new (double*) [ MAX_NUMBER_TIME_STEPS + 10 ];
+xreac = new (double*) [ timeRows ];
 if( xreac == 0 ) {
 cerr << "ERROR: Unable to allocate memory for xreac!" << endl;
 return 1;
 }
-//for( int i = 0; i < ( MAX_NUMBER_REACTIONS + 1 ); i++ ) {
-for( int i = 0; i < ( MAX_NUMBER_TIME_STEPS + 10 ); i++ ) {
-//xreac[ i ] = new double[ MAX_NUMBER_TIME_STEPS + 10 ];
-xreac[ i ] = new double[ MAX_NUMBER_REACTIONS + 1 ];
+for( int i = 0; i < timeRows; i++ ) {
+xreac[ i ] = new double[ numberOfReactions + 1 ];
 if( xreac[ i ] == 0 ) {
 cerr << "ERROR: Unable to allocate memory for xreac[ " << i;
 cerr << " ]!" << endl;
 return 1;
 }
+for( int r = 0; r <= numberOfReactions; r++ ) {
+xreac[ i ][ r ] = 0.0;
+}
 }
 #endif
 
-xtime = new double[ MAX_NUMBER_TIME_STEPS + 10 ];
+xtime = new double[ timeRows ];
 if( xtime == 0 ) {
 cerr << "ERROR: Unable to allocate memory for xtime !" << endl;
 return 1;
 }
 
+intg_xtime_index = new int[numOfIntegrations+1];
+intg_xspec = new double**[numOfIntegrations+1];
+intg_xtime = new double*[numOfIntegrations+1];
+for(int i=0; i<=numOfIntegrations; i++){
+intg_xspec[i] = 0;
+intg_xtime[i] = 0;
+}
+
+// of the participants for lsodes, the rates and increments of the
+// reactions for the other methods, numberOfReactions + 1 each
+for( int q = 0; q <= MAX_NUMBER_PARTICIPANT_REACTIONS; q++ ) {
+indexOfInputSpecies[ q ] = new int[ numberOfReactions + 1 ];
+indexOfOutputSpecies[ q ] = new int[ numberOfReactions + 1 ];
+for( int r = 0; r <= numberOfReactions; r++ ) {
+indexOfInputSpecies[ q ][ r ] = 0;
+indexOfOutputSpecies[ q ][ r ] = 0;
+}
+}
+reactionWork = new double[ REACTION_ROWS * ( numberOfReactions + 1 ) ];
+if( reactionWork == 0 ) {
+cerr << "ERROR: Unable to allocate memory for reactionWork!" << endl;
+return 1;
+}
+
+return 0;
+}
+
+/*
+* row k of reactionWork, 0 .. REACTION_ROWS-1, set to 0: vfor, vbak
+* and the increments of xreac of a method. The methods that use them
+* run one at a time, an ensemble runs only the stochastic ones.
+*/
+double *KinSolver::reactionRow( int k )
+{
+double *row = reactionWork + (long) k * ( numberOfReactions + 1 );
+for( int r = 0; r <= numberOfReactions; r++ ) {
+row[ r ] = 0.0;
+}
+return row;
+}
+
+/*
+* a row of xspec per time step, for a run that keeps them
+*/
+int KinSolver::allocateRows()
+{
+for( int i = 0; i < timeRows; i++ ) {
+xspec[ i ] = new double[ numberOfSpecies + 1 ];
+if( xspec[ i ] == 0 ) {
+cerr << "ERROR: Unable to allocate memory for xspec[ " << i;
+cerr << " ]!" << endl;
+return 1;
+}
+for( int k = 0; k <= numberOfSpecies; k++ ) {
+xspec[ i ][ k ] = 0.0;
+}
+}
 return 0;
 }
 
-void setnumofintegrations(){
+void KinModel::setnumofintegrations(){
 double remaintime;
 if(!extFlag){
 return;
@@ -145,16 +216,14 @@ if(remaintime<0.0) break;
 //cout << numOfIntegrations <<endl;
 }
 
-void setintg_(){
+// time pieces of the external control, the results of each piece
+// are kept by the solver ( storedata )
+void KinModel::setintg_(){
 intg_initialTime = new double[numOfIntegrations+1];
 intg_finalTime = new double[numOfIntegrations+1];
 intg_numberOfTimeSteps = new int[numOfIntegrations+1];
-intg_xtime_index = new int[numOfIntegrations+1];
 intg_dtime = new double[numOfIntegrations+1];
 
-intg_xspec = new double**[numOfIntegrations+1];
-intg_xtime = new double*[numOfIntegrations+1];
-
 if(!extFlag){
 intg_initialTime[1] = true_initialTime;
 intg_finalTime[1] = true_finalTime;
@@ -192,22 +261,22 @@ cout << intg_initialTime[i] << " " << intg_finalTime[i] << " " << intg_dtime[i]
 
 }
 
-void setinitial(int i){
+void KinSolver::setinitial(int i){
 initialTime = intg_initialTime[i];
 }
 
-void setfinal(int i){
+void KinSolver::setfinal(int i){
 finalTime = intg_finalTime[i];
 }
 
-void setfix(int i)
+void KinSolver::setfix(int i)
 {
 //dtime = ( finalTime - initialTime ) / ( 1.0 * numberOfTimeSteps );
 numberOfTimeSteps = intg_numberOfTimeSteps[i];
 dtime = intg_dtime[i];   
 }
 
-void setinitialdata(int i){
+void KinSolver::setinitialdata(int i){
 
 if(i==1){
 for( int i = 1; i <= numberOfSpecies; i++ ) {
@@ -227,14 +296,14 @@ xspec[ 0 ][ i ] = xspec[ top ][ i ];
 
 }
 
-void storedata(int i){
+void KinSolver::storedata(int i){
 
 int top = numberOfTimeSteps;
 if( integrationOption == 4 ) { // RK Adaptive
 top = xtime_index;
-intg_xtime_index[i] = top;
 intg_xtime[i] = new double[ top+1 ];
 }//endof if
+intg_xtime_index[i] = top;
 
 intg_xspec[i] = new double* [ top + 1 ];
 if( intg_xspec[i] == 0 ) {
@@ -259,517 +328,1525 @@ intg_xtime[ i ][ j ] = xtime[ j ];
 }
 
 // solves kinetic equations for arbitrary reaction networks
-int main(int argc, char **argv)
+/*************************************************************
+*   r u n
+*************************************************************
+* integrates the model, piece by piece with external control
+*/
+void KinSolver::run()
 {
+streamMtime = -1;
+streamDone = 0.0;
+runStart = wallClock();
+halted = 0;
+// observe() has put the rows into its ring already
+if( xspec[ 0 ] == 0 && allocateRows() != 0 ) {
+halted = 1;
+return;
+}
 
-lsodesArgv = argv[1];
-outputArgv = argv[2];
-includeArgv = argv[3]; 
-
-clock_t start, end;
-double elapsed = 0.0;
-
-int retValue = 0;
-
-numberOfDataSets = 0;
-
-start = clock();
-if( initializeBigMatrices() != 0 ) {
-return 1;
+if( ensembleRuns > 0 && isStochasticMethod( integrationOption ) ) {
+runEnsemble();
+if( streamRow != 0 ) {
+for( int o = 0; o < ensemble->outputs; o++ ) {
+streamRow( streamUser, initialTime + ensemble->outputIndex[ o ] * dtime,
+selectRow( ensemble->mean[ o ] ), numberOfOutputSpecies );
 }
-end = clock();
-elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-if( DEBUG_EXECUTION_TIME ) {
-cerr << " initializeBigMatrices time: " << elapsed <<endl;
 }
-
-do {
-start = clock();
-retValue = readInputData();
-
-if( retValue != 0 ) {
-break;
+progress( 1.0 );
+return;
 }
 
-end = clock();
-elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-if( DEBUG_EXECUTION_TIME ) {
-cerr << " readInputData time: " << elapsed <<endl;
+writerFree( writer );
+writer = 0;
+freePoints();
+// the rows of "points" are known only at the end
+if( background && integrationOption != 6 && outputPoints == 0 && observeX == 0 ) {
+writer = writerNew( numberOfOutputSpecies, outputSpecies + 1, outputDigits, timeMajor );
 }
 
-setnet();
-setnumofintegrations();
-setintg_();
-
-start = clock();
-
 for(int i=1; i<=numOfIntegrations; i++){
-cout << i << endl;
 setinitial(i);
 setfinal(i);
 setfix(i);
 setinitialdata(i);
+streamNext = 0;
+streamEmitted = -1;
+observeNext = 0;
 runkin();
+if( ( streamRow != 0 || writer != 0 ) && integrationOption != 6 ) {
+int top = ( integrationOption == 4 ? xtime_index : numberOfTimeSteps );
+stream( top, top );
+if( streamEmitted != top ) {
+// stopped between rows, top had passed already
+streamEmit( top );
+}
+}
+if( observeX != 0 ) {
+observeRows( integrationOption == 4 ? xtime_index : numberOfTimeSteps );
+}
+else {
 storedata(i);
 }
-
-end = clock();
-elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-if( DEBUG_EXECUTION_TIME ) {
-cerr << " total integration time:  " << elapsed <<endl;
+if( halted ) {
+break;
+}
+}
+if( writer != 0 ) {
+writerClose( writer );
 }
+if( outputPoints > 0 && integrationOption != 6 && observeX == 0 ) {
+pickPoints();
+}
+progress( 1.0 );
+}
+
+/*
+* writes kin.o01 .. kin.o04 after run()
+* returns 0 when ok
+*/
+int KinSolver::output()
+{
+int retValue = 0;
 
 //for lsodesMethod
 if( integrationOption == 6 ){
 //just stop
+return 0;
 }//endof if
-//for all other methods
-
-else{
-retValue = 1;//stop it
 
+//for all other methods
 retValue = outputDataFile1();
 
 if( retValue != 0 ) {
 cerr << "error at outputDataFile1()" << endl;
-break;
+return retValue;
 }
 
+if( ensemble != 0 ) {
+retValue = outputEnsembleFile2();
+}
+else {
 retValue = outputDataFile2();
+}
 
 if( retValue != 0 ) {
 cerr << "error at outputDataFile2()" << endl;
-break;
+return retValue;
 }
 
 retValue = outputDataFile3();
 
 if( retValue != 0 ) {
 cerr << "error at outputDataFile3()" << endl;
-break;
+return retValue;
 }
 
+if( isFspMethod( integrationOption ) ) {
+retValue = outputDataFile4();
+
+if( retValue != 0 ) {
+cerr << "error at outputDataFile4()" << endl;
+return retValue;
+}
 }
-} while( retValue == 0 );
 
-freeMemory();
+return 0;
 }
 
-/**
-* Reads input data from "kin.i01" and writes them into "kin.o01"
-* @return  zero if everything was ok
+/*
+* the output rows of the run ( those of kin_o02 ) into time[] and
+* x[ row * numberOfSpecies + i - 1 ], at most rows of them;
+* returns the total number of rows
 */
-int readInputData()
+int KinSolver::trajectory( double time[], double x[], int rows )
 {
+return trajectory( time, x, rows, numberOfSpecies, 0 );
+}
 
-int iset = 0;
-char buf[ LINE ];
+/*
+* the same of species species index[ 0 .. species-1 ] ( 0: all ) only,
+* x[ row * species + k ] for species index[ k ]
+*/
+int KinSolver::trajectory( double time[], double x[], int rows, int species, const int index[] )
+{
+int n = 0;
 
-// open files kin_i01 and kin_o01 
-ifstream inputFile( kin_i01, ios::in );
-if( ! inputFile ) {
-cerr << "Couldn't open input file " << kin_i01 << endl;
-return 1;
+if( integrationOption == 6 ) {
+// lsodes writes its own output
+return 0;
 }
 
-ofstream outputFile1( kin_o01, ( numberOfDataSets == 0 ? ios::out : ios::app ) );
-if( ! outputFile1 ) {
-cerr << "Couldn't open input file " << kin_i01 << endl;
-return 1;
+if( ensemble != 0 ) {
+EnsembleStats *st = ensemble;
+for( int o = 0; o < st->outputs; o++, n++ ) {
+if( n < rows ) {
+time[ n ] = initialTime + st->outputIndex[ o ] * dtime;
+for( int k = 0; k < species; k++ ) {
+x[ (long) n * species + k ] = st->mean[ o ][ index != 0 ? index[ k ] : k + 1 ];
 }
-
-// find first/next input data set:
-int dataSet = 0;
-while( dataSet <= numberOfDataSets ) {
-inputFile.getline( buf, LINE );
-if( strstr( buf, "data set" ) != NULL ) {
-dataSet++;
 }
-if( inputFile.eof() ) {
-break;
 }
+return n;
 }
 
-// verify that a data set was actually read
-if( dataSet <= numberOfDataSets ) {
-return 1;
+int mtime = -1;
+for( int i_intg = 1; i_intg <= numOfIntegrations; i_intg++ ) {
+if( intg_xspec[ i_intg ] == 0 ) {
+// not run
+break;
 }
-if( DEBUG ) {
-cerr << "dataSet = " << dataSet << endl;
+int top = intg_xtime_index[ i_intg ];
+for( int t = 0; t <= top; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
+}
+if( outputRow( i_intg, t, top, mtime ) ) {
+if( n < rows ) {
+if( integrationOption == 4 ) {
+time[ n ] = intg_xtime[ i_intg ][ t ];
+}
+else {
+time[ n ] = intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ];
+}
+const double *row = intg_xspec[ i_intg ][ t ];
+for( int k = 0; k < species; k++ ) {
+x[ (long) n * species + k ] = row[ index != 0 ? index[ k ] : k + 1 ];
+}
+}
+n++;
+}
+}
+}
+return n;
 }
-numberOfDataSets = dataSet;
-
-// read in input parameters:
-int copiedLines = 0;
-bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
-strcpy( bline[ copiedLines ], buf );
 
-// number of species and reactions:
-copiedLines++;
-inputFile.getline( buf, LINE );
-bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
-strcpy( bline[ copiedLines ], buf );
-inputFile >> numberOfSpecies;
-inputFile >> numberOfReactions;
-inputFile.getline( buf, LINE );  // skip the new line
-if( DEBUG ) {
-cerr << "numberOfSpecies=" << numberOfSpecies;
-cerr << "  numberOfReactions=" << numberOfReactions << endl;
+/*
+* called by the methods when the rows up to t of the current piece
+* are final: passes them on to streamRow and the time to progress().
+* The last row of an adaptive piece ( jtime=4 ) is only known at its
+* end, so there one row is held back until run() has it.
+* On a cancel or past the deadline the piece ends at row t: the
+* loops of the methods run to numberOfTimeSteps ( the adaptive one
+* tests the return value ), so they stop there and the writers
+* give the results up to that time.
+* returns nonzero when the run stops
+*/
+int KinSolver::step( int t )
+{
+if( ! halted && stopRequested() ) {
+halt( t );
+}
+if( observeX != 0 ) {
+// an adaptive step may still be redone, as for stream()
+observeRows( integrationOption == 4 ? t - 1 : t );
+}
+if( streamRow != 0 || writer != 0 ) {
+if( integrationOption == 4 ) {
+stream( t - 1, -1 );
+}
+else {
+stream( t, numberOfTimeSteps );
+}
+}
+if( streamProgress != 0 ) {
+double time = ( integrationOption == 4 ? xtime[ t ] : initialTime + t * dtime );
+progress( ( time - true_initialTime ) / ( true_finalTime - true_initialTime ) );
+}
+return halted;
 }
 
-if( numberOfSpecies > MAX_NUMBER_SPECIES ) { 
-cerr << endl << endl << " ERROR" << endl;
-cerr << "   Increase array size MAX_NUMBER_SPECIES" << endl;
-cerr << "  EXECUTION TERMINATED" << endl;
-return 1;
+// the run stops, the piece ends at row t
+void KinSolver::halt( int t )
+{
+halted = 1;
+numberOfTimeSteps = t;
+finalTime = ( integrationOption == 4 ? xtime[ t ] : initialTime + t * dtime );
 }
 
-if( numberOfReactions > MAX_NUMBER_REACTIONS ) { 
-cerr << endl << endl << " ERROR" << endl;
-cerr << "   Increase array size MAX_NUMBER_SPECIES" << endl;
-cerr << "  EXECUTION TERMINATED" << endl;
+int KinSolver::stopRequested()
+{
+if( cancelRequested ) {
 return 1;
 }
+return deadline > 0.0 && wallClock() - runStart >= deadline;
+}
 
-// initial + final time, number of time steps, time integrtn. option
-copiedLines++;
-inputFile.getline( buf, LINE );
-bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
-strcpy( bline[ copiedLines ], buf );
-inputFile >> initialTime;
-true_initialTime = initialTime;
-inputFile >> finalTime;
-true_finalTime = finalTime;
-inputFile >> numberOfTimeSteps;
-true_numberOfTimeSteps = numberOfTimeSteps;
-inputFile >> ntskip;
-inputFile >> integrationOption;
-inputFile.getline( buf, LINE );  // skip the new line
-if( DEBUG ) {
-cerr << "initialTime=" << initialTime << "  finalTime=";
-cerr << finalTime << "  numberOfTimeSteps=" << numberOfTimeSteps;
-cerr << "  integrationOption=" << integrationOption << endl;
+/*
+* rows streamNext .. t of the piece to streamRow and the writer, those that
+* outputDataFile2() writes: every ntskip-th and the last one, top
+* ( -1 while it is not known )
+*/
+void KinSolver::stream( int t, int top )
+{
+for( ; streamNext <= t; streamNext++ ) {
+int r = streamNext;
+streamMtime = streamMtime + 1;
+if( streamMtime == ntskip ) {
+streamMtime = 0;
+}
+if( streamMtime == 0 || r == top ) {
+streamEmit( r );
+}
+}
 }
 
-double h = 0.0;
-double hMin = 0.0;
-double errorBound = 0.0;
-h = ( finalTime - initialTime ) / numberOfTimeSteps;
-if( numberOfTimeSteps > MAX_NUMBER_TIME_STEPS ) { 
-cerr << endl << endl << " ERROR" << endl;
-cerr << "   Increase array size MAX_NUMBER_TIME_STEPS" << endl;
-cerr << "  EXECUTION TERMINATED" << endl;
-return 1;
+void KinSolver::streamEmit( int r )
+{
+double time = ( integrationOption == 4 ? xtime[ r ] : initialTime + r * dtime );
+if( streamRow != 0 ) {
+streamRow( streamUser, time, selectRow( xspec[ r ] ), numberOfOutputSpecies );
+}
+if( writer != 0 ) {
+writerPut( writer, r, time, xspec[ r ] );
+}
+streamEmitted = r;
 }
 
-// names and initial concentration of reacting species:
-copiedLines++;
-inputFile.getline( buf, LINE );
-bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
-strcpy( bline[ copiedLines ], buf );
+// the selected species of row[ 1 .. numberOfSpecies ], from 0
+const double *KinSolver::selectRow( const double row[] )
+{
+if( streamSelected == 0 ) {
+return row + 1;
+}
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+streamSelected[ k - 1 ] = row[ outputSpecies[ k ] ];
+}
+return streamSelected;
+}
 
-char *abc = new char[75];
+/*************************************************************
+*   o b s e r v a t i o n s
+*************************************************************
+* kin_solver_observe(): the state at given times instead of the
+* rows. The rows of xspec point into a ring of a few, which the
+* methods fill as ever; step() takes the observations out of the
+* last two rows before they are overwritten, nothing is stored.
+* Row t of a step is written while the rows back to t - OBSERVE_BACK
+* are read: stiffSolver's three-row formula, xrate() of row t - 1
+* and observeRows() look back no further. A method reading older rows
+* needs OBSERVE_BACK raised with it.
+*/
+#define OBSERVE_RING 8           // rows
+#define OBSERVE_BACK 2           // rows before t the methods read
 
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-inputFile.getline( tmpLine, LINE );
-//cerr << "OK " << tmpLine;
-nameOfSpecies[ i ] = new char[ strlen( tmpLine ) + 1 ];
-strcpy( nameOfSpecies[ i ], tmpLine );
-inputFile >> initialConcentration[ i ];
-inputFile >> jfix[ i ];
-if((jfix[i]==10)||(jfix[i]==20)){
-extFlag = true;
-whichExt = i;
-inputFile >> npulse[ i ];  
-// process the external control information
-inputFile.getline( buf, LINE ); //skip the new line
-inputFile.getline( buf, LINE ); //skip one line
+#if OBSERVE_RING <= OBSERVE_BACK + 1
+#error "OBSERVE_RING too small for the rows the methods look back"
+#endif
 
-for(int j = 1; j <= 2*npulse[i]+2; j++){
-inputFile >> abc; //actually ipm
-inputFile >> extOfSpecies[i][j]; //pmspec
-if((j!=1)&&(j%2==1)){
-oneCycle[i] = oneCycle[i] + extOfSpecies[i][j];
-slopeTrap[i][j] = (extOfSpecies[i][j+1]-extOfSpecies[i][j-1])/extOfSpecies[i][j];
+/*
+* the rows of xspec into a ring of OBSERVE_RING, row
+* true_numberOfTimeSteps apart ( the last one of every piece, which
+* the next starts from ); instead of allocateRows(), those of a run
+* before are freed
+*/
+void KinSolver::ringRows()
+{
+for( int i = 0; i < timeRows; i++ ) {
+delete [] xspec[ i ];
 }
-}//endof for j
-
-// get slopes
-for(int j = 1; j <= 2*npulse[i]+2; j++){
-if((j!=1)&&(j%2==1)){
-slopeTrap[i][j] = (extOfSpecies[i][j+1]-extOfSpecies[i][j-1])/extOfSpecies[i][j];
-//cout << extOfSpecies[i][j+1] << " " << extOfSpecies[i][j-1] << " " << extOfSpecies[i][j] <<endl;
-//cout << slopeTrap[i][j] << endl;
+observeRing = new double* [ OBSERVE_RING + 1 ];
+for( int k = 0; k <= OBSERVE_RING; k++ ) {
+observeRing[ k ] = new double[ numberOfSpecies + 1 ];
+for( int i = 0; i <= numberOfSpecies; i++ ) {
+observeRing[ k ][ i ] = 0.0;
 }
-}//endof for j
-
-//cerr << " ok " << oneCycle[i];
-}   
-inputFile.getline( buf, LINE );  // skip the new line
-if( DEBUG ) {
-cerr << "nameOfSpecies[" << i << "]=" << nameOfSpecies[ i ];
-cerr << "  initialConcentration=" << initialConcentration[ i ];
-cerr << " jfix=" << jfix[ i ] << endl;
 }
+for( int t = 0; t < timeRows; t++ ) {
+xspec[ t ] = observeRing[ t % OBSERVE_RING ];
+}
+xspec[ true_numberOfTimeSteps ] = observeRing[ OBSERVE_RING ];
 }
 
-// reaction network by raction number:
-// reaction kinetics and rates, number of reactant and product species:
-//  jkin= 1: standard single-step kinetics with
-//    rkfor, rkbak   = forward, backward rate constants
-//  jkin=11: Michaelis-Menten (MM) two-step kinetics with
-//    nameispec(1,.)=nameospec(1,.) = enzyme species
-//    rkfor,  rkbak  = step-1 rate constants
-//    rkfor2, rkbak2 = step-2 rate constants
-
-for( int r = 1; r <= numberOfReactions; r++ ) {
-copiedLines++;
-inputFile.getline( buf, LINE );
-bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
-strcpy( bline[ copiedLines ], buf );
-inputFile >> forwardReactionRates[ r ];
-inputFile >> backwardReactionRates[ r ];
-inputFile >> numberInputParticipants[ r ];
-inputFile >> numberOutputParticipants[ r ];
-inputFile >> jkin[ r ];
-inputFile.getline( buf, LINE );  // skip the new line
-if( DEBUG ) {
-cerr << bline[ copiedLines ] << endl;
-cerr << "forwardReactionRates=" << forwardReactionRates[ r ];
-cerr << "  backwardReactionRates=" << backwardReactionRates[ r ];
-cerr << "  numberInputParticipants=" << numberInputParticipants[ r ];
-cerr << "  numberOutputParticipants=" << numberOutputParticipants[ r ];
-cerr << "  jkin=" << jkin[ r ] << endl;
+double KinSolver::rowTime( int r )
+{
+return integrationOption == 4 ? xtime[ r ] : initialTime + r * dtime;
 }
-if( jkin[ r ] == 11 ) {
-inputFile >> forwardReactionRates2[ r ];
-inputFile >> backwardReactionRates2[ r ];
-inputFile.getline( buf, LINE );  // skip the new line
-if( DEBUG ) {
-cerr << "forwardReactionRates2=" << forwardReactionRates2[ r ];
-cerr << "  backwardReactionRates2=" << backwardReactionRates2[ r ] << endl;
+
+/*
+* the observations up to row t of the piece: between two rows
+* interpolated linearly, for the stochastic methods ( a jump
+* process ) the row before
+*/
+void KinSolver::observeRows( int t )
+{
+for( ; observeNext <= t; observeNext++ ) {
+int r = observeNext;
+double tr = rowTime( r );
+while( observeDone < observeCount && observeTime[ observeDone ] <= tr ) {
+double *x = observeX + (long) observeDone * numberOfSpecies;
+double w = 1.0;
+if( r > 0 ) {
+double t0 = rowTime( r - 1 );
+if( isStochasticMethod( integrationOption ) ) {
+w = ( observeTime[ observeDone ] < tr ? 0.0 : 1.0 );
 }
+else if( tr > t0 && observeTime[ observeDone ] > t0 ) {
+w = ( observeTime[ observeDone ] - t0 ) / ( tr - t0 );
 }
-if( numberInputParticipants[ r ] > MAX_NUMBER_PARTICIPANT_REACTIONS 
-||numberOutputParticipants[ r ] > MAX_NUMBER_PARTICIPANT_REACTIONS) {
-cerr << endl << endl << " ERROR" << endl;
-cerr << "   At reaction : " << r << " : " << bline[ copiedLines ];
-cerr << endl << "   nipart=" << numberInputParticipants[ r ];
-cerr << ", nopart=" << numberOutputParticipants[ r ] << endl;
-cerr << "   Increase array size MAX_NUMBER_PARTICIPANT_REACTIONS";
-cerr << endl << "  EXECUTION TERMINATED" << endl;
-return 1;
+else if( tr > t0 ) {
+w = 0.0;
 }
-// reactants:
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-inputFile.getline( tmpLine, LINE );
-nameOfInputSpecies[ q ][ r ] = new char[ strlen( tmpLine ) + 1 ];
-strcpy( nameOfInputSpecies[ q ][ r ], tmpLine );
-if( DEBUG ) {
-cerr << "nameOfInputSpecies[" << q << "]=";
-cerr << nameOfInputSpecies[ q ][ r ] << endl;
 }
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+double b = xspec[ r ][ i ];
+double a = ( r > 0 ? xspec[ r - 1 ][ i ] : b );
+x[ i - 1 ] = a + w * ( b - a );
 }
-// products:
-for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
-inputFile.getline( tmpLine, LINE );
-nameOfOutputSpecies[ p ][ r ] = new char[ strlen( tmpLine ) + 1 ];
-strcpy( nameOfOutputSpecies[ p ][ r ], tmpLine );
-if( DEBUG ) {
-cerr << "nameOfOutputSpecies[" << p << "]=";
-cerr << nameOfOutputSpecies[ p ][ r ] << endl;
+observeDone++;
 }
 }
 }
-inputFile.close();
-
-// write out input parameters ( to file kin_o01 )
-copiedLines = 0;
-outputFile1 << " " << endl;
-outputFile1 << " " << endl;
-outputFile1 << bline[ copiedLines ] << endl;
-
-copiedLines++;
-outputFile1 << bline[ copiedLines ] << endl;
-outputFile1 << setw( DEC8 ) << numberOfSpecies;
-outputFile1 << setw( DEC8 ) << numberOfReactions << endl;
 
-copiedLines++;
-outputFile1 << bline[ copiedLines ] << endl;
-outputFile1 << setiosflags( ios::scientific | ios::uppercase );
-outputFile1 << setw( FRAC ) << initialTime;
-outputFile1 << setw( FRAC ) << finalTime;
-outputFile1 << setw( DEC8 ) << numberOfTimeSteps;
-outputFile1 << setw( DEC8 ) << ntskip;
-outputFile1 << setw( DEC8 ) << integrationOption << endl;
+/*
+* runs the model and puts the state at time[ 0 .. n-1 ] into
+* x[ k * numberOfSpecies + i - 1 ]
+* returns the number of times reached, -1 on an error
+*/
+int KinSolver::observe( const double time[], int n, double x[] )
+{
+if( integrationOption == 6 ) {
+cerr << "ERROR: lsodes writes its own output, no observations" << endl;
+return -1;
+}
+if( ensembleRuns > 0 && isStochasticMethod( integrationOption ) ) {
+cerr << "ERROR: observations of a single run only, not of an ensemble" << endl;
+return -1;
+}
+double slack = 1.0e-12 * ( myabs( true_initialTime ) + myabs( true_finalTime ) );
+for( int k = 0; k < n; k++ ) {
+if( time[ k ] < true_initialTime - slack || time[ k ] > true_finalTime + slack
+|| ( k > 0 && time[ k ] < time[ k - 1 ] ) ) {
+cerr << "ERROR: observation time " << time[ k ] << " out of order or outside ";
+cerr << true_initialTime << " .. " << true_finalTime << endl;
+return -1;
+}
+}
 
-copiedLines++;
-outputFile1 << bline[ copiedLines ] << endl;
+if( observeRing == 0 ) {
+ringRows();
+}
+observeTime = time;
+observeX = x;
+observeCount = n;
+observeDone = 0;
+run();
 
+// the last times, past the end by round off
+if( ! halted ) {
+while( observeDone < observeCount ) {
+double *o = observeX + (long) observeDone * numberOfSpecies;
+int top = ( integrationOption == 4 ? xtime_index : numberOfTimeSteps );
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-outputFile1 << nameOfSpecies[ i ] << endl;
-outputFile1 << setw( FRAC ) << initialConcentration[ i ];
-outputFile1 << setw( DEC8 ) << jfix[ i ] << endl;
+o[ i - 1 ] = xspec[ top ][ i ];
+}
+observeDone++;
+}
+}
+observeX = 0;
+return observeDone;
 }
 
-for( int r = 1; r <= numberOfReactions; r++ ) {
-copiedLines++;
-outputFile1 << bline[ copiedLines ] << endl;
-outputFile1 << setw( FRAC ) << forwardReactionRates[ r ];
-outputFile1 << setw( FRAC ) << backwardReactionRates[ r ];
-outputFile1 << setw( DEC8 ) << numberInputParticipants[ r ];
-outputFile1 << setw( DEC8 ) << numberOutputParticipants[ r ];
-outputFile1 << setw( DEC8 ) << jkin[ r ] << endl;
-if( jkin[ r ] == 11 ) {
-outputFile1 << forwardReactionRates2[ r ] << " ";
-outputFile1 << backwardReactionRates2[ r ] << endl;
+/*************************************************************
+*   d o w n s a m p l i n g
+*************************************************************
+* "points n": the rows of kin_o02 picked by the shape of each
+* species' curve, about n per species, instead of every ntskip-th.
+* Largest triangle three buckets ( lttb ) keeps of every bucket the
+* row that spans the largest triangle with the row kept before and
+* the mean of the next bucket; minmax keeps the lowest and the
+* highest of every bucket. Spikes survive either way. A row picked
+* for one species is written for all, the first and the last row
+* of every piece always.
+*/
+void lttbPick( const double x[], const double y[], int n, int points, char pick[] )
+{
+double every = (double) ( n - 2 ) / ( points - 2 );
+int a = 0;
+for( int b = 0; b < points - 2; b++ ) {
+int start = (int) ( b * every ) + 1;
+int end = (int) ( ( b + 1 ) * every ) + 1;
+int nextEnd = (int) ( ( b + 2 ) * every ) + 1;
+if( end > n - 1 ) {
+end = n - 1;
 }
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-outputFile1 << nameOfInputSpecies[ q ][ r ] << endl;
+if( nextEnd > n ) {
+nextEnd = n;
 }
-for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
-outputFile1 << nameOfOutputSpecies[ p ][ r ] << endl;
+if( end >= nextEnd ) {
+// the last bucket, the next is the last row
+nextEnd = end + 1;
 }
+double mx = 0.0;
+double my = 0.0;
+for( int k = end; k < nextEnd; k++ ) {
+mx += x[ k ];
+my += y[ k ];
 }
+mx /= nextEnd - end;
+my /= nextEnd - end;
 
-outputFile1.close();
-return 0;
+int best = start;
+double most = -1.0;
+for( int k = start; k < end; k++ ) {
+double area = myabs( ( x[ a ] - mx ) * ( y[ k ] - y[ a ] ) - ( x[ a ] - x[ k ] ) * ( my - y[ a ] ) );
+if( area > most ) {
+most = area;
+best = k;
 }
-
-
-// tabulate species number "ispec" for each named
-// reactant and product species "nispec", "nospec" 
-// of each reaction "ireac"
-void setnet()
-{
-char * name2look = 0;
-int index = 0;
-
-for( int r = 1; r <= numberOfReactions; r++ ) {
-
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-iispec[ q ][ r ] = ispec4name( trim( nameOfInputSpecies[ q ][ r ] ) );
 }
-
-for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
-iospec[ q ][ r ] = ispec4name( trim( nameOfOutputSpecies[ q ][ r ] ) );
+pick[ best ] = 1;
+a = best;
 }
 }
 
-if( DEBUG ) {
-cerr << "iispec[][] :" << endl;
-for( int r = 1; r <= numberOfReactions; r++ ) {
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-cerr << trim( nameOfInputSpecies[ q ][ r ] ) << "=";
-cerr << iispec[ q ][ r ] << "\t ";
+void minmaxPick( const double y[], int n, int points, char pick[] )
+{
+int buckets = ( points - 2 ) / 2;
+if( buckets < 1 ) {
+buckets = 1;
 }
-cerr << " ." << endl;
+double every = (double) ( n - 2 ) / buckets;
+for( int b = 0; b < buckets; b++ ) {
+int start = (int) ( b * every ) + 1;
+int end = (int) ( ( b + 1 ) * every ) + 1;
+if( end > n - 1 ) {
+end = n - 1;
 }
-cerr << "iospec[][] :" << endl;
-for( int r = 1; r <= numberOfReactions; r++ ) {
-for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
-cerr << trim( nameOfOutputSpecies[ q ][ r ] ) << "=";
-cerr << iospec[ q ][ r ] << "\t ";
+int low = start;
+int high = start;
+for( int k = start; k < end; k++ ) {
+if( y[ k ] < y[ low ] ) {
+low = k;
 }
-cerr << " ." << endl;
+if( y[ k ] > y[ high ] ) {
+high = k;
+}
+}
+if( start < end ) {
+pick[ low ] = 1;
+pick[ high ] = 1;
 }
 }
-
 }
 
 /*
-* e v a l _ f x 
-*
-* Evaluates the r.h.s.
-* version by Aleman
-* March 19, 2001
+* picked[ piece ][ t ] after run(), for "points"
 */
-void eval_fx( double x_vector[], double result[], 
-double leftProduct[], double rightProduct[] )
+void KinSolver::pickPoints()
 {
-for( int r = 1; r <= numberOfReactions; r++ ) {
-leftProduct[ r ] = forwardReactionRates[ r ];
-for( int input = 1; input <= numberInputParticipants[ r ]; input++ ) {
-leftProduct[ r ] *= x_vector[ iispec[ input ][ r ] ];
+int n = 0;
+for( int i_intg = 1; i_intg <= numOfIntegrations && intg_xspec[ i_intg ] != 0; i_intg++ ) {
+n += intg_xtime_index[ i_intg ] + 1;
+}
+int points = ( outputPoints < 3 ? 3 : outputPoints );
+
+int *piece = new int[ n ];
+int *row = new int[ n ];
+double *x = new double[ n ];
+double *y = new double[ n ];
+char *pick = new char[ n ];
+int k = 0;
+for( int i_intg = 1; i_intg <= numOfIntegrations && intg_xspec[ i_intg ] != 0; i_intg++ ) {
+int top = intg_xtime_index[ i_intg ];
+for( int t = 0; t <= top; t++, k++ ) {
+piece[ k ] = i_intg;
+row[ k ] = t;
+if( integrationOption == 4 ) {
+x[ k ] = intg_xtime[ i_intg ][ t ];
+}
+else {
+x[ k ] = intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ];
+}
+pick[ k ] = ( t == 0 || t == top || n <= points );
+}
 }
 
-rightProduct[ r ] = backwardReactionRates[ r ];
-for( int out = 1; out <= numberOutputParticipants[ r ]; out++ ) {
-rightProduct[ r ] *= x_vector[ iospec[ out ][ r ] ];
+for( int j = 1; j <= numberOfOutputSpecies && n > points; j++ ) {
+int i = outputSpecies[ j ];
+for( k = 0; k < n; k++ ) {
+y[ k ] = intg_xspec[ piece[ k ] ][ row[ k ] ][ i ];
 }
+if( pointMethod == POINTS_MINMAX ) {
+minmaxPick( y, n, points, pick );
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-result[ i ] = 0.0;
+else {
+lttbPick( x, y, n, points, pick );
 }
-for( int r = 1; r <= numberOfReactions; r++ ) {
-for( int input = 1; input <= numberInputParticipants[ r ]; input++ ) {
-result[ iispec[ input ][ r ] ] = result[ iispec[ input ][ r ] ] 
-- leftProduct[ r ] + rightProduct[ r ];
 }
-for( int out = 1; out <= numberOutputParticipants[ r ]; out++ ) {
-result[ iospec[ out ][ r ] ] = result[ iospec[ out ][ r ] ] 
-+ leftProduct[ r ] - rightProduct[ r ];
+
+picked = new char* [ numOfIntegrations + 1 ];
+for( int i_intg = 0; i_intg <= numOfIntegrations; i_intg++ ) {
+picked[ i_intg ] = 0;
 }
+for( k = 0; k < n; k++ ) {
+if( row[ k ] == 0 ) {
+picked[ piece[ k ] ] = new char[ intg_xtime_index[ piece[ k ] ] + 1 ];
 }
+picked[ piece[ k ] ][ row[ k ] ] = pick[ k ];
 }
 
-/*************************************************************
-*   t e s t M e t h o d _ a l e m a n ()
-*************************************************************
-* test method by Aleman - N O T - U S E D
-* March 19, 2001
+delete [] pick;
+delete [] y;
+delete [] x;
+delete [] row;
+delete [] piece;
+}
+
+/*
+* row t of piece i_intg goes to kin_o02: picked by "points", else
+* every ntskip-th ( mtime counts them over the pieces ) and the last
 */
-void testMethod_aleman()
+int KinSolver::outputRow( int i_intg, int t, int top, int mtime )
 {
+if( picked != 0 ) {
+return picked[ i_intg ][ t ];
+}
+return mtime == 0 || t == top;
+}
 
-Evaluate ***prepared_jac = 0;
-prepared_jac = new Evaluate**[ numberOfSpecies + 1 ];
-if( prepared_jac == 0 ) {
-cerr << "ERROR: allocation for prepared_jac failed!" << endl;
+void KinSolver::freePoints()
+{
+if( picked != 0 ) {
+for( int i_intg = 0; i_intg <= numOfIntegrations; i_intg++ ) {
+delete [] picked[ i_intg ];
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-prepared_jac[ i ] = new Evaluate*[ numberOfSpecies + 1 ];
-if( prepared_jac[ i ] == 0 ) {
-cerr << "ERROR: allocation for prepared_jac[" << i << "] failed!";
-cerr << endl;
+delete [] picked;
+picked = 0;
 }
 }
-prepareJacobian( prepared_jac );
 
-double **jac = 0;
-jac = new double*[ numberOfSpecies + 1 ];
-if( jac == 0 ) {
-cerr << "ERROR: allocation for jac failed!" << endl;
+// the part done to streamProgress, in steps of a hundredth
+void KinSolver::progress( double done )
+{
+if( streamProgress == 0 ) {
+return;
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-jac[ i ] = new double[ numberOfSpecies + 1 ];
-if( jac[ i ] == 0 ) {
-cerr << "ERROR: allocation for jac[" << i << "] failed!";
-cerr << endl;
+if( done < streamDone + 0.01 && ( done < 1.0 || streamDone >= 1.0 ) ) {
+return;
 }
+streamDone = done;
+streamProgress( streamUser, done );
 }
 
-eval_prep_jacobian( 1, jac, prepared_jac );
+KinModel::KinModel()
+{
+memset( this, 0, sizeof( KinModel ) );
+numOfIntegrations = 1;
+ssaSeed = SSA_DEFAULT_SEED;
+tauEpsilon = TAU_DEFAULT_EPSILON;
+fspTolerance = FSP_DEFAULT_TOLERANCE;
+fspMaxStates = FSP_DEFAULT_STATES;
+// the lines before the reactions, reactionTables() makes room for those
+bline = new char* [ 10 ];
+for( int i = 0; i < 10; i++ ) {
+bline[ i ] = 0;
+}
+}
 
+/*
+* the tables of the reactions, sized by numberOfReactions once it is
+* known; the lines of bline so far are kept
+*/
+void KinModel::reactionTables()
+{
+int n = numberOfReactions + 1;
+char **lines = new char* [ 10 + numberOfReactions ];
+for( int i = 0; i < 10 + numberOfReactions; i++ ) {
+lines[ i ] = ( i < 10 + reactionRows ? bline[ i ] : 0 );
+}
+delete [] bline;
+bline = lines;
+for( int q = 0; q <= MAX_NUMBER_PARTICIPANT_REACTIONS; q++ ) {
+nameOfInputSpecies[ q ] = new char* [ n ];
+nameOfOutputSpecies[ q ] = new char* [ n ];
+iispec[ q ] = new int[ n ];
+iospec[ q ] = new int[ n ];
+for( int r = 0; r < n; r++ ) {
+nameOfInputSpecies[ q ][ r ] = 0;
+nameOfOutputSpecies[ q ][ r ] = 0;
+iispec[ q ][ r ] = 0;
+iospec[ q ][ r ] = 0;
+}
+}
+numberInputParticipants = new int[ n ];
+numberOutputParticipants = new int[ n ];
+jkin = new int[ n ];
+fluxReaction = new int[ n ];
+forwardReactionRates = new double[ n ];
+backwardReactionRates = new double[ n ];
+forwardReactionRates2 = new double[ n ];
+backwardReactionRates2 = new double[ n ];
+for( int r = 0; r < n; r++ ) {
+numberInputParticipants[ r ] = 0;
+numberOutputParticipants[ r ] = 0;
+jkin[ r ] = 0;
+fluxReaction[ r ] = 0;
+forwardReactionRates[ r ] = 0.0;
+backwardReactionRates[ r ] = 0.0;
+forwardReactionRates2[ r ] = 0.0;
+backwardReactionRates2[ r ] = 0.0;
+}
+reactionRows = numberOfReactions;
 }
 
-/*************************************************************
-*lsodesMethod, first generate tmp.f file
-************************************************************
-* generate tmp.f file for lsodes Fortran code
-* Added 02/12/04
-*by Yihai Yu
+/*
+* tables of the network, channel tables, moments and time pieces
+* returns 0 when ok
 */
-int lsodesMethod()
+int KinModel::compile()
 {
-ofstream fortranFile( tmp_f);
-if( ! fortranFile ) {
-cerr << "Couldn't open input file " << fortranFile << endl;
+if( compiled ) {
+return 0;
+}
+
+if( numberOfQuantiles == 0 ) {
+numberOfQuantiles = 3;
+quantile[ 1 ] = 0.05;
+quantile[ 2 ] = 0.5;
+quantile[ 3 ] = 0.95;
+}
+
+setnet();
+if( isStochasticMethod( integrationOption ) || isFspMethod( integrationOption )
+|| momentClosure != 0 ) {
+setssa();
+}
+if( setmoments() != 0 ) {
 return 1;
 }
+setselect();
+setnumofintegrations();
+setintg_();
+compiled = 1;
+return 0;
+}
 
-fortranFile << "      include \'" << includeArgv << "\'" << endl;
-fortranFile << "*DECK PROGTMP" << endl;
+/*
+* new rate constants of reaction r, also in the channel tables
+* returns 0 when ok
+*/
+int KinModel::setrate( int r, double rkfor, double rkbak )
+{
+if( r < 1 || r > numberOfReactions ) {
+cerr << "ERROR: no reaction " << r << endl;
+return 1;
+}
+forwardReactionRates[ r ] = rkfor;
+backwardReactionRates[ r ] = rkbak;
+if( ssaNet != 0 ) {
+ssaNet->rate[ 2 * r - 1 ] = rkfor;
+ssaNet->rate[ 2 * r ] = rkbak;
+}
+return 0;
+}
+
+/**
+* Reads input data from "kin.i01" and writes them into "kin.o01"
+* @return  zero if everything was ok
+*/
+int KinModel::readInputData()
+{
+// open files kin_i01 and kin_o01 
+ifstream inputFile( kin_i01, ios::in );
+if( ! inputFile ) {
+cerr << "Couldn't open input file " << kin_i01 << endl;
+return 1;
+}
+
+ofstream outputFile1( kin_o01, ( numberOfDataSets == 0 ? ios::out : ios::app ) );
+if( ! outputFile1 ) {
+cerr << "Couldn't open input file " << kin_i01 << endl;
+return 1;
+}
+
+if( readInputData( inputFile ) != 0 ) {
+return 1;
+}
+inputFile.close();
+
+echoInputData( outputFile1 );
+outputFile1.close();
+return 0;
+}
+
+/**
+* Reads the next data set ( after numberOfDataSets ) of a kin.i01
+* text from inputFile
+* @return  zero if everything was ok
+*/
+int KinModel::readInputData( istream &inputFile )
+{
+char buf[ LINE ];
+
+// find first/next input data set:
+int dataSet = 0;
+while( dataSet <= numberOfDataSets ) {
+inputFile.getline( buf, LINE );
+if( strstr( buf, "data set" ) != NULL ) {
+dataSet++;
+}
+if( inputFile.eof() ) {
+break;
+}
+if( inputFile.fail() ) {
+// line longer than LINE, the rest comes with the next getline
+inputFile.clear();
+}
+}
+
+// verify that a data set was actually read
+if( dataSet <= numberOfDataSets ) {
+return 1;
+}
+if( DEBUG ) {
+cerr << "dataSet = " << dataSet << endl;
+}
+numberOfDataSets = dataSet;
+
+// read in input parameters:
+int copiedLines = 0;
+bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
+strcpy( bline[ copiedLines ], buf );
+
+// number of species and reactions:
+copiedLines++;
+inputFile.getline( buf, LINE );
+bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
+strcpy( bline[ copiedLines ], buf );
+inputFile >> numberOfSpecies;
+inputFile >> numberOfReactions;
+inputFile.getline( buf, LINE );  // skip the new line
+if( DEBUG ) {
+cerr << "numberOfSpecies=" << numberOfSpecies;
+cerr << "  numberOfReactions=" << numberOfReactions << endl;
+}
+
+if( numberOfSpecies > MAX_NUMBER_SPECIES ) { 
+cerr << endl << endl << " ERROR" << endl;
+cerr << "   Increase array size MAX_NUMBER_SPECIES" << endl;
+cerr << "  EXECUTION TERMINATED" << endl;
+return 1;
+}
+
+if( numberOfReactions > MAX_NUMBER_REACTIONS ) { 
+cerr << endl << endl << " ERROR" << endl;
+cerr << "   Increase array size MAX_NUMBER_REACTIONS" << endl;
+cerr << "  EXECUTION TERMINATED" << endl;
+return 1;
+}
+if( numberOfReactions < 0 ) {
+numberOfReactions = 0;
+}
+reactionTables();
+
+// initial + final time, number of time steps, time integrtn. option
+copiedLines++;
+inputFile.getline( buf, LINE );
+bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
+strcpy( bline[ copiedLines ], buf );
+inputFile >> true_initialTime;
+inputFile >> true_finalTime;
+inputFile >> true_numberOfTimeSteps;
+inputFile >> ntskip;
+inputFile >> integrationOption;
+inputFile.getline( buf, LINE );  // skip the new line
+if( DEBUG ) {
+cerr << "initialTime=" << true_initialTime << "  finalTime=";
+cerr << true_finalTime << "  numberOfTimeSteps=" << true_numberOfTimeSteps;
+cerr << "  integrationOption=" << integrationOption << endl;
+}
+
+if( true_numberOfTimeSteps > MAX_NUMBER_TIME_STEPS ) { 
+cerr << endl << endl << " ERROR" << endl;
+cerr << "   Increase array size MAX_NUMBER_TIME_STEPS" << endl;
+cerr << "  EXECUTION TERMINATED" << endl;
+return 1;
+}
+
+// names and initial concentration of reacting species:
+copiedLines++;
+inputFile.getline( buf, LINE );
+bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
+strcpy( bline[ copiedLines ], buf );
+
+char *abc = new char[75];
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+inputFile.getline( tmpLine, LINE );
+//cerr << "OK " << tmpLine;
+nameOfSpecies[ i ] = new char[ strlen( tmpLine ) + 1 ];
+strcpy( nameOfSpecies[ i ], tmpLine );
+inputFile >> initialConcentration[ i ];
+inputFile >> jfix[ i ];
+if((jfix[i]==10)||(jfix[i]==20)){
+extFlag = true;
+whichExt = i;
+inputFile >> npulse[ i ];  
+// process the external control information
+inputFile.getline( buf, LINE ); //skip the new line
+inputFile.getline( buf, LINE ); //skip one line
+
+for(int j = 1; j <= 2*npulse[i]+2; j++){
+inputFile >> abc; //actually ipm
+inputFile >> extOfSpecies[i][j]; //pmspec
+if((j!=1)&&(j%2==1)){
+oneCycle[i] = oneCycle[i] + extOfSpecies[i][j];
+slopeTrap[i][j] = (extOfSpecies[i][j+1]-extOfSpecies[i][j-1])/extOfSpecies[i][j];
+}
+}//endof for j
+
+// get slopes
+for(int j = 1; j <= 2*npulse[i]+2; j++){
+if((j!=1)&&(j%2==1)){
+slopeTrap[i][j] = (extOfSpecies[i][j+1]-extOfSpecies[i][j-1])/extOfSpecies[i][j];
+//cout << extOfSpecies[i][j+1] << " " << extOfSpecies[i][j-1] << " " << extOfSpecies[i][j] <<endl;
+//cout << slopeTrap[i][j] << endl;
+}
+}//endof for j
+
+//cerr << " ok " << oneCycle[i];
+}   
+inputFile.getline( buf, LINE );  // skip the new line
+if( DEBUG ) {
+cerr << "nameOfSpecies[" << i << "]=" << nameOfSpecies[ i ];
+cerr << "  initialConcentration=" << initialConcentration[ i ];
+cerr << " jfix=" << jfix[ i ] << endl;
+}
+}
+
+// reaction network by raction number:
+// reaction kinetics and rates, number of reactant and product species:
+//  jkin= 1: standard single-step kinetics with
+//    rkfor, rkbak   = forward, backward rate constants
+//  jkin=11: Michaelis-Menten (MM) two-step kinetics with
+//    nameispec(1,.)=nameospec(1,.) = enzyme species
+//    rkfor,  rkbak  = step-1 rate constants
+//    rkfor2, rkbak2 = step-2 rate constants
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+copiedLines++;
+inputFile.getline( buf, LINE );
+bline[ copiedLines ] = new char[ strlen( buf ) + 1 ];
+strcpy( bline[ copiedLines ], buf );
+inputFile >> forwardReactionRates[ r ];
+inputFile >> backwardReactionRates[ r ];
+inputFile >> numberInputParticipants[ r ];
+inputFile >> numberOutputParticipants[ r ];
+inputFile >> jkin[ r ];
+inputFile.getline( buf, LINE );  // skip the new line
+if( DEBUG ) {
+cerr << bline[ copiedLines ] << endl;
+cerr << "forwardReactionRates=" << forwardReactionRates[ r ];
+cerr << "  backwardReactionRates=" << backwardReactionRates[ r ];
+cerr << "  numberInputParticipants=" << numberInputParticipants[ r ];
+cerr << "  numberOutputParticipants=" << numberOutputParticipants[ r ];
+cerr << "  jkin=" << jkin[ r ] << endl;
+}
+if( jkin[ r ] == 11 ) {
+inputFile >> forwardReactionRates2[ r ];
+inputFile >> backwardReactionRates2[ r ];
+inputFile.getline( buf, LINE );  // skip the new line
+if( DEBUG ) {
+cerr << "forwardReactionRates2=" << forwardReactionRates2[ r ];
+cerr << "  backwardReactionRates2=" << backwardReactionRates2[ r ] << endl;
+}
+}
+if( numberInputParticipants[ r ] > MAX_NUMBER_PARTICIPANT_REACTIONS 
+||numberOutputParticipants[ r ] > MAX_NUMBER_PARTICIPANT_REACTIONS) {
+cerr << endl << endl << " ERROR" << endl;
+cerr << "   At reaction : " << r << " : " << bline[ copiedLines ];
+cerr << endl << "   nipart=" << numberInputParticipants[ r ];
+cerr << ", nopart=" << numberOutputParticipants[ r ] << endl;
+cerr << "   Increase array size MAX_NUMBER_PARTICIPANT_REACTIONS";
+cerr << endl << "  EXECUTION TERMINATED" << endl;
+return 1;
+}
+// reactants:
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+inputFile.getline( tmpLine, LINE );
+nameOfInputSpecies[ q ][ r ] = new char[ strlen( tmpLine ) + 1 ];
+strcpy( nameOfInputSpecies[ q ][ r ], tmpLine );
+if( DEBUG ) {
+cerr << "nameOfInputSpecies[" << q << "]=";
+cerr << nameOfInputSpecies[ q ][ r ] << endl;
+}
+}
+// products:
+for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
+inputFile.getline( tmpLine, LINE );
+nameOfOutputSpecies[ p ][ r ] = new char[ strlen( tmpLine ) + 1 ];
+strcpy( nameOfOutputSpecies[ p ][ r ], tmpLine );
+if( DEBUG ) {
+cerr << "nameOfOutputSpecies[" << p << "]=";
+cerr << nameOfOutputSpecies[ p ][ r ] << endl;
+}
+}
+}
+
+// optional keyword lines, up to the next data set:
+//   seed <n>     seed of the random numbers for stochastic methods
+//   epsilon <e>  error control of tau-leaping ( jtime=8 )
+//   ensemble <n> number of stochastic realizations ( jtime=7,8 )
+//   threads <n>  threads for the ensemble, default one per processor
+//   quantiles <p1> <p2> ..  ensemble quantiles, default 0.05 0.5 0.95
+//   fsptolerance <e>  probability the projection may lose ( jtime=9 )
+//   fspstates <n>     largest state space of the projection
+//   moments lna|normal  second moments as extra species ( jtime=1,2,3,4,45 )
+//   points <n> [ lttb|minmax ]  about n rows per species in kin.o02
+//                picked by the shape of the curves instead of ntskip
+//   fluxes <r1> <r2> ..|all [ extents ]  the net rates of these reactions
+//                in kin.o03, with their integrals when extents
+//   select <name|number> ..  the species of kin.o02 and the other
+//                outputs, default all
+while( ! inputFile.eof() ) {
+inputFile.getline( buf, LINE );
+if( inputFile.fail() && ! inputFile.eof() ) {
+inputFile.clear();
+}
+if( strstr( buf, "data set" ) != NULL ) {
+break;
+}
+readOption( buf );
+}
+
+return 0;
+}
+
+/*
+* one keyword line of the options after the reactions,
+* unknown keywords are ignored
+*/
+void KinModel::readOption( const char *buf )
+{
+char key[ LINE ] = { 0 };
+if( sscanf( buf, "%s", key ) != 1 ) {
+return;
+}
+if( strcmp( key, "seed" ) == 0 ) {
+sscanf( buf, "%*s %llu", &ssaSeed );
+}
+if( strcmp( key, "epsilon" ) == 0 ) {
+sscanf( buf, "%*s %lf", &tauEpsilon );
+}
+if( strcmp( key, "moments" ) == 0 ) {
+char closure[ LINE ] = { 0 };
+sscanf( buf, "%*s %s", closure );
+if( strcmp( closure, "lna" ) == 0 ) {
+momentClosure = MOMENT_LNA;
+}
+else if( strcmp( closure, "normal" ) == 0 ) {
+momentClosure = MOMENT_NORMAL;
+}
+else {
+cerr << "ERROR: unknown moment closure " << closure << endl;
+}
+}
+if( strcmp( key, "fsptolerance" ) == 0 ) {
+sscanf( buf, "%*s %lf", &fspTolerance );
+}
+if( strcmp( key, "fspstates" ) == 0 ) {
+sscanf( buf, "%*s %d", &fspMaxStates );
+}
+if( strcmp( key, "ensemble" ) == 0 ) {
+sscanf( buf, "%*s %d", &ensembleRuns );
+}
+if( strcmp( key, "points" ) == 0 ) {
+char method[ LINE ] = { 0 };
+sscanf( buf, "%*s %d %s", &outputPoints, method );
+if( outputPoints < 0 ) {
+outputPoints = 0;
+}
+if( method[ 0 ] == 0 || strcmp( method, "lttb" ) == 0 ) {
+pointMethod = POINTS_LTTB;
+}
+else if( strcmp( method, "minmax" ) == 0 ) {
+pointMethod = POINTS_MINMAX;
+}
+else {
+cerr << "ERROR: unknown points method " << method << endl;
+}
+}
+if( strcmp( key, "fluxes" ) == 0 ) {
+char word[ LINE ] = { 0 };
+int used = 0;
+const char *next = strstr( buf, "fluxes" ) + strlen( "fluxes" );
+fluxReactions = 0;
+fluxExtents = 0;
+while( sscanf( next, "%s%n", word, &used ) == 1 ) {
+int r = 0;
+if( strcmp( word, "extents" ) == 0 ) {
+fluxExtents = 1;
+}
+else if( strcmp( word, "all" ) == 0 ) {
+fluxReactions = 0;
+for( r = 1; r <= numberOfReactions; r++ ) {
+fluxReaction[ ++fluxReactions ] = r;
+}
+}
+else if( sscanf( word, "%d", &r ) == 1 && r >= 1 && r <= numberOfReactions ) {
+if( fluxReactions < numberOfReactions ) {
+fluxReaction[ ++fluxReactions ] = r;
+}
+}
+else {
+cerr << "ERROR: no reaction " << word << " for fluxes" << endl;
+}
+next += used;
+}
+}
+if( strcmp( key, "select" ) == 0 ) {
+// names of the moment species are known only in compile()
+delete [] selectLine;
+selectLine = kinCopy( buf );
+}
+if( strcmp( key, "threads" ) == 0 ) {
+sscanf( buf, "%*s %d", &ensembleThreads );
+}
+if( strcmp( key, "quantiles" ) == 0 ) {
+int used = 0;
+const char *next = strstr( buf, "quantiles" ) + strlen( "quantiles" );
+double p = 0.0;
+numberOfQuantiles = 0;
+while( numberOfQuantiles < MAX_NUMBER_QUANTILES
+&& sscanf( next, "%lf%n", &p, &used ) == 1 ) {
+if( p > 0.0 && p < 1.0 ) {
+quantile[ ++numberOfQuantiles ] = p;
+}
+next += used;
+}
+}
+if( DEBUG ) {
+cerr << "option: " << buf << endl;
+}
+}
+
+/*
+* outputSpecies[ 1 .. numberOfOutputSpecies ] and outputMask of the
+* "select" line, by name or number, in the order of the species;
+* all species without one or when none of it is known
+*/
+void KinModel::setselect()
+{
+for( int i = 0; i <= MAX_NUMBER_SPECIES; i++ ) {
+outputMask[ i ] = 0;
+}
+if( selectLine != 0 ) {
+char word[ LINE ] = { 0 };
+int used = 0;
+const char *next = strstr( selectLine, "select" ) + strlen( "select" );
+while( sscanf( next, "%s%n", word, &used ) == 1 ) {
+int index = 0;
+for( int i = 1; i <= numberOfSpecies && index == 0; i++ ) {
+char *name = trim( nameOfSpecies[ i ] );
+if( strcmp( name, word ) == 0 ) {
+index = i;
+}
+delete [] name;
+}
+if( index == 0 && sscanf( word, "%d", &index ) == 1
+&& ( index < 1 || index > numberOfSpecies ) ) {
+index = 0;
+}
+if( index == 0 ) {
+cerr << "ERROR: no species " << word << " to select" << endl;
+}
+else {
+outputMask[ index ] = 1;
+}
+next += used;
+}
+}
+
+numberOfOutputSpecies = 0;
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( outputMask[ i ] ) {
+outputSpecies[ ++numberOfOutputSpecies ] = i;
+}
+}
+if( numberOfOutputSpecies == 0 ) {
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+outputMask[ i ] = 1;
+outputSpecies[ ++numberOfOutputSpecies ] = i;
+}
+}
+}
+
+/*
+* writes the input parameters of the data set ( to file kin_o01 )
+*/
+void KinModel::echoInputData( ostream &outputFile1 )
+{
+int copiedLines = 0;
+outputFile1 << " " << endl;
+outputFile1 << " " << endl;
+outputFile1 << bline[ copiedLines ] << endl;
+
+copiedLines++;
+outputFile1 << bline[ copiedLines ] << endl;
+outputFile1 << setw( DEC8 ) << numberOfSpecies;
+outputFile1 << setw( DEC8 ) << numberOfReactions << endl;
+
+copiedLines++;
+outputFile1 << bline[ copiedLines ] << endl;
+outputFile1 << setiosflags( ios::scientific | ios::uppercase );
+outputFile1 << setw( FRAC ) << true_initialTime;
+outputFile1 << setw( FRAC ) << true_finalTime;
+outputFile1 << setw( DEC8 ) << true_numberOfTimeSteps;
+outputFile1 << setw( DEC8 ) << ntskip;
+outputFile1 << setw( DEC8 ) << integrationOption << endl;
+
+copiedLines++;
+outputFile1 << bline[ copiedLines ] << endl;
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+outputFile1 << nameOfSpecies[ i ] << endl;
+outputFile1 << setw( FRAC ) << initialConcentration[ i ];
+outputFile1 << setw( DEC8 ) << jfix[ i ] << endl;
+}
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+copiedLines++;
+outputFile1 << bline[ copiedLines ] << endl;
+outputFile1 << setw( FRAC ) << forwardReactionRates[ r ];
+outputFile1 << setw( FRAC ) << backwardReactionRates[ r ];
+outputFile1 << setw( DEC8 ) << numberInputParticipants[ r ];
+outputFile1 << setw( DEC8 ) << numberOutputParticipants[ r ];
+outputFile1 << setw( DEC8 ) << jkin[ r ] << endl;
+if( jkin[ r ] == 11 ) {
+outputFile1 << forwardReactionRates2[ r ] << " ";
+outputFile1 << backwardReactionRates2[ r ] << endl;
+}
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+outputFile1 << nameOfInputSpecies[ q ][ r ] << endl;
+}
+for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
+outputFile1 << nameOfOutputSpecies[ p ][ r ] << endl;
+}
+}
+}
+
+/*
+* writes everything of the data set that decides its results, at
+* full precision and one item per line: data sets with the same
+* canonical text give the same kin.o02, whatever the spacing and
+* the comment lines of their kin.i01 ( key of the result cache );
+* needs the compiled model, the participants are species numbers
+*/
+void KinModel::canonical( ostream &out ) const
+{
+out << setprecision( 17 );
+out << "title " << bline[ 0 ] << "\n";
+out << "size " << numberOfSpecies << " " << numberOfReactions << "\n";
+out << "time " << true_initialTime << " " << true_finalTime << " ";
+out << true_numberOfTimeSteps << " " << ntskip << " " << integrationOption << "\n";
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+out << "species " << nameOfSpecies[ i ] << "\n";
+out << initialConcentration[ i ] << " " << jfix[ i ];
+if( jfix[ i ] == 10 || jfix[ i ] == 20 ) {
+out << " " << npulse[ i ];
+for( int j = 1; j <= 2 * npulse[ i ] + 2; j++ ) {
+out << " " << extOfSpecies[ i ][ j ];
+}
+}
+out << "\n";
+}
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+out << "reaction " << forwardReactionRates[ r ] << " " << backwardReactionRates[ r ];
+out << " " << jkin[ r ];
+if( jkin[ r ] == 11 ) {
+out << " " << forwardReactionRates2[ r ] << " " << backwardReactionRates2[ r ];
+}
+out << "\n";
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+out << "< " << iispec[ q ][ r ] << "\n";
+}
+for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
+out << "> " << iospec[ p ][ r ] << "\n";
+}
+}
+
+// ensembleThreads is left out: the runs do not depend on it
+out << "seed " << ssaSeed << "\n";
+out << "epsilon " << tauEpsilon << "\n";
+out << "ensemble " << ensembleRuns << "\n";
+out << "quantiles";
+for( int k = 1; k <= numberOfQuantiles; k++ ) {
+out << " " << quantile[ k ];
+}
+out << "\n";
+out << "fsp " << fspTolerance << " " << fspMaxStates << "\n";
+out << "moments " << momentClosure << "\n";
+if( outputPoints > 0 ) {
+out << "points " << outputPoints << " " << pointMethod << "\n";
+}
+if( numberOfOutputSpecies < numberOfSpecies ) {
+out << "select";
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+out << " " << outputSpecies[ k ];
+}
+out << "\n";
+}
+}
+
+/*
+* a rough estimate of the work of a run, in rate evaluations of a
+* single reaction or species: enough to tell a quick run from a
+* long one, not a time. The time steps times the work of one step
+* of the method; the stochastic ones take a guessed number of
+* events per step.
+*/
+double KinModel::cost() const
+{
+double terms = numberOfReactions + numberOfSpecies;
+for( int r = 1; r <= numberOfReactions; r++ ) {
+terms += numberInputParticipants[ r ] + numberOutputParticipants[ r ];
+}
+double n = numberOfSpecies;
+double step = terms;
+switch( integrationOption ) {
+case 2:  step = 2 * terms; break;
+case 3:  step = 4 * terms; break;
+case 45: step = 6 * terms; break;
+case 4:  step = 12 * terms; break;                 // rejected steps too
+case 5:  step = 3 * ( terms + n * terms + n * n * n / 3 ); break;  // Newton, Jacobian, gauss
+case 6:  step = 3 * ( terms + n * n ); break;
+case 7:  step = 10 * terms; break;
+case 8:  step = 4 * terms; break;
+case 9:  step = 100 * terms; break;
+}
+double work = step * true_numberOfTimeSteps;
+if( ensembleRuns > 0 && isStochasticMethod( integrationOption ) ) {
+work *= ensembleRuns;
+}
+return work;
+}
+
+// bytes of a heap row of n doubles and its pointer
+double rowBytes( double n )
+{
+return 8.0 * n + 16.0 + 8.0;
+}
+
+/*
+* the memory a solver of the model will take, from the sizes alone:
+* the rows it keeps ( initializeBigMatrices, storedata ) and the
+* workspace of its method; an upper estimate where the method's
+* use depends on the run ( the FSP space at its limit ), least is
+* that with the FSP space of its initial box ( setfsp )
+*/
+void KinModel::estimate( kin_estimate *e ) const
+{
+double n = numberOfSpecies;
+double steps = true_numberOfTimeSteps;
+double rows = steps + 10;
+if( rows < MIN_numberOfTimeSteps + 10 ) {
+rows = MIN_numberOfTimeSteps + 10;
+}
+double channels = 2.0 * numberOfReactions;
+int skip = ( ntskip > 0 ? ntskip : 1 );
+
+// xspec and xtime, then the copy of every piece
+e->trajectory = rows * ( rowBytes( n + 1 ) + 8.0 );
+#ifndef OPTIMIZE
+e->trajectory += rows * rowBytes( numberOfReactions + 1 );
+#endif
+e->trajectory += numOfIntegrations * ( steps + 1 ) * ( rowBytes( n + 1 ) + ( integrationOption == 4 ? 8.0 : 0.0 ) );
+
+e->workspace = 0.0;
+if( integrationOption == 5 ) {
+// jac, jac2, bigFprime and the prepared Jacobian
+e->workspace = 3 * ( n + 1 ) * rowBytes( n + 1 ) + ( n + 1 ) * ( n + 1 ) * ( 8.0 + sizeof( Evaluate ) );
+}
+if( isStochasticMethod( integrationOption ) ) {
+e->workspace = 10 * 8.0 * ( channels + n + 2 ) + sizeof( SsaGroups );
+}
+double unused = 0.0;
+if( isFspMethod( integrationOption ) ) {
+// counts, p, hash, generator ( a column and a value per channel ),
+// Krylov basis
+double state = 4.0 * n + 8.0 + 8.0 + ( channels + 1 ) * 12.0 + ( FSP_KRYLOV + 2 ) * 8.0;
+double box = 1.0;
+for( int i = 1; i <= numberOfSpecies && box < fspMaxStates; i++ ) {
+if( jfix[ i ] == 0 ) {
+double x0 = initialConcentration[ i ] > 0.0 ? floor( initialConcentration[ i ] + 0.5 ) : 0.0;
+box *= ( 2 * x0 > x0 + FSP_MIN_BOUND ? 2 * x0 : x0 + FSP_MIN_BOUND ) + 1;
+}
+}
+if( box > fspMaxStates ) {
+box = fspMaxStates;
+}
+e->workspace = fspMaxStates * state;
+unused = ( fspMaxStates - box ) * state;
+}
+if( momentClosure != 0 ) {
+e->workspace += 2 * ( n + 1 ) * rowBytes( n + 1 );
+}
+if( ensembleRuns > 0 && isStochasticMethod( integrationOption ) ) {
+double outputs = steps / skip + 2;
+int threads = ensembleThreads;
+if( threads <= 0 ) {
+threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+}
+if( threads > ensembleRuns ) {
+threads = ensembleRuns;
+}
+// the means, m2 and quantiles of the output species, a grid and a
+// method workspace per thread
+double s = numberOfOutputSpecies;
+e->workspace = outputs * ( rowBytes( n + 1 ) + rowBytes( s + 1 ) + s * numberOfQuantiles * sizeof( P2Quantile ) )
++ threads * ( outputs * rowBytes( n + 1 ) + e->workspace );
+}
+
+e->bytes = e->trajectory + e->workspace + sizeof( KinSolver );
+e->least = e->bytes - unused;
+e->work = cost();
+}
+
+// tabulate species number "ispec" for each named
+// reactant and product species "nispec", "nospec" 
+// of each reaction "ireac"
+void KinModel::setnet()
+{
+char * name2look = 0;
+int index = 0;
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+name2look = trim( nameOfInputSpecies[ q ][ r ] );
+iispec[ q ][ r ] = ispec4name( name2look );
+delete [] name2look;
+}
+
+for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
+name2look = trim( nameOfOutputSpecies[ q ][ r ] );
+iospec[ q ][ r ] = ispec4name( name2look );
+delete [] name2look;
+}
+}
+
+if( DEBUG ) {
+cerr << "iispec[][] :" << endl;
+for( int r = 1; r <= numberOfReactions; r++ ) {
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+name2look = trim( nameOfInputSpecies[ q ][ r ] );
+cerr << name2look << "=";
+delete [] name2look;
+cerr << iispec[ q ][ r ] << "\t ";
+}
+cerr << " ." << endl;
+}
+cerr << "iospec[][] :" << endl;
+for( int r = 1; r <= numberOfReactions; r++ ) {
+for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
+name2look = trim( nameOfOutputSpecies[ q ][ r ] );
+cerr << name2look << "=";
+delete [] name2look;
+cerr << iospec[ q ][ r ] << "\t ";
+}
+cerr << " ." << endl;
+}
+}
+
+}
+
+/*
+* e v a l _ f x 
+*
+* Evaluates the r.h.s.
+* version by Aleman
+* March 19, 2001
+*/
+void KinSolver::eval_fx( double x_vector[], double result[], 
+double leftProduct[], double rightProduct[] )
+{
+for( int r = 1; r <= numberOfReactions; r++ ) {
+leftProduct[ r ] = forwardReactionRates[ r ];
+for( int input = 1; input <= numberInputParticipants[ r ]; input++ ) {
+leftProduct[ r ] *= x_vector[ iispec[ input ][ r ] ];
+}
+
+rightProduct[ r ] = backwardReactionRates[ r ];
+for( int out = 1; out <= numberOutputParticipants[ r ]; out++ ) {
+rightProduct[ r ] *= x_vector[ iospec[ out ][ r ] ];
+}
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+result[ i ] = 0.0;
+}
+for( int r = 1; r <= numberOfReactions; r++ ) {
+for( int input = 1; input <= numberInputParticipants[ r ]; input++ ) {
+result[ iispec[ input ][ r ] ] = result[ iispec[ input ][ r ] ] 
+- leftProduct[ r ] + rightProduct[ r ];
+}
+for( int out = 1; out <= numberOutputParticipants[ r ]; out++ ) {
+result[ iospec[ out ][ r ] ] = result[ iospec[ out ][ r ] ] 
++ leftProduct[ r ] - rightProduct[ r ];
+}
+}
+}
+
+/*************************************************************
+*   t e s t M e t h o d _ a l e m a n ()
+*************************************************************
+* test method by Aleman - N O T - U S E D
+* March 19, 2001
+*/
+void KinSolver::testMethod_aleman()
+{
+
+Evaluate ***prepared_jac = 0;
+prepared_jac = new Evaluate**[ numberOfSpecies + 1 ];
+if( prepared_jac == 0 ) {
+cerr << "ERROR: allocation for prepared_jac failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+prepared_jac[ i ] = new Evaluate*[ numberOfSpecies + 1 ];
+if( prepared_jac[ i ] == 0 ) {
+cerr << "ERROR: allocation for prepared_jac[" << i << "] failed!";
+cerr << endl;
+}
+}
+prepareJacobian( prepared_jac );
+
+double **jac = 0;
+jac = new double*[ numberOfSpecies + 1 ];
+if( jac == 0 ) {
+cerr << "ERROR: allocation for jac failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+jac[ i ] = new double[ numberOfSpecies + 1 ];
+if( jac[ i ] == 0 ) {
+cerr << "ERROR: allocation for jac[" << i << "] failed!";
+cerr << endl;
+}
+}
+
+eval_prep_jacobian( 1, jac, prepared_jac );
+
+}
+
+/*************************************************************
+*lsodesMethod, first generate tmp.f file
+************************************************************
+* generate tmp.f file for lsodes Fortran code
+* Added 02/12/04
+*by Yihai Yu
+*/
+int KinSolver::lsodesMethod()
+{
+ofstream fortranFile( tmp_f);
+if( ! fortranFile ) {
+cerr << "Couldn't open input file " << fortranFile << endl;
+return 1;
+}
+
+fortranFile << "      include \'" << includeArgv << "\'" << endl;
+fortranFile << "*DECK PROGTMP" << endl;
 fortranFile << "      PROGRAM PROGTMP" << endl;
 fortranFile << endl;
 fortranFile << "      external fex, jex" << endl;
@@ -780,2096 +1857,5414 @@ int rwork = 20 + 3*numberOfSpecies*numberOfSpecies + 20*numberOfSpecies;
 int iwork = 31 + numberOfSpecies + 2;
 fortranFile << "      dimension y("<< numberOfSpecies <<"), rwork(" << rwork << "), iwork(" << iwork << ")" << endl;
 fortranFile << "      data lrw/" << rwork << "/, liw/" << iwork << "/" << endl;
+// the species of "select" instead of those of the command line
+int selecting = ( numberOfOutputSpecies < numberOfSpecies );
+if( selecting ) {
+fortranFile << "      dimension isel(" << numberOfOutputSpecies << ")" << endl;
+}
+
+
+fortranFile << "      neq = "<< numberOfSpecies << endl;
+for(int i=1; i<=numberOfSpecies; i++){
+fortranFile << "      y("<< i <<") = " << initialConcentration[i] << endl;
+}//endof for
+for( int k = 1; selecting && k <= numberOfOutputSpecies; k++ ) {
+fortranFile << "      isel(" << k << ") = " << outputSpecies[ k ] << endl;
+}
+fortranFile << endl;
+fortranFile << "      t = " << initialTime << endl;
+double tout = (finalTime - initialTime)/(double)(numberOfTimeSteps/ntskip);
+fortranFile << "      tout = " << initialTime << endl;
+fortranFile << "      itol = 1" << endl;
+fortranFile << "      rtol = " << rtolLSODES <<endl;
+fortranFile << "      atol = " << atolLSODES <<endl;
+fortranFile << "      itask = 1" <<endl;
+fortranFile << "      istate = 1" <<endl;
+fortranFile << "      iopt = 0" <<endl;
+fortranFile << "      mf = "<< mfLSODES <<endl;
+fortranFile << "      OPEN (UNIT=20, FILE=" << "\n     1" << "'" << outputArgv << "')" << endl;
+
+//   fortranFile << "      OPEN (UNIT=20, FILE='columns.data')" << endl;
+
+fortranFile << "      do 40 iout = 0, "<< numberOfTimeSteps/ntskip <<endl;
+fortranFile << "        call lsodes (fex, neq, y, t, tout, itol, rtol, atol, " <<endl;
+fortranFile << "     1     itask, istate, iopt, rwork, lrw, iwork, liw, jex, mf)" << endl;
+if( selecting ) {
+fortranFile << "      write(20, *)iout, t, (y(isel(k)), k = 1, " << numberOfOutputSpecies << ")" << endl;
+}
+else {
+fortranFile << "      write(20, *)iout, t, y(" << lsodesArgv << ")"<< endl;
+}
+fortranFile << endl;
+fortranFile << "        if (istate .lt. 0) go to 80" << endl;
+fortranFile << "        tout = tout + " << tout <<endl;
+fortranFile << "  40    continue" << endl;
+fortranFile << "      lenrw = iwork(17)" << endl;
+fortranFile << "      leniw = iwork(18)" << endl;
+fortranFile << "      nst = iwork(11)" << endl;
+fortranFile << "      nfe = iwork(12)" << endl;
+fortranFile << "      nje = iwork(13)" << endl;
+fortranFile << "      nlu = iwork(21)" << endl;
+fortranFile << "      nnz = iwork(19)" << endl;
+fortranFile << "      nnzlu = iwork(25) + iwork(26) + neq" << endl;
+fortranFile << "      stop" << endl;
+fortranFile << "  80  write(6,90)istate" << endl;
+fortranFile << "  90  format(///22h error halt.. istate =,i3)" << endl;
+fortranFile << "      stop" << endl;
+fortranFile << "      end" << endl;
+
+//fex
+fortranFile << "      subroutine fex (neq, t, y, ydot)" << endl;
+fortranFile << "      double precision t, y, ydot" << endl;
+fortranFile << "      dimension y(" << numberOfSpecies << "), ydot(" << numberOfSpecies << ")" << endl;
+
+
+//   cout << "OK1" << endl;
+
+//   cout << "1 of 8: " << nameOfOutputSpecies[1][8] << endl;
+
+//Pre-process all the reactions to get the index of all the participants
+for(int i=1; i<=numberOfReactions; i++){
+//cout << "i = " << i << endl;
+for(int j=1; j<=numberInputParticipants[i]; j++){
+for(int k=1; k<=numberOfSpecies; k++){
+if(mystrcmp(nameOfInputSpecies[j][i], nameOfSpecies[k])==0){
+//cout << strlen(nameOfInputSpecies[j][i]) << "  " << strlen(nameOfSpecies[k]) <<endl;
+//cout << nameOfInputSpecies[j][i] << "  " << nameOfSpecies[k] <<endl;
+//if(nameOfInputSpecies[j][i][17]=='2')   cout<<"this is space" <<endl;
+indexOfInputSpecies[j][i] = k;
+}//endof if
+}//endof k
+}//endof j
+for(int j=1; j<=numberOutputParticipants[i]; j++){
+for(int k=1; k<=numberOfSpecies; k++){
+if(mystrcmp(nameOfOutputSpecies[j][i], nameOfSpecies[k])==0){
+indexOfOutputSpecies[j][i] = k;
+}//endof if
+}//endof k
+}//endof j
+}//endof for i
+
+//   cout << "OK2" << endl;
+
+for(int i=1; i<=numberOfSpecies; i++){
+
+int notHere = 0;//1 here, 0 not here, for this specie
+
+//for each specie, calculate the dy/dt
+//jfix
+
+if(jfix[i]==1){
+fortranFile << "      ydot(" << i << ")  = 0" << endl;
+}//endof if
+
+else{
+
+//LHS
+fortranFile << "      ydot(" << i << ")  = ";
+
+//RHS
+//all the reactions
+for(int j=1; j<=numberOfReactions; j++){
+//all the input participansts
+for(int k=1; k<=numberInputParticipants[j]; k++){
+if(mystrcmp(nameOfSpecies[i], nameOfInputSpecies[k][j])==0){
+notHere = 1;
+//forward reaction
+fortranFile << "\n" << "     1   -" << forwardReactionRates[j];
+for(int l=1; l<=numberInputParticipants[j]; l++){
+fortranFile << "*" << "y(" << indexOfInputSpecies[l][j] << ")";
+}//endof l
+//backward reaction
+fortranFile << "\n" << "     1   +" << backwardReactionRates[j];
+for(int l=1; l<=numberOutputParticipants[j]; l++){
+fortranFile << "*" << "y(" << indexOfOutputSpecies[l][j] << ")";
+}//endof l
+}//endof if
+}//endof for k
+//all the output participants
+for(int k=1; k<=numberOutputParticipants[j]; k++){
+if(mystrcmp(nameOfSpecies[i], nameOfOutputSpecies[k][j])==0){
+notHere = 1;
+//forward reaction
+fortranFile << "\n" << "     1   +" << forwardReactionRates[j];
+for(int l=1; l<=numberInputParticipants[j]; l++){
+fortranFile << "*" << "y(" << indexOfInputSpecies[l][j] << ")";
+}//endof l
+//backward reaction
+fortranFile << "\n" << "     1   -" << backwardReactionRates[j];
+for(int l=1; l<=numberOutputParticipants[j]; l++){
+fortranFile << "*" << "y(" << indexOfOutputSpecies[l][j] << ")";
+}//endof l
+}//endof if
+}//endof for k
+}//endof for j
+if(notHere==0){
+fortranFile << "0";
+}
+}//endof else      
+fortranFile << endl;
+}//endof for i
+fortranFile << "      return" << endl;
+fortranFile << "      end" << endl;
+
+//jex
+fortranFile << "      subroutine jex (neq, t, y, j, ia, ja, pdj)" << endl;
+fortranFile << "      double precision t, y, pdj" << endl;
+fortranFile << "      dimension y(1), ia(1), ja(1), pdj(1)" << endl;
+fortranFile << "      end" << endl;
+
+
+fortranFile.close();
+return 0;      
+
+}
+
+
+
+/*************************************************************
+*   e v a l _ p r e p _ j a c o b i a n
+*************************************************************
+* Evals the jacobian matrix with xspec[ time ][]
+* Added Mar 20, 2001
+* this version is supposed to work faster because it uses
+* a prepared jacobian structure
+* by Aleman-Meza, Boanerges
+*/
+void KinSolver::eval_prep_jacobian( int time, double ** jac, Evaluate *** prepared_jac )
+{
+double sum   = 0.0;
+double multi = 0.0;
+
+for(  int i = 1; i <= numberOfSpecies; i++ ) {
+
+for( int j = 1; j <= numberOfSpecies; j++ ) {
+
+sum = 0.0;
+for( Evaluate *eval = prepared_jac[ i ][ j ]; eval != 0; 
+eval = eval->next ) {
+multi = eval->multiplier * eval->appears;
+for( int m = 0; m < eval->participants; m++ ) {
+multi *= xspec[ time ][ eval->indexes[ m ] ];
+}
+for( int q = 1; q < eval->appears; q++ ) {
+multi *= xspec[ time ][ j ];
+}
+sum += multi;
+}
+jac[ i ][ j ] = sum;
+}
+}
+}
+
+double KinSolver::con_jfix_10(int i, double currentTime){
+
+double startTime;
+double startCon, endCon, inCycleStart, inCycleEnd;
+double inCycleTime;
+
+startTime = true_initialTime+extOfSpecies[i][1];
+if(integrationOption!=4){
+currentTime = initialTime + currentTime;
+}
+if(currentTime <= startTime){
+return initialConcentration[i];
+}//endof if
+else{
+inCycleTime = (currentTime-startTime) - oneCycle[i]*((int)((currentTime-startTime)/oneCycle[i]));
+//cerr << inCycleTime;
+inCycleStart = 0.0;
+inCycleEnd = 0.0;
+for(int j=2; j<2*npulse[i]+2; j=j+2){
+inCycleEnd = inCycleEnd + extOfSpecies[i][j+1];
+if(inCycleTime<=inCycleEnd){
+return slopeTrap[i][j+1]*(inCycleTime-inCycleStart)+extOfSpecies[i][j];
+break;
+}
+inCycleStart = inCycleEnd;
+}//endof for j
+}//endof else
+}
+
+double KinSolver::con_jfix_20(int i, double currentTime){
+
+double startTime;
+double startCon, endCon, inCycleStart, inCycleEnd;
+double inCycleTime;
+
+startTime = true_initialTime+extOfSpecies[i][1];
+if(integrationOption!=4){
+currentTime = initialTime + currentTime;
+}
+if(currentTime <= startTime){
+return extOfSpecies[i][2];
+}//endof if
+else{
+inCycleTime = (currentTime-startTime) - oneCycle[i]*((int)((currentTime-startTime)/oneCycle[i]));
+//cerr << inCycleTime;
+inCycleStart = 0.0;
+inCycleEnd = 0.0;
+for(int j=2; j<2*npulse[i]+2; j=j+2){
+inCycleEnd = inCycleEnd + extOfSpecies[i][j+1];
+if(inCycleTime<=inCycleEnd){
+return extOfSpecies[i][j+2];
+break;
+}
+inCycleStart = inCycleEnd;
+}//endof for j
+}//endof else
+}
+
+
+/*************************************************************
+*   e u l e r M e t h o d ()
+*************************************************************
+* jtime=1: Original Euler method (integrationOption)
+*/
+void KinSolver::eulerMethod()
+{
+
+double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+
+double currentTime;
+
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+
+currentTime = dtime*t;
+
+xrate( vspec, vfor, vbak, t );
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + vspec[ i ] * dtime;
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+
+}//endof if jfix = 20
+} // for i
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ]
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ]
++ ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+step( t );
+}
+
+}
+
+/*************************************************************
+*   m o d i f i e d E u l e r M e t h o d ()
+*************************************************************
+* T. Taha
+* Department of Computer Science
+* University of Georgia
+* Athens, GA 30602
+* E-Mail thiab@cs.uga.edu
+* added 00-08-01
+*/
+void KinSolver::modifiedEulerMethod()
+{
+
+double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+#ifndef OPTIMIZE
+double *k1_reac = reactionRow( 2 );
+#endif
+
+double currentTime;
+
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+
+currentTime = dtime*t;
+
+// evaluate f( t-1, xpec[ t-1 ] )
+xrate( vspec, vfor, vbak, t );
+// put h * f( t-1, xpec[ t-1 ] ) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k1[ i ] = vspec[ i ] * dtime;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+// put x[t-1] + k1 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k1[ i ];
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+}//endof if jfix = 20
+
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k1_reac[ r ];
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k1_reac[ r ];
+}
+#endif
+
+// evaluate f( t, xspec[ t ] + k1 )
+xrate( vspec, vfor, vbak, t + 1 );
+// put xspec[ t-1 ] + (1/2) ( k0 + h * f(...) into xspec[ t ]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + 0.5 * ( k1[ i ] 
++ vspec[ i ] * dtime );
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + 0.5 * ( k1_reac[ r ] 
++ ( vfor[ r ] - vbak[ r ] ) * dtime );
+}
+#endif
+
+
+step( t );
+}
+}
+
+void KinSolver::modifiedEulerMethod_original()
+{ 
+
+double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+
+xrate( vspec, vfor, vbak, t );
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + vspec[ i ] * dtime;
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+
+} // for i
+
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ]
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ]
++ ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+xrate( vspec, vfor, vbak, t + 1 );
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = 0.5 * ( xspec[ t ][ i ] + xspec[ t - 1 ][ i ]
++ vspec[ i ] * dtime );
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+} // for i
+
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = 0.5 * ( xreac[ r ][ t ] + xreac[ r ][ t - 1 ]
+xreac[ t ][ r ] = 0.5 * ( xreac[ t ][ r ] + xreac[ t - 1 ][ r ]
++ ( vfor[ r ] - vbak[ r ] ) * dtime );
+}
+#endif
+
+}
+}
+
+/*************************************************************
+*   r u n g e K u t t a O r d e r 4
+*************************************************************
+* Runge-Kutta Method order h^4
+* Added Jan 30, 2001
+* by Aleman-Meza, Boanerges
+* x[t+1] = x[t] + (1/6) * ( k1 + 2 * k2 + 2 * k3 + k4 )
+* where:
+* k1 = h * f( t,       x[t] )
+* k2 = h * f( t + h/2, x[t] + (1/2) * k1 )
+* k3 = h * f( t + h/2, x[t] + (1/2) * k2 )
+* k4 = h * f( t + 1,   x[t] + k3 )
+*/
+void KinSolver::rungeKuttaOrder4()
+{
+double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+#ifndef OPTIMIZE
+double *k1_reac = reactionRow( 2 );
+double *k2_reac = reactionRow( 3 );
+double *k3_reac = reactionRow( 4 );
+double *k4_reac = reactionRow( 5 );
+#endif
+
+double currentTime;
+
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+
+currentTime = dtime*t;
+
+// evaluate f( t-1, xpec[ t-1 ] )
+xrate( vspec, vfor, vbak, t );
+// put h * f( t-1, xpec[ t-1 ] ) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k1[ i ] = vspec[ i ] * dtime;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+// put x[t-1] + k1 / 2.0 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k1[ i ] / 2.0;
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+
+}//endof if jfix = 20
+
+}
+
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k1_reac[ r ] / 2.0;
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k1_reac[ r ] / 2.0;
+}
+#endif
+
+// evaluate f( t, xspec[ t ] + (1/2) * k1 )
+xrate( vspec, vfor, vbak, t + 1 );
+// put h * f( t, xspec[ t ] + (1/2) * k1 ) into k2
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k2[ i ] = vspec[ i ] * dtime;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+// put x[t-1] + k2 / 2.0 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k2[ i ] / 2.0;
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+
+}//endof if jfix = 20
+
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k2_reac[ r ] / 2.0;
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k2_reac[ r ] / 2.0;
+}
+#endif
+
+// evaluate f( t, xspec[ t ] + (1/2) * k2 )
+xrate( vspec, vfor, vbak, t + 1 );
+// put h * f( t, xspec[ t ] + (1/2) * k2 ) into k3
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k3[ i ] = vspec[ i ] * dtime;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+// put x[t-1] + k3  into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k3[ i ];
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k3_reac[ r ];
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k3_reac[ r ];
+}
+#endif
+
+// evaluate f( t, xspec[ t ] + k3 )
+xrate( vspec, vfor, vbak, t + 1 );
+// put h * f( t, xspec[ t ] + k3 ) into k4
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k4[ i ] = vspec[ i ] * dtime;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+}
+#endif
+
+// put x[t-1] + (1/6)*(k1 + 2*k2 + 2*k3 + k4) into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + ( k1[ i ] + 2.0 * k2[ i ]
++ 2.0 * k3[ i ] + k4[ i ] ) / 6.0;
+if( xspec[ t ][ i ] < 0.0 ) {
+xspec[ t ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t][i] = con_jfix_10(i, currentTime);
+
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t][i] = con_jfix_20(i, currentTime);
+
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + ( k1_reac[ r ]
+xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + ( k1_reac[ r ]
++ 2.0 * k2_reac[ r ] + 2.0 * k3_reac[ r ]
++ k4_reac[ r ] ) / 6.0;
+}
+#endif
+
+step( t );
+} 
+
+} // end method: rungeKuttaOrder4
+
+/*************************************************************
+*   r u n g e K u t t a 4 5
+*************************************************************
+* Runge-Kutta 45 Method
+* Added Feb 07, 2001
+* by Aleman-Meza, Boanerges
+* x[t+h] = x[t] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
+*               - (9/50) * k5 + (2/55)
+* where:
+* k1 = h * f( t, x[t] )
+* k2 = h * f( t, x[t] + (1/4) * k1 )
+* k3 = h * f( t, x[t] + (3/32) * k1 + (9/32) * k2 )
+* k4 = h * f( t, x[t] + (1932/2197) * k1 - (7200/2197) * k2 
+*                     + (7296/2197) * k3 )
+* k5 = h * f( t, x[t] + (439/216) * k1 - 8 * k2
+*                     + (3680/513) * k3 - (845/4104) * k4 )
+* k6 = h * f( t, x[t] - (8/27) * k1 + 2 * k2
+*                     - (3544/2565) * k3 + (1859/4104) * k4 - (11/40) * k5 )
+*/
+void KinSolver::rungeKutta45()
+{
+
+double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+
+double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k5[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k6[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+
+#ifndef OPTIMIZE
+double *k1_reac = reactionRow( 2 );
+double *k2_reac = reactionRow( 3 );
+double *k3_reac = reactionRow( 4 );
+double *k4_reac = reactionRow( 5 );
+double *k5_reac = reactionRow( 6 );
+double *k6_reac = reactionRow( 7 );
+#endif
+
+double h = dtime;
+
+double currentTime = initialTime;
+
+for( int t_index = 1; t_index <= numberOfTimeSteps; t_index++ ) {
+
+currentTime = currentTime + h;
+
+// k1
+// evaluate f( t-1, xpec[ t-1 ] )
+xrate( vspec, vfor, vbak, t_index );
+// put h * f(...) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k1[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k2
+// put x[t-1] + (1/4) * k1 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c21 * k1[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c21 * k1_reac[ r ];
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c21 * k1_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (1/4) * k1 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k2
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k2[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k3
+// put x[t-1] + (3/32) * k1 + (9/32) * k2 ) into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c31 * k1[ i ]
++ c32 * k2[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c31 * k1_reac[ r ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c31 * k1_reac[ r ]
++ c32 * k2_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (3/32) * k1 + (9/32) * k2 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k3
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k3[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k4
+// put x[t-1] + (1932/2197) * k1 - (7200/2197) * k2
+//            + (7296/2197) * k3 ) into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c41 * k1[ i ]
++ c42 * k2[ i ] + c43 * k3[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c41 * k1_reac[ r ]
++ c42 * k2_reac[ r ] + c43 * k3_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (1932/2197) * k1 - (7200/2197) * k2
+//            + (7296/2197) * k3 ) )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k4
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k4[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k5
+// put x[t-1] + (439/216) * k1 - 8 * k2
+//            + (3680/513) * k3 - (845/4104) * k4 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c51 * k1[ i ]
++ c52 * k2[ i ] + c53 * k3[ i ]
++ c54 * k4[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c51 * k1_reac[ r ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c51 * k1_reac[ r ]
++ c52 * k2_reac[ r ] + c53 * k3_reac[ r ]
++ c54 * k4_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (439/216) * k1 - 8 * k2
+//            + (3680/513) * k3 - (845/4104) * k4 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k5
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k5[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k5_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k6
+// put x[t-1] - (8/27) * k1 + 2 * k2 - (3544/2565) * k3
+//            + (1859/4104) * k4 - (11/40) * k5 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c61 * k1[ i ]
++ c62 * k2[ i ] + c63 * k3[ i ]
++ c64 * k4[ i ] + c65 * k5[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c61 * k1_reac[ r ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c61 * k1_reac[ r ]
++ c62 * k2_reac[ r ] + c63 * k3_reac[ r ]
++ c64 * k4_reac[ r ] + c65 * k5_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] - (8/27) * k1 + 2 * k2
+//                              - (3544/2565) * k3 + (1859/4104) * k4
+//                              - (11/40) * k5 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k6
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k6[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k6_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// put x[t-1] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
+//            - (9/50) * k5 + (2/55)  into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + b1 * k1[ i ]
++ b3 * k3[ i ] + b4 * k4[ i ]
++ b5 * k5[ i ] + b6 * k6[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ]
++ b1 * k1_reac[ r ]
++ b3 * k3_reac[ r ] + b4 * k4_reac[ r ]
++ b5 * k5_reac[ r ] + b6 * k6_reac[ r ];
+}
+#endif
+step( t_index );
+}
+
+} // end method: rungeKutta45
+
+
+
+/*************************************************************
+*   r u n g e K u t t a A d a p t i v e 
+*************************************************************
+* Adaptive Runge-Kutta Fehlberg Method
+* Added Feb 07, 2001
+* by Aleman-Meza, Boanerges
+* x[t+h] = x[t] + (25/216) * k1 + (1408/2565) * k3 + (2197/4104) * k4 
+*               - (1/5) * k5
+* where:
+* k1 = h * f( t,               x[t] )
+* k2 = h * f( t + (1/2) * h,   x[t] + (1/4) * k1 )
+* k3 = h * f( t + (3/8) * h,   x[t] + (3/32) * k1 + (9/32) * k2 )
+* k4 = h * f( t + (12/13) * h, x[t] + (1932/2197) * k1 - (7200/2197) * k2
+*                                   + (7296/2197) * k3 )
+* k5 = h * f( t + h,           x[t] + (439/216) * k1 - 8 * k2 
+*                                   + (3680/513) * k3 - (845/4104) * k4 )
+* k6 = h * f( t,               x[t] - (8/27) * k1 + 2 * k2 
+*                                   - (3544/2565) * k3 + (1859/4104) * k4 
+*                                   - (11/40) * k5 )
+*/
+void KinSolver::rungeKuttaAdaptive()
+{
+double vspec[ MAX_NUMBER_SPECIES ] = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
+
+double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k5[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+double k6[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+
+#ifndef OPTIMIZE
+double *k1_reac = reactionRow( 2 );
+double *k2_reac = reactionRow( 3 );
+double *k3_reac = reactionRow( 4 );
+double *k4_reac = reactionRow( 5 );
+double *k5_reac = reactionRow( 6 );
+double *k6_reac = reactionRow( 7 );
+#endif
+
+int iterations = 0;
+
+double epsilon_max = 1e-6;  //<- these 2 work with accuracy 1e-6
+double epsilon_min = 1e-13;
+
+
+double h_max = 1.0 / 4;   //dtime * 10.0;
+double h_min = 0.001;
+
+//change h 
+//double h = h_max; //( finalTime - initialTime ) * 1.0 / 1000.0;
+double h = h_min;
+
+double diff = 0.0;
+double x4 = 0.0;
+double x4_reac = 0.0;
+double epsilon = 0.0;
+
+// initialy xpec[][ 0 ] holds the i.c.
+
+int exit_loop = 0;
+int t_index = 0;
+double time = initialTime;
+double time_save = 0.0;
+
+xtime_index = 0;
+xtime[ t_index ] = time;
+
+while( ( t_index <= numberOfTimeSteps ) && ( exit_loop < 2 ) ) {
+
+// the rows up to t_index are accepted for good
+if( step( t_index ) ) {
+break;
+}
+
+/*        
+if( h < h_min ) {
+h = h_min;
+}
+if( h > h_max ) {
+h = h_max;
+}
+*/  
+
+diff = myabs( finalTime - time );
+if( diff <= myabs( h ) ) {
+if( diff < ( 0.5e-5 * finalTime ) ) {
+break;
+}
+h = diff;
+exit_loop++;
+}      
+
+t_index++;
+iterations++;
+time_save = time;
+time = time + h;
+
+// k1 
+// evaluate f( t-1, xpec[ t-1 ] )
+xrate( vspec, vfor, vbak, t_index );
+// put h * f(...) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k1[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k2 
+// put x[t-1] + (1/4) * k1 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c21 * k1[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] +  c21 * k1_reac[ r ];
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] +  c21 * k1_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (1/4) * k1 ) 
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k2
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k2[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k3 
+// put x[t-1] + (3/32) * k1 + (9/32) * k2 ) into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c31 * k1[ i ]
++ c32 * k2[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] 
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] 
++ c31 * k1_reac[ r ] + c32 * k2_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (3/32) * k1 + (9/32) * k2 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k3
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k3[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k4
+// put x[t-1] + (1932/2197) * k1 - (7200/2197) * k2
+//            + (7296/2197) * k3 ) into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c41 * k1[ i ]
++ c42 * k2[ i ] + c43 * k3[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c41 * k1_reac[ r ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c41 * k1_reac[ r ]
++ c42 * k2_reac[ r ] + c43 * k3_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (1932/2197) * k1 - (7200/2197) * k2
+//            + (7296/2197) * k3 ) )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k4
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k4[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k5
+// put x[t-1] + (439/216) * k1 - 8 * k2
+//            + (3680/513) * k3 - (845/4104) * k4 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c51 * k1[ i ]
++ c52 * k2[ i ] + c53 * k3[ i ] + c54 * k4[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] 
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] 
++ c51 * k1_reac[ r ] + c52 * k2_reac[ r ] 
++ c53 * k3_reac[ r ] + c54 * k4_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] + (439/216) * k1 - 8 * k2
+//            + (3680/513) * k3 - (845/4104) * k4 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k5
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k5[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k5_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// k6
+// put x[t-1] - (8/27) * k1 + 2 * k2 - (3544/2565) * k3
+//            + (1859/4104) * k4 - (11/40) * k5 into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c61 * k1[ i ]
++ c62 * k2[ i ] + c63 * k3[ i ]
++ c64 * k4[ i ] + c65 * k5[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c61 * k1_reac[ r ]
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c61 * k1_reac[ r ]
++ c62 * k2_reac[ r ] + c63 * k3_reac[ r ]
++ c64 * k4_reac[ r ] + c65 * k5_reac[ r ];
+}
+#endif
+
+// evaluate f( t-1, xpec[ t-1 ] - (8/27) * k1 + 2 * k2 
+//                              - (3544/2565) * k3 + (1859/4104) * k4 
+//                              - (11/40) * k5 )
+xrate( vspec, vfor, vbak, t_index + 1 );
+// put h * f( ... ) into k6
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+k6[ i ] = vspec[ i ] * h;
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+k6_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+}
+#endif
+
+// put x[t-1] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
+//            - (9/50) * k5 + (2/55)  into x[t]
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + b1 * k1[ i ] 
++ b3 * k3[ i ] + b4 * k4[ i ] 
++ b5 * k5[ i ] + b6 * k6[ i ];
+x4 = xspec[ t_index - 1 ][ i ] + a1 * k1[ i ]
++ a3 * k3[ i ] + a4 * k4[ i ] + a5 * k5[ i ];
+if( xspec[ t_index ][ i ] < 0.0 ) {
+xspec[ t_index ][ i ] = 0.0;
+}
+xtime[ t_index ] = time;
+if( x4 < 0.0 ) {
+x4 = 0.0;
+}
+diff = myabs( xspec[ t_index ][ i ] - x4 );
+if( diff > epsilon_min ) {
+epsilon = diff;
+if( epsilon > epsilon_max ) {
+break;
+}
+}
+else {
+epsilon = diff;
+}
+}
+else if( jfix[ i ] == 10){
+// trapezoidal polygon pulse
+xspec[t_index][i] = con_jfix_10(i, time); 
+}//endof if jfix=10
+else if( jfix[ i ] == 20){
+// rectangle pulse
+xspec[t_index][i] = con_jfix_20(i, time);
+}//endof if jfix = 20
+
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + b1 * k1_reac[ r ] 
+xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + b1 * k1_reac[ r ] 
++ b3 * k3_reac[ r ] + b4 * k4_reac[ r ] 
++ b5 * k5_reac[ r ] + b6 * k6_reac[ r ];
+//x4_reac = xreac[ r ][ t_index - 1 ] + a1 * k1_reac[ r ]
+x4_reac = xreac[ t_index - 1 ][ r ] + a1 * k1_reac[ r ]
++ a3 * k3_reac[ r ] + a4 * k4_reac[ r ] + a5 * k5_reac[ r ];
+//diff = myabs( xreac[ r ][ t_index ] - x4_reac );
+diff = myabs( xreac[ t_index ][ r ] - x4_reac );
+if( diff > epsilon_min && diff > epsilon_max ) {
+epsilon = diff;
+break;
+}
+}
+#endif
+
+if( epsilon < epsilon_min ) {
+h = 2.0 * h;
+}
+if( epsilon > epsilon_max ) {
+h = h / 2.0;
+time = time_save;
+t_index = t_index - 1;
+}
+
+// avoid to stay forever
+if( iterations > ( numberOfTimeSteps * 2 ) ) {
+break;
+}
+
+} 
+
+// cerr << "iterations = " << iterations << endl;
+// cerr << "timesteps = " << t_index << endl;
+xtime_index = t_index;
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+xspec[ numberOfTimeSteps ][ i ] = xspec[ t_index ][ i ];
+}
+#ifndef OPTIMIZE
+for( int i = 1; i <= numberOfReactions; i++ ) {
+//xreac[ i ][ numberOfTimeSteps ] = xreac[ i ][ t_index ];
+xreac[ numberOfTimeSteps ][ i ] = xreac[ t_index ][ i ];
+}
+#endif
+
+} // end method: rungeKuttaAdaptive
+
+
+/*************************************************************
+*   e v a l _ j a c o b i a n
+*************************************************************
+* Evals the jacobian matrix with xspec[ time ][]
+* Added Mar 01, 2001
+* by Aleman-Meza, Boanerges
+*/
+void KinSolver::eval_jacobian( int time, double ** jac )
+{
+
+double multi   = 1.0;
+double sum     = 0.0;
+double fwdPart = 0.0;
+double bckPart = 0.0;
+int existsInLeft  = 0;
+int existsInRight = 0;
+int respecttoAppears = 0;
+
+for( int equation = 1; equation <= numberOfSpecies; equation++ ) {
+
+for( int respectto = 1; respectto <= numberOfSpecies; respectto++ ) {
+
+sum = 0.0;
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+
+multi = 1.0;
+respecttoAppears = 0;
+existsInLeft  = 0;
+existsInRight = 0;
+
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+if( equation == iispec[ q ][ r ] ) {
+existsInLeft++;
+}
+if( respectto == iispec[ q ][ r ] ) {
+respecttoAppears++;
+}
+else {
+multi *= xspec[ time ][ iispec[ q ][ r ] ];
+}
+}
+// for the case x^3 ( which derivative is 3*x^2), compute x^2
+for( int k = 1; k < respecttoAppears; k++ ) {
+multi *= xspec[ time ][ respectto ];
+}
+fwdPart = multi * forwardReactionRates[ r ] * ( (double) respecttoAppears );
+
+multi = 1.0;
+respecttoAppears = 0;
+
+for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
+if( equation == iospec[ q ][ r ] ) {
+existsInRight++;
+}
+if( respectto == iospec[ q ][ r ] ) {
+respecttoAppears++;
+}
+else {
+multi *= xspec[ time ][ iospec[ q ][ r ] ];
+}
+}
+// for the case x^3 ( which derivative is 3*x^2), compute x^2
+for( int k = 1; k < respecttoAppears; k++ ) {
+multi *= xspec[ time ][ respectto ];
+}
+bckPart = multi * backwardReactionRates[ r ] * ( (double) respecttoAppears );
+
+if( existsInLeft ) {
+sum = sum - fwdPart + bckPart;
+}
+if( existsInRight ) {
+sum = sum + fwdPart - bckPart;
+}
+
+}
+
+jac[ equation ][ respectto ] = sum;
+
+}
+
+}
+}
+
+/*************************************************************
+*   p r e p a r e J a c o b i a n
+*************************************************************
+* prepares the jacobian matrix ( will be evaluated later many times )
+* Added Mar 19, 2001
+* by Aleman-Meza, Boanerges
+*/
+void KinSolver::prepareJacobian( Evaluate *** jac )
+{
+
+double   *tMulti = new double[ MAX_NUMBER_PARTICIPANT_REACTIONS * 2 ];
+int      *tIndex = new    int[ MAX_NUMBER_PARTICIPANT_REACTIONS * 2 ];
+int      tPartic = 0;
+Evaluate *left   = 0;
+Evaluate *right  = 0;
+Evaluate *eval   = 0;
+Evaluate *list   = 0;
+int existsInLeft = 0;
+int existsInRight = 0;
+int respecttoAppears = 0;
+
+for( int equation = 1; equation <= numberOfSpecies; equation++ ) {
+
+for( int respectto = 1; respectto <= numberOfSpecies; respectto++ ) {
+
+list = 0;
+
+for( int r = 1; r <= numberOfReactions; r++ ) {
+
+tPartic = 0;
+respecttoAppears = 0;
+existsInLeft  = 0;
+left = 0;
+
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+if( equation == iispec[ q ][ r ] ) {
+existsInLeft++;
+}
+if( respectto == iispec[ q ][ r ] ) {
+respecttoAppears++;
+}
+else {
+tIndex[ tPartic++ ] = iispec[ q ][ r ];
+}
+}
+if( respecttoAppears ) {
+left = new Evaluate;
+left->appears = respecttoAppears;
+left->multiplier = forwardReactionRates[ r ];
+left->participants = tPartic;
+left->indexes = new int[ tPartic ];
+for( int i = 0; i < tPartic; i++ ) {
+left->indexes[ i ] = tIndex[ i ];
+}
+left->next = 0;
+}
+
+tPartic = 0;
+respecttoAppears = 0;
+existsInRight = 0;
+right = 0;
+
+for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
+if( equation == iospec[ q ][ r ] ) {
+existsInRight++;
+}
+if( respectto == iospec[ q ][ r ] ) {
+respecttoAppears++;
+}
+else {
+tIndex[ tPartic++ ] = iospec[ q ][ r ];
+}
+}
+if( respecttoAppears ) {
+right = new Evaluate;
+right->appears = respecttoAppears;
+right->multiplier = backwardReactionRates[ r ];
+right->participants = tPartic;
+right->indexes = new int[ tPartic ];
+for( int i = 0; i < tPartic; i++ ) {
+right->indexes[ i ] = tIndex[ i ];
+}
+right->next = 0;
+}
+if( ( ! existsInLeft && ! existsInRight )
+|| ( existsInLeft && existsInRight ) ) {
+// they cancel each other, do not store them
+if( left != 0 ) {
+delete [] left->indexes;
+delete left;
+}
+if( right != 0 ) {
+delete [] right->indexes;
+delete right;
+}
+continue;
+}
+if( existsInLeft && left != 0 ) {
+left->multiplier = -left->multiplier;
+// add it to the list
+if( list == 0 ) {
+list = left;
+}
+else {
+for( Evaluate *tmp = list; tmp != 0; tmp = tmp->next ) {
+if( tmp->next == 0 ) {
+tmp->next = left;
+break;
+}
+}
+}
+} 
+if( existsInRight && right != 0 ) {
+right->multiplier = -right->multiplier;
+// add it to the list
+if( list == 0 ) {
+list = right;
+}
+else {
+for( Evaluate *tmp = list; tmp != 0; tmp = tmp->next ) {
+if( tmp->next == 0 ) {
+tmp->next = right;
+break;
+}
+}
+}
+} 
+
+}
+jac[ equation ][ respectto ] = list;
+
+}
+
+}
+delete [] tMulti;
+delete [] tIndex;
+}
+
+
+/*************************************************************
+*   s t i f f S o l v e r
+*************************************************************
+*
+*/
+void KinSolver::stiffSolver()
+{
+Evaluate ***prepared_jac = 0;
+prepared_jac = new Evaluate**[ numberOfSpecies + 1 ];
+if( prepared_jac == 0 ) {
+cerr << "ERROR: allocation for prepared_jac failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+prepared_jac[ i ] = new Evaluate*[ numberOfSpecies + 1 ];
+if( prepared_jac[ i ] == 0 ) {
+cerr << "ERROR: allocation for prepared_jac[" << i << "] failed!";
+cerr << endl;
+}
+}
+prepareJacobian( prepared_jac );
 
+/*
+cerr << "h = " << dtime << ", initialTime = " << initialTime;
+cerr << ", finalTime = " << finalTime << endl;
+*/
 
-fortranFile << "      neq = "<< numberOfSpecies << endl;
-for(int i=1; i<=numberOfSpecies; i++){
-fortranFile << "      y("<< i <<") = " << initialConcentration[i] << endl;
-}//endof for
-fortranFile << endl;
-fortranFile << "      t = " << initialTime << endl;
-double tout = (finalTime - initialTime)/(double)(numberOfTimeSteps/ntskip);
-fortranFile << "      tout = " << initialTime << endl;
-fortranFile << "      itol = 1" << endl;
-fortranFile << "      rtol = " << rtolLSODES <<endl;
-fortranFile << "      atol = " << atolLSODES <<endl;
-fortranFile << "      itask = 1" <<endl;
-fortranFile << "      istate = 1" <<endl;
-fortranFile << "      iopt = 0" <<endl;
-fortranFile << "      mf = "<< mfLSODES <<endl;
-fortranFile << "      OPEN (UNIT=20, FILE=" << "\n     1" << "'" << outputArgv << "')" << endl;
+clock_t start, end;
+double elapsed_jac = 0.0;
+double elapsed_gauss = 0.0;
+double elapsed_xrate = 0.0;
 
-//   fortranFile << "      OPEN (UNIT=20, FILE='columns.data')" << endl;
+double vspec[ MAX_NUMBER_SPECIES ] = { 0 };
+double *vfor = reactionRow( 0 );
+double *vbak = reactionRow( 1 );
 
-fortranFile << "      do 40 iout = 0, "<< numberOfTimeSteps/ntskip <<endl;
-fortranFile << "        call lsodes (fex, neq, y, t, tout, itol, rtol, atol, " <<endl;
-fortranFile << "     1     itask, istate, iopt, rwork, lrw, iwork, liw, jex, mf)" << endl;
-fortranFile << "      write(20, *)iout, t, y(" << lsodesArgv << ")"<< endl;
-fortranFile << endl;
-fortranFile << "        if (istate .lt. 0) go to 80" << endl;
-fortranFile << "        tout = tout + " << tout <<endl;
-fortranFile << "  40    continue" << endl;
-fortranFile << "      lenrw = iwork(17)" << endl;
-fortranFile << "      leniw = iwork(18)" << endl;
-fortranFile << "      nst = iwork(11)" << endl;
-fortranFile << "      nfe = iwork(12)" << endl;
-fortranFile << "      nje = iwork(13)" << endl;
-fortranFile << "      nlu = iwork(21)" << endl;
-fortranFile << "      nnz = iwork(19)" << endl;
-fortranFile << "      nnzlu = iwork(25) + iwork(26) + neq" << endl;
-fortranFile << "      stop" << endl;
-fortranFile << "  80  write(6,90)istate" << endl;
-fortranFile << "  90  format(///22h error halt.. istate =,i3)" << endl;
-fortranFile << "      stop" << endl;
-fortranFile << "      end" << endl;
+const int maxIts     = 100;
+//const double epsilon = 1.0E-6;
+const double epsilon = 1.0E-3;
+int Y0 = 0;
+int Y1 = 1;
+int Y2 = 2;
 
-//fex
-fortranFile << "      subroutine fex (neq, t, y, ydot)" << endl;
-fortranFile << "      double precision t, y, ydot" << endl;
-fortranFile << "      dimension y(" << numberOfSpecies << "), ydot(" << numberOfSpecies << ")" << endl;
+double time                = 0.0;
+double maxerror            = 0.0;
+double newvalue            = 0.0;
+double *initialConditions = new double[ numberOfSpecies + 1 ];
+double *bigF      = new double[ numberOfSpecies + 1 ];
+double *m         = new double[ numberOfSpecies + 1 ];
+double *temp      = new double[ numberOfSpecies + 1 ];
+int    *tempInt   = new int[ numberOfSpecies + 1 ];
+int    its        = 0;
+double totalIts   = 0;
 
+double **bigFprime = 0;
+bigFprime = new double*[ numberOfSpecies + 1 ];
+if( bigFprime == 0 ) {
+cerr << "ERROR: allocation for bigFprime failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+bigFprime[ i ] = new double[ numberOfSpecies + 1 ];
+if( bigFprime[ i ] == 0 ) {
+cerr << "ERROR: allocation for bigFprime[" << i << "] failed!";
+cerr << endl;
+}
+}
 
-//   cout << "OK1" << endl;
+double **jac = 0;
+jac = new double*[ numberOfSpecies + 1 ];
+if( jac == 0 ) {
+cerr << "ERROR: allocation for jac failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+jac[ i ] = new double[ numberOfSpecies + 1 ];
+if( jac[ i ] == 0 ) {
+cerr << "ERROR: allocation for jac[" << i << "] failed!";
+cerr << endl;
+}
+}
 
-//   cout << "1 of 8: " << nameOfOutputSpecies[1][8] << endl;
+/*
+double **jac2 = 0;
+jac2 = new (double*)[ numberOfSpecies + 1 ];
+if( jac2 == 0 ) {
+cerr << "ERROR: allocation for jac2 failed!" << endl;
+}
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+jac2[ i ] = new double[ numberOfSpecies + 1 ];
+if( jac2[ i ] == 0 ) {
+cerr << "ERROR: allocation for jac2[" << i << "] failed!";
+cerr << endl;
+}
+}
+*/
 
-//Pre-process all the reactions to get the index of all the participants
-for(int i=1; i<=numberOfReactions; i++){
-//cout << "i = " << i << endl;
-for(int j=1; j<=numberInputParticipants[i]; j++){
-for(int k=1; k<=numberOfSpecies; k++){
-if(mystrcmp(nameOfInputSpecies[j][i], nameOfSpecies[k])==0){
-//cout << strlen(nameOfInputSpecies[j][i]) << "  " << strlen(nameOfSpecies[k]) <<endl;
-//cout << nameOfInputSpecies[j][i] << "  " << nameOfSpecies[k] <<endl;
-//if(nameOfInputSpecies[j][i][17]=='2')   cout<<"this is space" <<endl;
-indexOfInputSpecies[j][i] = k;
-}//endof if
-}//endof k
-}//endof j
-for(int j=1; j<=numberOutputParticipants[i]; j++){
-for(int k=1; k<=numberOfSpecies; k++){
-if(mystrcmp(nameOfOutputSpecies[j][i], nameOfSpecies[k])==0){
-indexOfOutputSpecies[j][i] = k;
-}//endof if
-}//endof k
-}//endof j
-}//endof for i
+// put y0 into y1 as a first guess
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+xspec[ Y1 ][ i ] = xspec[ Y0 ][ i ];
+}
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ Y1 ] = xreac[ r ][ Y0 ];
+xreac[ Y1 ][ r ] = xreac[ Y0 ][ r ];
+}
+#endif
 
-//   cout << "OK2" << endl;
 
-for(int i=1; i<=numberOfSpecies; i++){
+// for time = 1 :
+// approximate y1 with BDF1
+// F( y1 ) = y1 - y0 - h * f( t1, y1 ) = 0
+// xspec[ 0 ] actually holds y0, x[ 1 ] will hold y1
+time = initialTime + dtime;
 
-int notHere = 0;//1 here, 0 not here, for this specie
+its = 0;
+int t_index = 1;
 
-//for each specie, calculate the dy/dt
-//jfix
+do {
+// eval fx( time, y1, temp, numberOfSpecies );
+// evaluate f( t, xpec[ t ] )
+start = clock();
+xrate( vspec, vfor, vbak, t_index + 1 );
+end = clock();
+elapsed_xrate += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
 
-if(jfix[i]==1){
-fortranFile << "      ydot(" << i << ")  = 0" << endl;
-}//endof if
+// put h * f(...) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+bigF[ i ] = xspec[ Y1 ][ i ] - xspec[ Y0 ][ i ] 
+- dtime * vspec[ i ];
+}
 
-else{
+start = clock();
+//eval_jacobian( t_index, jac2 ); 
+eval_prep_jacobian( t_index, jac , prepared_jac ); 
+end = clock();
+elapsed_jac += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+for( int j = 1; j <= numberOfSpecies; j++ ) {
+bigFprime[ i ][ j ] = ( i == j ? 1.0 : 0.0 ) 
+- dtime * jac[ i ][ j ];
+}
+}
+
+start = clock();
+gauss( bigFprime, tempInt, numberOfSpecies );
+gauss_solve( bigFprime, tempInt, bigF, m, numberOfSpecies );
+end = clock();
+elapsed_gauss += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+
+maxerror = 0.0;
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+newvalue = xspec[ Y1 ][ i ] - m[ i ];
+maxerror = maxerror > myabs( xspec[ Y1 ][ i ] - newvalue ) 
+? maxerror : myabs( xspec[ Y1 ][ i ] - newvalue );
+xspec[ Y1 ][ i ] = newvalue;
+}
+}
+
+its++;
+if( its > maxIts ) {
+cerr << "ERROR 1:  Max iterations reached!" << endl;
+return;
+}
+} while( maxerror > epsilon );
+
+//cerr << "time= " << time << ", h= " << dtime << "\tnumberOfTimeSteps = ";
+
+totalIts += its;
+//(end) approximate y1 with BDF1
+step( 1 );
+
+// now go on with BDF2 for the remaining timeSteps
+// F( y2 ) = y2 - (4/3) y1 + (1/3) y0 - (2/3) * f( t2, y2) = 0
+const double a1 =  4.0 / 3.0;
+const double a2 =  1.0 / 3.0;
+const double b0 =  2.0 / 3.0;
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+xspec[ Y2 ][ i ] = xspec[ Y1 ][ i ];
+}
+
+for( t_index = 2; t_index <= numberOfTimeSteps; t_index++ ) {
+
+time = initialTime + dtime * (double) t_index;
+its = 0;
+do {
+// eval_fx( time, y2, temp, numberOfSpecies );
+// evaluate f( t, xpec[ t ] )
+start = clock();
+xrate( vspec, vfor, vbak, t_index + 1 );
+end = clock();
+elapsed_xrate += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+
+// put h * f(...) into k1
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+bigF[ i ] = xspec[ Y2 ][ i ] - a1 * xspec[ Y1 ][ i ] 
++ a2 * xspec[ Y0 ][ i ] - b0 * dtime * vspec[ i ];
+}
+
+start = clock();
+//eval_jacobian( t_index, jac );
+eval_prep_jacobian( t_index, jac, prepared_jac ); 
+end = clock();
+elapsed_jac += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+for( int j = 1; j <= numberOfSpecies; j++ ) {
+bigFprime[ i ][ j ] = ( i == j ? 1.0 : 0.0 ) 
+- b0 * dtime * jac[ i ][ j ];
+}
+}
 
-//LHS
-fortranFile << "      ydot(" << i << ")  = ";
+start = clock();
+gauss( bigFprime, tempInt, numberOfSpecies );
+gauss_solve( bigFprime, tempInt, bigF, m, numberOfSpecies );
+end = clock();
+elapsed_gauss += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
 
-//RHS
-//all the reactions
-for(int j=1; j<=numberOfReactions; j++){
-//all the input participansts
-for(int k=1; k<=numberInputParticipants[j]; k++){
-if(mystrcmp(nameOfSpecies[i], nameOfInputSpecies[k][j])==0){
-notHere = 1;
-//forward reaction
-fortranFile << "\n" << "     1   -" << forwardReactionRates[j];
-for(int l=1; l<=numberInputParticipants[j]; l++){
-fortranFile << "*" << "y(" << indexOfInputSpecies[l][j] << ")";
-}//endof l
-//backward reaction
-fortranFile << "\n" << "     1   +" << backwardReactionRates[j];
-for(int l=1; l<=numberOutputParticipants[j]; l++){
-fortranFile << "*" << "y(" << indexOfOutputSpecies[l][j] << ")";
-}//endof l
-}//endof if
-}//endof for k
-//all the output participants
-for(int k=1; k<=numberOutputParticipants[j]; k++){
-if(mystrcmp(nameOfSpecies[i], nameOfOutputSpecies[k][j])==0){
-notHere = 1;
-//forward reaction
-fortranFile << "\n" << "     1   +" << forwardReactionRates[j];
-for(int l=1; l<=numberInputParticipants[j]; l++){
-fortranFile << "*" << "y(" << indexOfInputSpecies[l][j] << ")";
-}//endof l
-//backward reaction
-fortranFile << "\n" << "     1   -" << backwardReactionRates[j];
-for(int l=1; l<=numberOutputParticipants[j]; l++){
-fortranFile << "*" << "y(" << indexOfOutputSpecies[l][j] << ")";
-}//endof l
-}//endof if
-}//endof for k
-}//endof for j
-if(notHere==0){
-fortranFile << "0";
+maxerror = 0.0;
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 0 ) {
+newvalue = xspec[ Y2 ][ i ] - m[ i ];
+maxerror = maxerror > myabs( xspec[ Y2 ][ i ] - newvalue ) 
+? maxerror : myabs( xspec[ Y2 ][ i ] - newvalue );
+xspec[ Y2 ][ i ] = newvalue;
+}
 }
-}//endof else      
-fortranFile << endl;
-}//endof for i
-fortranFile << "      return" << endl;
-fortranFile << "      end" << endl;
 
-//jex
-fortranFile << "      subroutine jex (neq, t, y, j, ia, ja, pdj)" << endl;
-fortranFile << "      double precision t, y, pdj" << endl;
-fortranFile << "      dimension y(1), ia(1), ja(1), pdj(1)" << endl;
-fortranFile << "      end" << endl;
+its++;
+if( its > maxIts ) {
+cerr << "ERROR: Max iterations reached!" << endl;
+return;
+}
+} while( maxerror > epsilon );
 
+totalIts += its;
 
-fortranFile.close();
-return 0;      
+Y0++;
+Y1++;
+Y2++;
 
+step( t_index );
 }
 
+/*
+cerr << "time = " << time << ", h = " << dtime << "\ttimesteps = ";
+cerr << numberOfTimeSteps << endl;
+//      cerr << "Y0 = " << Y0 << ", Y1 = " << Y1 << ", Y2 = " << Y2 << endl;
+//      for( int i = 1; i <= numberOfSpecies; i++ ) {
+//         cerr << trim( nameOfSpecies[ i ] ) << "\t";
+//         cerr << xspec[ Y0 ][ i ] << " \t" << xspec[ Y1 ][ i ] << endl;
+//      }
+*/
+cerr << " its = " << totalIts;
+cerr << ", jac_time = " << elapsed_jac;
+cerr << ", xrate_time = " << elapsed_xrate;
+cerr << ", gauss_time = " << elapsed_gauss << endl;
+
+// free up allocated memory
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+delete [] bigFprime[ i ];
+}
+delete [] bigFprime;
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+delete [] jac[ i ];
+}
+delete [] jac;
+delete [] bigF;
+delete [] m;
+delete [] temp;
+delete [] tempInt;
 
+} // end method: stiffSolver
 
 /*************************************************************
-*   e v a l _ p r e p _ j a c o b i a n
+*   s t o c h a s t i c   s i m u l a t i o n
 *************************************************************
-* Evals the jacobian matrix with xspec[ time ][]
-* Added Mar 20, 2001
-* this version is supposed to work faster because it uses
-* a prepared jacobian structure
-* by Aleman-Meza, Boanerges
+* Shared pieces of the stochastic methods ( jtime=7,8 ):
+* random numbers, the channel tables built by setssa(), the
+* propensities and ssaRecord(), which puts the state on the
+* regular time grid xspec[ t ] ( t * dtime ) so the usual
+* kin.o01/o02/o03 writers are used unchanged.
+* The methods take their generator, output grid and initial
+* state as arguments and only read the globals, so the ensemble
+* runs them from several threads at once.
 */
-void eval_prep_jacobian( int time, double ** jac, Evaluate *** prepared_jac )
+int isStochasticMethod( int option )
 {
-double sum   = 0.0;
-double multi = 0.0;
+return option == 7 || option == 8;
+}
 
-for(  int i = 1; i <= numberOfSpecies; i++ ) {
+// splitmix64, only used to expand a seed into generator state
+unsigned long long splitmix64( unsigned long long *x )
+{
+unsigned long long z = ( *x += 0x9E3779B97F4A7C15ULL );
+z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+return z ^ ( z >> 31 );
+}
 
-for( int j = 1; j <= numberOfSpecies; j++ ) {
+void seedRandom( KinRandom *rng, unsigned long long seed )
+{
+unsigned long long x = seed;
+for( int i = 0; i < 4; i++ ) {
+rng->s[ i ] = splitmix64( &x );
+}
+}
 
-sum = 0.0;
-for( Evaluate *eval = prepared_jac[ i ][ j ]; eval != 0; 
-eval = eval->next ) {
-multi = eval->multiplier * eval->appears;
-for( int m = 0; m < eval->participants; m++ ) {
-multi *= xspec[ time ][ eval->indexes[ m ] ];
+// xoshiro256**
+unsigned long long nextRandom( KinRandom *rng )
+{
+unsigned long long *s = rng->s;
+unsigned long long r = s[ 1 ] * 5;
+r = ( ( r << 7 ) | ( r >> 57 ) ) * 9;
+unsigned long long t = s[ 1 ] << 17;
+s[ 2 ] ^= s[ 0 ];
+s[ 3 ] ^= s[ 1 ];
+s[ 1 ] ^= s[ 2 ];
+s[ 0 ] ^= s[ 3 ];
+s[ 2 ] ^= t;
+s[ 3 ] = ( s[ 3 ] << 45 ) | ( s[ 3 ] >> 19 );
+return r;
+}
+
+// uniform in the open interval (0,1)
+double uniformRandom( KinRandom *rng )
+{
+return ( (double) ( nextRandom( rng ) >> 11 ) + 0.5 ) * ( 1.0 / 9007199254740992.0 );
 }
-for( int q = 1; q < eval->appears; q++ ) {
-multi *= xspec[ time ][ j ];
+
+/*
+* Propensity of channel c for the species counts x[].
+* Mass action uses the falling factorial n(n-1).. of each reactant,
+* jkin=11 channels use the same quasi steady state form as xrate().
+*/
+double KinSolver::ssaPropensity( const SsaNetwork *net, int c, const double x[] )
+{
+int r = net->reaction[ c ];
+
+if( jkin[ r ] == 11 ) {
+double vf = forwardReactionRates[ r ];
+for( int q = 2; q <= numberInputParticipants[ r ]; q++ ) {
+vf *= x[ iispec[ q ][ r ] ];
 }
-sum += multi;
+double vb = backwardReactionRates2[ r ];
+for( int p = 2; p <= numberOutputParticipants[ r ]; p++ ) {
+vb *= x[ iospec[ p ][ r ] ];
 }
-jac[ i ][ j ] = sum;
+double den = vf + vb + backwardReactionRates[ r ] + forwardReactionRates2[ r ];
+if( den <= 0.0 ) {
+return 0.0;
 }
+double fmm = x[ iispec[ 1 ][ r ] ] / den;
+if( c % 2 == 1 ) {
+return fmm * forwardReactionRates2[ r ] * vf;
 }
+return fmm * backwardReactionRates[ r ] * vb;
 }
 
-double con_jfix_10(int i, double currentTime){
-
-double startTime;
-double startCon, endCon, inCycleStart, inCycleEnd;
-double inCycleTime;
-
-startTime = true_initialTime+extOfSpecies[i][1];
-if(integrationOption!=4){
-currentTime = initialTime + currentTime;
+double a = net->rate[ c ];
+for( int k = net->reactantStart[ c ]; k < net->reactantStart[ c + 1 ]; k++ ) {
+double n = x[ net->reactantSpecies[ k ] ];
+for( int m = 0; m < net->reactantOrder[ k ]; m++ ) {
+a *= ( n - m ) > 0.0 ? ( n - m ) : 0.0;
 }
-if(currentTime <= startTime){
-return initialConcentration[i];
-}//endof if
-else{
-inCycleTime = (currentTime-startTime) - oneCycle[i]*((int)((currentTime-startTime)/oneCycle[i]));
-//cerr << inCycleTime;
-inCycleStart = 0.0;
-inCycleEnd = 0.0;
-for(int j=2; j<2*npulse[i]+2; j=j+2){
-inCycleEnd = inCycleEnd + extOfSpecies[i][j+1];
-if(inCycleTime<=inCycleEnd){
-return slopeTrap[i][j+1]*(inCycleTime-inCycleStart)+extOfSpecies[i][j];
-break;
 }
-inCycleStart = inCycleEnd;
-}//endof for j
-}//endof else
+return a;
 }
 
-double con_jfix_20(int i, double currentTime){
-
-double startTime;
-double startCon, endCon, inCycleStart, inCycleEnd;
-double inCycleTime;
-
-startTime = true_initialTime+extOfSpecies[i][1];
-if(integrationOption!=4){
-currentTime = initialTime + currentTime;
+/*
+* adds participant "species" with weight "w" to the list of channel c,
+* entries of the same species are merged
+*/
+int ssaAddEntry( int species[], int weight[], int n, int s, int w )
+{
+for( int k = 0; k < n; k++ ) {
+if( species[ k ] == s ) {
+weight[ k ] += w;
+return n;
 }
-if(currentTime <= startTime){
-return extOfSpecies[i][2];
-}//endof if
-else{
-inCycleTime = (currentTime-startTime) - oneCycle[i]*((int)((currentTime-startTime)/oneCycle[i]));
-//cerr << inCycleTime;
-inCycleStart = 0.0;
-inCycleEnd = 0.0;
-for(int j=2; j<2*npulse[i]+2; j=j+2){
-inCycleEnd = inCycleEnd + extOfSpecies[i][j+1];
-if(inCycleTime<=inCycleEnd){
-return extOfSpecies[i][j+2];
-break;
 }
-inCycleStart = inCycleEnd;
-}//endof for j
-}//endof else
+species[ n ] = s;
+weight[ n ] = w;
+return n + 1;
 }
 
-
 /*************************************************************
-*   e u l e r M e t h o d ()
+*   s e t s s a
 *************************************************************
-* jtime=1: Original Euler method (integrationOption)
+* builds the channel tables and the dependency graph of the
+* network after setnet(), and seeds the random numbers
 */
-void eulerMethod()
+void KinModel::setssa()
 {
+freessa();
+
+SsaNetwork *net = new SsaNetwork;
+int channels = 2 * numberOfReactions;
+int maxList = 2 * MAX_NUMBER_PARTICIPANT_REACTIONS + 2;
+int *tSpecies = new int[ maxList ];
+int *tWeight = new int[ maxList ];
+
+net->channels = channels;
+net->rate = new double[ channels + 1 ];
+net->reaction = new int[ channels + 1 ];
+net->reactantStart = new int[ channels + 2 ];
+net->changeStart = new int[ channels + 2 ];
+net->reactantSpecies = new int[ channels * maxList + 1 ];
+net->reactantOrder = new int[ channels * maxList + 1 ];
+net->changeSpecies = new int[ channels * maxList + 1 ];
+net->changeDelta = new int[ channels * maxList + 1 ];
+
+int nReactant = 0;
+int nChange = 0;
+for( int c = 1; c <= channels; c++ ) {
+int r = ( c + 1 ) / 2;
+int forward = ( c % 2 == 1 );
+int mm = ( jkin[ r ] == 11 );
+net->reaction[ c ] = r;
+net->rate[ c ] = forward ? forwardReactionRates[ r ] : backwardReactionRates[ r ];
+net->reactantStart[ c ] = nReactant;
+net->changeStart[ c ] = nChange;
+
+// species read by the propensity
+int n = 0;
+if( mm ) {
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iispec[ q ][ r ], 0 );
+}
+for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iospec[ p ][ r ], 0 );
+}
+}
+else if( forward ) {
+for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iispec[ q ][ r ], 1 );
+}
+}
+else {
+for( int p = 1; p <= numberOutputParticipants[ r ]; p++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iospec[ p ][ r ], 1 );
+}
+}
+for( int k = 0; k < n; k++ ) {
+net->reactantSpecies[ nReactant ] = tSpecies[ k ];
+net->reactantOrder[ nReactant ] = tWeight[ k ];
+nReactant++;
+}
 
-double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
+// state change, the enzyme of jkin=11 and fixed species do not change
+n = 0;
+int sign = forward ? 1 : -1;
+for( int q = 1 + mm; q <= numberInputParticipants[ r ]; q++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iispec[ q ][ r ], -sign );
+}
+for( int p = 1 + mm; p <= numberOutputParticipants[ r ]; p++ ) {
+n = ssaAddEntry( tSpecies, tWeight, n, iospec[ p ][ r ], sign );
+}
+for( int k = 0; k < n; k++ ) {
+if( tWeight[ k ] != 0 && jfix[ tSpecies[ k ] ] == 0 ) {
+net->changeSpecies[ nChange ] = tSpecies[ k ];
+net->changeDelta[ nChange ] = tWeight[ k ];
+nChange++;
+}
+}
+}
+net->reactantStart[ channels + 1 ] = nReactant;
+net->changeStart[ channels + 1 ] = nChange;
 
-double currentTime;
+// species -> channels reading it
+net->speciesStart = new int[ numberOfSpecies + 2 ];
+for( int i = 0; i <= numberOfSpecies + 1; i++ ) {
+net->speciesStart[ i ] = 0;
+}
+for( int k = 0; k < nReactant; k++ ) {
+net->speciesStart[ net->reactantSpecies[ k ] + 1 ]++;
+}
+for( int i = 1; i <= numberOfSpecies + 1; i++ ) {
+net->speciesStart[ i ] += net->speciesStart[ i - 1 ];
+}
+int *fill = new int[ numberOfSpecies + 1 ];
+for( int i = 0; i <= numberOfSpecies; i++ ) {
+fill[ i ] = net->speciesStart[ i ];
+}
+net->speciesChannel = new int[ nReactant + 1 ];
+for( int c = 1; c <= channels; c++ ) {
+for( int k = net->reactantStart[ c ]; k < net->reactantStart[ c + 1 ]; k++ ) {
+net->speciesChannel[ fill[ net->reactantSpecies[ k ] ]++ ] = c;
+}
+}
+delete [] fill;
 
-for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+// channel -> channels to update after it fired
+int *mark = new int[ channels + 1 ];
+for( int c = 0; c <= channels; c++ ) {
+mark[ c ] = 0;
+}
+int nDepend = 0;
+for( int pass = 0; pass < 2; pass++ ) {
+if( pass == 1 ) {
+net->dependChannel = new int[ nDepend + 1 ];
+}
+nDepend = 0;
+for( int c = 1; c <= channels; c++ ) {
+if( pass == 1 ) {
+net->dependStart[ c ] = nDepend;
+}
+else if( c == 1 ) {
+net->dependStart = new int[ channels + 2 ];
+}
+for( int k = net->changeStart[ c ]; k < net->changeStart[ c + 1 ]; k++ ) {
+int s = net->changeSpecies[ k ];
+for( int j = net->speciesStart[ s ]; j < net->speciesStart[ s + 1 ]; j++ ) {
+int d = net->speciesChannel[ j ];
+if( mark[ d ] != c ) {
+mark[ d ] = c;
+if( pass == 1 ) {
+net->dependChannel[ nDepend ] = d;
+}
+nDepend++;
+}
+}
+}
+}
+for( int c = 0; c <= channels; c++ ) {
+mark[ c ] = 0;
+}
+}
+net->dependStart[ channels + 1 ] = nDepend;
+delete [] mark;
+delete [] tSpecies;
+delete [] tWeight;
 
-currentTime = dtime*t;
+ssaNet = net;
+}
 
-xrate( vspec, vfor, vbak, t );
+void KinModel::freessa()
+{
+if( ssaNet == 0 ) {
+return;
+}
+delete [] ssaNet->rate;
+delete [] ssaNet->reaction;
+delete [] ssaNet->reactantStart;
+delete [] ssaNet->reactantSpecies;
+delete [] ssaNet->reactantOrder;
+delete [] ssaNet->changeStart;
+delete [] ssaNet->changeSpecies;
+delete [] ssaNet->changeDelta;
+delete [] ssaNet->dependStart;
+delete [] ssaNet->dependChannel;
+delete [] ssaNet->speciesStart;
+delete [] ssaNet->speciesChannel;
+delete ssaNet;
+ssaNet = 0;
+}
+
+// puts the species counts on the output grid ( xspec or a private one )
+void KinSolver::ssaRecord( double **grid, const double x[], int t )
+{
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+grid[ t ][ i ] = x[ i ];
+}
+if( grid == xspec ) {
+step( t );
+}
+}
 
+// sets the pulsed species ( jfix=10,20 ) for time "currentTime",
+// returns nonzero if any was changed
+int KinSolver::ssaClamp( double x[], double currentTime )
+{
+int changed = 0;
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + vspec[ i ] * dtime;
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+double value = x[ i ];
+if( jfix[ i ] == 10 ) {
+value = con_jfix_10( i, currentTime );
+}
+else if( jfix[ i ] == 20 ) {
+value = con_jfix_20( i, currentTime );
+}
+if( value != x[ i ] ) {
+x[ i ] = value;
+changed = 1;
+}
+}
+return changed;
+}
+
+/*
+* composition-rejection groups
+*/
+void ssaGroupInsert( SsaGroups *grp, int c, double a )
+{
+if( a <= 0.0 ) {
+grp->groupOf[ c ] = -1;
+return;
+}
+int e = 0;
+frexp( a, &e );
+int g = e + SSA_GROUP_OFFSET;
+if( grp->count[ g ] == grp->capacity[ g ] ) {
+int capacity = grp->capacity[ g ] == 0 ? 8 : 2 * grp->capacity[ g ];
+int *member = new int[ capacity ];
+for( int k = 0; k < grp->count[ g ]; k++ ) {
+member[ k ] = grp->member[ g ][ k ];
+}
+if( grp->member[ g ] != 0 ) {
+delete [] grp->member[ g ];
+}
+grp->member[ g ] = member;
+grp->capacity[ g ] = capacity;
+}
+grp->groupOf[ c ] = g;
+grp->position[ c ] = grp->count[ g ];
+grp->member[ g ][ grp->count[ g ]++ ] = c;
+grp->sum[ g ] += a;
+if( g < grp->lowest ) {
+grp->lowest = g;
+}
+if( g > grp->highest ) {
+grp->highest = g;
 }
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
-
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
 
-}//endof if jfix = 20
-} // for i
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ]
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ]
-+ ( vfor[ r ] - vbak[ r ] ) * dtime;
+void ssaGroupRemove( SsaGroups *grp, int c, double a )
+{
+int g = grp->groupOf[ c ];
+if( g < 0 ) {
+return;
+}
+int last = grp->member[ g ][ --grp->count[ g ] ];
+grp->member[ g ][ grp->position[ c ] ] = last;
+grp->position[ last ] = grp->position[ c ];
+grp->groupOf[ c ] = -1;
+grp->sum[ g ] -= a;
+if( grp->count[ g ] == 0 ) {
+grp->sum[ g ] = 0.0;
+while( grp->lowest <= grp->highest && grp->count[ grp->lowest ] == 0 ) {
+grp->lowest++;
+}
+while( grp->highest >= grp->lowest && grp->count[ grp->highest ] == 0 ) {
+grp->highest--;
+}
+if( grp->lowest > grp->highest ) {
+grp->lowest = SSA_GROUPS;
+grp->highest = -1;
+}
 }
-#endif
 }
 
+// recomputes the group sums to get rid of the accumulated round off
+void ssaGroupResum( SsaGroups *grp, const double a[] )
+{
+for( int g = grp->lowest; g <= grp->highest; g++ ) {
+grp->sum[ g ] = 0.0;
+for( int k = 0; k < grp->count[ g ]; k++ ) {
+grp->sum[ g ] += a[ grp->member[ g ][ k ] ];
+}
+}
 }
 
 /*************************************************************
-*   m o d i f i e d E u l e r M e t h o d ()
+*   c o m p o s i t i o n R e j e c t i o n S S A
 *************************************************************
-* T. Taha
-* Department of Computer Science
-* University of Georgia
-* Athens, GA 30602
-* E-Mail thiab@cs.uga.edu
-* added 00-08-01
+* jtime=7: exact stochastic simulation ( Gillespie ), the next
+* channel is selected in O(1) expected time:
+* the channels are binned by propensity into groups [2^(e-1),2^e),
+* a group is picked with probability sum/a0 ( composition ) and a
+* member of the group by uniform pick plus acceptance a/2^e
+* ( rejection, accepts with probability > 1/2 ).
+* After a channel fired only the channels of the dependency graph
+* are re-evaluated.
 */
-void modifiedEulerMethod()
+void KinSolver::compositionRejectionSSA( KinRandom *rng, double **grid, const double initial[] )
 {
+const SsaNetwork *net = ssaNet;
+int channels = net->channels;
 
-double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
-double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-#ifndef OPTIMIZE
-double k1_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-#endif
-
-double currentTime;
-
-for( int t = 1; t <= numberOfTimeSteps; t++ ) {
-
-currentTime = dtime*t;
+double *x = new double[ numberOfSpecies + 1 ];
+double *a = new double[ channels + 1 ];
+SsaGroups *grp = new SsaGroups;
 
-// evaluate f( t-1, xpec[ t-1 ] )
-xrate( vspec, vfor, vbak, t );
-// put h * f( t-1, xpec[ t-1 ] ) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k1[ i ] = vspec[ i ] * dtime;
-}
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+for( int g = 0; g < SSA_GROUPS; g++ ) {
+grp->sum[ g ] = 0.0;
+grp->count[ g ] = 0;
+grp->capacity[ g ] = 0;
+grp->member[ g ] = 0;
 }
-#endif
+grp->lowest = SSA_GROUPS;
+grp->highest = -1;
+grp->groupOf = new int[ channels + 1 ];
+grp->position = new int[ channels + 1 ];
 
-// put x[t-1] + k1 into x[t]
 for( int i = 1; i <= numberOfSpecies; i++ ) {
+x[ i ] = initial[ i ];
 if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k1[ i ];
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+x[ i ] = x[ i ] > 0.0 ? floor( x[ i ] + 0.5 ) : 0.0;
 }
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
-}//endof if jfix = 20
+ssaClamp( x, 0.0 );
+ssaRecord( grid, x, 0 );
 
+for( int c = 1; c <= channels; c++ ) {
+a[ c ] = ssaPropensity( net, c, x );
+ssaGroupInsert( grp, c, a[ c ] );
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k1_reac[ r ];
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k1_reac[ r ];
+
+double currentTime = 0.0;
+long fired = 0;
+int t = 1;
+
+while( t <= numberOfTimeSteps ) {
+
+double a0 = 0.0;
+for( int g = grp->lowest; g <= grp->highest; g++ ) {
+a0 += grp->sum[ g ];
 }
-#endif
 
-// evaluate f( t, xspec[ t ] + k1 )
-xrate( vspec, vfor, vbak, t + 1 );
-// put xspec[ t-1 ] + (1/2) ( k0 + h * f(...) into xspec[ t ]
+double tau = a0 > 0.0 ? -log( uniformRandom( rng ) ) / a0 : 0.0;
+if( a0 <= 0.0 || currentTime + tau >= dtime * t ) {
+// nothing fires before the grid point, the exponential waiting
+// time is memoryless so it is drawn again from there
+currentTime = dtime * t;
+if( ssaClamp( x, currentTime ) ) {
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + 0.5 * ( k1[ i ] 
-+ vspec[ i ] * dtime );
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+if( jfix[ i ] != 10 && jfix[ i ] != 20 ) {
+continue;
 }
+for( int k = net->speciesStart[ i ]; k < net->speciesStart[ i + 1 ]; k++ ) {
+int d = net->speciesChannel[ k ];
+ssaGroupRemove( grp, d, a[ d ] );
+a[ d ] = ssaPropensity( net, d, x );
+ssaGroupInsert( grp, d, a[ d ] );
 }
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + 0.5 * ( k1_reac[ r ] 
-+ ( vfor[ r ] - vbak[ r ] ) * dtime );
 }
-#endif
-
+ssaRecord( grid, x, t );
+t++;
+continue;
+}
+currentTime += tau;
 
+// composition: pick the group
+double target = uniformRandom( rng ) * a0;
+int g = grp->highest;
+for( ; g > grp->lowest; g-- ) {
+if( grp->count[ g ] == 0 ) {
+continue;
+}
+if( target < grp->sum[ g ] ) {
+break;
+}
+target -= grp->sum[ g ];
 }
+while( grp->count[ g ] == 0 ) {   // round off at the low end
+g++;
 }
 
-void modifiedEulerMethod_original()
-{ 
+// rejection: pick the channel inside the group
+double bound = ldexp( 1.0, g - SSA_GROUP_OFFSET );
+int c = 0;
+do {
+int k = (int) ( uniformRandom( rng ) * grp->count[ g ] );
+if( k >= grp->count[ g ] ) {
+k = grp->count[ g ] - 1;
+}
+c = grp->member[ g ][ k ];
+} while( uniformRandom( rng ) * bound >= a[ c ] );
 
-double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
+// fire c
+for( int k = net->changeStart[ c ]; k < net->changeStart[ c + 1 ]; k++ ) {
+x[ net->changeSpecies[ k ] ] += net->changeDelta[ k ];
+}
+for( int k = net->dependStart[ c ]; k < net->dependStart[ c + 1 ]; k++ ) {
+int d = net->dependChannel[ k ];
+ssaGroupRemove( grp, d, a[ d ] );
+a[ d ] = ssaPropensity( net, d, x );
+ssaGroupInsert( grp, d, a[ d ] );
+}
 
-for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+fired++;
+if( fired % SSA_RESUM == 0 ) {
+ssaGroupResum( grp, a );
+}
+if( fired % SSA_STOP_CHECK == 0 && grid == xspec && stopRequested() ) {
+// between two grid points: the rows up to t-1 are the results
+halt( t - 1 );
+break;
+}
+}
 
-xrate( vspec, vfor, vbak, t );
+if( DEBUG ) {
+cerr << " ssa fired = " << fired << endl;
+}
 
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + vspec[ i ] * dtime;
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+for( int g = 0; g < SSA_GROUPS; g++ ) {
+if( grp->member[ g ] != 0 ) {
+delete [] grp->member[ g ];
 }
 }
+delete [] grp->groupOf;
+delete [] grp->position;
+delete grp;
+delete [] a;
+delete [] x;
 
-} // for i
+} // end method: compositionRejectionSSA
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ]
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ]
-+ ( vfor[ r ] - vbak[ r ] ) * dtime;
+// log( k! ), Stirling series for large k ( lgamma() is not thread safe )
+double logFactorial( double k )
+{
+if( k < 10.0 ) {
+double f = 1.0;
+for( double j = 2.0; j <= k; j += 1.0 ) {
+f *= j;
+}
+return log( f );
+}
+double z = k + 1.0;
+return ( z - 0.5 ) * log( z ) - z + 0.91893853320467274178
++ 1.0 / ( 12.0 * z ) - 1.0 / ( 360.0 * z * z * z );
 }
-#endif
-
-xrate( vspec, vfor, vbak, t + 1 );
 
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = 0.5 * ( xspec[ t ][ i ] + xspec[ t - 1 ][ i ]
-+ vspec[ i ] * dtime );
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+/*************************************************************
+*   p o i s s o n R a n d o m
+*************************************************************
+* Fills k[ 0..n-1 ] with Poisson numbers of means mean[ 0..n-1 ].
+* Done as a batch in two sweeps: small means by inversion of the
+* cumulative distribution, large means by the transformed
+* rejection method PTRS ( W. Hormann, 1993 ), which needs about
+* 1.1 uniform pairs per number whatever the mean.
+*/
+void poissonRandom( KinRandom *rng, const double mean[], double k[], int n )
+{
+for( int j = 0; j < n; j++ ) {
+double m = mean[ j ];
+if( m >= POISSON_PTRS_MEAN ) {
+continue;
 }
+double count = 0.0;
+if( m > 0.0 ) {
+double p = exp( -m );
+double f = p;
+double u = uniformRandom( rng );
+while( u > f && p > 0.0 ) {
+count += 1.0;
+p *= m / count;
+f += p;
+}
+}
+k[ j ] = count;
 }
-} // for i
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = 0.5 * ( xreac[ r ][ t ] + xreac[ r ][ t - 1 ]
-xreac[ t ][ r ] = 0.5 * ( xreac[ t ][ r ] + xreac[ t - 1 ][ r ]
-+ ( vfor[ r ] - vbak[ r ] ) * dtime );
+for( int j = 0; j < n; j++ ) {
+double m = mean[ j ];
+if( m < POISSON_PTRS_MEAN ) {
+continue;
+}
+double slam = sqrt( m );
+double loglam = log( m );
+double b = 0.931 + 2.53 * slam;
+double a = -0.059 + 0.02483 * b;
+double invalpha = 1.1239 + 1.1328 / ( b - 3.4 );
+double vr = 0.9277 - 3.6224 / ( b - 2.0 );
+while( 1 ) {
+double u = uniformRandom( rng ) - 0.5;
+double v = uniformRandom( rng );
+double us = 0.5 - myabs( u );
+double count = floor( ( 2.0 * a / us + b ) * u + m + 0.43 );
+if( us >= 0.07 && v <= vr ) {
+k[ j ] = count;
+break;
+}
+if( count < 0.0 || ( us < 0.013 && v > us ) ) {
+continue;
+}
+if( log( v ) + log( invalpha ) - log( a / ( us * us ) + b )
+<= -m + count * loglam - logFactorial( count ) ) {
+k[ j ] = count;
+break;
+}
+}
+}
 }
-#endif
 
+// applies channel c "times" times to the counts x[]
+void KinSolver::ssaFire( const SsaNetwork *net, int c, double times, double x[] )
+{
+for( int k = net->changeStart[ c ]; k < net->changeStart[ c + 1 ]; k++ ) {
+x[ net->changeSpecies[ k ] ] += times * net->changeDelta[ k ];
 }
 }
 
 /*************************************************************
-*   r u n g e K u t t a O r d e r 4
+*   t a u L e a p i n g
 *************************************************************
-* Runge-Kutta Method order h^4
-* Added Jan 30, 2001
-* by Aleman-Meza, Boanerges
-* x[t+1] = x[t] + (1/6) * ( k1 + 2 * k2 + 2 * k3 + k4 )
-* where:
-* k1 = h * f( t,       x[t] )
-* k2 = h * f( t + h/2, x[t] + (1/2) * k1 )
-* k3 = h * f( t + h/2, x[t] + (1/2) * k2 )
-* k4 = h * f( t + 1,   x[t] + k3 )
+* jtime=8: adaptive tau-leaping ( Cao, Gillespie, Petzold 2006 )
+* - channels that can exhaust a reactant within TAU_CRITICAL
+*   firings are critical, at most one of them fires per leap and
+*   with its exact exponential waiting time
+* - the leap tau' of the others bounds the relative change of
+*   every reactant's propensity by tauEpsilon ( option "epsilon" )
+* - when tau' < 10/a0 leaping does not pay and TAU_SSA_STEPS exact
+*   direct method steps are taken instead
+* Leaps stop on the grid points, so the output is on the same
+* xspec grid as for the other methods.
 */
-void rungeKuttaOrder4()
+void KinSolver::tauLeaping( KinRandom *rng, double **grid, const double initial[] )
 {
-double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
-double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-#ifndef OPTIMIZE
-double k1_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k2_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k3_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k4_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-#endif
-
-double currentTime;
-
-for( int t = 1; t <= numberOfTimeSteps; t++ ) {
-
-currentTime = dtime*t;
-
-// evaluate f( t-1, xpec[ t-1 ] )
-xrate( vspec, vfor, vbak, t );
-// put h * f( t-1, xpec[ t-1 ] ) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k1[ i ] = vspec[ i ] * dtime;
+const SsaNetwork *net = ssaNet;
+int channels = net->channels;
+
+double *x = new double[ numberOfSpecies + 1 ];
+double *xTry = new double[ numberOfSpecies + 1 ];
+double *a = new double[ channels + 1 ];
+int *critical = new int[ channels + 1 ];
+double *mean = new double[ channels + 1 ];
+double *fire = new double[ channels + 1 ];
+int *leap = new int[ channels + 1 ];
+double *mu = new double[ numberOfSpecies + 1 ];
+double *sigma2 = new double[ numberOfSpecies + 1 ];
+int *hor = new int[ numberOfSpecies + 1 ];
+int *horMult = new int[ numberOfSpecies + 1 ];
+
+// highest order of reaction of each reactant species, and how
+// many molecules of it that reaction needs ( g_i of the paper )
+for( int i = 0; i <= numberOfSpecies; i++ ) {
+hor[ i ] = 0;
+horMult[ i ] = 0;
+}
+for( int c = 1; c <= channels; c++ ) {
+int order = 0;
+for( int k = net->reactantStart[ c ]; k < net->reactantStart[ c + 1 ]; k++ ) {
+order += net->reactantOrder[ k ] > 0 ? net->reactantOrder[ k ] : 1;
+}
+for( int k = net->reactantStart[ c ]; k < net->reactantStart[ c + 1 ]; k++ ) {
+int s = net->reactantSpecies[ k ];
+int mult = net->reactantOrder[ k ] > 0 ? net->reactantOrder[ k ] : 1;
+if( order > hor[ s ] || ( order == hor[ s ] && mult > horMult[ s ] ) ) {
+hor[ s ] = order;
+horMult[ s ] = mult;
+}
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
 }
-#endif
 
-// put x[t-1] + k1 / 2.0 into x[t]
 for( int i = 1; i <= numberOfSpecies; i++ ) {
+x[ i ] = initial[ i ];
 if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k1[ i ] / 2.0;
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+x[ i ] = x[ i ] > 0.0 ? floor( x[ i ] + 0.5 ) : 0.0;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
+}
+ssaClamp( x, 0.0 );
+ssaRecord( grid, x, 0 );
 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
+double currentTime = 0.0;
+long leaps = 0;
+long exact = 0;
+int t = 1;
 
-}//endof if jfix = 20
+while( t <= numberOfTimeSteps ) {
 
+if( grid == xspec && stopRequested() ) {
+halt( t - 1 );
+break;
 }
 
+double next = dtime * t;
+double a0 = 0.0;
+for( int c = 1; c <= channels; c++ ) {
+a[ c ] = ssaPropensity( net, c, x );
+a0 += a[ c ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k1_reac[ r ] / 2.0;
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k1_reac[ r ] / 2.0;
+if( a0 <= 0.0 ) {
+currentTime = next;
+ssaClamp( x, currentTime );
+ssaRecord( grid, x, t );
+t++;
+continue;
 }
-#endif
 
-// evaluate f( t, xspec[ t ] + (1/2) * k1 )
-xrate( vspec, vfor, vbak, t + 1 );
-// put h * f( t, xspec[ t ] + (1/2) * k1 ) into k2
+// critical channels and the leap condition of the others
+double a0c = 0.0;
+int nLeap = 0;
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-k2[ i ] = vspec[ i ] * dtime;
-}
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+mu[ i ] = 0.0;
+sigma2[ i ] = 0.0;
 }
-#endif
-
-// put x[t-1] + k2 / 2.0 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k2[ i ] / 2.0;
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+for( int c = 1; c <= channels; c++ ) {
+critical[ c ] = 0;
+if( a[ c ] <= 0.0 ) {
+continue;
 }
+for( int k = net->changeStart[ c ]; k < net->changeStart[ c + 1 ]; k++ ) {
+if( net->changeDelta[ k ] < 0
+&& x[ net->changeSpecies[ k ] ] < -TAU_CRITICAL * net->changeDelta[ k ] ) {
+critical[ c ] = 1;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
-
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
-
-}//endof if jfix = 20
-
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k2_reac[ r ] / 2.0;
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k2_reac[ r ] / 2.0;
+if( critical[ c ] ) {
+a0c += a[ c ];
+continue;
 }
-#endif
-
-// evaluate f( t, xspec[ t ] + (1/2) * k2 )
-xrate( vspec, vfor, vbak, t + 1 );
-// put h * f( t, xspec[ t ] + (1/2) * k2 ) into k3
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k3[ i ] = vspec[ i ] * dtime;
+leap[ nLeap++ ] = c;
+for( int k = net->changeStart[ c ]; k < net->changeStart[ c + 1 ]; k++ ) {
+double v = net->changeDelta[ k ];
+mu[ net->changeSpecies[ k ] ] += v * a[ c ];
+sigma2[ net->changeSpecies[ k ] ] += v * v * a[ c ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
 }
-#endif
 
-// put x[t-1] + k3  into x[t]
+double tau1 = HUGE_VAL;
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + k3[ i ];
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+if( hor[ i ] == 0 || jfix[ i ] != 0 || ( mu[ i ] == 0.0 && sigma2[ i ] == 0.0 ) ) {
+continue;
+}
+double g = hor[ i ];
+double xi = x[ i ];
+if( horMult[ i ] == 2 && xi > 1.0 ) {
+g = ( hor[ i ] == 2 ) ? 2.0 + 1.0 / ( xi - 1.0 ) : 1.5 * ( 2.0 + 1.0 / ( xi - 1.0 ) );
+}
+else if( horMult[ i ] == 3 && xi > 2.0 ) {
+g = 3.0 + 1.0 / ( xi - 1.0 ) + 2.0 / ( xi - 2.0 );
+}
+double bound = tauEpsilon * xi / g;
+if( bound < 1.0 ) {
+bound = 1.0;
+}
+if( mu[ i ] != 0.0 && bound / myabs( mu[ i ] ) < tau1 ) {
+tau1 = bound / myabs( mu[ i ] );
+}
+if( sigma2[ i ] > 0.0 && bound * bound / sigma2[ i ] < tau1 ) {
+tau1 = bound * bound / sigma2[ i ];
 }
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
+if( tau1 < 10.0 / a0 ) {
+// exact steps, direct method on the dependency graph
+for( int n = 0; n < TAU_SSA_STEPS && t <= numberOfTimeSteps; n++ ) {
+double tau = a0 > 0.0 ? -log( uniformRandom( rng ) ) / a0 : 0.0;
+if( a0 <= 0.0 || currentTime + tau >= dtime * t ) {
+currentTime = dtime * t;
+ssaClamp( x, currentTime );
+ssaRecord( grid, x, t );
+t++;
+break;   // pulses may have changed, start over
+}
+currentTime += tau;
+double target = uniformRandom( rng ) * a0;
+int c = 1;
+for( ; c < channels; c++ ) {
+if( target < a[ c ] ) {
+break;
+}
+target -= a[ c ];
+}
+while( a[ c ] <= 0.0 && c > 1 ) {   // round off at the end
+c--;
+}
+ssaFire( net, c, 1.0, x );
+for( int k = net->dependStart[ c ]; k < net->dependStart[ c + 1 ]; k++ ) {
+int d = net->dependChannel[ k ];
+a0 -= a[ d ];
+a[ d ] = ssaPropensity( net, d, x );
+a0 += a[ d ];
+}
+exact++;
+}
+continue;
+}
 
-}//endof if jfix = 20
+// leap, shrink tau' until no count goes negative
+double tau = 0.0;
+int hitGrid = 0;
+while( 1 ) {
+double tau2 = a0c > 0.0 ? -log( uniformRandom( rng ) ) / a0c : HUGE_VAL;
+tau = tau1 < tau2 ? tau1 : tau2;
+int criticalFires = tau2 <= tau1;
+hitGrid = 0;
+if( currentTime + tau >= next ) {
+tau = next - currentTime;
+criticalFires = 0;
+hitGrid = 1;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + k3_reac[ r ];
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + k3_reac[ r ];
+
+for( int j = 0; j < nLeap; j++ ) {
+mean[ j ] = a[ leap[ j ] ] * tau;
 }
-#endif
+poissonRandom( rng, mean, fire, nLeap );
 
-// evaluate f( t, xspec[ t ] + k3 )
-xrate( vspec, vfor, vbak, t + 1 );
-// put h * f( t, xspec[ t ] + k3 ) into k4
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-k4[ i ] = vspec[ i ] * dtime;
+xTry[ i ] = x[ i ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * dtime;
+for( int j = 0; j < nLeap; j++ ) {
+if( fire[ j ] > 0.0 ) {
+ssaFire( net, leap[ j ], fire[ j ], xTry );
+}
+}
+if( criticalFires ) {
+double target = uniformRandom( rng ) * a0c;
+int c = 0;
+for( int d = 1; d <= channels; d++ ) {
+if( critical[ d ] ) {
+c = d;
+if( target < a[ d ] ) {
+break;
+}
+target -= a[ d ];
+}
+}
+ssaFire( net, c, 1.0, xTry );
 }
-#endif
 
-// put x[t-1] + (1/6)*(k1 + 2*k2 + 2*k3 + k4) into x[t]
+int negative = 0;
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ] + ( k1[ i ] + 2.0 * k2[ i ]
-+ 2.0 * k3[ i ] + k4[ i ] ) / 6.0;
-if( xspec[ t ][ i ] < 0.0 ) {
-xspec[ t ][ i ] = 0.0;
+if( xTry[ i ] < 0.0 ) {
+negative = 1;
+break;
 }
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t][i] = con_jfix_10(i, currentTime);
+if( ! negative ) {
+break;
+}
+tau1 = tau1 / 2.0;
+}
 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t][i] = con_jfix_20(i, currentTime);
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+x[ i ] = xTry[ i ];
+}
+currentTime += tau;
+leaps++;
 
-}//endof if jfix = 20
+if( hitGrid ) {
+currentTime = next;
+ssaClamp( x, currentTime );
+ssaRecord( grid, x, t );
+t++;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t ] = xreac[ r ][ t - 1 ] + ( k1_reac[ r ]
-xreac[ t ][ r ] = xreac[ t - 1 ][ r ] + ( k1_reac[ r ]
-+ 2.0 * k2_reac[ r ] + 2.0 * k3_reac[ r ]
-+ k4_reac[ r ] ) / 6.0;
 }
-#endif
 
-} 
+if( DEBUG ) {
+cerr << " tau leaps = " << leaps << ", exact steps = " << exact << endl;
+}
 
-} // end method: rungeKuttaOrder4
+delete [] x;
+delete [] xTry;
+delete [] a;
+delete [] critical;
+delete [] mean;
+delete [] fire;
+delete [] leap;
+delete [] mu;
+delete [] sigma2;
+delete [] hor;
+delete [] horMult;
+
+} // end method: tauLeaping
 
 /*************************************************************
-*   r u n g e K u t t a 4 5
+*   s t o c h a s t i c   e n s e m b l e
 *************************************************************
-* Runge-Kutta 45 Method
-* Added Feb 07, 2001
-* by Aleman-Meza, Boanerges
-* x[t+h] = x[t] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
-*               - (9/50) * k5 + (2/55)
-* where:
-* k1 = h * f( t, x[t] )
-* k2 = h * f( t, x[t] + (1/4) * k1 )
-* k3 = h * f( t, x[t] + (3/32) * k1 + (9/32) * k2 )
-* k4 = h * f( t, x[t] + (1932/2197) * k1 - (7200/2197) * k2 
-*                     + (7296/2197) * k3 )
-* k5 = h * f( t, x[t] + (439/216) * k1 - 8 * k2
-*                     + (3680/513) * k3 - (845/4104) * k4 )
-* k6 = h * f( t, x[t] - (8/27) * k1 + 2 * k2
-*                     - (3544/2565) * k3 + (1859/4104) * k4 - (11/40) * k5 )
+* option lines "ensemble <n>", "threads <n>", "quantiles <p>..":
+* runs n independent realizations of the stochastic method on a
+* pool of threads and reduces them on the fly to mean, variance
+* and quantiles on the ntskip output grid, no trajectory is kept.
+* Realization k always uses random stream k of "seed", and the
+* realizations are folded in the order 0,1,2.., so the result is
+* the same for any number of threads.
 */
-void rungeKutta45()
-{
-
-double vspec[ MAX_NUMBER_SPECIES ]  = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
-
-double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k5[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k6[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-
-#ifndef OPTIMIZE
-double k1_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k2_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k3_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k4_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k5_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k6_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-#endif
-
-double h = dtime;
 
-double currentTime = initialTime;
+// generator of realization "stream" of "seed"
+void seedStream( KinRandom *rng, unsigned long long seed, long stream )
+{
+seedRandom( rng, seed + 0x9E3779B97F4A7C15ULL * (unsigned long long) ( stream + 1 ) );
+}
 
-for( int t_index = 1; t_index <= numberOfTimeSteps; t_index++ ) {
+/*
+* P-square running quantile ( R. Jain, I. Chlamtac, 1985 ), five
+* markers follow the minimum, p/2, p, (1+p)/2 and the maximum
+*/
+void p2Add( P2Quantile *e, double p, double x )
+{
+double *h = e->height;
+int *n = e->position;
 
-currentTime = currentTime + h;
+if( e->count < 5 ) {
+int k = e->count++;
+while( k > 0 && h[ k - 1 ] > x ) {
+h[ k ] = h[ k - 1 ];
+k--;
+}
+h[ k ] = x;
+for( int i = 0; i < 5; i++ ) {
+n[ i ] = i + 1;
+}
+return;
+}
 
-// k1
-// evaluate f( t-1, xpec[ t-1 ] )
-xrate( vspec, vfor, vbak, t_index );
-// put h * f(...) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k1[ i ] = vspec[ i ] * h;
+int k = 0;
+if( x < h[ 0 ] ) {
+h[ 0 ] = x;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+else if( x >= h[ 4 ] ) {
+h[ 4 ] = x;
+k = 3;
 }
-#endif
+else {
+while( x >= h[ k + 1 ] ) {
+k++;
+}
+}
+for( int i = k + 1; i < 5; i++ ) {
+n[ i ]++;
+}
+e->count++;
 
-// k2
-// put x[t-1] + (1/4) * k1 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c21 * k1[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+double last = e->count - 1;
+double desired[ 5 ] = { 1.0, 1.0 + last * p / 2.0, 1.0 + last * p,
+1.0 + last * ( 1.0 + p ) / 2.0, 1.0 + last };
+for( int i = 1; i <= 3; i++ ) {
+double d = desired[ i ] - n[ i ];
+if( ( d >= 1.0 && n[ i + 1 ] - n[ i ] > 1 )
+|| ( d <= -1.0 && n[ i - 1 ] - n[ i ] < -1 ) ) {
+int s = d > 0.0 ? 1 : -1;
+double hp = h[ i ] + (double) s / ( n[ i + 1 ] - n[ i - 1 ] )
+* ( ( n[ i ] - n[ i - 1 ] + s ) * ( h[ i + 1 ] - h[ i ] ) / ( n[ i + 1 ] - n[ i ] )
++ ( n[ i + 1 ] - n[ i ] - s ) * ( h[ i ] - h[ i - 1 ] ) / ( n[ i ] - n[ i - 1 ] ) );
+if( h[ i - 1 ] < hp && hp < h[ i + 1 ] ) {
+h[ i ] = hp;
 }
+else {
+h[ i ] = h[ i ] + s * ( h[ i + s ] - h[ i ] ) / ( n[ i + s ] - n[ i ] );
+}
+n[ i ] += s;
 }
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c21 * k1_reac[ r ];
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c21 * k1_reac[ r ];
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (1/4) * k1 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k2
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k2[ i ] = vspec[ i ] * h;
+double p2Value( const P2Quantile *e, double p )
+{
+if( e->count >= 5 ) {
+return e->height[ 2 ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+if( e->count == 0 ) {
+return 0.0;
+}
+// fewer than five values, nearest rank
+return e->height[ (int) floor( p * ( e->count - 1 ) + 0.5 ) ];
 }
-#endif
 
-// k3
-// put x[t-1] + (3/32) * k1 + (9/32) * k2 ) into x[t]
+// adds one realization ( the output rows of "grid" ) to the statistics
+void KinSolver::ensembleFold( EnsembleStats *st, double **grid )
+{
+double n = ++st->runs;
+for( int o = 0; o < st->outputs; o++ ) {
+double *x = grid[ st->outputIndex[ o ] ];
+double *mean = st->mean[ o ];
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+int i = outputSpecies[ k ];
+double delta = x[ i ] - mean[ i ];
+mean[ i ] += delta / n;
+st->m2[ o ][ k ] += delta * ( x[ i ] - mean[ i ] );
+P2Quantile *e = st->quant + ( o * numberOfOutputSpecies + k - 1 ) * numberOfQuantiles;
+for( int q = 0; q < numberOfQuantiles; q++ ) {
+p2Add( e + q, quantile[ q + 1 ], x[ i ] );
+}
+}
+// the others only for the mean trajectory
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c31 * k1[ i ]
-+ c32 * k2[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+if( ! outputMask[ i ] ) {
+mean[ i ] += ( x[ i ] - mean[ i ] ) / n;
 }
 }
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c31 * k1_reac[ r ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c31 * k1_reac[ r ]
-+ c32 * k2_reac[ r ];
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (3/32) * k1 + (9/32) * k2 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k3
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k3[ i ] = vspec[ i ] * h;
-}
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+struct EnsembleJob {
+KinSolver       *solver;
+EnsembleStats   *stats;
+int              runs;
+int              next;       // next realization to start
+pthread_mutex_t  lock;
+pthread_cond_t   turn;
+};
+
+void *ensembleWorker( void *arg )
+{
+EnsembleJob *job = (EnsembleJob *) arg;
+job->solver->ensembleWork( job );
+return 0;
 }
-#endif
 
-// k4
-// put x[t-1] + (1932/2197) * k1 - (7200/2197) * k2
-//            + (7296/2197) * k3 ) into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c41 * k1[ i ]
-+ c42 * k2[ i ] + c43 * k3[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+void KinSolver::ensembleWork( EnsembleJob *job )
+{
+EnsembleStats *st = job->stats;
+KinRandom rng;
+
+// only the output rows are kept, the others share one scratch row
+double *scratch = new double[ numberOfSpecies + 1 ];
+double **grid = new double*[ numberOfTimeSteps + 1 ];
+for( int t = 0; t <= numberOfTimeSteps; t++ ) {
+grid[ t ] = scratch;
 }
+for( int o = 0; o < st->outputs; o++ ) {
+grid[ st->outputIndex[ o ] ] = new double[ numberOfSpecies + 1 ];
 }
+
+while( 1 ) {
+pthread_mutex_lock( &job->lock );
+if( ! halted && stopRequested() ) {
+// no new runs, those under way are still folded in
+halted = 1;
+job->next = job->runs;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c41 * k1_reac[ r ]
-+ c42 * k2_reac[ r ] + c43 * k3_reac[ r ];
+int k = job->next++;
+pthread_mutex_unlock( &job->lock );
+if( k >= job->runs ) {
+break;
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (1932/2197) * k1 - (7200/2197) * k2
-//            + (7296/2197) * k3 ) )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k4
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k4[ i ] = vspec[ i ] * h;
+seedStream( &rng, ssaSeed, k );
+if( integrationOption == 8 ) {
+tauLeaping( &rng, grid, initialConcentration );
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+else {
+compositionRejectionSSA( &rng, grid, initialConcentration );
 }
-#endif
 
-// k5
-// put x[t-1] + (439/216) * k1 - 8 * k2
-//            + (3680/513) * k3 - (845/4104) * k4 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c51 * k1[ i ]
-+ c52 * k2[ i ] + c53 * k3[ i ]
-+ c54 * k4[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
-}
+// fold in realization order
+pthread_mutex_lock( &job->lock );
+while( st->runs != k ) {
+pthread_cond_wait( &job->turn, &job->lock );
 }
+ensembleFold( st, grid );
+progress( (double) st->runs / job->runs );
+pthread_cond_broadcast( &job->turn );
+pthread_mutex_unlock( &job->lock );
 }
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c51 * k1_reac[ r ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c51 * k1_reac[ r ]
-+ c52 * k2_reac[ r ] + c53 * k3_reac[ r ]
-+ c54 * k4_reac[ r ];
+for( int o = 0; o < st->outputs; o++ ) {
+delete [] grid[ st->outputIndex[ o ] ];
+}
+delete [] grid;
+delete [] scratch;
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (439/216) * k1 - 8 * k2
-//            + (3680/513) * k3 - (845/4104) * k4 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k5
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k5[ i ] = vspec[ i ] * h;
+/*************************************************************
+*   r u n E n s e m b l e
+*************************************************************
+* integrates the whole time range as one piece ( also with
+* external control ) ensembleRuns times, leaves the statistics
+* in "ensemble" and the mean on the output rows of xspec, so
+* outputDataFile1() lists the mean trajectory
+*/
+void KinSolver::runEnsemble()
+{
+initialTime = true_initialTime;
+finalTime = true_finalTime;
+numberOfTimeSteps = true_numberOfTimeSteps;
+dtime = ( finalTime - initialTime ) / numberOfTimeSteps;
+
+freeEnsemble();
+EnsembleStats *st = new EnsembleStats;
+st->runs = 0;
+st->outputs = 0;
+st->outputIndex = new int[ numberOfTimeSteps + 1 ];
+int mtime = -1;
+for( int t = 0; t <= numberOfTimeSteps; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
+}
+if( mtime == 0 || t == numberOfTimeSteps ) {
+st->outputIndex[ st->outputs++ ] = t;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k5_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
 }
-#endif
-
-// k6
-// put x[t-1] - (8/27) * k1 + 2 * k2 - (3544/2565) * k3
-//            + (1859/4104) * k4 - (11/40) * k5 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c61 * k1[ i ]
-+ c62 * k2[ i ] + c63 * k3[ i ]
-+ c64 * k4[ i ] + c65 * k5[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+st->mean = new double*[ st->outputs ];
+st->m2 = new double*[ st->outputs ];
+for( int o = 0; o < st->outputs; o++ ) {
+st->mean[ o ] = new double[ numberOfSpecies + 1 ];
+st->m2[ o ] = new double[ numberOfOutputSpecies + 1 ];
+for( int i = 0; i <= numberOfSpecies; i++ ) {
+st->mean[ o ][ i ] = 0.0;
 }
+for( int k = 0; k <= numberOfOutputSpecies; k++ ) {
+st->m2[ o ][ k ] = 0.0;
 }
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c61 * k1_reac[ r ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c61 * k1_reac[ r ]
-+ c62 * k2_reac[ r ] + c63 * k3_reac[ r ]
-+ c64 * k4_reac[ r ] + c65 * k5_reac[ r ];
+int nq = st->outputs * numberOfOutputSpecies * numberOfQuantiles;
+st->quant = new P2Quantile[ nq ];
+for( int q = 0; q < nq; q++ ) {
+st->quant[ q ].count = 0;
 }
-#endif
+ensemble = st;
 
-// evaluate f( t-1, xpec[ t-1 ] - (8/27) * k1 + 2 * k2
-//                              - (3544/2565) * k3 + (1859/4104) * k4
-//                              - (11/40) * k5 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k6
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k6[ i ] = vspec[ i ] * h;
+int threads = ensembleThreads;
+if( threads <= 0 ) {
+threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k6_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+if( threads > ensembleRuns ) {
+threads = ensembleRuns;
 }
-#endif
-
-// put x[t-1] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
-//            - (9/50) * k5 + (2/55)  into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + b1 * k1[ i ]
-+ b3 * k3[ i ] + b4 * k4[ i ]
-+ b5 * k5[ i ] + b6 * k6[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+if( threads < 1 ) {
+threads = 1;
 }
+
+EnsembleJob job;
+job.solver = this;
+job.stats = st;
+job.runs = ensembleRuns;
+job.next = 0;
+pthread_mutex_init( &job.lock, 0 );
+pthread_cond_init( &job.turn, 0 );
+
+pthread_t *pool = new pthread_t[ threads ];
+for( int k = 0; k < threads; k++ ) {
+if( pthread_create( &pool[ k ], 0, ensembleWorker, &job ) != 0 ) {
+cerr << "ERROR: Unable to start ensemble thread " << k << endl;
+threads = k;
+break;
 }
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ]
-+ b1 * k1_reac[ r ]
-+ b3 * k3_reac[ r ] + b4 * k4_reac[ r ]
-+ b5 * k5_reac[ r ] + b6 * k6_reac[ r ];
+if( threads == 0 ) {
+ensembleWorker( &job );
 }
-#endif
+for( int k = 0; k < threads; k++ ) {
+pthread_join( pool[ k ], 0 );
 }
+delete [] pool;
+pthread_mutex_destroy( &job.lock );
+pthread_cond_destroy( &job.turn );
 
-} // end method: rungeKutta45
-
+for( int o = 0; o < st->outputs; o++ ) {
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+xspec[ st->outputIndex[ o ] ][ i ] = st->mean[ o ][ i ];
+}
+}
+}
 
+void KinSolver::freeEnsemble()
+{
+if( ensemble == 0 ) {
+return;
+}
+for( int o = 0; o < ensemble->outputs; o++ ) {
+delete [] ensemble->mean[ o ];
+delete [] ensemble->m2[ o ];
+}
+delete [] ensemble->mean;
+delete [] ensemble->m2;
+delete [] ensemble->quant;
+delete [] ensemble->outputIndex;
+delete ensemble;
+ensemble = 0;
+}
 
 /*************************************************************
-*   r u n g e K u t t a A d a p t i v e 
+*   f i n i t e   s t a t e   p r o j e c t i o n
 *************************************************************
-* Adaptive Runge-Kutta Fehlberg Method
-* Added Feb 07, 2001
-* by Aleman-Meza, Boanerges
-* x[t+h] = x[t] + (25/216) * k1 + (1408/2565) * k3 + (2197/4104) * k4 
-*               - (1/5) * k5
-* where:
-* k1 = h * f( t,               x[t] )
-* k2 = h * f( t + (1/2) * h,   x[t] + (1/4) * k1 )
-* k3 = h * f( t + (3/8) * h,   x[t] + (3/32) * k1 + (9/32) * k2 )
-* k4 = h * f( t + (12/13) * h, x[t] + (1932/2197) * k1 - (7200/2197) * k2
-*                                   + (7296/2197) * k3 )
-* k5 = h * f( t + h,           x[t] + (439/216) * k1 - 8 * k2 
-*                                   + (3680/513) * k3 - (845/4104) * k4 )
-* k6 = h * f( t,               x[t] - (8/27) * k1 + 2 * k2 
-*                                   - (3544/2565) * k3 + (1859/4104) * k4 
-*                                   - (11/40) * k5 )
+* jtime=9: the chemical master equation dp/dt = A p is solved on
+* the states reachable from the initial counts inside a box of
+* per species bounds ( Munsky, Khammash 2006 ). Probability that
+* leaves the box is lost, when more than "fsptolerance" is lost
+* the box is enlarged where the probability hits it and the time
+* step is redone. p is moved with a Krylov approximation of
+* exp( dtime A ) p ( Sidje, Expokit ). xspec holds the mean counts
+* and kin.o04 the distribution of every species at the final time.
+* The state space and p are kept over the external control pieces.
 */
-void rungeKuttaAdaptive()
+int isFspMethod( int option )
 {
-double vspec[ MAX_NUMBER_SPECIES ] = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
-
-double k1[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k2[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k3[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k4[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k5[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-double k6[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-
-#ifndef OPTIMIZE
-double k1_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k2_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k3_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k4_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k5_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-double k6_reac[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-#endif
+return option == 9;
+}
 
-int iterations = 0;
+unsigned int fspHash( const int state[], int n )
+{
+unsigned int h = 2166136261u;
+for( int k = 0; k < n; k++ ) {
+h = ( h ^ (unsigned int) state[ k ] ) * 16777619u;
+}
+return h;
+}
 
-double epsilon_max = 1e-6;  //<- these 2 work with accuracy 1e-6
-double epsilon_min = 1e-13;
+// index of "state" in the space, -1 when it is not there
+int fspFind( const FspSpace *sp, const int state[] )
+{
+int n = sp->species;
+int h = fspHash( state, n ) & ( sp->hashSize - 1 );
+for( int k = sp->hashHead[ h ]; k >= 0; k = sp->hashNext[ k ] ) {
+const int *other = sp->count + (long) k * n;
+int j = 0;
+while( j < n && other[ j ] == state[ j ] ) {
+j++;
+}
+if( j == n ) {
+return k;
+}
+}
+return -1;
+}
 
+void fspRehash( FspSpace *sp )
+{
+for( int h = 0; h < sp->hashSize; h++ ) {
+sp->hashHead[ h ] = -1;
+}
+for( int k = 0; k < sp->states; k++ ) {
+int h = fspHash( sp->count + (long) k * sp->species, sp->species ) & ( sp->hashSize - 1 );
+sp->hashNext[ k ] = sp->hashHead[ h ];
+sp->hashHead[ h ] = k;
+}
+}
 
-double h_max = 1.0 / 4;   //dtime * 10.0;
-double h_min = 0.001;
+// appends "state", returns its index or -1 when the space is full
+int KinSolver::fspAdd( FspSpace *sp, const int state[] )
+{
+int n = sp->species;
+if( sp->states == fspMaxStates ) {
+return -1;
+}
+if( sp->states == sp->capacity ) {
+int capacity = 2 * sp->capacity;
+if( capacity > fspMaxStates ) {
+capacity = fspMaxStates;
+}
+int *count = new int[ (long) capacity * n + 1 ];
+double *p = new double[ capacity ];
+for( long k = 0; k < (long) sp->states * n; k++ ) {
+count[ k ] = sp->count[ k ];
+}
+for( int k = 0; k < sp->states; k++ ) {
+p[ k ] = sp->p[ k ];
+}
+delete [] sp->count;
+delete [] sp->p;
+delete [] sp->hashNext;
+sp->count = count;
+sp->p = p;
+sp->hashNext = new int[ capacity ];
+sp->capacity = capacity;
+if( capacity > sp->hashSize ) {
+delete [] sp->hashHead;
+while( sp->hashSize < capacity ) {
+sp->hashSize *= 2;
+}
+sp->hashHead = new int[ sp->hashSize ];
+}
+fspRehash( sp );
+}
+int k = sp->states++;
+for( int j = 0; j < n; j++ ) {
+sp->count[ (long) k * n + j ] = state[ j ];
+}
+sp->p[ k ] = 0.0;
+int h = fspHash( state, n ) & ( sp->hashSize - 1 );
+sp->hashNext[ k ] = sp->hashHead[ h ];
+sp->hashHead[ h ] = k;
+return k;
+}
+
+// species counts of state k in the kin numbering, fixed species from x
+void KinSolver::fspState( const FspSpace *sp, int k, double x[] )
+{
+for( int j = 0; j < sp->species; j++ ) {
+x[ sp->speciesIndex[ j ] ] = sp->count[ (long) k * sp->species + j ];
+}
+}
 
-//change h 
-//double h = h_max; //( finalTime - initialTime ) * 1.0 / 1000.0;
-double h = h_min;
+/*
+* target of channel c from state k, returns 0 when the channel
+* leaves the box ( sets the bound flag of the species ) or
+* would make a count negative
+*/
+int KinSolver::fspTarget( FspSpace *sp, int k, int c, int target[] )
+{
+int n = sp->species;
+for( int j = 0; j < n; j++ ) {
+target[ j ] = sp->count[ (long) k * n + j ];
+}
+for( int q = ssaNet->changeStart[ c ]; q < ssaNet->changeStart[ c + 1 ]; q++ ) {
+int j = sp->freeIndex[ ssaNet->changeSpecies[ q ] ];
+target[ j ] += ssaNet->changeDelta[ q ];
+if( target[ j ] < 0 ) {
+return 0;
+}
+if( target[ j ] > sp->bound[ j ] ) {
+sp->hit[ j ] = 1;
+return 0;
+}
+}
+return 1;
+}
 
-double diff = 0.0;
-double x4 = 0.0;
-double x4_reac = 0.0;
-double epsilon = 0.0;
+/*
+* breadth first search from all states in the space, x holds the
+* fixed species, a channel only counts when its propensity is > 0
+*/
+void KinSolver::fspExpand( FspSpace *sp, double x[] )
+{
+int *target = new int[ sp->species + 1 ];
+for( int j = 0; j < sp->species; j++ ) {
+sp->hit[ j ] = 0;
+}
+for( int k = 0; k < sp->states; k++ ) {
+fspState( sp, k, x );
+for( int c = 1; c <= ssaNet->channels; c++ ) {
+if( ssaPropensity( ssaNet, c, x ) <= 0.0 ) {
+continue;
+}
+if( fspTarget( sp, k, c, target ) && fspFind( sp, target ) < 0 ) {
+if( fspAdd( sp, target ) < 0 ) {
+delete [] target;
+return;
+}
+}
+}
+}
+delete [] target;
+}
 
-// initialy xpec[][ 0 ] holds the i.c.
+/*
+* generator A, stored by rows ( target state ), the diagonal
+* holds the total outflow including the flow out of the box
+*/
+void KinSolver::fspGenerator( FspSpace *sp, double x[] )
+{
+int n = sp->states;
+int *target = new int[ sp->species + 1 ];
+int *to = new int[ n + 1 ];
+int entries = n;
+
+delete [] sp->rowStart;
+delete [] sp->column;
+delete [] sp->value;
+
+// count, then fill
+sp->rowStart = new int[ n + 2 ];
+for( int k = 0; k <= n + 1; k++ ) {
+sp->rowStart[ k ] = 0;
+}
+for( int pass = 0; pass < 2; pass++ ) {
+if( pass == 1 ) {
+for( int k = 1; k <= n + 1; k++ ) {
+sp->rowStart[ k ] += sp->rowStart[ k - 1 ];
+}
+entries = sp->rowStart[ n ];
+sp->column = new int[ entries + 1 ];
+sp->value = new double[ entries + 1 ];
+for( int k = 0; k < n; k++ ) {
+to[ k ] = sp->rowStart[ k ];
+sp->column[ to[ k ] ] = k;
+sp->value[ to[ k ] ] = 0.0;
+to[ k ]++;
+}
+}
+else {
+for( int k = 0; k < n; k++ ) {
+sp->rowStart[ k + 1 ] = 1;
+}
+}
+for( int k = 0; k < n; k++ ) {
+fspState( sp, k, x );
+for( int c = 1; c <= ssaNet->channels; c++ ) {
+double a = ssaPropensity( ssaNet, c, x );
+if( a <= 0.0 ) {
+continue;
+}
+int j = fspTarget( sp, k, c, target ) ? fspFind( sp, target ) : -1;
+if( j == k ) {
+continue;
+}
+if( pass == 0 ) {
+if( j >= 0 ) {
+sp->rowStart[ j + 1 ]++;
+}
+continue;
+}
+sp->value[ sp->rowStart[ k ] ] -= a;
+if( j >= 0 ) {
+sp->column[ to[ j ] ] = k;
+sp->value[ to[ j ] ] = a;
+to[ j ]++;
+}
+}
+}
+}
 
-int exit_loop = 0;
-int t_index = 0;
-double time = initialTime;
-double time_save = 0.0;
+sp->norm = 0.0;
+for( int k = 0; k < n; k++ ) {
+double sum = 0.0;
+for( int q = sp->rowStart[ k ]; q < sp->rowStart[ k + 1 ]; q++ ) {
+sum += myabs( sp->value[ q ] );
+}
+if( sum > sp->norm ) {
+sp->norm = sum;
+}
+}
 
-xtime_index = 0;
-xtime[ t_index ] = time;
+delete [] to;
+delete [] target;
+}
 
-while( ( t_index <= numberOfTimeSteps ) && ( exit_loop < 2 ) ) {
+void fspMultiply( const FspSpace *sp, const double v[], double w[] )
+{
+for( int k = 0; k < sp->states; k++ ) {
+double sum = 0.0;
+for( int q = sp->rowStart[ k ]; q < sp->rowStart[ k + 1 ]; q++ ) {
+sum += sp->value[ q ] * v[ sp->column[ q ] ];
+}
+w[ k ] = sum;
+}
+}
 
-/*        
-if( h < h_min ) {
-h = h_min;
+/*
+* f = exp( h ), h and f are n x n with 1 based rows and columns,
+* diagonal Pade (6,6) approximation with scaling and squaring
+*/
+void fspDenseExp( double **h, double **f, int n )
+{
+const int PADE = 6;
+double norm = 0.0;
+for( int i = 1; i <= n; i++ ) {
+double sum = 0.0;
+for( int j = 1; j <= n; j++ ) {
+sum += myabs( h[ i ][ j ] );
 }
-if( h > h_max ) {
-h = h_max;
+if( sum > norm ) {
+norm = sum;
 }
-*/  
+}
+int squarings = 0;
+if( norm > 0.5 ) {
+squarings = (int) ( log( norm ) / log( 2.0 ) ) + 2;
+}
+double scale = ldexp( 1.0, -squarings );
 
-diff = myabs( finalTime - time );
-if( diff <= myabs( h ) ) {
-if( diff < ( 0.5e-5 * finalTime ) ) {
-break;
+double **x = new double*[ n + 1 ];
+double **power = new double*[ n + 1 ];
+double **num = new double*[ n + 1 ];
+double **den = new double*[ n + 1 ];
+for( int i = 1; i <= n; i++ ) {
+x[ i ] = new double[ n + 1 ];
+power[ i ] = new double[ n + 1 ];
+num[ i ] = new double[ n + 1 ];
+den[ i ] = new double[ n + 1 ];
+for( int j = 1; j <= n; j++ ) {
+x[ i ][ j ] = h[ i ][ j ] * scale;
+power[ i ][ j ] = i == j ? 1.0 : 0.0;
+num[ i ][ j ] = power[ i ][ j ];
+den[ i ][ j ] = power[ i ][ j ];
 }
-h = diff;
-exit_loop++;
-}      
+}
+double *row = new double[ n + 1 ];
+double *b = new double[ n + 1 ];
+double *col = new double[ n + 1 ];
+int *d = new int[ n + 1 ];
 
-t_index++;
-iterations++;
-time_save = time;
-time = time + h;
+double c = 1.0;
+for( int k = 1; k <= PADE; k++ ) {
+c = c * ( PADE - k + 1 ) / ( k * ( 2 * PADE - k + 1 ) );
+for( int i = 1; i <= n; i++ ) {
+for( int j = 1; j <= n; j++ ) {
+double sum = 0.0;
+for( int l = 1; l <= n; l++ ) {
+sum += power[ i ][ l ] * x[ l ][ j ];
+}
+row[ j ] = sum;
+}
+for( int j = 1; j <= n; j++ ) {
+power[ i ][ j ] = row[ j ];
+num[ i ][ j ] += c * row[ j ];
+den[ i ][ j ] += ( k % 2 == 0 ? c : -c ) * row[ j ];
+}
+}
+}
 
-// k1 
-// evaluate f( t-1, xpec[ t-1 ] )
-xrate( vspec, vfor, vbak, t_index );
-// put h * f(...) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k1[ i ] = vspec[ i ] * h;
+// f = den^-1 num, column by column
+gauss( den, d, n );
+for( int j = 1; j <= n; j++ ) {
+for( int i = 1; i <= n; i++ ) {
+b[ i ] = num[ i ][ j ];
+}
+gauss_solve( den, d, b, col, n );
+for( int i = 1; i <= n; i++ ) {
+f[ i ][ j ] = col[ i ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k1_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
 }
-#endif
 
-// k2 
-// put x[t-1] + (1/4) * k1 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c21 * k1[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+for( int s = 0; s < squarings; s++ ) {
+for( int i = 1; i <= n; i++ ) {
+for( int j = 1; j <= n; j++ ) {
+double sum = 0.0;
+for( int l = 1; l <= n; l++ ) {
+sum += f[ i ][ l ] * f[ l ][ j ];
 }
+x[ i ][ j ] = sum;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] +  c21 * k1_reac[ r ];
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] +  c21 * k1_reac[ r ];
+for( int i = 1; i <= n; i++ ) {
+for( int j = 1; j <= n; j++ ) {
+f[ i ][ j ] = x[ i ][ j ];
 }
-#endif
-
-// evaluate f( t-1, xpec[ t-1 ] + (1/4) * k1 ) 
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k2
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k2[ i ] = vspec[ i ] * h;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k2_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
 }
-#endif
 
-// k3 
-// put x[t-1] + (3/32) * k1 + (9/32) * k2 ) into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c31 * k1[ i ]
-+ c32 * k2[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
-}
+for( int i = 1; i <= n; i++ ) {
+delete [] x[ i ];
+delete [] power[ i ];
+delete [] num[ i ];
+delete [] den[ i ];
+}
+delete [] x;
+delete [] power;
+delete [] num;
+delete [] den;
+delete [] row;
+delete [] b;
+delete [] col;
+delete [] d;
+}
+
+// rounds the step to two significant digits as Expokit does
+double fspRoundStep( double tau )
+{
+double e = pow( 10.0, floor( log10( tau ) ) - 1.0 );
+return ceil( tau / e ) * e;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
 
+/*
+* p = exp( span A ) p by Krylov subspaces of dimension FSP_KRYLOV
+* with local error control ( expv of Expokit )
+*/
+void fspExpv( FspSpace *sp, double span )
+{
+const double tol = FSP_KRYLOV_TOLERANCE;
+const double gamma = 0.9;
+const double delta = 1.2;
+int n = sp->states;
+int m = FSP_KRYLOV < n ? FSP_KRYLOV : n;
+double anorm = sp->norm > 0.0 ? sp->norm : 1.0;
+double xm = 1.0 / m;
+
+double **v = new double*[ m + 2 ];
+for( int j = 0; j <= m + 1; j++ ) {
+v[ j ] = new double[ n ];
+}
+double **h = new double*[ m + 3 ];
+double **f = new double*[ m + 3 ];
+for( int i = 0; i <= m + 2; i++ ) {
+h[ i ] = new double[ m + 3 ];
+f[ i ] = new double[ m + 3 ];
+}
+
+double now = 0.0;
+double tau = sp->step;
+if( tau <= 0.0 ) {
+double beta = 0.0;
+for( int k = 0; k < n; k++ ) {
+beta += sp->p[ k ] * sp->p[ k ];
+}
+beta = sqrt( beta );
+double fact = pow( ( m + 1 ) / exp( 1.0 ), m + 1 ) * sqrt( 2.0 * 3.14159265358979 * ( m + 1 ) );
+tau = ( 1.0 / anorm ) * pow( ( fact * tol ) / ( 4.0 * beta * anorm ), xm );
+tau = fspRoundStep( tau );
+}
+
+while( span - now > 1.0e-12 * span ) {
+double beta = 0.0;
+for( int k = 0; k < n; k++ ) {
+beta += sp->p[ k ] * sp->p[ k ];
+}
+beta = sqrt( beta );
+if( beta == 0.0 ) {
+break;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] 
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] 
-+ c31 * k1_reac[ r ] + c32 * k2_reac[ r ];
+if( tau > span - now ) {
+tau = span - now;
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (3/32) * k1 + (9/32) * k2 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k3
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k3[ i ] = vspec[ i ] * h;
+// Arnoldi
+for( int i = 0; i <= m + 2; i++ ) {
+for( int j = 0; j <= m + 2; j++ ) {
+h[ i ][ j ] = 0.0;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k3_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
 }
-#endif
-
-// k4
-// put x[t-1] + (1932/2197) * k1 - (7200/2197) * k2
-//            + (7296/2197) * k3 ) into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c41 * k1[ i ]
-+ c42 * k2[ i ] + c43 * k3[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+for( int k = 0; k < n; k++ ) {
+v[ 0 ][ k ] = sp->p[ k ] / beta;
 }
+int mb = m;
+int k1 = 2;
+double avnorm = 0.0;
+for( int j = 0; j < m; j++ ) {
+fspMultiply( sp, v[ j ], v[ j + 1 ] );
+for( int i = 0; i <= j; i++ ) {
+double dot = 0.0;
+for( int k = 0; k < n; k++ ) {
+dot += v[ i ][ k ] * v[ j + 1 ][ k ];
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
+h[ i + 1 ][ j + 1 ] = dot;
+for( int k = 0; k < n; k++ ) {
+v[ j + 1 ][ k ] -= dot * v[ i ][ k ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c41 * k1_reac[ r ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c41 * k1_reac[ r ]
-+ c42 * k2_reac[ r ] + c43 * k3_reac[ r ];
 }
-#endif
+double s = 0.0;
+for( int k = 0; k < n; k++ ) {
+s += v[ j + 1 ][ k ] * v[ j + 1 ][ k ];
+}
+s = sqrt( s );
+if( s < FSP_BREAKDOWN ) {
+// invariant subspace, the step is exact
+k1 = 0;
+mb = j + 1;
+tau = span - now;
+break;
+}
+h[ j + 2 ][ j + 1 ] = s;
+for( int k = 0; k < n; k++ ) {
+v[ j + 1 ][ k ] /= s;
+}
+}
+if( k1 != 0 ) {
+h[ m + 2 ][ m + 1 ] = 1.0;
+fspMultiply( sp, v[ m ], v[ m + 1 ] );
+for( int k = 0; k < n; k++ ) {
+avnorm += v[ m + 1 ][ k ] * v[ m + 1 ][ k ];
+}
+avnorm = sqrt( avnorm );
+}
 
-// evaluate f( t-1, xpec[ t-1 ] + (1932/2197) * k1 - (7200/2197) * k2
-//            + (7296/2197) * k3 ) )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k4
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k4[ i ] = vspec[ i ] * h;
+// small exponential, the step is shortened until the error is met
+double error = 0.0;
+int mx = mb + k1;
+for( int reject = 0; ; reject++ ) {
+double **th = new double*[ mx + 1 ];
+for( int i = 1; i <= mx; i++ ) {
+th[ i ] = new double[ mx + 1 ];
+for( int j = 1; j <= mx; j++ ) {
+th[ i ][ j ] = tau * h[ i ][ j ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k4_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
 }
-#endif
+fspDenseExp( th, f, mx );
+for( int i = 1; i <= mx; i++ ) {
+delete [] th[ i ];
+}
+delete [] th;
 
-// k5
-// put x[t-1] + (439/216) * k1 - 8 * k2
-//            + (3680/513) * k3 - (845/4104) * k4 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c51 * k1[ i ]
-+ c52 * k2[ i ] + c53 * k3[ i ] + c54 * k4[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+if( k1 == 0 ) {
+error = FSP_BREAKDOWN;
+break;
 }
+double phi1 = myabs( beta * f[ m + 1 ][ 1 ] );
+double phi2 = myabs( beta * f[ m + 2 ][ 1 ] * avnorm );
+if( phi1 > 10.0 * phi2 ) {
+error = phi2;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
+else if( phi1 > phi2 ) {
+error = ( phi1 * phi2 ) / ( phi1 - phi2 );
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] 
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] 
-+ c51 * k1_reac[ r ] + c52 * k2_reac[ r ] 
-+ c53 * k3_reac[ r ] + c54 * k4_reac[ r ];
+else {
+error = phi1;
+}
+if( error <= delta * tau * tol || reject >= FSP_REJECTIONS ) {
+break;
+}
+tau = fspRoundStep( gamma * tau * pow( tau * tol / error, xm ) );
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] + (439/216) * k1 - 8 * k2
-//            + (3680/513) * k3 - (845/4104) * k4 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k5
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k5[ i ] = vspec[ i ] * h;
+mx = mb + ( k1 > 0 ? k1 - 1 : 0 );
+for( int k = 0; k < n; k++ ) {
+double sum = 0.0;
+for( int j = 0; j < mx; j++ ) {
+sum += v[ j ][ k ] * f[ j + 1 ][ 1 ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k5_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+sp->p[ k ] = beta * sum;
 }
-#endif
+now += tau;
 
-// k6
-// put x[t-1] - (8/27) * k1 + 2 * k2 - (3544/2565) * k3
-//            + (1859/4104) * k4 - (11/40) * k5 into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + c61 * k1[ i ]
-+ c62 * k2[ i ] + c63 * k3[ i ]
-+ c64 * k4[ i ] + c65 * k5[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+if( error > 0.0 ) {
+tau = fspRoundStep( gamma * tau * pow( tau * tol / error, xm ) );
 }
+if( k1 != 0 ) {
+sp->step = tau;
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + c61 * k1_reac[ r ]
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + c61 * k1_reac[ r ]
-+ c62 * k2_reac[ r ] + c63 * k3_reac[ r ]
-+ c64 * k4_reac[ r ] + c65 * k5_reac[ r ];
+
+for( int j = 0; j <= m + 1; j++ ) {
+delete [] v[ j ];
+}
+for( int i = 0; i <= m + 2; i++ ) {
+delete [] h[ i ];
+delete [] f[ i ];
+}
+delete [] v;
+delete [] h;
+delete [] f;
 }
-#endif
 
-// evaluate f( t-1, xpec[ t-1 ] - (8/27) * k1 + 2 * k2 
-//                              - (3544/2565) * k3 + (1859/4104) * k4 
-//                              - (11/40) * k5 )
-xrate( vspec, vfor, vbak, t_index + 1 );
-// put h * f( ... ) into k6
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-k6[ i ] = vspec[ i ] * h;
+double fspRetained( const FspSpace *sp )
+{
+double sum = 0.0;
+for( int k = 0; k < sp->states; k++ ) {
+sum += sp->p[ k ];
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-k6_reac[ r ] = ( vfor[ r ] - vbak[ r ] ) * h;
+return sum;
 }
-#endif
 
-// put x[t-1] + (16/135) * k1 + (6656/12825) * k3 + (28561/56430) * k4
-//            - (9/50) * k5 + (2/55)  into x[t]
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-xspec[ t_index ][ i ] = xspec[ t_index - 1 ][ i ] + b1 * k1[ i ] 
-+ b3 * k3[ i ] + b4 * k4[ i ] 
-+ b5 * k5[ i ] + b6 * k6[ i ];
-x4 = xspec[ t_index - 1 ][ i ] + a1 * k1[ i ]
-+ a3 * k3[ i ] + a4 * k4[ i ] + a5 * k5[ i ];
-if( xspec[ t_index ][ i ] < 0.0 ) {
-xspec[ t_index ][ i ] = 0.0;
+/*
+* enlarges the bounds of the species whose bound carries more of p
+* than the others, all bounds that were hit when none stands out,
+* returns 0 when no bound was hit
+*/
+int KinSolver::fspEnlarge( FspSpace *sp )
+{
+int n = sp->species;
+double *edge = new double[ n + 1 ];
+for( int j = 0; j < n; j++ ) {
+edge[ j ] = 0.0;
 }
-xtime[ t_index ] = time;
-if( x4 < 0.0 ) {
-x4 = 0.0;
+for( int k = 0; k < sp->states; k++ ) {
+for( int j = 0; j < n; j++ ) {
+if( sp->count[ (long) k * n + j ] == sp->bound[ j ] ) {
+edge[ j ] += sp->p[ k ];
 }
-diff = myabs( xspec[ t_index ][ i ] - x4 );
-if( diff > epsilon_min ) {
-epsilon = diff;
-if( epsilon > epsilon_max ) {
-break;
 }
 }
-else {
-epsilon = diff;
+int grown = 0;
+for( int j = 0; j < n; j++ ) {
+if( sp->hit[ j ] && edge[ j ] > fspTolerance / n ) {
+sp->bound[ j ] += sp->bound[ j ] / 2 + FSP_MIN_BOUND;
+grown = 1;
 }
 }
-else if( jfix[ i ] == 10){
-// trapezoidal polygon pulse
-xspec[t_index][i] = con_jfix_10(i, time); 
-}//endof if jfix=10
-else if( jfix[ i ] == 20){
-// rectangle pulse
-xspec[t_index][i] = con_jfix_20(i, time);
-}//endof if jfix = 20
-
+for( int j = 0; j < n && ! grown; j++ ) {
+if( sp->hit[ j ] ) {
+sp->bound[ j ] += sp->bound[ j ] / 2 + FSP_MIN_BOUND;
+grown = 2;
 }
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ t_index ] = xreac[ r ][ t_index - 1 ] + b1 * k1_reac[ r ] 
-xreac[ t_index ][ r ] = xreac[ t_index - 1 ][ r ] + b1 * k1_reac[ r ] 
-+ b3 * k3_reac[ r ] + b4 * k4_reac[ r ] 
-+ b5 * k5_reac[ r ] + b6 * k6_reac[ r ];
-//x4_reac = xreac[ r ][ t_index - 1 ] + a1 * k1_reac[ r ]
-x4_reac = xreac[ t_index - 1 ][ r ] + a1 * k1_reac[ r ]
-+ a3 * k3_reac[ r ] + a4 * k4_reac[ r ] + a5 * k5_reac[ r ];
-//diff = myabs( xreac[ r ][ t_index ] - x4_reac );
-diff = myabs( xreac[ t_index ][ r ] - x4_reac );
-if( diff > epsilon_min && diff > epsilon_max ) {
-epsilon = diff;
-break;
 }
+delete [] edge;
+return grown;
 }
-#endif
 
-if( epsilon < epsilon_min ) {
-h = 2.0 * h;
+/*************************************************************
+*   s e t f s p
+*************************************************************
+* the projection starts as the initial state with probability 1
+* inside a box of twice the initial counts ( at least FSP_MIN_BOUND )
+*/
+void KinSolver::setfsp()
+{
+freefsp();
+
+FspSpace *sp = new FspSpace;
+int n = 0;
+sp->freeIndex = new int[ numberOfSpecies + 1 ];
+sp->speciesIndex = new int[ numberOfSpecies + 1 ];
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+sp->freeIndex[ i ] = -1;
+if( jfix[ i ] == 0 ) {
+sp->freeIndex[ i ] = n;
+sp->speciesIndex[ n++ ] = i;
+}
+}
+sp->species = n;
+sp->bound = new int[ n + 1 ];
+sp->hit = new int[ n + 1 ];
+sp->capacity = 1024 < fspMaxStates ? 1024 : fspMaxStates;
+sp->states = 0;
+sp->count = new int[ (long) sp->capacity * n + 1 ];
+sp->p = new double[ sp->capacity ];
+sp->hashSize = 1;
+while( sp->hashSize < sp->capacity ) {
+sp->hashSize *= 2;
+}
+sp->hashHead = new int[ sp->hashSize ];
+sp->hashNext = new int[ sp->capacity ];
+sp->rowStart = 0;
+sp->column = 0;
+sp->value = 0;
+sp->norm = 0.0;
+sp->step = 0.0;
+sp->warned = 0;
+
+int *state = new int[ n + 1 ];
+for( int j = 0; j < n; j++ ) {
+double x0 = initialConcentration[ sp->speciesIndex[ j ] ];
+state[ j ] = x0 > 0.0 ? (int) floor( x0 + 0.5 ) : 0;
+sp->bound[ j ] = 2 * state[ j ] > state[ j ] + FSP_MIN_BOUND ? 2 * state[ j ] : state[ j ] + FSP_MIN_BOUND;
+sp->hit[ j ] = 0;
+}
+fspRehash( sp );
+fspAdd( sp, state );
+sp->p[ 0 ] = 1.0;
+delete [] state;
+
+fsp = sp;
+}
+
+void KinSolver::freefsp()
+{
+if( fsp == 0 ) {
+return;
 }
-if( epsilon > epsilon_max ) {
-h = h / 2.0;
-time = time_save;
-t_index = t_index - 1;
+delete [] fsp->freeIndex;
+delete [] fsp->speciesIndex;
+delete [] fsp->bound;
+delete [] fsp->hit;
+delete [] fsp->count;
+delete [] fsp->p;
+delete [] fsp->hashHead;
+delete [] fsp->hashNext;
+delete [] fsp->rowStart;
+delete [] fsp->column;
+delete [] fsp->value;
+delete fsp;
+fsp = 0;
+}
+
+// mean counts of the free species, conditional on staying in the box
+void KinSolver::fspRecord( const FspSpace *sp, double **grid, double x[], int t )
+{
+double total = fspRetained( sp );
+for( int j = 0; j < sp->species; j++ ) {
+double sum = 0.0;
+for( int k = 0; k < sp->states; k++ ) {
+sum += sp->p[ k ] * sp->count[ (long) k * sp->species + j ];
 }
-
-// avoid to stay forever
-if( iterations > ( numberOfTimeSteps * 2 ) ) {
-break;
+x[ sp->speciesIndex[ j ] ] = total > 0.0 ? sum / total : 0.0;
+}
+ssaRecord( grid, x, t );
 }
 
-} 
-
-// cerr << "iterations = " << iterations << endl;
-// cerr << "timesteps = " << t_index << endl;
-xtime_index = t_index;
+/*************************************************************
+*   f i n i t e S t a t e P r o j e c t i o n
+*************************************************************
+* moves the distribution over the current time piece, the fixed
+* species are set at the grid points as in the SSA
+*/
+void KinSolver::finiteStateProjection()
+{
+FspSpace *sp = fsp;
+double *x = new double[ numberOfSpecies + 1 ];
+double *p0 = 0;
 
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-xspec[ numberOfTimeSteps ][ i ] = xspec[ t_index ][ i ];
+x[ i ] = xspec[ 0 ][ i ];
+}
+ssaClamp( x, 0.0 );
+fspExpand( sp, x );
+fspGenerator( sp, x );
+fspRecord( sp, xspec, x, 0 );
+
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+int saved = sp->states;
+delete [] p0;
+p0 = new double[ saved ];
+for( int k = 0; k < saved; k++ ) {
+p0[ k ] = sp->p[ k ];
+}
+
+while( 1 ) {
+fspExpv( sp, dtime );
+double lost = 1.0 - fspRetained( sp );
+if( lost <= fspTolerance || sp->states >= fspMaxStates || ! fspEnlarge( sp ) ) {
+if( lost > fspTolerance && ! sp->warned ) {
+cerr << "WARNING: finite state projection lost " << lost;
+cerr << " of the probability with " << sp->states << " states" << endl;
+sp->warned = 1;
+}
+break;
+}
+// redo the step on a larger box
+fspExpand( sp, x );
+for( int k = 0; k < sp->states; k++ ) {
+sp->p[ k ] = k < saved ? p0[ k ] : 0.0;
+}
+fspGenerator( sp, x );
+if( DEBUG ) {
+cerr << " fsp states = " << sp->states << endl;
 }
-#ifndef OPTIMIZE
-for( int i = 1; i <= numberOfReactions; i++ ) {
-//xreac[ i ][ numberOfTimeSteps ] = xreac[ i ][ t_index ];
-xreac[ numberOfTimeSteps ][ i ] = xreac[ t_index ][ i ];
 }
-#endif
 
-} // end method: rungeKuttaAdaptive
+if( ssaClamp( x, dtime * t ) ) {
+fspExpand( sp, x );
+fspGenerator( sp, x );
+}
+fspRecord( sp, xspec, x, t );
+}
 
+delete [] p0;
+delete [] x;
+}
 
 /*************************************************************
-*   e v a l _ j a c o b i a n
+*   m o m e n t   e q u a t i o n s
 *************************************************************
-* Evals the jacobian matrix with xspec[ time ][]
-* Added Mar 01, 2001
-* by Aleman-Meza, Boanerges
+* option line "moments lna" or "moments normal": the species
+* counts get the second moments <A*B> = E[ A B ] appended as
+* extra species, which the deterministic engines (jtime=1,2,3,
+* 4,45) integrate through xrate(). The variance of A is
+* <A*A> - A^2. The rate constants are read as for the SSA.
+* lna:    linear noise approximation, the mean follows the usual
+*         rate equations, the covariance obeys J C + C J' + D
+* normal: the third central moments are set to zero, the mean and
+*         the covariance use the expected propensities, which is
+*         exact for reactions up to second order
+* The raw moments are integrated because the engines cut
+* negative values, a covariance may be negative.
 */
-void eval_jacobian( int time, double ** jac )
+int momentIndex( int species, int i, int j )
 {
+if( i > j ) {
+int k = i;
+i = j;
+j = k;
+}
+return species + ( i - 1 ) * ( 2 * species - i + 2 ) / 2 + ( j - i ) + 1;
+}
 
-double multi   = 1.0;
-double sum     = 0.0;
-double fwdPart = 0.0;
-double bckPart = 0.0;
-int existsInLeft  = 0;
-int existsInRight = 0;
-int respecttoAppears = 0;
+/*
+* appends the moments to the species, returns nonzero and leaves
+* the network alone when the moments do not fit or the method
+* cannot take them
+*/
+int KinModel::setmoments()
+{
+momentSpecies = 0;
+if( momentClosure == 0 ) {
+return 0;
+}
+int s = numberOfSpecies;
+int total = s + s * ( s + 1 ) / 2;
+if( integrationOption != 1 && integrationOption != 2 && integrationOption != 3
+&& integrationOption != 4 && integrationOption != 45 ) {
+cerr << "ERROR: moments need jtime=1,2,3,4 or 45" << endl;
+return 1;
+}
+if( total >= MAX_NUMBER_SPECIES ) {
+cerr << "ERROR: moments of " << s << " species need " << total;
+cerr << " variables, more than MAX_NUMBER_SPECIES = " << MAX_NUMBER_SPECIES << endl;
+return 1;
+}
 
-for( int equation = 1; equation <= numberOfSpecies; equation++ ) {
+momentSpecies = s;
+numberOfSpecies = total;
 
-for( int respectto = 1; respectto <= numberOfSpecies; respectto++ ) {
+for( int i = 1; i <= s; i++ ) {
+for( int j = i; j <= s; j++ ) {
+int k = momentIndex( momentSpecies, i, j );
+const char *a = nameOfSpecies[ i ] + strspn( nameOfSpecies[ i ], " " );
+const char *b = nameOfSpecies[ j ] + strspn( nameOfSpecies[ j ], " " );
+if( nameOfSpecies[ k ] != 0 ) {
+delete [] nameOfSpecies[ k ];
+}
+nameOfSpecies[ k ] = new char[ strlen( a ) + strlen( b ) + 14 ];
+sprintf( nameOfSpecies[ k ], "          <%s*%s>", a, b );
+// no fluctuations of fixed species
+jfix[ k ] = ( jfix[ i ] != 0 || jfix[ j ] != 0 ) ? 1 : 0;
+initialConcentration[ k ] = initialConcentration[ i ] * initialConcentration[ j ];
+}
+}
+return 0;
+}
 
-sum = 0.0;
+// scratch of momentRate()
+void KinSolver::setmomentwork()
+{
+int s = momentSpecies;
+momentWork = new MomentWork;
+momentWork->mean = new double[ s + 1 ];
+momentWork->rate = new double[ s + 1 ];
+momentWork->product = new double[ s + 1 ];
+momentWork->cov = new double*[ s + 1 ];
+momentWork->dcov = new double*[ s + 1 ];
+for( int i = 1; i <= s; i++ ) {
+momentWork->cov[ i ] = new double[ s + 1 ];
+momentWork->dcov[ i ] = new double[ s + 1 ];
+}
+}
 
-for( int r = 1; r <= numberOfReactions; r++ ) {
+void KinSolver::freemoments()
+{
+if( momentWork == 0 ) {
+return;
+}
+for( int i = 1; i <= momentSpecies; i++ ) {
+delete [] momentWork->cov[ i ];
+delete [] momentWork->dcov[ i ];
+}
+delete [] momentWork->cov;
+delete [] momentWork->dcov;
+delete [] momentWork->mean;
+delete [] momentWork->rate;
+delete [] momentWork->product;
+delete momentWork;
+momentWork = 0;
+}
 
-multi = 1.0;
-respecttoAppears = 0;
-existsInLeft  = 0;
-existsInRight = 0;
+/*
+* propensity of channel c at x, its gradient g[ k ] and Hessian
+* h[ k ][ l ] over the species of the channel's reactant list,
+* mass action x^n for lna, n(n-1).. for normal, finite
+* differences for jkin=11
+*/
+double KinSolver::momentPropensity( int c, double x[], double g[], double h[][ MOMENT_MAX_READ ], int n )
+{
+const SsaNetwork *net = ssaNet;
+int first = net->reactantStart[ c ];
+int r = net->reaction[ c ];
 
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-if( equation == iispec[ q ][ r ] ) {
-existsInLeft++;
-}
-if( respectto == iispec[ q ][ r ] ) {
-respecttoAppears++;
+if( jkin[ r ] == 11 ) {
+double a = ssaPropensity( net, c, x );
+double step[ MOMENT_MAX_READ ];
+for( int k = 0; k < n; k++ ) {
+int s = net->reactantSpecies[ first + k ];
+double keep = x[ s ];
+step[ k ] = 1.0e-4 * ( 1.0 + myabs( keep ) );
+x[ s ] = keep + step[ k ];
+double up = ssaPropensity( net, c, x );
+x[ s ] = keep - step[ k ];
+double down = ssaPropensity( net, c, x );
+x[ s ] = keep;
+g[ k ] = ( up - down ) / ( 2.0 * step[ k ] );
+h[ k ][ k ] = ( up - 2.0 * a + down ) / ( step[ k ] * step[ k ] );
+}
+for( int k = 0; k < n; k++ ) {
+for( int l = k + 1; l < n; l++ ) {
+int s = net->reactantSpecies[ first + k ];
+int u = net->reactantSpecies[ first + l ];
+double ks = x[ s ];
+double ku = x[ u ];
+double sum = 0.0;
+for( int corner = 0; corner < 4; corner++ ) {
+double ds = corner & 1 ? -step[ k ] : step[ k ];
+double du = corner & 2 ? -step[ l ] : step[ l ];
+x[ s ] = ks + ds;
+x[ u ] = ku + du;
+sum += ( ds * du > 0.0 ? 1.0 : -1.0 ) * ssaPropensity( net, c, x );
+}
+x[ s ] = ks;
+x[ u ] = ku;
+h[ k ][ l ] = sum / ( 4.0 * step[ k ] * step[ l ] );
+h[ l ][ k ] = h[ k ][ l ];
+}
+}
+return a;
+}
+
+// factor of each reactant and its first two derivatives
+double f[ MOMENT_MAX_READ ], f1[ MOMENT_MAX_READ ], f2[ MOMENT_MAX_READ ];
+for( int k = 0; k < n; k++ ) {
+double y = x[ net->reactantSpecies[ first + k ] ];
+f[ k ] = 1.0;
+f1[ k ] = 0.0;
+f2[ k ] = 0.0;
+for( int m = 0; m < net->reactantOrder[ first + k ]; m++ ) {
+double z = momentClosure == MOMENT_NORMAL ? y - m : y;
+f2[ k ] = f2[ k ] * z + 2.0 * f1[ k ];
+f1[ k ] = f1[ k ] * z + f[ k ];
+f[ k ] = f[ k ] * z;
+}
+}
+double a = net->rate[ c ];
+for( int k = 0; k < n; k++ ) {
+a *= f[ k ];
+}
+for( int k = 0; k < n; k++ ) {
+for( int l = k; l < n; l++ ) {
+double v = net->rate[ c ];
+for( int m = 0; m < n; m++ ) {
+if( m == k && m == l ) {
+v *= f2[ m ];
+}
+else if( m == k || m == l ) {
+v *= f1[ m ];
 }
 else {
-multi *= xspec[ time ][ iispec[ q ][ r ] ];
+v *= f[ m ];
 }
 }
-// for the case x^3 ( which derivative is 3*x^2), compute x^2
-for( int k = 1; k < respecttoAppears; k++ ) {
-multi *= xspec[ time ][ respectto ];
+h[ k ][ l ] = v;
+h[ l ][ k ] = v;
+}
+double v = net->rate[ c ];
+for( int m = 0; m < n; m++ ) {
+v *= m == k ? f1[ m ] : f[ m ];
+}
+g[ k ] = v;
+}
+return a;
 }
-fwdPart = multi * forwardReactionRates[ r ] * ( (double) respecttoAppears );
 
-multi = 1.0;
-respecttoAppears = 0;
+/*
+* d/dt of the means ( normal closure only, lna keeps the rate
+* equations of xrate() ) and of the second moments from the
+* state xspec[ t-1 ]
+*/
+void KinSolver::momentRate( double vspec[], int t )
+{
+const SsaNetwork *net = ssaNet;
+MomentWork *w = momentWork;
+int s = momentSpecies;
+double *x = xspec[ t - 1 ];
+double *mu = w->mean;
+double *dmu = w->rate;
+double *cg = w->product;
+double **cov = w->cov;
+double **dcov = w->dcov;
+double g[ MOMENT_MAX_READ ];
+double h[ MOMENT_MAX_READ ][ MOMENT_MAX_READ ];
+
+for( int i = 1; i <= s; i++ ) {
+mu[ i ] = x[ i ];
+dmu[ i ] = 0.0;
+}
+for( int i = 1; i <= s; i++ ) {
+for( int j = i; j <= s; j++ ) {
+double c = 0.0;
+if( jfix[ i ] == 0 && jfix[ j ] == 0 ) {
+c = x[ momentIndex( momentSpecies, i, j ) ] - mu[ i ] * mu[ j ];
+}
+cov[ i ][ j ] = c;
+cov[ j ][ i ] = c;
+dcov[ i ][ j ] = 0.0;
+dcov[ j ][ i ] = 0.0;
+}
+}
+
+for( int c = 1; c <= net->channels; c++ ) {
+int first = net->reactantStart[ c ];
+int n = net->reactantStart[ c + 1 ] - first;
+if( net->changeStart[ c + 1 ] == net->changeStart[ c ] ) {
+continue;
+}
+double a = momentPropensity( c, mu, g, h, n );
 
-for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
-if( equation == iospec[ q ][ r ] ) {
-existsInRight++;
+// expected propensity
+double ea = a;
+if( momentClosure == MOMENT_NORMAL ) {
+for( int k = 0; k < n; k++ ) {
+for( int l = 0; l < n; l++ ) {
+ea += 0.5 * h[ k ][ l ] * cov[ net->reactantSpecies[ first + k ] ][ net->reactantSpecies[ first + l ] ];
 }
-if( respectto == iospec[ q ][ r ] ) {
-respecttoAppears++;
 }
-else {
-multi *= xspec[ time ][ iospec[ q ][ r ] ];
 }
+
+// C g, the covariance of the state with the propensity
+for( int i = 1; i <= s; i++ ) {
+double sum = 0.0;
+for( int k = 0; k < n; k++ ) {
+sum += cov[ i ][ net->reactantSpecies[ first + k ] ] * g[ k ];
 }
-// for the case x^3 ( which derivative is 3*x^2), compute x^2
-for( int k = 1; k < respecttoAppears; k++ ) {
-multi *= xspec[ time ][ respectto ];
+cg[ i ] = sum;
 }
-bckPart = multi * backwardReactionRates[ r ] * ( (double) respecttoAppears );
 
-if( existsInLeft ) {
-sum = sum - fwdPart + bckPart;
+for( int p = net->changeStart[ c ]; p < net->changeStart[ c + 1 ]; p++ ) {
+int i = net->changeSpecies[ p ];
+double nu = net->changeDelta[ p ];
+dmu[ i ] += nu * ea;
+for( int j = 1; j <= s; j++ ) {
+dcov[ i ][ j ] += nu * cg[ j ];
+dcov[ j ][ i ] += nu * cg[ j ];
+}
+for( int q = net->changeStart[ c ]; q < net->changeStart[ c + 1 ]; q++ ) {
+dcov[ i ][ net->changeSpecies[ q ] ] += nu * net->changeDelta[ q ] * ea;
 }
-if( existsInRight ) {
-sum = sum + fwdPart - bckPart;
 }
-
 }
 
-jac[ equation ][ respectto ] = sum;
-
+if( momentClosure == MOMENT_NORMAL ) {
+for( int i = 1; i <= s; i++ ) {
+vspec[ i ] = dmu[ i ];
+}
+}
+else {
+for( int i = 1; i <= s; i++ ) {
+dmu[ i ] = jfix[ i ] == 0 ? vspec[ i ] : 0.0;
+}
 }
 
+for( int i = 1; i <= s; i++ ) {
+for( int j = i; j <= s; j++ ) {
+vspec[ momentIndex( momentSpecies, i, j ) ] = dcov[ i ][ j ] + dmu[ i ] * mu[ j ] + mu[ i ] * dmu[ j ];
+}
 }
 }
 
 /*************************************************************
-*   p r e p a r e J a c o b i a n
+*   r u n k i n
 *************************************************************
-* prepares the jacobian matrix ( will be evaluated later many times )
-* Added Mar 19, 2001
-* by Aleman-Meza, Boanerges
+* Runs the integration depening on integrationOption(jtime)
 */
-void prepareJacobian( Evaluate *** jac )
+void KinSolver::runkin()
 {
 
-double   *tMulti = new double[ MAX_NUMBER_PARTICIPANT_REACTIONS * 2 ];
-int      *tIndex = new    int[ MAX_NUMBER_PARTICIPANT_REACTIONS * 2 ];
-int      tPartic = 0;
-Evaluate *left   = 0;
-Evaluate *right  = 0;
-Evaluate *eval   = 0;
-Evaluate *list   = 0;
-int existsInLeft = 0;
-int existsInRight = 0;
-int respecttoAppears = 0;
 
-for( int equation = 1; equation <= numberOfSpecies; equation++ ) {
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+//xreac[ r ][ 0 ] = 0.0;
+xreac[ 0 ][ r ] = 0.0;
+}
+#endif
 
-for( int respectto = 1; respectto <= numberOfSpecies; respectto++ ) {
+for( int t = 1; t <= numberOfTimeSteps; t++ ) {
+for( int i = 1; i <= numberOfSpecies; i++ ) {
+if( jfix[ i ] == 1 ) {
+xspec[ t ][ i ] = xspec[ t - 1 ][ i ];
+}
+}
+}
 
-list = 0;
+if( integrationOption == 1 ) {
+eulerMethod();
+} 
 
-for( int r = 1; r <= numberOfReactions; r++ ) {
+if( integrationOption == 101 ) {
+testMethod_aleman();
+} 
 
-tPartic = 0;
-respecttoAppears = 0;
-existsInLeft  = 0;
-left = 0;
 
-for( int q = 1; q <= numberInputParticipants[ r ]; q++ ) {
-if( equation == iispec[ q ][ r ] ) {
-existsInLeft++;
+if( integrationOption == 2 ) {
+modifiedEulerMethod();
+} 
+
+
+if( integrationOption == 3 ) {
+rungeKuttaOrder4();
+} 
+
+
+if( integrationOption == 45 ) {
+rungeKutta45();
+} 
+
+
+if( integrationOption == 4 ) {
+rungeKuttaAdaptive();
 }
-if( respectto == iispec[ q ][ r ] ) {
-respecttoAppears++;
+
+
+if( integrationOption == 5 ) {
+stiffSolver();
 }
-else {
-tIndex[ tPartic++ ] = iispec[ q ][ r ];
+
+if( integrationOption == 6 ) {
+lsodesMethod();
 }
+
+if( integrationOption == 7 ) {
+compositionRejectionSSA( &ssaRandom, xspec, xspec[ 0 ] );
 }
-if( respecttoAppears ) {
-left = new Evaluate;
-left->appears = respecttoAppears;
-left->multiplier = forwardReactionRates[ r ];
-left->participants = tPartic;
-left->indexes = new int[ tPartic ];
-for( int i = 0; i < tPartic; i++ ) {
-left->indexes[ i ] = tIndex[ i ];
+
+if( integrationOption == 8 ) {
+tauLeaping( &ssaRandom, xspec, xspec[ 0 ] );
 }
-left->next = 0;
+
+if( integrationOption == 9 ) {
+finiteStateProjection();
 }
 
-tPartic = 0;
-respecttoAppears = 0;
-existsInRight = 0;
-right = 0;
+}
 
-for( int q = 1; q <= numberOutputParticipants[ r ]; q++ ) {
-if( equation == iospec[ q ][ r ] ) {
-existsInRight++;
+/*************************************************************
+*   t e x t   o u t p u t
+*************************************************************
+* the rows of kin_o01 .. kin_o04: the numbers as ostream << setw( FRAC )
+* in scientific mode writes them ( "%*.*E" ), formatted straight into
+* a buffer that goes out in few large writes
+*/
+#define TEXT_BUFFER 65536
+#define TEXT_NUMBER 64           // room for one number, at most
+
+struct TextOut {
+   ostream *out;
+   int      width;               // of a number, FRAC at 7 digits
+   int      precision;           // digits after the point
+   int      length;
+   char     data[ TEXT_BUFFER ];
+};
+
+// 10^0 .. 10^27, exact as long doubles ( 5^27 < 2^64 )
+const long double textTen[] = {
+   1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+   1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+   1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+
+/*
+* v as sprintf( p, "%*.*E", width, precision, v ) writes it; returns
+* the end. The digits come from v scaled by a power of ten, sprintf
+* is left the values whose rounding that cannot tell ( the scaled
+* value too close to a half ), infinities, NaNs and extreme exponents.
+*/
+char *formatNumber( char *p, double v, int width, int precision )
+{
+long double m = 0.0L;
+int e = 0;
+int fast = ( v - v == 0.0 ) && precision >= 0 && precision <= 15;
+if( fast && v != 0.0 ) {
+long double a = fabs( v );
+e = (int) floor( log10( fabs( v ) ) );
+// log10 may be one off at powers of ten
+for( int tries = 0; tries < 2; tries++ ) {
+int s = precision - e;
+if( s > 27 || s < -27 ) {
+fast = 0;
+break;
 }
-if( respectto == iospec[ q ][ r ] ) {
-respecttoAppears++;
+m = ( s >= 0 ? a * textTen[ s ] : a / textTen[ -s ] );
+if( m < textTen[ precision ] ) {
+e--;
+}
+else if( m >= textTen[ precision + 1 ] ) {
+e++;
 }
 else {
-tIndex[ tPartic++ ] = iospec[ q ][ r ];
+break;
 }
 }
-if( respecttoAppears ) {
-right = new Evaluate;
-right->appears = respecttoAppears;
-right->multiplier = backwardReactionRates[ r ];
-right->participants = tPartic;
-right->indexes = new int[ tPartic ];
-for( int i = 0; i < tPartic; i++ ) {
-right->indexes[ i ] = tIndex[ i ];
+if( fast && ( m < textTen[ precision ] || m >= textTen[ precision + 1 ]
+|| fabsl( m - floorl( m ) - 0.5L ) < m * 1.0e-15L ) ) {
+fast = 0;
 }
-right->next = 0;
 }
-if( ( ! existsInLeft && ! existsInRight )
-|| ( existsInLeft && existsInRight ) ) {
-// they cancel each other, do not store them
-if( left != 0 ) {
-delete [] left->indexes;
-delete left;
+if( ! fast ) {
+return p + sprintf( p, "%*.*E", width, precision, v );
 }
-if( right != 0 ) {
-delete [] right->indexes;
-delete right;
+
+unsigned long long r = (unsigned long long) ( m + 0.5L );
+if( r == (unsigned long long) textTen[ precision + 1 ] ) {
+r = (unsigned long long) textTen[ precision ];
+e++;
 }
-continue;
+char text[ TEXT_NUMBER ];
+char mantissa[ 16 ];
+int n = 0;
+if( signbit( v ) ) {
+text[ n++ ] = '-';
 }
-if( existsInLeft && left != 0 ) {
-left->multiplier = -left->multiplier;
-// add it to the list
-if( list == 0 ) {
-list = left;
+for( int k = precision; k >= 0; k-- ) {
+mantissa[ k ] = (char) ( '0' + r % 10 );
+r /= 10;
 }
-else {
-for( Evaluate *tmp = list; tmp != 0; tmp = tmp->next ) {
-if( tmp->next == 0 ) {
-tmp->next = left;
-break;
+text[ n++ ] = mantissa[ 0 ];
+if( precision > 0 ) {
+text[ n++ ] = '.';
+memcpy( text + n, mantissa + 1, precision );
+n += precision;
 }
+text[ n++ ] = 'E';
+text[ n++ ] = ( e < 0 ? '-' : '+' );
+if( e < 0 ) {
+e = -e;
 }
+if( e >= 100 ) {
+text[ n++ ] = (char) ( '0' + e / 100 );
+e %= 100;
 }
-} 
-if( existsInRight && right != 0 ) {
-right->multiplier = -right->multiplier;
-// add it to the list
-if( list == 0 ) {
-list = right;
+text[ n++ ] = (char) ( '0' + e / 10 );
+text[ n++ ] = (char) ( '0' + e % 10 );
+for( int k = n; k < width; k++ ) {
+*p++ = ' ';
+}
+memcpy( p, text, n );
+return p + n;
+}
+
+// v as setw( width ) << v; returns the end
+char *formatInt( char *p, long v, int width )
+{
+char text[ 24 ];
+int n = 0;
+unsigned long u = ( v < 0 ? - (unsigned long) v : v );
+do {
+text[ n++ ] = (char) ( '0' + u % 10 );
+u /= 10;
+} while( u > 0 );
+if( v < 0 ) {
+text[ n++ ] = '-';
 }
-else {
-for( Evaluate *tmp = list; tmp != 0; tmp = tmp->next ) {
-if( tmp->next == 0 ) {
-tmp->next = right;
-break;
+for( int k = n; k < width; k++ ) {
+*p++ = ' ';
 }
+while( n > 0 ) {
+*p++ = text[ --n ];
 }
+return p;
 }
-} 
 
+void textOpen( TextOut *b, ostream &out, int digits )
+{
+b->out = &out;
+b->precision = digits - 1;
+b->width = digits + FRAC - 7;
+b->length = 0;
 }
-jac[ equation ][ respectto ] = list;
 
+void textFlush( TextOut *b )
+{
+if( b->length > 0 ) {
+b->out->write( b->data, b->length );
+b->length = 0;
+}
 }
 
+void textRoom( TextOut *b )
+{
+if( b->length > TEXT_BUFFER - TEXT_NUMBER ) {
+textFlush( b );
 }
-delete [] tMulti;
-delete [] tIndex;
 }
 
+// v as setw( DEC8 ) << v
+void textInt( TextOut *b, long v )
+{
+textRoom( b );
+b->length = formatInt( b->data + b->length, v, DEC8 ) - b->data;
+}
+
+void textNumber( TextOut *b, double v )
+{
+textRoom( b );
+b->length = formatNumber( b->data + b->length, v, b->width, b->precision ) - b->data;
+}
+
+void textEnd( TextOut *b )
+{
+textRoom( b );
+b->data[ b->length++ ] = '\n';
+}
 
 /*************************************************************
-*   s t i f f S o l v e r
+*   b a c k g r o u n d   w r i t e r
 *************************************************************
-*
+* the rows of kin_o02 as the run computes them ( stream() ), through
+* a ring to a thread that formats them while the run goes on, into
+* one text per species; outputDataFile2() then only writes them out.
+* The run waits on "room" when the ring is full, the thread on
+* "more" when it is empty. head, tail and closed change under the
+* lock only; the rows between tail and head belong to the thread,
+* which formats them outside of it.
 */
-void stiffSolver()
+#define WRITER_RING 4096         // rows
+
+struct KinWriter {
+   pthread_t       thread;
+   pthread_mutex_t lock;
+   pthread_cond_t  more;         // rows put, or closed
+   pthread_cond_t  room;         // rows formatted
+   int           species;
+   int           stride;         // doubles of a row: t, time, x
+   const int    *index;          // [ species ] the species numbers of x
+   double       *ring;
+   long          head;           // rows put, by the run
+   long          tail;           // rows formatted, by the thread
+   int           closed;
+   int           running;
+   int           digits;
+   int           timeMajor;      // all in text[ 0 ], a line per row
+   char        **text;           // [ species ], the rows of kin_o02
+   long         *length;
+   long         *size;
+};
+
+// room for n more characters in text i
+void writerRoom( KinWriter *w, int i, long n )
 {
-Evaluate ***prepared_jac = 0;
-prepared_jac = new Evaluate**[ numberOfSpecies + 1 ];
-if( prepared_jac == 0 ) {
-cerr << "ERROR: allocation for prepared_jac failed!" << endl;
-}
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-prepared_jac[ i ] = new Evaluate*[ numberOfSpecies + 1 ];
-if( prepared_jac[ i ] == 0 ) {
-cerr << "ERROR: allocation for prepared_jac[" << i << "] failed!";
-cerr << endl;
+if( w->length[ i ] + n > w->size[ i ] ) {
+long size = 2 * w->size[ i ] + n;
+char *text = new char[ size ];
+memcpy( text, w->text[ i ], w->length[ i ] );
+delete [] w->text[ i ];
+w->text[ i ] = text;
+w->size[ i ] = size;
 }
 }
-prepareJacobian( prepared_jac );
-
-/*
-cerr << "h = " << dtime << ", initialTime = " << initialTime;
-cerr << ", finalTime = " << finalTime << endl;
-*/
-
-clock_t start, end;
-double elapsed_jac = 0.0;
-double elapsed_gauss = 0.0;
-double elapsed_xrate = 0.0;
 
-double vspec[ MAX_NUMBER_SPECIES ] = { 0 };
-double vfor[ MAX_NUMBER_REACTIONS ] = { 0 };
-double vbak[ MAX_NUMBER_REACTIONS ] = { 0 };
+void writerFormat( KinWriter *w, const double row[] )
+{
+char prefix[ TEXT_NUMBER + DEC8 ];
+int precision = w->digits - 1;
+int width = w->digits + FRAC - 7;
+char *p = formatInt( prefix, (long) row[ 0 ], DEC8 );
+int n = formatNumber( p, row[ 1 ], width, precision ) - prefix;
+
+if( w->timeMajor ) {
+writerRoom( w, 0, n + (long) w->species * TEXT_NUMBER + 1 );
+char *q = w->text[ 0 ] + w->length[ 0 ];
+memcpy( q, prefix, n );
+q += n;
+for( int i = 0; i < w->species; i++ ) {
+q = formatNumber( q, row[ 2 + i ], width, precision );
+}
+*q++ = '\n';
+w->length[ 0 ] = q - w->text[ 0 ];
+return;
+}
 
-const int maxIts     = 100;
-//const double epsilon = 1.0E-6;
-const double epsilon = 1.0E-3;
-int Y0 = 0;
-int Y1 = 1;
-int Y2 = 2;
+for( int i = 0; i < w->species; i++ ) {
+writerRoom( w, i, n + TEXT_NUMBER + 1 );
+char *q = w->text[ i ] + w->length[ i ];
+memcpy( q, prefix, n );
+q = formatNumber( q + n, row[ 2 + i ], width, precision );
+*q++ = '\n';
+w->length[ i ] = q - w->text[ i ];
+}
+}
 
-double time                = 0.0;
-double maxerror            = 0.0;
-double newvalue            = 0.0;
-double *initialConditions = new double[ numberOfSpecies + 1 ];
-double *bigF      = new double[ numberOfSpecies + 1 ];
-double *m         = new double[ numberOfSpecies + 1 ];
-double *temp      = new double[ numberOfSpecies + 1 ];
-int    *tempInt   = new int[ numberOfSpecies + 1 ];
-int    its        = 0;
-double totalIts   = 0;
+void *writerThread( void *arg )
+{
+KinWriter *w = (KinWriter *) arg;
+long tail = 0;
+for( ;; ) {
+pthread_mutex_lock( &w->lock );
+while( w->head == tail && ! w->closed ) {
+pthread_cond_wait( &w->more, &w->lock );
+}
+long head = w->head;
+pthread_mutex_unlock( &w->lock );
+if( head == tail ) {
+// closed and all formatted
+break;
+}
+for( ; tail < head; tail++ ) {
+writerFormat( w, w->ring + ( tail % WRITER_RING ) * w->stride );
+}
+pthread_mutex_lock( &w->lock );
+w->tail = tail;
+pthread_cond_signal( &w->room );
+pthread_mutex_unlock( &w->lock );
+}
+return 0;
+}
 
-double **bigFprime = 0;
-bigFprime = new double*[ numberOfSpecies + 1 ];
-if( bigFprime == 0 ) {
-cerr << "ERROR: allocation for bigFprime failed!" << endl;
+// 0 when the thread cannot start
+KinWriter *writerNew( int species, const int index[], int digits, int timeMajor )
+{
+KinWriter *w = new KinWriter;
+w->species = species;
+w->index = index;
+w->stride = species + 2;
+w->ring = new double[ WRITER_RING * w->stride ];
+w->head = 0;
+w->tail = 0;
+w->closed = 0;
+pthread_mutex_init( &w->lock, 0 );
+pthread_cond_init( &w->more, 0 );
+pthread_cond_init( &w->room, 0 );
+w->digits = digits;
+w->timeMajor = timeMajor;
+w->text = new char* [ species ];
+w->length = new long[ species ];
+w->size = new long[ species ];
+for( int i = 0; i < species; i++ ) {
+w->text[ i ] = 0;
+w->length[ i ] = 0;
+w->size[ i ] = 0;
+}
+w->running = pthread_create( &w->thread, 0, writerThread, w ) == 0;
+if( ! w->running ) {
+writerFree( w );
+return 0;
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-bigFprime[ i ] = new double[ numberOfSpecies + 1 ];
-if( bigFprime[ i ] == 0 ) {
-cerr << "ERROR: allocation for bigFprime[" << i << "] failed!";
-cerr << endl;
+return w;
 }
+
+// x[ index[ 0 .. species-1 ] ] of a row of xspec
+void writerPut( KinWriter *w, int r, double time, const double x[] )
+{
+pthread_mutex_lock( &w->lock );
+while( w->head - w->tail >= WRITER_RING ) {
+pthread_cond_wait( &w->room, &w->lock );
 }
+long head = w->head;
+pthread_mutex_unlock( &w->lock );
 
-double **jac = 0;
-jac = new double*[ numberOfSpecies + 1 ];
-if( jac == 0 ) {
-cerr << "ERROR: allocation for jac failed!" << endl;
+// the thread does not look at this row before head passes it
+double *row = w->ring + ( head % WRITER_RING ) * w->stride;
+row[ 0 ] = r;
+row[ 1 ] = time;
+for( int k = 0; k < w->species; k++ ) {
+row[ 2 + k ] = x[ w->index[ k ] ];
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-jac[ i ] = new double[ numberOfSpecies + 1 ];
-if( jac[ i ] == 0 ) {
-cerr << "ERROR: allocation for jac[" << i << "] failed!";
-cerr << endl;
+
+pthread_mutex_lock( &w->lock );
+w->head = head + 1;
+pthread_cond_signal( &w->more );
+pthread_mutex_unlock( &w->lock );
+}
+
+// waits until every row put is formatted
+void writerClose( KinWriter *w )
+{
+if( w->running ) {
+pthread_mutex_lock( &w->lock );
+w->closed = 1;
+pthread_cond_signal( &w->more );
+pthread_mutex_unlock( &w->lock );
+pthread_join( w->thread, 0 );
+w->running = 0;
 }
 }
 
-/*
-double **jac2 = 0;
-jac2 = new (double*)[ numberOfSpecies + 1 ];
-if( jac2 == 0 ) {
-cerr << "ERROR: allocation for jac2 failed!" << endl;
+void writerFree( KinWriter *w )
+{
+if( w == 0 ) {
+return;
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-jac2[ i ] = new double[ numberOfSpecies + 1 ];
-if( jac2[ i ] == 0 ) {
-cerr << "ERROR: allocation for jac2[" << i << "] failed!";
-cerr << endl;
+writerClose( w );
+for( int i = 0; i < w->species; i++ ) {
+delete [] w->text[ i ];
 }
+delete [] w->text;
+delete [] w->length;
+delete [] w->size;
+delete [] w->ring;
+pthread_mutex_destroy( &w->lock );
+pthread_cond_destroy( &w->more );
+pthread_cond_destroy( &w->room );
+delete w;
 }
+
+/* Writes out the second part of kin_o01
+* returns 0 when ok
 */
+int KinSolver::outputDataFile1()
+{
+ofstream outputFile1( kin_o01, ios::app );
+if( ! outputFile1 ) {
+cerr << "Couldn't open input file " << kin_i01 << endl;
+return 1;
+}
 
-// put y0 into y1 as a first guess
+outputFile1 << endl << endl;
+outputFile1 << setiosflags( ios::scientific | ios::uppercase );
+outputFile1 << " initial and final species concentrations" << endl << endl;
+outputFile1 << "   ispec         timei         xspec" << endl << endl;
+
+TextOut *text = new TextOut;
+textOpen( text, outputFile1, outputDigits );
 for( int i = 1; i <= numberOfSpecies; i++ ) {
-xspec[ Y1 ][ i ] = xspec[ Y0 ][ i ];
+
+outputFile1 << nameOfSpecies[ i ] << endl;
+
+textInt( text, i );
+textNumber( text, initialTime );
+textNumber( text, xspec[ 0 ][ i ] );
+textEnd( text );
+
+textInt( text, i );
+textNumber( text, finalTime );
+textNumber( text, xspec[ numberOfTimeSteps ][ i ] );
+textEnd( text );
+textFlush( text );
 }
+
+outputFile1 << endl << endl;
+outputFile1 << " final reaction concentrations" << endl << endl;
+outputFile1 << "   ireac         timei         xreac" << endl;
+
 #ifndef OPTIMIZE
 for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ Y1 ] = xreac[ r ][ Y0 ];
-xreac[ Y1 ][ r ] = xreac[ Y0 ][ r ];
+textInt( text, r );
+textNumber( text, finalTime );
+//outputFile1 << setw( FRAC ) << xreac[ r ][ numberOfTimeSteps ] << endl;
+textNumber( text, xreac[ numberOfTimeSteps ][ r ] );
+textEnd( text );
 }
+textFlush( text );
 #endif
 
+outputFile1 << endl << endl;
+outputFile1 << " time-dep. species concentrations" << endl;
 
-// for time = 1 :
-// approximate y1 with BDF1
-// F( y1 ) = y1 - y0 - h * f( t1, y1 ) = 0
-// xspec[ 0 ] actually holds y0, x[ 1 ] will hold y1
-time = initialTime + dtime;
-
-its = 0;
-int t_index = 1;
-
-do {
-// eval fx( time, y1, temp, numberOfSpecies );
-// evaluate f( t, xpec[ t ] )
-start = clock();
-xrate( vspec, vfor, vbak, t_index + 1 );
-end = clock();
-elapsed_xrate += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-
-// put h * f(...) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-bigF[ i ] = xspec[ Y1 ][ i ] - xspec[ Y0 ][ i ] 
-- dtime * vspec[ i ];
+int mtime = -1;
+int top = numberOfTimeSteps;
+if( integrationOption == 4 ) { // RK Adaptive
+top = xtime_index;
 }
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+int i = outputSpecies[ k ];
+mtime = -1;
+outputFile1 << endl << "   ispec" << endl;
+outputFile1 << setw( DEC8 ) << i << endl;
 
-start = clock();
-//eval_jacobian( t_index, jac2 ); 
-eval_prep_jacobian( t_index, jac , prepared_jac ); 
-end = clock();
-elapsed_jac += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-for( int j = 1; j <= numberOfSpecies; j++ ) {
-bigFprime[ i ][ j ] = ( i == j ? 1.0 : 0.0 ) 
-- dtime * jac[ i ][ j ];
+outputFile1 << " namespec:" << endl;
+outputFile1 << nameOfSpecies[ i ] << endl;
+outputFile1 << "   itime         timei         xspec" << endl;
+for( int t = 0; t <= top; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
 }
+if( mtime == 0 || t == top ) {
+textInt( text, t );
+if( integrationOption == 4 ) {
+textNumber( text, xtime[ t ] );
 }
-
-start = clock();
-gauss( bigFprime, tempInt, numberOfSpecies );
-gauss_solve( bigFprime, tempInt, bigF, m, numberOfSpecies );
-end = clock();
-elapsed_gauss += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-
-maxerror = 0.0;
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-newvalue = xspec[ Y1 ][ i ] - m[ i ];
-maxerror = maxerror > myabs( xspec[ Y1 ][ i ] - newvalue ) 
-? maxerror : myabs( xspec[ Y1 ][ i ] - newvalue );
-xspec[ Y1 ][ i ] = newvalue;
+else {
+textNumber( text, initialTime + t * dtime );
 }
+textNumber( text, xspec[ t ][ i ] );
+textEnd( text );
 }
-
-its++;
-if( its > maxIts ) {
-cerr << "ERROR 1:  Max iterations reached!" << endl;
-return;
 }
-} while( maxerror > epsilon );
-
-//cerr << "time= " << time << ", h= " << dtime << "\tnumberOfTimeSteps = ";
-
-totalIts += its;
-//(end) approximate y1 with BDF1
-
-// now go on with BDF2 for the remaining timeSteps
-// F( y2 ) = y2 - (4/3) y1 + (1/3) y0 - (2/3) * f( t2, y2) = 0
-const double a1 =  4.0 / 3.0;
-const double a2 =  1.0 / 3.0;
-const double b0 =  2.0 / 3.0;
-
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-xspec[ Y2 ][ i ] = xspec[ Y1 ][ i ];
+textFlush( text );
 }
 
-for( t_index = 2; t_index <= numberOfTimeSteps; t_index++ ) {
-
-time = initialTime + dtime * (double) t_index;
-its = 0;
-do {
-// eval_fx( time, y2, temp, numberOfSpecies );
-// evaluate f( t, xpec[ t ] )
-start = clock();
-xrate( vspec, vfor, vbak, t_index + 1 );
-end = clock();
-elapsed_xrate += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+outputFile1 << endl << endl << " time-dep. reaction concentrations" << endl;
 
-// put h * f(...) into k1
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-bigF[ i ] = xspec[ Y2 ][ i ] - a1 * xspec[ Y1 ][ i ] 
-+ a2 * xspec[ Y0 ][ i ] - b0 * dtime * vspec[ i ];
+#ifndef OPTIMIZE
+for( int r = 1; r <= numberOfReactions; r++ ) {
+outputFile1 << endl << "   ireac" << endl;
+outputFile1 << setw( DEC8 ) << r << endl;
+outputFile1 << "   itime         timei         xreac" << endl;
+mtime = -1;
+for( int t = 0; t <= top; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
+}
+if( mtime == 0 || t == top ) {
+textInt( text, t );
+if( integrationOption == 4 ) {
+textNumber( text, xtime[ t ] );
+}
+else {
+textNumber( text, initialTime + t * dtime );
+}
+//outputFile1 << setw( FRAC ) << xreac[ r ][ t ] << endl;
+textNumber( text, xreac[ t ][ r ] );
+textEnd( text );
 }
-
-start = clock();
-//eval_jacobian( t_index, jac );
-eval_prep_jacobian( t_index, jac, prepared_jac ); 
-end = clock();
-elapsed_jac += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
-
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-for( int j = 1; j <= numberOfSpecies; j++ ) {
-bigFprime[ i ][ j ] = ( i == j ? 1.0 : 0.0 ) 
-- b0 * dtime * jac[ i ][ j ];
 }
+textFlush( text );
 }
+#endif
 
-start = clock();
-gauss( bigFprime, tempInt, numberOfSpecies );
-gauss_solve( bigFprime, tempInt, bigF, m, numberOfSpecies );
-end = clock();
-elapsed_gauss += ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+delete text;
+outputFile1.close();
 
-maxerror = 0.0;
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 0 ) {
-newvalue = xspec[ Y2 ][ i ] - m[ i ];
-maxerror = maxerror > myabs( xspec[ Y2 ][ i ] - newvalue ) 
-? maxerror : myabs( xspec[ Y2 ][ i ] - newvalue );
-xspec[ Y2 ][ i ] = newvalue;
-}
+return 0;
 }
 
-its++;
-if( its > maxIts ) {
-cerr << "ERROR: Max iterations reached!" << endl;
-return;
-}
-} while( maxerror > epsilon );
+/**
+* Writes out file kin_o02 
+* returns 0 when ok
+*/
+int KinSolver::outputDataFile2()
+{
+ofstream outputFile2( kin_o02, ( numberOfDataSets == 1 ? ios::out : ios::app ) );
 
-totalIts += its;
+if( ! outputFile2 ) {
+cerr << "Couldn't open output file " << kin_o02 << endl;
+return 1;
+}
 
-Y0++;
-Y1++;
-Y2++;
+outputDataFile2( outputFile2 );
+outputFile2.close();
 
+return 0;
 }
 
-/*
-cerr << "time = " << time << ", h = " << dtime << "\ttimesteps = ";
-cerr << numberOfTimeSteps << endl;
-//      cerr << "Y0 = " << Y0 << ", Y1 = " << Y1 << ", Y2 = " << Y2 << endl;
-//      for( int i = 1; i <= numberOfSpecies; i++ ) {
-//         cerr << trim( nameOfSpecies[ i ] ) << "\t";
-//         cerr << xspec[ Y0 ][ i ] << " \t" << xspec[ Y1 ][ i ] << endl;
-//      }
+/**
+* Writes the kin_o02 text of the run to outputFile2
 */
-cerr << " its = " << totalIts;
-cerr << ", jac_time = " << elapsed_jac;
-cerr << ", xrate_time = " << elapsed_xrate;
-cerr << ", gauss_time = " << elapsed_gauss << endl;
-
-// free up allocated memory
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-delete [] bigFprime[ i ];
+void KinSolver::outputDataFile2( ostream &outputFile2 )
+{
+if( timeMajor ) {
+outputRows2( outputFile2 );
+return;
 }
-delete [] bigFprime;
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-delete [] jac[ i ];
+
+int mtime = -1;
+int top = numberOfTimeSteps;
+if( integrationOption == 4 ) { // RK Adaptive
+top = xtime_index;
 }
-delete [] jac;
-delete [] bigF;
-delete [] m;
-delete [] temp;
-delete [] tempInt;
 
-} // end method: stiffSolver
+outputFile2 << setiosflags( ios::scientific | ios::uppercase );
 
-/*************************************************************
-*   r u n k i n
-*************************************************************
-* Runs the integration depening on integrationOption(jtime)
-*/
-void runkin()
-{
+outputFile2 << "#" << endl;
+outputFile2 << "#" << endl;
+outputFile2 << "#" << bline[ 0 ] << endl;
+outputFile2 << "#  time-dep. species concentrations" << endl;
+outputFile2 << "#" << endl;
 
+TextOut *text = new TextOut;
+textOpen( text, outputFile2, outputDigits );
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+int i = outputSpecies[ k ];
+//cout <<i<<endl;      
+outputFile2 << "#" << endl;
+outputFile2 << "#   ispec" << endl;
+outputFile2 << "#" << setw( DEC8 ) << i << endl;
+outputFile2 << "# namespec:" << endl;
+outputFile2 << "#" << nameOfSpecies[ i ] << endl;
+outputFile2 << "#" << "  itime         timei         xspec" << endl;
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-//xreac[ r ][ 0 ] = 0.0;
-xreac[ 0 ][ r ] = 0.0;
+if( writer != 0 && writer->digits == outputDigits && ! writer->timeMajor ) {
+// formatted during the run
+outputFile2.write( writer->text[ k - 1 ], writer->length[ k - 1 ] );
+outputFile2 << " " << endl;
+outputFile2 << " " << endl;
+continue;
 }
-#endif
 
-for( int t = 1; t <= numberOfTimeSteps; t++ ) {
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-if( jfix[ i ] == 1 ) {
-xspec[ t ][ i ] = xspec[ t - 1 ][ i ];
-}
+mtime = -1;
+
+//cout << i << endl;
+
+for( int i_intg = 1; i_intg <= numOfIntegrations; i_intg++){
+//cout << " i_intg " << i_intg <<endl;
+if( intg_xspec[ i_intg ] == 0 ) {
+// not run, the run was stopped before
+break;
 }
+// the rows stored, all of the piece unless the run was stopped
+top = intg_xtime_index[i_intg];
+for( int t = 0; t <= top; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
 }
-
-if( integrationOption == 1 ) {
-eulerMethod();
+if( outputRow( i_intg, t, top, mtime ) ) {
+textInt( text, t );
+if( integrationOption == 4 ) {
+textNumber( text, intg_xtime[ i_intg ][ t ] );
 } 
+else {
+textNumber( text, intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ] );
+}
+textNumber( text, intg_xspec[ i_intg ][ t ][ i ] );
+textEnd( text );
+}
+}//endof for t
+}//endof for i_intg
+textFlush( text );
 
-if( integrationOption == 101 ) {
-testMethod_aleman();
-} 
+outputFile2 << " " << endl;
+outputFile2 << " " << endl;
 
 
-if( integrationOption == 2 ) {
-modifiedEulerMethod();
-} 
+}
+delete text;
+}
 
+// label right aligned over a column of width, apart from the one before
+void rowLabel( ostream &out, const char *label, int width )
+{
+out << " " << setw( width - 1 ) << label;
+}
 
-if( integrationOption == 3 ) {
-rungeKuttaOrder4();
-} 
+/**
+* Writes the kin_o02 text of the run to outputFile2 a line per time:
+* itime, timei and a column per species ( of an ensemble the mean,
+* the variance and the quantiles of each ), in one sweep over the rows
+*/
+void KinSolver::outputRows2( ostream &outputFile2 )
+{
+EnsembleStats *st = ensemble;
+TextOut *text = new TextOut;
+textOpen( text, outputFile2, outputDigits );
 
+outputFile2 << setiosflags( ios::scientific | ios::uppercase );
 
-if( integrationOption == 45 ) {
-rungeKutta45();
-} 
+outputFile2 << "#" << endl;
+outputFile2 << "#" << endl;
+outputFile2 << "#" << bline[ 0 ] << endl;
+outputFile2 << "#  time-dep. species concentrations, a line per time";
+if( st != 0 ) {
+outputFile2 << ", ensemble of " << st->runs << " runs";
+}
+outputFile2 << endl;
+outputFile2 << "#" << endl;
 
+char label[ LINE + 32 ];
+outputFile2 << "#" << setw( DEC8 - 1 ) << "itime";
+rowLabel( outputFile2, "timei", text->width );
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+char *name = trim( nameOfSpecies[ outputSpecies[ k ] ] );
+rowLabel( outputFile2, name, text->width );
+if( st != 0 ) {
+sprintf( label, "%.*s:variance", LINE, name );
+rowLabel( outputFile2, label, text->width );
+for( int q = 1; q <= numberOfQuantiles; q++ ) {
+sprintf( label, "%.*s:q%g", LINE, name, quantile[ q ] );
+rowLabel( outputFile2, label, text->width );
+}
+}
+delete [] name;
+}
+outputFile2 << endl;
 
+if( st != 0 ) {
+for( int o = 0; o < st->outputs; o++ ) {
+int t = st->outputIndex[ o ];
+textInt( text, t );
+textNumber( text, initialTime + t * dtime );
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+int i = outputSpecies[ k ];
+textNumber( text, st->mean[ o ][ i ] );
+textNumber( text, st->runs > 1 ? st->m2[ o ][ k ] / ( st->runs - 1 ) : 0.0 );
+P2Quantile *e = st->quant + ( o * numberOfOutputSpecies + k - 1 ) * numberOfQuantiles;
+for( int q = 0; q < numberOfQuantiles; q++ ) {
+textNumber( text, p2Value( e + q, quantile[ q + 1 ] ) );
+}
+}
+textEnd( text );
+}
+}
+else if( writer != 0 && writer->digits == outputDigits && writer->timeMajor ) {
+// formatted during the run
+textFlush( text );
+outputFile2.write( writer->text[ 0 ], writer->length[ 0 ] );
+}
+else {
+int mtime = -1;
+for( int i_intg = 1; i_intg <= numOfIntegrations; i_intg++ ) {
+if( intg_xspec[ i_intg ] == 0 ) {
+// not run, the run was stopped before
+break;
+}
+int top = intg_xtime_index[ i_intg ];
+for( int t = 0; t <= top; t++ ) {
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
+}
+if( outputRow( i_intg, t, top, mtime ) ) {
+textInt( text, t );
 if( integrationOption == 4 ) {
-rungeKuttaAdaptive();
+textNumber( text, intg_xtime[ i_intg ][ t ] );
+}
+else {
+textNumber( text, intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ] );
+}
+const double *row = intg_xspec[ i_intg ][ t ];
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+textNumber( text, row[ outputSpecies[ k ] ] );
+}
+textEnd( text );
+}
 }
-
-
-if( integrationOption == 5 ) {
-stiffSolver();
 }
-
-if( integrationOption == 6 ) {
-lsodesMethod();
 }
+textFlush( text );
+delete text;
 
+outputFile2 << " " << endl;
+outputFile2 << " " << endl;
 }
 
-/* Writes out the second part of kin_o01
+/**
+* Writes out file kin_o03
 * returns 0 when ok
 */
-int outputDataFile1()
+int KinSolver::outputDataFile3()
 {
-ofstream outputFile1( kin_o01, ios::app );
-if( ! outputFile1 ) {
-cerr << "Couldn't open input file " << kin_i01 << endl;
+ofstream outputFile3( kin_o03, ( numberOfDataSets == 1 ? ios::out : ios::app ) );
+int mtime = -1;
+int top = numberOfTimeSteps;
+if( integrationOption == 4 ) { // RK Adaptive
+top = xtime_index;
+}
+
+if( ! outputFile3 ) {
+cerr << "Couldn't open output file " << kin_o03 << endl;
 return 1;
 }
 
-outputFile1 << endl << endl;
-outputFile1 << setiosflags( ios::scientific | ios::uppercase );
-outputFile1 << " initial and final species concentrations" << endl << endl;
-outputFile1 << "   ispec         timei         xspec" << endl << endl;
+outputFile3 << setiosflags( ios::scientific | ios::uppercase );
 
-for( int i = 1; i <= numberOfSpecies; i++ ) {
+outputFile3 << "#" << endl;
+outputFile3 << "#" << endl;
+outputFile3 << "#  time-dep. reaction concentrations" << endl;
+outputFile3 << "#" << endl;
 
-outputFile1 << nameOfSpecies[ i ] << endl;
+#ifndef OPTIMIZE
+TextOut *text = new TextOut;
+textOpen( text, outputFile3, outputDigits );
+for( int r = 1; r <= numberOfReactions; r++ ) {
+
+outputFile3 << "#" << endl;
+outputFile3 << "#   ireac" << endl;
+outputFile3 << "#" << setw( DEC8 ) << r << endl;
+outputFile3 << "#" << "  itime         timei         xreac" << endl;
+
+mtime = -1;
+for( int t = 0; t <= top; t++ ) {
+
+mtime = mtime + 1;
+if( mtime == ntskip ) {
+mtime = 0;
+}
+if( mtime == 0 || t == top ) {
+textInt( text, t );
+if( integrationOption == 4 ) {
+textNumber( text, xtime[ t ] );
+}
+else {
+textNumber( text, initialTime + t * dtime );
+}
+//outputFile3 << setw( FRAC ) << xreac[ r ][ t ] << endl;
+textNumber( text, xreac[ t ][ r ] );
+textEnd( text );
+}
+}
+textFlush( text );
 
-outputFile1 << setw( DEC8 ) << i;
-outputFile1 << setw( FRAC ) << initialTime;
-outputFile1 << setw( FRAC ) << xspec[ 0 ][ i ] << endl;
+outputFile3 << " " << endl;
+outputFile3 << " " << endl;
 
-outputFile1 << setw( DEC8 ) << i;
-outputFile1 << setw( FRAC ) << finalTime;
-outputFile1 << setw( FRAC ) << xspec[ numberOfTimeSteps ][ i ] << endl;
 }
+delete text;
+#endif
 
-outputFile1 << endl << endl;
-outputFile1 << " final reaction concentrations" << endl << endl;
-outputFile1 << "   ireac         timei         xreac" << endl;
+if( fluxReactions > 0 && ensemble != 0 ) {
+outputFile3 << "#  no fluxes of an ensemble, its rows are not kept" << endl;
+}
+else if( fluxReactions > 0 ) {
+outputFluxes3( outputFile3 );
+}
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-outputFile1 << setw( DEC8 ) << r;
-outputFile1 << setw( FRAC ) << finalTime;
-//outputFile1 << setw( FRAC ) << xreac[ r ][ numberOfTimeSteps ] << endl;
-outputFile1 << setw( FRAC ) << xreac[ numberOfTimeSteps ][ r ] << endl;
+outputFile3.close();
+
+return 0;
 }
-#endif
 
-outputFile1 << endl << endl;
-outputFile1 << " time-dep. species concentrations" << endl;
+/**
+* Writes the fluxes of kin_o03: a block per reaction of "fluxes" with
+* its net rate at the rows of kin_o02, recomputed from the rows kept
+* ( xreac is not ), and with extents the integral of it from the
+* start over every time step, by the trapezoidal rule
+*/
+void KinSolver::outputFluxes3( ostream &outputFile3 )
+{
+TextOut *text = new TextOut;
+textOpen( text, outputFile3, outputDigits );
+for( int k = 1; k <= fluxReactions; k++ ) {
+int r = fluxReaction[ k ];
 
-int mtime = -1;
-int top = numberOfTimeSteps;
-if( integrationOption == 4 ) { // RK Adaptive
-top = xtime_index;
+outputFile3 << "#" << endl;
+outputFile3 << "#   ireac" << endl;
+outputFile3 << "#" << setw( DEC8 ) << r << endl;
+outputFile3 << "#" << "  itime         timei          flux";
+if( fluxExtents ) {
+outputFile3 << "        extent";
 }
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-mtime = -1;
-outputFile1 << endl << "   ispec" << endl;
-outputFile1 << setw( DEC8 ) << i << endl;
+outputFile3 << endl;
 
-outputFile1 << " namespec:" << endl;
-outputFile1 << nameOfSpecies[ i ] << endl;
-outputFile1 << "   itime         timei         xspec" << endl;
+int mtime = -1;
+double extent = 0.0;
+double before = 0.0;
+double beforeTime = 0.0;
+for( int i_intg = 1; i_intg <= numOfIntegrations; i_intg++ ) {
+if( intg_xspec[ i_intg ] == 0 ) {
+// not run, the run was stopped before
+break;
+}
+int top = intg_xtime_index[ i_intg ];
 for( int t = 0; t <= top; t++ ) {
+double time = integrationOption == 4 ? intg_xtime[ i_intg ][ t ]
+: intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ];
+double v = flux( r, intg_xspec[ i_intg ][ t ] );
+if( i_intg > 1 || t > 0 ) {
+extent += 0.5 * ( before + v ) * ( time - beforeTime );
+}
+before = v;
+beforeTime = time;
+
 mtime = mtime + 1;
 if( mtime == ntskip ) {
 mtime = 0;
 }
-if( mtime == 0 || t == top ) {
-outputFile1 << setw( DEC8 ) << t;
-if( integrationOption == 4 ) {
-outputFile1 << setw( FRAC ) << xtime[ t ];
+if( outputRow( i_intg, t, top, mtime ) ) {
+textInt( text, t );
+textNumber( text, time );
+textNumber( text, v );
+if( fluxExtents ) {
+textNumber( text, extent );
+}
+textEnd( text );
 }
-else {
-outputFile1 << setw( FRAC ) << ( initialTime + t * dtime );
 }
-outputFile1 << setw( FRAC ) << xspec[ t ][ i ] << endl;
 }
+textFlush( text );
+
+outputFile3 << " " << endl;
+outputFile3 << " " << endl;
+}
+delete text;
 }
+
+/**
+* Writes out file kin_o04: the distribution of every free species
+* at the final time of the finite state projection ( jtime=9 )
+* returns 0 when ok
+*/
+int KinSolver::outputDataFile4()
+{
+ofstream outputFile4( kin_o04, ( numberOfDataSets == 1 ? ios::out : ios::app ) );
+FspSpace *sp = fsp;
+
+if( ! outputFile4 ) {
+cerr << "Couldn't open output file " << kin_o04 << endl;
+return 1;
 }
 
-outputFile1 << endl << endl << " time-dep. reaction concentrations" << endl;
+outputFile4 << setiosflags( ios::scientific | ios::uppercase );
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
-outputFile1 << endl << "   ireac" << endl;
-outputFile1 << setw( DEC8 ) << r << endl;
-outputFile1 << "   itime         timei         xreac" << endl;
-mtime = -1;
-for( int t = 0; t <= top; t++ ) {
-mtime = mtime + 1;
-if( mtime == ntskip ) {
-mtime = 0;
+double total = fspRetained( sp );
+outputFile4 << "#" << endl;
+outputFile4 << "#" << endl;
+outputFile4 << "#" << bline[ 0 ] << endl;
+outputFile4 << "#  species distributions at time " << true_finalTime << endl;
+outputFile4 << "#  states " << sp->states;
+outputFile4 << "   lost probability " << ( total < 1.0 ? 1.0 - total : 0.0 ) << endl;
+outputFile4 << "#" << endl;
+
+TextOut *text = new TextOut;
+textOpen( text, outputFile4, outputDigits );
+for( int j = 0; j < sp->species; j++ ) {
+int i = sp->speciesIndex[ j ];
+if( ! outputMask[ i ] ) {
+continue;
 }
-if( mtime == 0 || t == top ) {
-outputFile1 << setw( DEC8 ) << t;
-if( integrationOption == 4 ) {
-outputFile1 << setw( FRAC ) << xtime[ t ];
+double *marginal = new double[ sp->bound[ j ] + 1 ];
+for( int c = 0; c <= sp->bound[ j ]; c++ ) {
+marginal[ c ] = 0.0;
 }
-else {
-outputFile1 << setw( FRAC ) << ( initialTime + t * dtime );
+for( int k = 0; k < sp->states; k++ ) {
+marginal[ sp->count[ (long) k * sp->species + j ] ] += sp->p[ k ];
 }
-//outputFile1 << setw( FRAC ) << xreac[ r ][ t ] << endl;
-outputFile1 << setw( FRAC ) << xreac[ t ][ r ] << endl;
+int last = sp->bound[ j ];
+while( last > 0 && marginal[ last ] == 0.0 ) {
+last--;
 }
+
+outputFile4 << "#" << endl;
+outputFile4 << "#   ispec" << endl;
+outputFile4 << "#" << setw( DEC8 ) << i << endl;
+outputFile4 << "# namespec:" << endl;
+outputFile4 << "#" << nameOfSpecies[ i ] << endl;
+outputFile4 << "#" << "  count   probability" << endl;
+for( int c = 0; c <= last; c++ ) {
+textInt( text, c );
+textNumber( text, marginal[ c ] );
+textEnd( text );
 }
+textFlush( text );
+outputFile4 << " " << endl;
+outputFile4 << " " << endl;
+delete [] marginal;
 }
-#endif
+delete text;
 
-outputFile1.close();
+outputFile4.close();
 
 return 0;
 }
 
 /**
-* Writes out file kin_o02 
+* Writes out file kin_o02 for an ensemble: the blocks of
+* outputDataFile2() with the mean as xspec followed by the
+* variance and the quantile columns
 * returns 0 when ok
 */
-int outputDataFile2()
+int KinSolver::outputEnsembleFile2()
 {
 ofstream outputFile2( kin_o02, ( numberOfDataSets == 1 ? ios::out : ios::app ) );
-int mtime = -1;
-int top = numberOfTimeSteps;
-if( integrationOption == 4 ) { // RK Adaptive
-top = xtime_index;
-}
 
 if( ! outputFile2 ) {
 cerr << "Couldn't open output file " << kin_o02 << endl;
 return 1;
 }
 
+outputEnsembleFile2( outputFile2 );
+outputFile2.close();
+
+return 0;
+}
+
+/**
+* Writes the kin_o02 text of the ensemble to outputFile2
+*/
+void KinSolver::outputEnsembleFile2( ostream &outputFile2 )
+{
+EnsembleStats *st = ensemble;
+
+if( timeMajor ) {
+outputRows2( outputFile2 );
+return;
+}
+
 outputFile2 << setiosflags( ios::scientific | ios::uppercase );
 
 outputFile2 << "#" << endl;
 outputFile2 << "#" << endl;
 outputFile2 << "#" << bline[ 0 ] << endl;
-outputFile2 << "#  time-dep. species concentrations" << endl;
+outputFile2 << "#  time-dep. species concentrations, ensemble of ";
+outputFile2 << st->runs << " runs" << endl;
 outputFile2 << "#" << endl;
 
-for( int i = 1; i <= numberOfSpecies; i++ ) {
-//cout <<i<<endl;      
+char label[ 32 ];
+TextOut *text = new TextOut;
+textOpen( text, outputFile2, outputDigits );
+for( int k = 1; k <= numberOfOutputSpecies; k++ ) {
+int i = outputSpecies[ k ];
 outputFile2 << "#" << endl;
 outputFile2 << "#   ispec" << endl;
 outputFile2 << "#" << setw( DEC8 ) << i << endl;
 outputFile2 << "# namespec:" << endl;
 outputFile2 << "#" << nameOfSpecies[ i ] << endl;
-outputFile2 << "#" << "  itime         timei         xspec" << endl;
+outputFile2 << "#" << "  itime         timei         xspec";
+outputFile2 << setw( text->width ) << "variance";
+for( int q = 1; q <= numberOfQuantiles; q++ ) {
+sprintf( label, "q%g", quantile[ q ] );
+outputFile2 << setw( text->width ) << label;
+}
+outputFile2 << endl;
 
-mtime = -1;
+for( int o = 0; o < st->outputs; o++ ) {
+int t = st->outputIndex[ o ];
+textInt( text, t );
+textNumber( text, initialTime + t * dtime );
+textNumber( text, st->mean[ o ][ i ] );
+textNumber( text, st->runs > 1 ? st->m2[ o ][ k ] / ( st->runs - 1 ) : 0.0 );
+P2Quantile *e = st->quant + ( o * numberOfOutputSpecies + k - 1 ) * numberOfQuantiles;
+for( int q = 0; q < numberOfQuantiles; q++ ) {
+textNumber( text, p2Value( e + q, quantile[ q + 1 ] ) );
+}
+textEnd( text );
+}
+textFlush( text );
 
-//cout << i << endl;
+outputFile2 << " " << endl;
+outputFile2 << " " << endl;
+}
+delete text;
+}
 
-for( int i_intg = 1; i_intg <= numOfIntegrations; i_intg++){
-//cout << " i_intg " << i_intg <<endl;
-if(integrationOption == 4){
-top = intg_xtime_index[i_intg];
-//cout << " top " << top <<endl;
+/*************************************************************
+*   p a c k e d   o u t p u t
+*************************************************************
+* the rows of kin_o02 as a binary frame ( see libkin.h ): the names
+* once, then a block per column of floats, each value stored as its
+* XOR with the one before ( most are close, so the XOR has long runs
+* of zero bits at both ends and takes few bits )
+*/
+struct PackBits {
+   unsigned char *data;
+   long           bits;
+};
+
+void packPut( PackBits *b, unsigned long v, int n )
+{
+for( int k = n - 1; k >= 0; k-- ) {
+if( ( b->bits & 7 ) == 0 ) {
+b->data[ b->bits >> 3 ] = 0;
 }
-else{
-top = intg_numberOfTimeSteps[i_intg];
-//cout << " top " << top <<endl;
+if( ( v >> k ) & 1 ) {
+b->data[ b->bits >> 3 ] |= 0x80 >> ( b->bits & 7 );
 }
-for( int t = 0; t <= top; t++ ) {
-mtime = mtime + 1;
-if( mtime == ntskip ) {
-mtime = 0;
+b->bits++;
+}
+}
+
+// an unsigned little-endian integer of n bytes
+void packInt( ostream &out, unsigned long v, int n )
+{
+for( int k = 0; k < n; k++ ) {
+out.put( (char) ( ( v >> ( 8 * k ) ) & 0xff ) );
+}
+}
+
+void packName( ostream &out, const char *name )
+{
+int n = strlen( name );
+packInt( out, n, 2 );
+out.write( name, n );
+}
+
+/*
+* column v[ 0 .. n-1 ] into data, at most 6 bytes a value;
+* returns the bytes used
+*/
+long packColumn( const float v[], int n, unsigned char data[] )
+{
+PackBits b = { data, 0 };
+unsigned int prev = 0;
+int lead = -1, trail = 0;
+for( int k = 0; k < n; k++ ) {
+unsigned int bits;
+memcpy( &bits, v + k, 4 );
+if( k == 0 ) {
+packPut( &b, bits, 32 );
+prev = bits;
+continue;
+}
+unsigned int x = bits ^ prev;
+prev = bits;
+if( x == 0 ) {
+packPut( &b, 0, 1 );
+continue;
+}
+int l = 0, r = 0;
+while( ( x & ( 0x80000000u >> l ) ) == 0 ) {
+l++;
+}
+while( ( x & ( 1u << r ) ) == 0 ) {
+r++;
+}
+packPut( &b, 1, 1 );
+if( lead >= 0 && l >= lead && r >= trail ) {
+// within the bits of the value before
+packPut( &b, 0, 1 );
+packPut( &b, x >> trail, 32 - lead - trail );
 }
-if( mtime == 0 || t == top ) {
-outputFile2 << setw( DEC8 ) << t;
-if( integrationOption == 4 ) {
-outputFile2 << setw( FRAC ) << intg_xtime[ i_intg ][ t ];
-} 
 else {
-outputFile2 << setw( FRAC ) << ( intg_initialTime[ i_intg ] + t * intg_dtime[ i_intg ] );
+packPut( &b, 1, 1 );
+packPut( &b, l, 5 );
+packPut( &b, 32 - l - r - 1, 5 );
+packPut( &b, x >> r, 32 - l - r );
+lead = l;
+trail = r;
 }
-outputFile2 << setw( FRAC ) << intg_xspec[ i_intg ][ t ][ i ] << endl;
 }
-}//endof for t
-}//endof for i_intg
+return ( b.bits + 7 ) >> 3;
+}
 
-outputFile2 << " " << endl;
-outputFile2 << " " << endl;
+/**
+* Writes the packed frame of the run to out
+*/
+void KinSolver::pack( ostream &out )
+{
+int species = numberOfOutputSpecies;
+int rows = trajectory( 0, 0, 0 );
+double *time = new double[ rows + 1 ];
+double *x = new double[ (long) rows * species + 1 ];
+trajectory( time, x, rows, species, outputSpecies + 1 );
 
+ostrstream body;
+packInt( body, numberOfDataSets, 2 );
+packInt( body, species, 4 );
+packInt( body, rows, 4 );
+packName( body, bline[ 0 ] );
+for( int k = 1; k <= species; k++ ) {
+packName( body, nameOfSpecies[ outputSpecies[ k ] ] );
+}
 
+float *column = new float[ rows + 1 ];
+unsigned char *data = new unsigned char[ 6L * rows + 8 ];
+for( int i = 0; i <= species; i++ ) {
+for( int t = 0; t < rows; t++ ) {
+column[ t ] = (float) ( i == 0 ? time[ t ] : x[ (long) t * species + i - 1 ] );
+}
+long n = packColumn( column, rows, data );
+packInt( body, n, 4 );
+body.write( (const char *) data, n );
 }
 
-outputFile2.close();
+out.write( "KINB", 4 );
+packInt( out, 1, 1 );
+packInt( out, body.pcount(), 4 );
+out.write( body.str(), body.pcount() );
+body.freeze( 0 );
 
-return 0;
+delete [] data;
+delete [] column;
+delete [] x;
+delete [] time;
 }
 
 /**
-* Writes out file kin_o03
+* Writes out file kin_b02, the packed frame of every data set
 * returns 0 when ok
 */
-int outputDataFile3()
+int KinSolver::outputPackedFile2()
 {
-ofstream outputFile3( kin_o03, ( numberOfDataSets == 1 ? ios::out : ios::app ) );
-int mtime = -1;
-int top = numberOfTimeSteps;
-if( integrationOption == 4 ) { // RK Adaptive
-top = xtime_index;
-}
+ofstream outputFile( kin_b02, ( numberOfDataSets == 1 ? ios::out : ios::app ) | ios::binary );
 
-if( ! outputFile3 ) {
-cerr << "Couldn't open output file " << kin_o03 << endl;
+if( ! outputFile ) {
+cerr << "Couldn't open output file " << kin_b02 << endl;
 return 1;
 }
 
-outputFile3 << setiosflags( ios::scientific | ios::uppercase );
+pack( outputFile );
+outputFile.close();
 
-outputFile3 << "#" << endl;
-outputFile3 << "#" << endl;
-outputFile3 << "#  time-dep. reaction concentrations" << endl;
-outputFile3 << "#" << endl;
+return 0;
+}
 
-#ifndef OPTIMIZE
-for( int r = 1; r <= numberOfReactions; r++ ) {
+/*************************************************************
+*   s h a r e d   m e m o r y
+*************************************************************
+* the rows of the run and its report in a POSIX shared memory
+* segment ( kin_shm in libkin.h ), for a consumer on this machine
+* to map instead of reading kin.o02
+*/
+long shmAlign( long n )
+{
+return ( n + 7 ) & ~7L;
+}
 
-outputFile3 << "#" << endl;
-outputFile3 << "#   ireac" << endl;
-outputFile3 << "#" << setw( DEC8 ) << r << endl;
-outputFile3 << "#" << "  itime         timei         xreac" << endl;
+/**
+* Publishes the run under name, the frame of pack() as report when
+* packed, else the kin_o02 text
+* returns 0 when ok
+*/
+int KinSolver::publish( const char *name, int packed )
+{
+int rows = trajectory( 0, 0, 0 );
 
-mtime = -1;
-for( int t = 0; t <= top; t++ ) {
+ostrstream report;
+if( packed ) {
+pack( report );
+}
+else if( ensemble != 0 ) {
+outputEnsembleFile2( report );
+}
+else {
+outputDataFile2( report );
+}
+
+int species = numberOfOutputSpecies;
+long names = strlen( bline[ 0 ] ) + 1;
+for( int k = 1; k <= species; k++ ) {
+names += strlen( nameOfSpecies[ outputSpecies[ k ] ] ) + 1;
+}
+
+kin_shm h;
+memset( &h, 0, sizeof( h ) );
+memcpy( h.magic, "KINS", 4 );
+h.version = 1;
+h.dataSet = numberOfDataSets;
+h.species = species;
+h.rows = rows;
+h.halted = halted;
+h.names = shmAlign( sizeof( h ) );
+h.time = shmAlign( h.names + names );
+h.x = h.time + 8LL * rows;
+h.report = h.x + 8LL * rows * species;
+h.reportLength = report.pcount();
+h.size = h.report + h.reportLength;
+
+int fd = shm_open( name, O_CREAT | O_TRUNC | O_RDWR, 0600 );
+if( fd < 0 ) {
+cerr << "Couldn't create shared memory " << name << endl;
+report.freeze( 0 );
+return 1;
+}
+char *base = 0;
+if( ftruncate( fd, h.size ) == 0 ) {
+base = (char *) mmap( 0, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+}
+close( fd );
+if( base == 0 || base == (char *) MAP_FAILED ) {
+cerr << "Couldn't map shared memory " << name << endl;
+shm_unlink( name );
+report.freeze( 0 );
+return 1;
+}
 
-mtime = mtime + 1;
-if( mtime == ntskip ) {
-mtime = 0;
+char *p = base + h.names;
+strcpy( p, bline[ 0 ] );
+p += strlen( p ) + 1;
+for( int k = 1; k <= species; k++ ) {
+strcpy( p, nameOfSpecies[ outputSpecies[ k ] ] );
+p += strlen( p ) + 1;
 }
-if( mtime == 0 || t == top ) {
-outputFile3 << setw( DEC8 ) << t;
-if( integrationOption == 4 ) {
-outputFile3 << setw( FRAC ) << xtime[ t ];
+trajectory( (double *) ( base + h.time ), (double *) ( base + h.x ), rows, species, outputSpecies + 1 );
+memcpy( base + h.report, report.str(), h.reportLength );
+report.freeze( 0 );
+// the header last, a consumer sees the magic only when all is there
+memcpy( base, &h, sizeof( h ) );
+munmap( base, h.size );
+
+return 0;
+}
+
+/*************************************************************
+*   c o l u m n   o u t p u t
+*************************************************************
+* the rows of kin_o02 as a block of kin_c02 ( kin_columns in
+* libkin.h ): a header, the names, the time column in doubles, then
+* one contiguous column per species, so that a reader maps the file
+* and takes any species without parsing
+*/
+void columnPad( ostream &out, long from, long to )
+{
+for( ; from < to; from++ ) {
+out.put( 0 );
+}
+}
+
+/**
+* Writes the block of the run to out, values of bytes bytes, 8
+* ( double ) or 4 ( float )
+*/
+void KinSolver::columns( ostream &out, int bytes )
+{
+int species = numberOfOutputSpecies;
+int rows = trajectory( 0, 0, 0 );
+double *time = new double[ rows + 1 ];
+double *x = new double[ (long) rows * species + 1 ];
+trajectory( time, x, rows, species, outputSpecies + 1 );
+
+long names = strlen( bline[ 0 ] ) + 1;
+for( int k = 1; k <= species; k++ ) {
+names += strlen( nameOfSpecies[ outputSpecies[ k ] ] ) + 1;
+}
+
+kin_columns h;
+memset( &h, 0, sizeof( h ) );
+memcpy( h.magic, "KINC", 4 );
+h.version = 1;
+h.dataSet = numberOfDataSets;
+h.species = species;
+h.rows = rows;
+h.bytes = bytes;
+h.jtime = integrationOption;
+h.ntime = true_numberOfTimeSteps;
+h.ntskip = ntskip;
+h.halted = halted;
+h.runs = ( ensemble != 0 ? ensemble->runs : 0 );
+h.time0 = true_initialTime;
+h.time1 = true_finalTime;
+h.names = shmAlign( sizeof( h ) );
+h.time = shmAlign( h.names + names );
+h.x = h.time + 8LL * rows;
+h.size = shmAlign( h.x + (long long) bytes * rows * species );
+
+out.write( (const char *) &h, sizeof( h ) );
+columnPad( out, sizeof( h ), h.names );
+out.write( bline[ 0 ], strlen( bline[ 0 ] ) + 1 );
+for( int k = 1; k <= species; k++ ) {
+out.write( nameOfSpecies[ outputSpecies[ k ] ], strlen( nameOfSpecies[ outputSpecies[ k ] ] ) + 1 );
+}
+columnPad( out, h.names + names, h.time );
+out.write( (const char *) time, 8L * rows );
+
+// a column at a time, gathered from the rows
+char *column = new char[ (long) bytes * rows + 1 ];
+for( int i = 0; i < species; i++ ) {
+for( int r = 0; r < rows; r++ ) {
+double v = x[ (long) r * species + i ];
+if( bytes == 4 ) {
+( (float *) column )[ r ] = (float) v;
 }
 else {
-outputFile3 << setw( FRAC ) << ( initialTime + t * dtime );
+( (double *) column )[ r ] = v;
 }
-//outputFile3 << setw( FRAC ) << xreac[ r ][ t ] << endl;
-outputFile3 << setw( FRAC ) << xreac[ t ][ r ] << endl;
 }
+out.write( column, (long) bytes * rows );
 }
+columnPad( out, h.x + (long long) bytes * rows * species, h.size );
 
-outputFile3 << " " << endl;
-outputFile3 << " " << endl;
+delete [] column;
+delete [] x;
+delete [] time;
+}
+
+/**
+* Writes out file kin_c02, the block of every data set
+* returns 0 when ok
+*/
+int KinSolver::outputColumnFile2( int bytes )
+{
+ofstream outputFile( kin_c02, ( numberOfDataSets == 1 ? ios::out : ios::app ) | ios::binary );
 
+if( ! outputFile ) {
+cerr << "Couldn't open output file " << kin_c02 << endl;
+return 1;
 }
-#endif
 
-outputFile3.close();
+columns( outputFile, bytes );
+outputFile.close();
 
 return 0;
 }
@@ -2878,37 +7273,14 @@ return 0;
 // --reaction forward + backward reaction 
 //   rates "vfor", "vbak" for each reaction "ireac"
 // --net production rate "vspec" for each species "ispec",
-void xrate( double vspec[], double vfor[], double vbak[], int t )
+void KinSolver::xrate( double vspec[], double vfor[], double vbak[], int t )
 {
 int nzyme = 0;
-double fmm = 0.0;
 
 // calculate each reaction's forward and backward reaction rates
 for( int r = 1; r <= numberOfReactions; r++ ) {
-
 nzyme = jkin[ r ] == 11 ? 1 :0;
-
-vfor[ r ] = forwardReactionRates[ r ];
-for( int q = ( 1 + nzyme ); q <= numberInputParticipants[ r ]; q++ ) {
-vfor[ r ] = vfor[ r ] * xspec[ t - 1 ][ iispec[ q ][ r ] ];
-}
-
-vbak[ r ] = backwardReactionRates[ r ];
-if( jkin[ r ] == 11 ) {
-vbak[ r ] = backwardReactionRates2[ r ];
-}
-
-for( int p = ( 1 + nzyme ); p <= numberOutputParticipants[ r ]; p++ ) {
-vbak[ r ] = vbak[ r ] * xspec[ t - 1 ][ iospec[ p ][ r ] ];
-}
-
-if( jkin[ r ] == 11 ) {
-fmm = xspec[ t - 1 ][ iispec[ 1 ][ r ] ]
-/ ( vfor[ r ] + vbak[ r ] + backwardReactionRates[ r ]
-+ forwardReactionRates2[ r ] );
-vfor[ r ] = fmm * forwardReactionRates2[ r ] * vfor[ r ];
-vbak[ r ] = fmm * backwardReactionRates[ r ] * vbak[ r ];
-}
+reactionRate( r, xspec[ t - 1 ], &vfor[ r ], &vbak[ r ] );
 }
 
 // calculate each species' net production rate
@@ -2931,12 +7303,69 @@ vspec[ iospec[ p ][ r ] ] = vspec[ iospec[ p ][ r ] ] + vfor[ r ]
 
 }
 
+if( momentSpecies > 0 ) {
+momentRate( vspec, t );
+}
+
+}
+
+// forward and backward rate of reaction r in state x
+inline void KinSolver::reactionRate( int r, const double x[], double *vfor, double *vbak )
+{
+int nzyme = jkin[ r ] == 11 ? 1 :0;
+double fmm = 0.0;
+
+*vfor = forwardReactionRates[ r ];
+for( int q = ( 1 + nzyme ); q <= numberInputParticipants[ r ]; q++ ) {
+*vfor = *vfor * x[ iispec[ q ][ r ] ];
+}
+
+*vbak = backwardReactionRates[ r ];
+if( jkin[ r ] == 11 ) {
+*vbak = backwardReactionRates2[ r ];
+}
+
+for( int p = ( 1 + nzyme ); p <= numberOutputParticipants[ r ]; p++ ) {
+*vbak = *vbak * x[ iospec[ p ][ r ] ];
+}
+
+if( jkin[ r ] == 11 ) {
+fmm = x[ iispec[ 1 ][ r ] ]
+/ ( *vfor + *vbak + backwardReactionRates[ r ]
++ forwardReactionRates2[ r ] );
+*vfor = fmm * forwardReactionRates2[ r ] * *vfor;
+*vbak = fmm * backwardReactionRates[ r ] * *vbak;
+}
+}
+
+/*
+* the net rate vfor - vbak of reaction r in state x ( a row of xspec ),
+* for kin_o03 after the run: the rate law of xrate(), of the stochastic
+* methods the propensities of the two channels
+*/
+double KinSolver::flux( int r, const double x[] )
+{
+if( ssaNet != 0 && ( isStochasticMethod( integrationOption ) || isFspMethod( integrationOption ) ) ) {
+return ssaPropensity( ssaNet, 2 * r - 1, x ) - ssaPropensity( ssaNet, 2 * r, x );
+}
+double vfor = 0.0;
+double vbak = 0.0;
+reactionRate( r, x, &vfor, &vbak );
+return vfor - vbak;
+}
+
+// wall clock seconds
+double wallClock()
+{
+struct timeval tv;
+gettimeofday( &tv, 0 );
+return tv.tv_sec + 1.0e-6 * tv.tv_usec;
 }
 
 //removes the spaces of a string of characters
 char* trim( const char *str )
 {
-static char ret[ LINE ] = { 0 };
+char ret[ LINE ] = { 0 };
 int q = 0;
 
 for( int i = 0; i < strlen( str ); i++ ) {
@@ -2945,21 +7374,24 @@ ret[ q++ ] = str[ i ];
 }
 }
 ret[ q ] = 0;
-char * value = new char[ q ];
+char * value = new char[ q + 1 ];
 strcpy( value, ret );
 return value;
 }
 
 // returns the index where the specie name is 
-int ispec4name( const char *name2look )
+int KinModel::ispec4name( const char *name2look )
 {
 int index = 0;
 if( name2look != 0 ) {
 for( int i = 1; i <= numberOfSpecies && index == 0; i++ ) {
-if( strstr( nameOfSpecies[ i ], name2look ) != NULL 
-&& strstr( name2look, trim( nameOfSpecies[ i ] ) ) != NULL ) {
+if( strstr( nameOfSpecies[ i ], name2look ) != NULL ) {
+char *name = trim( nameOfSpecies[ i ] );
+if( strstr( name2look, name ) != NULL ) {
 index = i;
 }
+delete [] name;
+}
 }
 }
 if( index == 0 ) {
@@ -2987,20 +7419,21 @@ return number;
 *************************************************************
 * Clears up memory allocated with 'new'
 */
-void freeMemory()
+KinModel::~KinModel()
 {
-for( int i = 0; i < ( 10 + MAX_NUMBER_REACTIONS ); i++ ) {
+for( int i = 0; i < ( 10 + reactionRows ); i++ ) {
 if( bline[ i ] != 0 ) { 
 delete [] bline[ i ];
 }
 }
+delete [] bline;
 for( int i = 0; i < ( 1 + MAX_NUMBER_SPECIES ); i++ ) {
 if( nameOfSpecies[ i ] != 0 ) {
 delete [] nameOfSpecies[ i ];
 }
 }
 for( int i = 0; i < ( MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ); i++ ) {
-for( int j = 0; j < ( MAX_NUMBER_REACTIONS + 1 ); j++ ) {
+for( int j = 0; nameOfInputSpecies[ i ] != 0 && j < ( reactionRows + 1 ); j++ ) {
 if( nameOfOutputSpecies[ i ][ j ] != 0 ) {
 delete [] nameOfOutputSpecies[ i ][ j ];
 }
@@ -3008,29 +7441,197 @@ if( nameOfInputSpecies[ i ][ j ] != 0 ) {
 delete [] nameOfInputSpecies[ i ][ j ];
 }
 }
+delete [] nameOfInputSpecies[ i ];
+delete [] nameOfOutputSpecies[ i ];
+delete [] iispec[ i ];
+delete [] iospec[ i ];
 }
-for( int i = 0; i < ( MAX_NUMBER_TIME_STEPS + 10 ); i++ ) {
+delete [] numberInputParticipants;
+delete [] numberOutputParticipants;
+delete [] jkin;
+delete [] fluxReaction;
+delete [] forwardReactionRates;
+delete [] backwardReactionRates;
+delete [] forwardReactionRates2;
+delete [] backwardReactionRates2;
+delete [] intg_initialTime;
+delete [] intg_finalTime;
+delete [] intg_dtime;
+delete [] intg_numberOfTimeSteps;
+delete [] selectLine;
+freessa();
+}
+
+/*
+* takes over the model ( see kin.h ), the big matrices are
+* allocated by initializeBigMatrices() and run()
+*/
+KinSolver::KinSolver( const KinModel *m )
+{
+model = m;
+
+numberOfDataSets = m->numberOfDataSets;
+numberOfSpecies = m->numberOfSpecies;
+numberOfReactions = m->numberOfReactions;
+true_numberOfTimeSteps = m->true_numberOfTimeSteps;
+integrationOption = m->integrationOption;
+ntskip = m->ntskip;
+true_initialTime = m->true_initialTime;
+true_finalTime = m->true_finalTime;
+bline = m->bline;
+nameOfSpecies = m->nameOfSpecies;
+nameOfInputSpecies = m->nameOfInputSpecies;
+nameOfOutputSpecies = m->nameOfOutputSpecies;
+extOfSpecies = m->extOfSpecies;
+oneCycle = m->oneCycle;
+slopeTrap = m->slopeTrap;
+iispec = m->iispec;
+iospec = m->iospec;
+jfix = m->jfix;
+npulse = m->npulse;
+numberInputParticipants = m->numberInputParticipants;
+numberOutputParticipants = m->numberOutputParticipants;
+jkin = m->jkin;
+initialConcentration = m->initialConcentration;
+forwardReactionRates = m->forwardReactionRates;
+backwardReactionRates = m->backwardReactionRates;
+forwardReactionRates2 = m->forwardReactionRates2;
+backwardReactionRates2 = m->backwardReactionRates2;
+extFlag = m->extFlag;
+numOfIntegrations = m->numOfIntegrations;
+whichExt = m->whichExt;
+intg_initialTime = m->intg_initialTime;
+intg_finalTime = m->intg_finalTime;
+intg_dtime = m->intg_dtime;
+intg_numberOfTimeSteps = m->intg_numberOfTimeSteps;
+ssaSeed = m->ssaSeed;
+tauEpsilon = m->tauEpsilon;
+ensembleRuns = m->ensembleRuns;
+ensembleThreads = m->ensembleThreads;
+numberOfQuantiles = m->numberOfQuantiles;
+quantile = m->quantile;
+fspTolerance = m->fspTolerance;
+fspMaxStates = m->fspMaxStates;
+momentClosure = m->momentClosure;
+outputPoints = m->outputPoints;
+pointMethod = m->pointMethod;
+fluxReactions = m->fluxReactions;
+fluxReaction = m->fluxReaction;
+fluxExtents = m->fluxExtents;
+momentSpecies = m->momentSpecies;
+ssaNet = m->ssaNet;
+numberOfOutputSpecies = m->numberOfOutputSpecies;
+outputSpecies = m->outputSpecies;
+outputMask = m->outputMask;
+
+initialTime = true_initialTime;
+finalTime = true_finalTime;
+numberOfTimeSteps = true_numberOfTimeSteps;
+dtime = ( finalTime - initialTime ) / numberOfTimeSteps;
+timeRows = 0;
+xspec = 0;
+#ifndef OPTIMIZE
+xreac = 0;
+#endif
+xtime = 0;
+xtime_index = 0;
+intg_xtime_index = 0;
+intg_xspec = 0;
+intg_xtime = 0;
+for( int q = 0; q <= MAX_NUMBER_PARTICIPANT_REACTIONS; q++ ) {
+indexOfInputSpecies[ q ] = 0;
+indexOfOutputSpecies[ q ] = 0;
+}
+reactionWork = 0;
+ensemble = 0;
+fsp = 0;
+momentWork = 0;
+streamRow = 0;
+streamProgress = 0;
+streamUser = 0;
+streamNext = 0;
+streamMtime = -1;
+streamDone = 0.0;
+streamSelected = 0;
+if( numberOfOutputSpecies < numberOfSpecies ) {
+streamSelected = new double[ numberOfOutputSpecies ];
+}
+cancelRequested = 0;
+deadline = 0.0;
+runStart = 0.0;
+halted = 0;
+outputDigits = 7;
+background = 0;
+timeMajor = 0;
+writer = 0;
+picked = 0;
+observeTime = 0;
+observeX = 0;
+observeCount = 0;
+observeDone = 0;
+observeNext = 0;
+observeRing = 0;
+
+seedRandom( &ssaRandom, ssaSeed );
+if( isFspMethod( integrationOption ) ) {
+setfsp();
+}
+if( momentSpecies > 0 ) {
+setmomentwork();
+}
+}
+
+KinSolver::~KinSolver()
+{
+delete [] streamSelected;
+if( observeRing != 0 ) {
+for( int k = 0; k <= OBSERVE_RING; k++ ) {
+delete [] observeRing[ k ];
+}
+delete [] observeRing;
+}
+else if( xspec != 0 ) {
+for( int i = 0; i < timeRows; i++ ) {
 delete [] xspec[ i ];
 }
+}
 delete [] xspec;
 #ifndef OPTIMIZE
-for( int i = 0; i < ( MAX_NUMBER_TIME_STEPS + 10 ); i++ ) {
+if( xreac != 0 ) {
+for( int i = 0; i < timeRows; i++ ) {
 delete [] xreac[ i ];
 }
 delete [] xreac;
+}
 #endif
 delete [] xtime;
 
-delete [] jfix;
-delete [] numberInputParticipants;
-delete [] numberOutputParticipants;
-delete [] jkin;
-delete [] initialConcentration;
-delete [] forwardReactionRates;
-delete [] backwardReactionRates;
-delete [] forwardReactionRates2;
-delete [] backwardReactionRates2;
+if( intg_xspec != 0 ) {
+for( int i = 1; i <= numOfIntegrations; i++ ) {
+if( intg_xspec[ i ] == 0 ) {
+continue;
+}
+for( int j = 0; j <= intg_xtime_index[ i ]; j++ ) {
+delete [] intg_xspec[ i ][ j ];
+}
+delete [] intg_xspec[ i ];
+delete [] intg_xtime[ i ];
+}
+delete [] intg_xspec;
+delete [] intg_xtime;
+delete [] intg_xtime_index;
+}
+for( int q = 0; q <= MAX_NUMBER_PARTICIPANT_REACTIONS; q++ ) {
+delete [] indexOfInputSpecies[ q ];
+delete [] indexOfOutputSpecies[ q ];
+}
+delete [] reactionWork;
 
+freeEnsemble();
+freefsp();
+freemoments();
+writerFree( writer );
+freePoints();
 }
 
 /*************************************************************
@@ -3151,3 +7752,481 @@ return cmpresult;
 
 
 
+
+/*************************************************************
+*   l i b k i n
+*************************************************************
+* the C interface of libkin.h: models from kin.i01, from memory or
+* built call by call, solvers whose results come back in buffers
+*/
+
+// copy of a line for bline[] and the name tables
+char *kinCopy( const char *text )
+{
+char *copy = new char[ strlen( text ) + 1 ];
+strcpy( copy, text );
+return copy;
+}
+
+void kin_lsodes( const char *lsodes, const char *output, const char *include )
+{
+lsodesArgv = (char *) lsodes;
+outputArgv = (char *) output;
+includeArgv = (char *) include;
+}
+
+/*
+* every file name of the session as dir/name, or in the working
+* directory again for dir 0 or ""
+*/
+int kin_session( const char *dir )
+{
+const char *names[] = { "kin.i01", "kin.o01", "kin.o02", "kin.o03", "kin.o04", "kin.b02", "kin.c02", "tmp.f" };
+char *paths[] = { kin_i01, kin_o01, kin_o02, kin_o03, kin_o04, kin_b02, kin_c02, tmp_f };
+int n = ( dir == 0 ? 0 : strlen( dir ) );
+if( n + 10 > MAX_PATH ) {
+cerr << "Session directory too long: " << dir << endl;
+return 1;
+}
+for( int k = 0; k < 8; k++ ) {
+if( n == 0 ) {
+strcpy( paths[ k ], names[ k ] );
+}
+else {
+sprintf( paths[ k ], "%s/%s", dir, names[ k ] );
+}
+}
+return 0;
+}
+
+kin_model *kin_model_load( int dataSet )
+{
+KinModel *model = new KinModel;
+model->numberOfDataSets = dataSet - 1;
+if( model->readInputData() != 0 || model->compile() != 0 ) {
+delete model;
+return 0;
+}
+return model;
+}
+
+kin_model *kin_model_read( const char *text, long length, int dataSet )
+{
+KinModel *model = new KinModel;
+model->numberOfDataSets = dataSet - 1;
+istrstream inputFile( text, length );
+if( model->readInputData( inputFile ) != 0 || model->compile() != 0 ) {
+delete model;
+return 0;
+}
+return model;
+}
+
+kin_model *kin_model_new( const char *title, int species, int reactions )
+{
+if( species < 1 || species > MAX_NUMBER_SPECIES ) {
+cerr << "ERROR: " << species << " species, at most " << MAX_NUMBER_SPECIES << endl;
+return 0;
+}
+if( reactions < 0 || reactions > MAX_NUMBER_REACTIONS ) {
+cerr << "ERROR: " << reactions << " reactions, at most " << MAX_NUMBER_REACTIONS << endl;
+return 0;
+}
+
+KinModel *model = new KinModel;
+model->numberOfDataSets = 1;
+model->numberOfSpecies = species;
+model->numberOfReactions = reactions;
+model->ntskip = 1;
+model->integrationOption = 1;
+model->reactionTables();
+
+char line[ LINE ];
+sprintf( line, "data set %.50s", title != 0 ? title : "" );
+model->bline[ 0 ] = kinCopy( line );
+model->bline[ 1 ] = kinCopy( "nspec     nreac" );
+model->bline[ 2 ] = kinCopy( "            time0         time1        ntime        ntskip       jtime" );
+model->bline[ 3 ] = kinCopy( "         namespec/xspec0       jfix" );
+for( int r = 1; r <= reactions; r++ ) {
+sprintf( line, "R%-7d rkfor       rkbak       nipart       nopart       jkin", r );
+model->bline[ 3 + r ] = kinCopy( line );
+}
+return model;
+}
+
+int kin_model_time( kin_model *model, double time0, double time1,
+int ntime, int ntskip, int jtime )
+{
+if( ntime < 1 || ntime > MAX_NUMBER_TIME_STEPS ) {
+cerr << "ERROR: " << ntime << " time steps, at most " << MAX_NUMBER_TIME_STEPS << endl;
+return 1;
+}
+model->true_initialTime = time0;
+model->true_finalTime = time1;
+model->true_numberOfTimeSteps = ntime;
+model->ntskip = ntskip > 0 ? ntskip : 1;
+model->integrationOption = jtime;
+return 0;
+}
+
+int kin_model_species( kin_model *model, int i, const char *name,
+double xspec0, int jfix )
+{
+if( i < 1 || i > model->numberOfSpecies || name == 0 ) {
+cerr << "ERROR: no species " << i << endl;
+return 1;
+}
+if( jfix != 0 && jfix != 1 ) {
+cerr << "ERROR: jfix=" << jfix << " of " << name << ", pulses need kin.i01 text" << endl;
+return 1;
+}
+if( model->nameOfSpecies[ i ] != 0 ) {
+delete [] model->nameOfSpecies[ i ];
+}
+model->nameOfSpecies[ i ] = kinCopy( name );
+model->initialConcentration[ i ] = xspec0;
+model->jfix[ i ] = jfix;
+return 0;
+}
+
+int kin_model_reaction( kin_model *model, int r, double rkfor, double rkbak,
+int jkin, int nipart, const char *const reactants[],
+int nopart, const char *const products[] )
+{
+if( r < 1 || r > model->numberOfReactions ) {
+cerr << "ERROR: no reaction " << r << endl;
+return 1;
+}
+if( nipart < 0 || nipart > MAX_NUMBER_PARTICIPANT_REACTIONS
+|| nopart < 0 || nopart > MAX_NUMBER_PARTICIPANT_REACTIONS ) {
+cerr << "ERROR: At reaction : " << r << " nipart=" << nipart;
+cerr << ", nopart=" << nopart << endl;
+return 1;
+}
+model->forwardReactionRates[ r ] = rkfor;
+model->backwardReactionRates[ r ] = rkbak;
+model->jkin[ r ] = jkin;
+model->numberInputParticipants[ r ] = nipart;
+model->numberOutputParticipants[ r ] = nopart;
+for( int q = 1; q <= nipart; q++ ) {
+if( model->nameOfInputSpecies[ q ][ r ] != 0 ) {
+delete [] model->nameOfInputSpecies[ q ][ r ];
+}
+model->nameOfInputSpecies[ q ][ r ] = kinCopy( reactants[ q - 1 ] );
+}
+for( int p = 1; p <= nopart; p++ ) {
+if( model->nameOfOutputSpecies[ p ][ r ] != 0 ) {
+delete [] model->nameOfOutputSpecies[ p ][ r ];
+}
+model->nameOfOutputSpecies[ p ][ r ] = kinCopy( products[ p - 1 ] );
+}
+return 0;
+}
+
+int kin_model_reaction2( kin_model *model, int r, double rkfor2, double rkbak2 )
+{
+if( r < 1 || r > model->numberOfReactions ) {
+cerr << "ERROR: no reaction " << r << endl;
+return 1;
+}
+model->forwardReactionRates2[ r ] = rkfor2;
+model->backwardReactionRates2[ r ] = rkbak2;
+return 0;
+}
+
+int kin_model_option( kin_model *model, const char *line )
+{
+if( model->compiled ) {
+cerr << "ERROR: option after compile: " << line << endl;
+return 1;
+}
+model->readOption( line );
+return 0;
+}
+
+int kin_model_compile( kin_model *model )
+{
+for( int i = 1; i <= model->numberOfSpecies; i++ ) {
+if( model->nameOfSpecies[ i ] == 0 ) {
+cerr << "ERROR: species " << i << " not given" << endl;
+return 1;
+}
+}
+for( int r = 1; r <= model->numberOfReactions; r++ ) {
+if( model->numberInputParticipants[ r ] + model->numberOutputParticipants[ r ] == 0 ) {
+cerr << "ERROR: reaction " << r << " not given" << endl;
+return 1;
+}
+}
+if( model->true_numberOfTimeSteps < 1 ) {
+cerr << "ERROR: time steps not given" << endl;
+return 1;
+}
+return model->compile();
+}
+
+int kin_model_rate( kin_model *model, int r, double rkfor, double rkbak )
+{
+return model->setrate( r, rkfor, rkbak );
+}
+
+int kin_model_species_count( const kin_model *model )
+{
+return model->numberOfSpecies;
+}
+
+const char *kin_model_species_name( const kin_model *model, int i )
+{
+if( i < 1 || i > model->numberOfSpecies ) {
+return 0;
+}
+return model->nameOfSpecies[ i ];
+}
+
+int kin_model_output_species( const kin_model *model, int species[] )
+{
+if( species != 0 ) {
+for( int k = 1; k <= model->numberOfOutputSpecies; k++ ) {
+species[ k - 1 ] = model->outputSpecies[ k ];
+}
+}
+return model->numberOfOutputSpecies;
+}
+
+void kin_model_free( kin_model *model )
+{
+delete model;
+}
+
+kin_solver *kin_solver_new( const kin_model *model )
+{
+if( ! model->compiled ) {
+cerr << "ERROR: model not compiled" << endl;
+return 0;
+}
+KinSolver *solver = new KinSolver( model );
+if( solver->initializeBigMatrices() != 0 ) {
+delete solver;
+return 0;
+}
+return solver;
+}
+
+int kin_solver_run( kin_solver *solver )
+{
+solver->run();
+return solver->halted;
+}
+
+void kin_solver_cancel( kin_solver *solver )
+{
+solver->cancelRequested = 1;
+}
+
+void kin_solver_deadline( kin_solver *solver, double seconds )
+{
+solver->deadline = seconds;
+}
+
+void kin_solver_background( kin_solver *solver, int on )
+{
+solver->background = on;
+}
+
+int kin_solver_observe( kin_solver *solver, const double time[], int n, double x[] )
+{
+return solver->observe( time, n, x );
+}
+
+void kin_solver_time_major( kin_solver *solver, int on )
+{
+solver->timeMajor = on;
+}
+
+int kin_solver_digits( kin_solver *solver, int digits )
+{
+if( digits < 1 || digits > 17 ) {
+cerr << "ERROR: " << digits << " digits, 1 .. 17" << endl;
+return 1;
+}
+solver->outputDigits = digits;
+return 0;
+}
+
+double kin_solver_flux( kin_solver *solver, int r, const double x[] )
+{
+double row[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
+if( r < 1 || r > solver->numberOfReactions ) {
+cerr << "ERROR: no reaction " << r << endl;
+return 0.0;
+}
+for( int i = 1; i <= solver->numberOfSpecies; i++ ) {
+row[ i ] = x[ i - 1 ];
+}
+return solver->flux( r, row );
+}
+
+int kin_solver_trajectory( kin_solver *solver, double time[], double x[], int rows )
+{
+return solver->trajectory( time, x, rows );
+}
+
+long kin_solver_report( kin_solver *solver, char *text, long size )
+{
+ostrstream outputFile2;
+if( solver->integrationOption != 6 ) {
+if( solver->ensemble != 0 ) {
+solver->outputEnsembleFile2( outputFile2 );
+}
+else {
+solver->outputDataFile2( outputFile2 );
+}
+}
+long length = outputFile2.pcount();
+char *str = outputFile2.str();
+if( size > 0 ) {
+long n = length < size - 1 ? length : size - 1;
+memcpy( text, str, n );
+text[ n ] = 0;
+}
+outputFile2.freeze( 0 );
+return length;
+}
+
+void kin_solver_stream( kin_solver *solver, kin_row_fn row,
+kin_progress_fn progress, void *user )
+{
+solver->streamRow = row;
+solver->streamProgress = progress;
+solver->streamUser = user;
+}
+
+long kin_solver_pack( kin_solver *solver, char *data, long size )
+{
+ostrstream frame;
+if( solver->integrationOption != 6 ) {
+solver->pack( frame );
+}
+long length = frame.pcount();
+char *str = frame.str();
+if( size > 0 ) {
+memcpy( data, str, length < size ? length : size );
+}
+frame.freeze( 0 );
+return length;
+}
+
+int kin_solver_write_packed( kin_solver *solver )
+{
+if( solver->integrationOption == 6 ) {
+return 0;
+}
+return solver->outputPackedFile2();
+}
+
+int kin_solver_write_columns( kin_solver *solver, int bytes )
+{
+if( bytes != 8 && bytes != 4 ) {
+cerr << "ERROR: columns of " << bytes << " byte values, 8 or 4" << endl;
+return 1;
+}
+if( solver->integrationOption == 6 ) {
+return 0;
+}
+return solver->outputColumnFile2( bytes );
+}
+
+const kin_columns *kin_columns_find( const void *data, long length, int dataSet )
+{
+const char *p = (const char *) data;
+while( length >= (long) sizeof( kin_columns ) ) {
+const kin_columns *h = (const kin_columns *) p;
+if( memcmp( h->magic, "KINC", 4 ) != 0 || h->size < (long long) sizeof( kin_columns )
+|| h->size > length ) {
+return 0;
+}
+if( h->dataSet == dataSet ) {
+return h;
+}
+p += h->size;
+length -= h->size;
+}
+return 0;
+}
+
+int kin_solver_publish( kin_solver *solver, const char *name, int packed )
+{
+if( solver->integrationOption == 6 ) {
+cerr << "ERROR: lsodes writes its own output, nothing to publish" << endl;
+return 1;
+}
+return solver->publish( name, packed );
+}
+
+const kin_shm *kin_shm_attach( const char *name )
+{
+int fd = shm_open( name, O_RDONLY, 0 );
+if( fd < 0 ) {
+return 0;
+}
+struct stat st;
+void *base = MAP_FAILED;
+if( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( kin_shm ) ) {
+base = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+}
+close( fd );
+if( base == MAP_FAILED ) {
+return 0;
+}
+const kin_shm *h = (const kin_shm *) base;
+if( memcmp( h->magic, "KINS", 4 ) != 0 || h->size != st.st_size ) {
+munmap( base, st.st_size );
+return 0;
+}
+return h;
+}
+
+void kin_shm_detach( const kin_shm *shm )
+{
+munmap( (void *) shm, shm->size );
+}
+
+double kin_model_cost( const kin_model *model )
+{
+return model->cost();
+}
+
+int kin_model_estimate( const kin_model *model, kin_estimate *estimate )
+{
+if( ! model->compiled ) {
+cerr << "ERROR: model not compiled" << endl;
+return 1;
+}
+model->estimate( estimate );
+return 0;
+}
+
+long kin_model_key( const kin_model *model, char *text, long size )
+{
+ostrstream key;
+model->canonical( key );
+long length = key.pcount();
+char *str = key.str();
+if( size > 0 ) {
+long n = length < size - 1 ? length : size - 1;
+memcpy( text, str, n );
+text[ n ] = 0;
+}
+key.freeze( 0 );
+return length;
+}
+
+int kin_solver_write( kin_solver *solver )
+{
+return solver->output();
+}
+
+void kin_solver_free( kin_solver *solver )
+{
+delete solver;
+}
@@ -8,6 +8,9 @@
 #ifndef __kin_h__
 #define __kin_h__
 
+#include <iostream.h>
+#include "libkin.h"
+
 
  #define OPTIMIZE 
 
@@ -26,82 +29,32 @@
 //c Version 1.1, 00-05-17
 
       const int MAX_NUMBER_SPECIES   = 200;
-      const int MAX_NUMBER_REACTIONS = 250;
+      const int MAX_NUMBER_REACTIONS = 5000; //250, a limit only, the tables take numberOfReactions
       const int MAX_NUMBER_PARTICIPANT_REACTIONS = 10;
       const int MAX_NUMBER_TIME_STEPS = 100000; //20000
       const int MAX_PATH = 200;
 
       const int MAX_NUMBER_PULSE = 10;
 
-      char tmpLine[ 72 ] = { 0 };
-
-      char *bline[ 10 + MAX_NUMBER_REACTIONS ] = { 0 };
-      char *nameOfSpecies[ MAX_NUMBER_SPECIES + 1 ] = { 0 };               
-      char *nameOfInputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-      char *nameOfOutputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-
-      int indexOfInputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-      int indexOfOutputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-
-      double diffSpecies[ MAX_NUMBER_SPECIES + 1 ] = { 0.0 };               
-
-      double extOfSpecies[MAX_NUMBER_SPECIES + 1][2*MAX_NUMBER_PULSE + 2 + 1] = {0.0};
-      double oneCycle[MAX_NUMBER_SPECIES + 1] = {0.0};
-      double slopeTrap[MAX_NUMBER_SPECIES + 1][MAX_NUMBER_PULSE+1];
-
-      int numberOfDataSets;
-      int numberOfSpecies, numberOfReactions;
-      int numberOfTimeSteps;
-      int true_numberOfTimeSteps;
-      int integrationOption;
-      int ntskip;
-
-      int iispec[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-      int iospec[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ][ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-
-      int *jfix = new int[ MAX_NUMBER_SPECIES + 1 ];
-      int *npulse = new int[ MAX_NUMBER_SPECIES + 1 ];
-      int *numberInputParticipants = new int[ MAX_NUMBER_REACTIONS + 1 ];
-      int *numberOutputParticipants = new int[ MAX_NUMBER_REACTIONS + 1 ];
-      int *jkin = new int[ MAX_NUMBER_REACTIONS + 1 ];
-
-//      int jfix[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-//      int numberInputParticipants[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-//      int numberOutputParticipants[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-//      int jkin[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-
-      double initialTime, finalTime, dtime;
-      double true_initialTime, true_finalTime, true_dtime;
-
-      double *initialConcentration = new double[ MAX_NUMBER_SPECIES + 1 ];
-//      double initialConcentration[ MAX_NUMBER_SPECIES + 1 ] = { 0 };
-
-//      double xspec[ MAX_NUMBER_SPECIES + 1 ][ MAX_NUMBER_TIME_STEPS + 1 ] = { 0 };
-//      double xreac[ MAX_NUMBER_REACTIONS + 1 ][ MAX_NUMBER_TIME_STEPS + 1 ] = { 0 };
-      double **xspec;
-#ifndef OPTIMIZE
-      double **xreac;
-#endif
-
-      double *xtime;
-      int xtime_index;
+      const int MAX_NUMBER_QUANTILES = 9;
 
-//      double forwardReactionRates[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-//      double backwardReactionRates[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-//      double forwardReactionRates2[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-//      double backwardReactionRates2[ MAX_NUMBER_REACTIONS + 1 ] = { 0 };
-      double *forwardReactionRates = new double[ MAX_NUMBER_REACTIONS + 1 ];
-      double *backwardReactionRates = new double[ MAX_NUMBER_REACTIONS + 1 ];
-      double *forwardReactionRates2 = new double[ MAX_NUMBER_REACTIONS + 1 ];
-      double *backwardReactionRates2 = new double[ MAX_NUMBER_REACTIONS + 1 ];
+   // option line "points <n> [ lttb | minmax ]"
+   const int POINTS_LTTB = 0;
+   const int POINTS_MINMAX = 1;
+      const int MAX_LINE = 72;
 
-   const char *kin_i01 = "kin.i01";
-   const char *kin_o01 = "kin.o01";
-   const char *kin_o02 = "kin.o02";
-   const char *kin_o03 = "kin.o03";
+   // the files, in the working directory unless kin_session() put
+   // them into another
+   char kin_i01[ MAX_PATH+2 ] = "kin.i01";
+   char kin_o01[ MAX_PATH+2 ] = "kin.o01";
+   char kin_o02[ MAX_PATH+2 ] = "kin.o02";
+   char kin_o03[ MAX_PATH+2 ] = "kin.o03";
+   char kin_o04[ MAX_PATH+2 ] = "kin.o04";
+   char kin_b02[ MAX_PATH+2 ] = "kin.b02";
+   char kin_c02[ MAX_PATH+2 ] = "kin.c02";
 
    //filename for Fortran file of lsodes
-   const char *tmp_f = "tmp.f";
+   char tmp_f[ MAX_PATH+2 ] = "tmp.f";
    const double rtolLSODES = 1.0e-6;
    const double atolLSODES = 1.0e-12;
    const int mfLSODES = 222;
@@ -129,53 +82,465 @@
    };
 
 
-//for lsodes, argv value
+//for lsodes, argv value ( set once by main, read only afterwards )
    char *lsodesArgv = new char[MAX_NUMBER_SPECIES+2];
    char *outputArgv = new char[MAX_PATH+2];
    char *includeArgv = new char[MAX_PATH+2];
 
+   //todo for pulse, just use this
+   const int MIN_numberOfTimeSteps = 100;
+
+   // start of stochastic simulation (jtime=7,8,9)
+   // species counts are the rounded xspec0 values and rkfor/rkbak are
+   // used as stochastic rate constants, so the mean follows the ODEs
+   // for unit volume
+   struct KinRandom {
+      unsigned long long s[ 4 ];
+   };
+
+   // one channel per direction: 2r-1 forward, 2r backward of reaction r,
+   // the lists are stored CSR style ( xxxStart[ c ] .. xxxStart[ c+1 ]-1 )
+   struct SsaNetwork {
+      int     channels;
+      double *rate;
+      int    *reaction;
+      int    *reactantStart;
+      int    *reactantSpecies;
+      int    *reactantOrder;     // multiplicity of the reactant
+      int    *changeStart;
+      int    *changeSpecies;
+      int    *changeDelta;
+      int    *dependStart;       // channels to update after channel fired
+      int    *dependChannel;
+      int    *speciesStart;      // channels whose propensity reads species
+      int    *speciesChannel;
+   };
+
+   // composition-rejection groups: channel c with propensity in
+   // [ 2^(e-1), 2^e ) lives in group e + SSA_GROUP_OFFSET
+   const int SSA_GROUP_OFFSET = 1100;
+   const int SSA_GROUPS = 2200;
+   const int SSA_RESUM = 65536;
+   const int SSA_STOP_CHECK = 1024;  // events between stop checks
+
+   struct SsaGroups {
+      double  sum[ SSA_GROUPS ];
+      int     count[ SSA_GROUPS ];
+      int     capacity[ SSA_GROUPS ];
+      int    *member[ SSA_GROUPS ];
+      int     lowest, highest;   // occupied range
+      int    *groupOf;           // per channel, -1 when propensity is 0
+      int    *position;          // per channel, index in member[]
+   };
+
+   const unsigned long long SSA_DEFAULT_SEED = 20041110ULL;
+
+   // tau-leaping (jtime=8)
+   const double TAU_DEFAULT_EPSILON = 0.03;
+   const double TAU_CRITICAL = 10.0;      // n_c of Cao et al.
+   const int TAU_SSA_STEPS = 100;
+   const double POISSON_PTRS_MEAN = 10.0;
+
+   // P-square estimate of one quantile
+   struct P2Quantile {
+      double height[ 5 ];
+      int    position[ 5 ];
+      int    count;
+   };
+
+   // online statistics of an ensemble on the output grid: the mean
+   // of every species, the spread of the output species ( "select" )
+   struct EnsembleStats {
+      int         outputs;
+      int        *outputIndex;    // time step of each output
+      int         runs;           // realizations folded so far
+      double    **mean;           // [ output ][ species ]
+      double    **m2;             // [ output ][ output species ], sum of
+                                  // squared deviations ( Welford )
+      P2Quantile *quant;          // [ output ][ output species ][ quantile ]
+   };
+
+   // finite state projection of the master equation (jtime=9)
+   const double FSP_DEFAULT_TOLERANCE = 1.0e-6;
+   const int FSP_DEFAULT_STATES = 100000;
+   const int FSP_MIN_BOUND = 16;
+   const int FSP_KRYLOV = 30;
+   const double FSP_KRYLOV_TOLERANCE = 1.0e-10;
+   const double FSP_BREAKDOWN = 1.0e-7;
+   const int FSP_REJECTIONS = 20;
+
+   // states are the counts of the free ( jfix=0 ) species, stored
+   // row by row in count[], found again through a hash table
+   struct FspSpace {
+      int     species;
+      int    *speciesIndex;   // free species -> kin species
+      int    *freeIndex;      // kin species -> free species, -1 fixed
+      int    *bound;          // box of the projection
+      int    *hit;            // bound was reached by a channel
+      int     states;
+      int     capacity;
+      int    *count;
+      double *p;
+      int     hashSize;
+      int    *hashHead;
+      int    *hashNext;
+      int    *rowStart;       // generator A, rows by target state
+      int    *column;
+      double *value;
+      double  norm;           // infinity norm of A
+      double  step;           // last Krylov step
+      int     warned;
+   };
+   // end of stochastic simulation
+
+   // moment equations, the second moments follow the species
+   // ( option line "moments lna|normal" )
+   const int MOMENT_LNA = 1;
+   const int MOMENT_NORMAL = 2;
+   const int MOMENT_MAX_READ = 2 * MAX_NUMBER_PARTICIPANT_REACTIONS + 2;
+
+   struct MomentWork {
+      double  *mean;
+      double  *rate;
+      double  *product;
+      double **cov;
+      double **dcov;
+   };
+   // end of moment equations
+
+
+   struct EnsembleJob;
+   struct KinWriter;
+
+/*
+* KinModel: one data set of kin.i01, read by readInputData() and
+* compiled once by compile(). Nothing changes it afterwards, so
+* any number of KinSolvers ( also in several threads ) share it.
+*/
+   struct KinModel {
+      int numberOfDataSets;      // data sets read so far
+      int numberOfSpecies, numberOfReactions;
+      int true_numberOfTimeSteps;
+      int integrationOption;
+      int ntskip;
+      double true_initialTime, true_finalTime;
+
+      char tmpLine[ MAX_LINE ];
+
+      // the tables of the reactions have numberOfReactions + 1
+      // entries, [ q ][ r ] a row per participant q ( reactionTables )
+      int reactionRows;          // reactions they have room for
+      char **bline;              // 10 + reactionRows lines
+      char *nameOfSpecies[ MAX_NUMBER_SPECIES + 1 ];
+      char **nameOfInputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+      char **nameOfOutputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+
+      double extOfSpecies[MAX_NUMBER_SPECIES + 1][2*MAX_NUMBER_PULSE + 2 + 1];
+      double oneCycle[MAX_NUMBER_SPECIES + 1];
+      double slopeTrap[MAX_NUMBER_SPECIES + 1][MAX_NUMBER_PULSE+1];
+
+      int *iispec[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+      int *iospec[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+
+      int jfix[ MAX_NUMBER_SPECIES + 1 ];
+      int npulse[ MAX_NUMBER_SPECIES + 1 ];
+      int *numberInputParticipants;
+      int *numberOutputParticipants;
+      int *jkin;
+
+      double initialConcentration[ MAX_NUMBER_SPECIES + 1 ];
+
+      double *forwardReactionRates;
+      double *backwardReactionRates;
+      double *forwardReactionRates2;
+      double *backwardReactionRates2;
+
+      // start of external control
+      bool extFlag;
+      int numOfIntegrations;
+      int numofcycle;
+      //todo only for one external control
+      int whichExt;
+      double* intg_initialTime;
+      double* intg_finalTime;
+      double* intg_dtime;
+      int* intg_numberOfTimeSteps;
+      // end of external control
+
+      // option lines after the reactions
+      unsigned long long ssaSeed;
+      double tauEpsilon;
+      int ensembleRuns;
+      int ensembleThreads;       // 0: one per processor
+      int numberOfQuantiles;
+      double quantile[ MAX_NUMBER_QUANTILES + 1 ];
+      double fspTolerance;
+      int fspMaxStates;
+      int momentClosure;
+      int outputPoints;          // rows per species of kin_o02, 0 ntskip
+      int pointMethod;           // POINTS_LTTB, POINTS_MINMAX
+      int fluxReactions;         // reactions of kin_o03, 0 none
+      int *fluxReaction;
+      int fluxExtents;           // kin_o03 also integrates them
+      char *selectLine;          // the "select" line, 0 all species
+
+      int momentSpecies;         // species before the moments, 0 off
+      SsaNetwork *ssaNet;        // channel tables of jtime=7,8,9
+      int numberOfOutputSpecies; // species of kin_o02, by setselect()
+      int outputSpecies[ MAX_NUMBER_SPECIES + 1 ];
+      char outputMask[ MAX_NUMBER_SPECIES + 1 ];
+      int compiled;
+
+      KinModel();
+      ~KinModel();
+      void reactionTables();
+      int readInputData();
+      int readInputData( istream &inputFile );
+      void readOption( const char *buf );
+      void echoInputData( ostream &outputFile1 );
+      void canonical( ostream &out ) const;
+      double cost() const;
+      void estimate( kin_estimate *e ) const;
+      int compile();
+      int setrate( int r, double rkfor, double rkbak );
+      void setnet();
+      int ispec4name( const char *name2look );
+      void setnumofintegrations();
+      void setintg_();
+      void setssa();
+      void freessa();
+      int setmoments();
+      void setselect();
+   };
+
+/*
+* KinSolver: the state of one run of a KinModel. The integrators
+* and the writers are its member functions and see the model under
+* the usual names ( read only copies of the scalars, pointers to
+* the tables ), everything they write lives here.
+*/
+   struct KinSolver {
+      const KinModel *model;
+
+      // the model
+      int numberOfDataSets;
+      int numberOfSpecies, numberOfReactions;
+      int true_numberOfTimeSteps;
+      int integrationOption;
+      int ntskip;
+      double true_initialTime, true_finalTime;
+      char *const *bline;
+      char *const *nameOfSpecies;
+      char **const *nameOfInputSpecies;
+      char **const *nameOfOutputSpecies;
+      const double (*extOfSpecies)[2*MAX_NUMBER_PULSE + 2 + 1];
+      const double *oneCycle;
+      const double (*slopeTrap)[MAX_NUMBER_PULSE+1];
+      const int *const *iispec;
+      const int *const *iospec;
+      const int *jfix;
+      const int *npulse;
+      const int *numberInputParticipants;
+      const int *numberOutputParticipants;
+      const int *jkin;
+      const double *initialConcentration;
+      const double *forwardReactionRates;
+      const double *backwardReactionRates;
+      const double *forwardReactionRates2;
+      const double *backwardReactionRates2;
+      bool extFlag;
+      int numOfIntegrations;
+      int whichExt;
+      const double *intg_initialTime;
+      const double *intg_finalTime;
+      const double *intg_dtime;
+      const int *intg_numberOfTimeSteps;
+      unsigned long long ssaSeed;
+      double tauEpsilon;
+      int ensembleRuns;
+      int ensembleThreads;
+      int numberOfQuantiles;
+      const double *quantile;
+      double fspTolerance;
+      int fspMaxStates;
+      int momentClosure;
+      int outputPoints;
+      int pointMethod;
+      int fluxReactions;
+      const int *fluxReaction;
+      int fluxExtents;
+      int momentSpecies;
+      const SsaNetwork *ssaNet;
+      int numberOfOutputSpecies;
+      const int *outputSpecies;
+      const char *outputMask;
+
+      // the run
+      double initialTime, finalTime, dtime;
+      int numberOfTimeSteps;
+      int timeRows;              // rows of xspec, xreac and xtime
+      double **xspec;
+#ifndef OPTIMIZE
+      double **xreac;
+#endif
+      double *xtime;
+      int xtime_index;
+      int* intg_xtime_index;
+      double ***intg_xspec; //big matrix, need to delete
+      double **intg_xtime;
+      int *indexOfInputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+      int *indexOfOutputSpecies[ MAX_NUMBER_PARTICIPANT_REACTIONS + 1 ];
+      double *reactionWork;      // REACTION_ROWS rows for the methods
+      KinRandom ssaRandom;
+      EnsembleStats *ensemble;
+      FspSpace *fsp;
+      MomentWork *momentWork;
+
+      // the rows as they are computed ( kin_solver_stream )
+      kin_row_fn streamRow;
+      kin_progress_fn streamProgress;
+      void *streamUser;
+      int streamNext;            // next row of the piece to pass on
+      int streamMtime;           // ntskip count, as in outputDataFile2
+      int streamEmitted;         // row of the piece last passed on
+      double *streamSelected;    // the row of the selected species
+      double streamDone;         // progress last passed on
+
+      // stopping early ( kin_solver_cancel, kin_solver_deadline )
+      volatile int cancelRequested;
+      double deadline;           // wall clock seconds for run(), 0 none
+      double runStart;
+      int halted;                // run() stopped before the end
+
+      int outputDigits;          // significant digits of the text numbers
+      int background;            // format kin_o02 during run()
+      int timeMajor;             // kin_o02 a line per time ( kin_solver_time_major )
+      KinWriter *writer;         // ( kin_solver_background )
+      char **picked;             // [ piece ][ t ] rows of "points", 0 none
+
+      // the state at given times instead of the rows ( kin_solver_observe )
+      const double *observeTime;
+      double *observeX;          // 0 unless observing
+      int observeCount;
+      int observeDone;           // times filled
+      int observeNext;           // next row of the piece to look at
+      double **observeRing;      // the rows xspec points into
+
+      KinSolver( const KinModel *m );
+      ~KinSolver();
+      int initializeBigMatrices();
+      int allocateRows();
+      double *reactionRow( int k );
+      void run();
+      int output();
+      int trajectory( double time[], double x[], int rows );
+      int trajectory( double time[], double x[], int rows, int species, const int index[] );
+      const double *selectRow( const double row[] );
+      int step( int t );
+      int stopRequested();
+      void halt( int t );
+      void streamEmit( int r );
+      void stream( int t, int top );
+      void progress( double done );
+      void pickPoints();
+      void ringRows();
+      double rowTime( int r );
+      void observeRows( int t );
+      int observe( const double time[], int n, double x[] );
+      int outputRow( int i_intg, int t, int top, int mtime );
+      void freePoints();
+
+      void setinitial(int i);
+      void setfinal(int i);
+      void setfix(int i);
+      void setinitialdata(int i);
+      void storedata(int i);
+      void runkin();
+      void xrate( double vspec[], double vfor[], double vbak[], int t );
+      void reactionRate( int r, const double x[], double *vfor, double *vbak );
+      double flux( int r, const double x[] );
+      double con_jfix_10(int i, double currentTime);
+      double con_jfix_20(int i, double currentTime);
+      int outputDataFile1();
+      int outputDataFile2();
+      void outputDataFile2( ostream &outputFile2 );
+      void outputRows2( ostream &outputFile2 );
+      int outputDataFile3();
+      void outputFluxes3( ostream &outputFile3 );
+
+      void eval_fx( double x_vector[], double result[], double leftProduct[], double rightProduct[] );
+      void testMethod_aleman();
+      int lsodesMethod();
+      void eulerMethod();
+      void modifiedEulerMethod();
+      void modifiedEulerMethod_original();
+      void rungeKuttaOrder4();
+      void rungeKutta45();
+      void rungeKuttaAdaptive();
+      void eval_jacobian( int time, double ** jac );
+      void prepareJacobian( Evaluate *** jac );
+      void eval_prep_jacobian( int time, double ** jac, Evaluate *** prepared_jac);
+      void stiffSolver();
+
+      double ssaPropensity( const SsaNetwork *net, int c, const double x[] );
+      void ssaRecord( double **grid, const double x[], int t );
+      int ssaClamp( double x[], double currentTime );
+      void ssaFire( const SsaNetwork *net, int c, double times, double x[] );
+      void compositionRejectionSSA( KinRandom *rng, double **grid, const double initial[] );
+      void tauLeaping( KinRandom *rng, double **grid, const double initial[] );
+      void ensembleFold( EnsembleStats *st, double **grid );
+      void ensembleWork( EnsembleJob *job );
+      void runEnsemble();
+      void freeEnsemble();
+      int outputEnsembleFile2();
+      void outputEnsembleFile2( ostream &outputFile2 );
+      void pack( ostream &out );
+      int outputPackedFile2();
+      void columns( ostream &out, int bytes );
+      int outputColumnFile2( int bytes );
+      int publish( const char *name, int packed );
+
+      int fspAdd( FspSpace *sp, const int state[] );
+      void fspState( const FspSpace *sp, int k, double x[] );
+      int fspTarget( FspSpace *sp, int k, int c, int target[] );
+      void fspExpand( FspSpace *sp, double x[] );
+      void fspGenerator( FspSpace *sp, double x[] );
+      int fspEnlarge( FspSpace *sp );
+      void setfsp();
+      void freefsp();
+      void fspRecord( const FspSpace *sp, double **grid, double x[], int t );
+      void finiteStateProjection();
+      int outputDataFile4();
+
+      void setmomentwork();
+      void freemoments();
+      double momentPropensity( int c, double x[], double g[], double h[][ MOMENT_MAX_READ ], int n );
+      void momentRate( double vspec[], int t );
+   };
+
 
 // functions:
 
-   int  readInputData();
-   void setfix(int i);
-   void setnet();
-   void runkin();
-   int outputDataFile1();
-   int outputDataFile2();
-   int outputDataFile3();
    char* trim( const char *str );
-   int ispec4name( const char *name2look );
-   void xrate( double vspec[], double vfor[], double vbak[], int t );
-
+   double wallClock();
+   char *kinCopy( const char *text );
    double myabs( double number );
-   void freeMemory();
    void gauss( double **a, int d[], int n );
    void gauss_solve( double **a, int d[], double b[], double x[], int n );
-   void prepareJacobian( Evaluate *** jac );
-   void eval_prep_jacobian( int time, double ** jac, Evaluate *** prepared_jac);
 
    int mystrcmp(const char *str1, const char *str2);
 
-   // start of external control
-   bool extFlag = false;
-   int numOfIntegrations = 1;
-   int numofcycle;
-   //todo only for one external control
-   int whichExt;
-   //todo for pulse, just use this
-   const int MIN_numberOfTimeSteps = 100;
-  
-   double* intg_initialTime;
-   double* intg_finalTime;
-   double* intg_dtime;
-   int* intg_numberOfTimeSteps;
-   int* intg_xtime_index;
-   double ***intg_xspec; //big matrix, need to delete
-   double **intg_xtime;
-   // end of external control
+   int isStochasticMethod( int option );
+   void seedRandom( KinRandom *rng, unsigned long long seed );
+   double uniformRandom( KinRandom *rng );
+   void poissonRandom( KinRandom *rng, const double mean[], double k[], int n );
+   int isFspMethod( int option );
+   double fspRetained( const FspSpace *sp );
+   int momentIndex( int species, int i, int j );
+   KinWriter *writerNew( int species, const int index[], int digits, int timeMajor );
+   void writerPut( KinWriter *w, int r, double time, const double x[] );
+   void writerClose( KinWriter *w );
+   void writerFree( KinWriter *w );
 
 
 #endif
-
-
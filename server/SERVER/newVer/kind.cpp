@@ -0,0 +1,1459 @@
+/*
+c========================================
+c kind: the kin solver as a daemon
+c========================================
+c
+c   Speaks the protocol of theServer.java on its own: a client sends
+c   the lines of a kin.i01, then "THE END"; it gets back the lines of
+c   kin.o02, then "THE END". The solver runs in-process ( libkin ) on
+c   a pool of worker threads, nothing goes through files and no
+c   process is started per request. Compiled models are kept, a
+c   request with the same kin.i01 text reuses them.
+c
+c   With a cache directory the results are kept on disk as well, by
+c   the canonical text of the model ( kin_model_key ), so that a data
+c   set sent again, also with other spacing or comments, is answered
+c   without running it. The least recently used results go when the
+c   cache grows over its size.
+c
+c   Lines "#!<directive>" before the kin.i01 lines change a request:
+c   "#!stats"  the counters of the cache come first in the reply
+c   "#!stream" the rows and the progress of every data set are sent
+c              while it runs, as lines "#!set <data set> <species>",
+c              "#!row <time> <x1> .. <xn>", "#!progress <done> <eta s>"
+c              ( as kin -s writes them ), the kin.o02 text follows
+c   "#!binary" the results come as packed binary frames, one per data
+c              set ( kin_solver_pack, libkin.h ), instead of the kin.o02
+c              text: a line "#!binary <bytes>", the frames, then "THE END"
+c   "#!digits <n>" significant digits of the numbers of the kin.o02
+c              text, 7 by default ( kin_solver_digits, libkin.h )
+c   "#!rows"   the kin.o02 text a line per time with a column per
+c              species ( kin_solver_time_major, libkin.h )
+c   "#!deadline <seconds>" wall clock limit of the request: the data
+c              set running then stops at its next time step and its
+c              results up to there are sent ( so are those of a run
+c              stopped by the client, see below ); later sets are not run
+c   "#!batch"  a long job, run after the interactive ones ( jobs of
+c              a large estimated cost are batch jobs anyway )
+c   "#!client <name>" the client for fair share, else its address
+c   "#!queue"  the jobs waiting and running and the usage of the
+c              clients come first in the reply
+c   Others are ignored. How the jobs are ordered: s c h e d u l e r.
+c
+c   The line "#!cancel" sent while the request runs cancels it, so
+c   does a connection that fails; other lines are ignored and a
+c   client that only shuts down its sending side still gets the whole
+c   reply. Partial results are not cached.
+c
+c   A connection that starts with the line "#!mux" stays open and
+c   carries any number of tagged requests, run side by side, with
+c   their replies interleaved and a cancel per request; see
+c   m u l t i p l e x below.
+c
+c   usage: kind [ -m <memory MB> ] <port> [ <workers> [ <cache directory> [ <cache MB> ] ] ]
+c          workers default to one per processor, the cache to 256 MB,
+c          the memory of the running jobs to 3/4 of the machine
+c
+*/
+
+#include "libkin.h"
+#include <iostream.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define KIND_BACKLOG 64
+#define KIND_MODELS 32           // compiled models kept
+#define KIND_READ 4096
+#define KIND_PATH 1024           // longest cache file name, with the 0
+#define KIND_QUEUE 4             // requests waiting, per worker
+#define KIND_END "THE END"
+#define KIND_STATS "#!stats"
+#define KIND_STREAM "#!stream"
+#define KIND_DEADLINE "#!deadline"
+#define KIND_BINARY "#!binary"
+#define KIND_DIGITS "#!digits"
+#define KIND_ROWS "#!rows"
+#define KIND_MUX "#!mux"
+#define KIND_JOB "#!job"
+#define KIND_CANCEL "#!cancel"
+#define KIND_FRAME "#!frame"
+#define KIND_DONE "#!done"
+#define KIND_TAG 64              // longest job tag, with the 0
+#define KIND_QUEUE_STATE "#!queue"
+#define KIND_BATCH "#!batch"
+#define KIND_CLIENT "#!client"
+#define KIND_CLIENTS 64          // clients kept for fair share
+#define KIND_BATCH_COST 5.0e8    // jobs costing more ( ~10 s ) are batch
+#define KIND_STARVE 60.0         // seconds a batch job waits at most
+#define KIND_HALF_LIFE 60.0      // seconds, of the usage of a client
+#define KIND_REJECTED "#!rejected"
+#define MB ( 1024.0 * 1024.0 )
+#define KIND_FLUSH 0.25          // seconds between stream sends
+#define KIND_WATCH 100           // milliseconds between cancel checks
+#define KIND_CACHE_MB 256
+
+   // a compiled model and the kin.i01 text it came from
+   struct KindModel {
+      char          *text;
+      long           length;
+      int            dataSet;
+      kin_model     *model;
+      int            users;      // solvers running it now
+      unsigned long  used;       // last request, for eviction
+   };
+
+   struct KindJob;
+
+   // the text of a request or reply, grown as needed
+   struct KindText {
+      char *text;
+      long  length;
+      long  size;
+   };
+
+   KindModel kindModels[ KIND_MODELS ];
+   unsigned long kindClock = 0;
+   pthread_mutex_t kindModelLock = PTHREAD_MUTEX_INITIALIZER;
+
+   // a result file of the cache, <hash>.o02: the length of the key
+   // on the first line, the key, then the kin.o02 text
+   struct KindResult {
+      unsigned long long hash;
+      long               size;
+      unsigned long      used;
+   };
+
+   const char *kindCacheDir = 0;
+   long long kindCacheLimit = 0;
+   long long kindCacheBytes = 0;
+   KindResult *kindResults = 0;
+   int kindResultCount = 0;
+   int kindResultSize = 0;
+   unsigned long kindCacheClock = 0;
+   unsigned long kindHits = 0, kindMisses = 0, kindStores = 0, kindEvictions = 0;
+   pthread_mutex_t kindCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+   // a client by its "#!client" name or address, for fair share
+   struct KindClient {
+      char   name[ KIND_TAG ];
+      double usage;              // cost of the jobs started, decaying
+      double updated;            // time of usage
+      int    jobs;               // waiting or running
+      int    running;
+   };
+
+   KindClient kindClients[ KIND_CLIENTS ];
+   KindJob *kindJobs = 0;        // waiting and running
+   int kindWaiting = 0;
+   int kindQueueSize = 0;
+   int kindWorkers = 0;
+   int kindBatchRunning = 0;
+   double kindMemoryLimit = 0.0; // bytes the running jobs may take
+   double kindMemoryUsed = 0.0;  // estimated, of the running jobs
+   pthread_mutex_t kindQueueLock = PTHREAD_MUTEX_INITIALIZER;
+   pthread_cond_t kindQueueReady = PTHREAD_COND_INITIALIZER;
+   pthread_cond_t kindQueueRoom = PTHREAD_COND_INITIALIZER;
+
+/*************************************************************
+*   t e x t
+*************************************************************/
+void textAppend( KindText *t, const char *data, long n )
+{
+if( t->length + n + 1 > t->size ) {
+long size = 2 * t->size + n + 1;
+char *text = new char[ size ];
+if( t->length > 0 ) {
+memcpy( text, t->text, t->length );
+}
+delete [] t->text;
+t->text = text;
+t->size = size;
+}
+memcpy( t->text + t->length, data, n );
+t->length += n;
+t->text[ t->length ] = 0;
+}
+
+/*
+* buffered line reader of a socket, the line without '\r' and '\n'
+* returns 0 at the end of the stream
+*/
+struct KindReader {
+   int  sock;
+   char buf[ KIND_READ ];
+   int  start;
+   int  end;
+   int  closed;    // the client shut its side down, nothing more comes
+};
+
+int readLine( KindReader *rd, KindText *line )
+{
+line->length = 0;
+textAppend( line, "", 0 );
+for( ;; ) {
+for( int i = rd->start; i < rd->end; i++ ) {
+if( rd->buf[ i ] == '\n' ) {
+textAppend( line, rd->buf + rd->start, i - rd->start );
+rd->start = i + 1;
+if( line->length > 0 && line->text[ line->length - 1 ] == '\r' ) {
+line->text[ --line->length ] = 0;
+}
+return 1;
+}
+}
+textAppend( line, rd->buf + rd->start, rd->end - rd->start );
+rd->start = rd->end = 0;
+int n = recv( rd->sock, rd->buf, KIND_READ, 0 );
+if( n <= 0 ) {
+rd->closed = ( n == 0 );
+return line->length > 0;
+}
+rd->end = n;
+}
+}
+
+/*
+* 1 when the complete lines buffered in rd hold KIND_CANCEL, they are
+* dropped up to it; the start of a line still to come is kept
+*/
+int cancelLine( KindReader *rd )
+{
+int length = strlen( KIND_CANCEL );
+for( int i = rd->start; i < rd->end; i++ ) {
+if( rd->buf[ i ] == '\n' ) {
+int n = i - rd->start;
+if( n > 0 && rd->buf[ i - 1 ] == '\r' ) {
+n--;
+}
+int found = ( n == length && strncmp( rd->buf + rd->start, KIND_CANCEL, n ) == 0 );
+rd->start = i + 1;
+if( found ) {
+return 1;
+}
+}
+}
+memmove( rd->buf, rd->buf + rd->start, rd->end - rd->start );
+rd->end -= rd->start;
+rd->start = 0;
+if( rd->end == KIND_READ ) {
+// a line that long is no cancel
+rd->end = 0;
+}
+return 0;
+}
+
+int sendAll( int sock, const char *data, long n )
+{
+while( n > 0 ) {
+long sent = send( sock, data, n, 0 );
+if( sent <= 0 ) {
+return 1;
+}
+data += sent;
+n -= sent;
+}
+return 0;
+}
+
+/*************************************************************
+*   m o d e l s
+*************************************************************
+* compiled models by kin.i01 text and data set; a model in use is
+* never evicted, a full table just compiles without keeping
+*/
+KindModel *modelGet( const char *text, long length, int dataSet )
+{
+pthread_mutex_lock( &kindModelLock );
+kindClock++;
+for( int k = 0; k < KIND_MODELS; k++ ) {
+KindModel *e = kindModels + k;
+if( e->model != 0 && e->dataSet == dataSet && e->length == length
+&& memcmp( e->text, text, length ) == 0 ) {
+e->users++;
+e->used = kindClock;
+pthread_mutex_unlock( &kindModelLock );
+return e;
+}
+}
+pthread_mutex_unlock( &kindModelLock );
+
+kin_model *model = kin_model_read( text, length, dataSet );
+if( model == 0 ) {
+return 0;
+}
+
+pthread_mutex_lock( &kindModelLock );
+KindModel *slot = 0;
+for( int k = 0; k < KIND_MODELS; k++ ) {
+KindModel *e = kindModels + k;
+if( e->users > 0 ) {
+continue;
+}
+if( slot == 0 || e->model == 0 || ( slot->model != 0 && e->used < slot->used ) ) {
+slot = e;
+}
+}
+if( slot == 0 ) {
+pthread_mutex_unlock( &kindModelLock );
+slot = new KindModel;
+slot->text = 0;
+slot->model = model;
+slot->users = -1;        // not kept
+return slot;
+}
+if( slot->model != 0 ) {
+kin_model_free( slot->model );
+delete [] slot->text;
+}
+slot->text = new char[ length ];
+memcpy( slot->text, text, length );
+slot->length = length;
+slot->dataSet = dataSet;
+slot->model = model;
+slot->users = 1;
+slot->used = kindClock;
+pthread_mutex_unlock( &kindModelLock );
+return slot;
+}
+
+void modelPut( KindModel *e )
+{
+if( e->users < 0 ) {
+kin_model_free( e->model );
+delete e;
+return;
+}
+pthread_mutex_lock( &kindModelLock );
+e->users--;
+pthread_mutex_unlock( &kindModelLock );
+}
+
+/*************************************************************
+*   c a c h e
+*************************************************************
+* results on disk by the hash of the model key; the key is stored
+* with the result and compared, so a hash collision is a miss
+*/
+unsigned long long keyHash( const char *key, long length )
+{
+unsigned long long h = 14695981039346656037ULL;     // FNV-1a
+for( long k = 0; k < length; k++ ) {
+h ^= (unsigned char) key[ k ];
+h *= 1099511628211ULL;
+}
+return h;
+}
+
+// 0 if the name does not fit into path
+int resultPath( char *path, unsigned long long hash )
+{
+int n = snprintf( path, KIND_PATH, "%s/%016llx.o02", kindCacheDir, hash );
+return n >= 0 && n < KIND_PATH;
+}
+
+// the entry of hash in kindResults, -1 if none; kindCacheLock held
+int resultFind( unsigned long long hash )
+{
+for( int k = 0; k < kindResultCount; k++ ) {
+if( kindResults[ k ].hash == hash ) {
+return k;
+}
+}
+return -1;
+}
+
+// drops entry k and its file; kindCacheLock held
+void resultDrop( int k )
+{
+char path[ KIND_PATH ];
+if( resultPath( path, kindResults[ k ].hash ) ) {
+unlink( path );
+}
+kindCacheBytes -= kindResults[ k ].size;
+kindResults[ k ] = kindResults[ --kindResultCount ];
+}
+
+// a new entry, the least recently used go while over the limit
+void resultAdd( unsigned long long hash, long size, unsigned long used )
+{
+if( kindResultCount == kindResultSize ) {
+kindResultSize = 2 * kindResultSize + 64;
+KindResult *results = new KindResult[ kindResultSize ];
+for( int k = 0; k < kindResultCount; k++ ) {
+results[ k ] = kindResults[ k ];
+}
+delete [] kindResults;
+kindResults = results;
+}
+KindResult *e = kindResults + kindResultCount++;
+e->hash = hash;
+e->size = size;
+e->used = used;
+kindCacheBytes += size;
+
+while( kindCacheBytes > kindCacheLimit && kindResultCount > 1 ) {
+int oldest = 0;
+for( int k = 1; k < kindResultCount; k++ ) {
+if( kindResults[ k ].used < kindResults[ oldest ].used ) {
+oldest = k;
+}
+}
+resultDrop( oldest );
+kindEvictions++;
+}
+}
+
+int byUse( const void *a, const void *b )
+{
+unsigned long ua = ( (const KindResult *) a )->used;
+unsigned long ub = ( (const KindResult *) b )->used;
+return ua < ub ? -1 : ( ua > ub ? 1 : 0 );
+}
+
+/*
+* the results left by an earlier run of kind, in the order of their
+* last use ( the modification time, see cacheGet )
+*/
+int cacheOpen( const char *dir, long long limit )
+{
+mkdir( dir, 0777 );
+DIR *d = opendir( dir );
+if( d == 0 ) {
+cerr << "Can't open cache directory " << dir << endl;
+return 1;
+}
+kindCacheDir = dir;
+kindCacheLimit = limit;
+char probe[ KIND_PATH ];
+if( !resultPath( probe, 0 ) ) {
+cerr << "Cache directory name too long, results are not kept: " << dir << endl;
+}
+
+struct dirent *f;
+while( ( f = readdir( d ) ) != 0 ) {
+unsigned long long hash;
+char tail[ 8 ] = { 0 };
+if( strlen( f->d_name ) != 20 || sscanf( f->d_name, "%16llx%7s", &hash, tail ) != 2
+|| strcmp( tail, ".o02" ) != 0 ) {
+continue;
+}
+char path[ KIND_PATH ];
+struct stat st;
+if( resultPath( path, hash ) && stat( path, &st ) == 0 ) {
+resultAdd( hash, st.st_size, (unsigned long) st.st_mtime );
+}
+}
+closedir( d );
+
+qsort( kindResults, kindResultCount, sizeof( KindResult ), byUse );
+for( int k = 0; k < kindResultCount; k++ ) {
+kindResults[ k ].used = ++kindCacheClock;
+}
+return 0;
+}
+
+/*
+* appends the cached result of key to reply; 0 if there is none
+*/
+int cacheGet( const char *key, long length, KindText *reply )
+{
+unsigned long long hash = keyHash( key, length );
+char path[ KIND_PATH ];
+FILE *f = resultPath( path, hash ) ? fopen( path, "rb" ) : 0;
+if( f == 0 ) {
+pthread_mutex_lock( &kindCacheLock );
+kindMisses++;
+pthread_mutex_unlock( &kindCacheLock );
+return 0;
+}
+long keyLength = -1;
+int found = 0;
+if( fscanf( f, "%ld", &keyLength ) == 1 && fgetc( f ) == '\n' && keyLength == length ) {
+char *stored = new char[ length + 1 ];
+if( (long) fread( stored, 1, length, f ) == length && memcmp( stored, key, length ) == 0 ) {
+found = 1;
+char buf[ KIND_READ ];
+size_t n;
+while( ( n = fread( buf, 1, KIND_READ, f ) ) > 0 ) {
+textAppend( reply, buf, n );
+}
+}
+delete [] stored;
+}
+fclose( f );
+if( found ) {
+utime( path, 0 );
+}
+
+pthread_mutex_lock( &kindCacheLock );
+if( found ) {
+kindHits++;
+int k = resultFind( hash );
+if( k >= 0 ) {
+kindResults[ k ].used = ++kindCacheClock;
+}
+}
+else {
+kindMisses++;
+}
+pthread_mutex_unlock( &kindCacheLock );
+return found;
+}
+
+/*
+* stores the result of key: into a file of its own, renamed into
+* place when complete, so readers never see half a result
+*/
+void cachePut( const char *key, long length, const char *text, long n )
+{
+unsigned long long hash = keyHash( key, length );
+char path[ KIND_PATH ], tmp[ KIND_PATH ];
+if( !resultPath( path, hash ) ) {
+return;
+}
+int m = snprintf( tmp, sizeof( tmp ), "%s.%lx", path, (unsigned long) pthread_self() );
+if( m < 0 || m >= (int) sizeof( tmp ) ) {
+return;
+}
+
+FILE *f = fopen( tmp, "wb" );
+if( f == 0 ) {
+cerr << "Can't write cache file " << tmp << endl;
+return;
+}
+fprintf( f, "%ld\n", length );
+int failed = (long) fwrite( key, 1, length, f ) != length
+|| (long) fwrite( text, 1, n, f ) != n;
+long size = ftell( f );
+failed = fclose( f ) != 0 || failed;
+if( failed ) {
+unlink( tmp );
+return;
+}
+
+pthread_mutex_lock( &kindCacheLock );
+if( rename( tmp, path ) != 0 ) {
+unlink( tmp );
+}
+else {
+int k = resultFind( hash );
+if( k >= 0 ) {
+kindCacheBytes -= kindResults[ k ].size;
+kindResults[ k ] = kindResults[ --kindResultCount ];
+}
+resultAdd( hash, size, ++kindCacheClock );
+kindStores++;
+}
+pthread_mutex_unlock( &kindCacheLock );
+}
+
+void cacheStats( KindText *reply )
+{
+char buf[ 512 ];
+pthread_mutex_lock( &kindCacheLock );
+sprintf( buf, "hits %lu\nmisses %lu\nstores %lu\nevictions %lu\n"
+"results %d\nbytes %lld\nlimit %lld\n",
+kindHits, kindMisses, kindStores, kindEvictions,
+kindResultCount, kindCacheBytes, kindCacheLimit );
+pthread_mutex_unlock( &kindCacheLock );
+textAppend( reply, buf, strlen( buf ) );
+}
+
+/*************************************************************
+*   s i n k
+*************************************************************
+* where the reply of a request goes: the socket itself, or on a
+* multiplexed connection frames "#!frame <tag> <bytes>" of the job
+*/
+struct KindSink {
+   int              sock;
+   const char      *tag;         // 0 on a connection of its own
+   pthread_mutex_t *lock;        // of the multiplexed connection
+};
+
+int sinkSend( KindSink *out, const char *data, long n )
+{
+if( out->tag == 0 ) {
+return sendAll( out->sock, data, n );
+}
+if( n == 0 ) {
+return 0;
+}
+char head[ 128 ];
+sprintf( head, KIND_FRAME " %s %ld\n", out->tag, n );
+pthread_mutex_lock( out->lock );
+int failed = sendAll( out->sock, head, strlen( head ) ) || sendAll( out->sock, data, n );
+pthread_mutex_unlock( out->lock );
+return failed;
+}
+
+/*************************************************************
+*   s t r e a m
+*************************************************************
+* the frames of a streamed run, sent when a quarter of a second
+* has passed or a progress frame comes
+*/
+struct KindStream {
+   KindSink *out;
+   KindText  frames;
+   double    start;
+   double    flushed;
+};
+
+// wall clock seconds
+double now()
+{
+struct timeval tv;
+gettimeofday( &tv, 0 );
+return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+void streamFlush( KindStream *st )
+{
+sinkSend( st->out, st->frames.text, st->frames.length );
+st->frames.length = 0;
+st->flushed = now();
+}
+
+void streamRow( void *user, double time, const double x[], int species )
+{
+KindStream *st = (KindStream *) user;
+char buf[ 32 ];
+sprintf( buf, "#!row %.6E", time );
+textAppend( &st->frames, buf, strlen( buf ) );
+for( int i = 0; i < species; i++ ) {
+sprintf( buf, " %.6E", x[ i ] );
+textAppend( &st->frames, buf, strlen( buf ) );
+}
+textAppend( &st->frames, "\n", 1 );
+if( now() - st->flushed > KIND_FLUSH ) {
+streamFlush( st );
+}
+}
+
+void streamProgress( void *user, double done )
+{
+KindStream *st = (KindStream *) user;
+double elapsed = now() - st->start;
+double eta = ( done > 0.0 ? elapsed * ( 1.0 - done ) / done : -1.0 );
+char buf[ 64 ];
+sprintf( buf, "#!progress %.2f %.1f\n", done, eta );
+textAppend( &st->frames, buf, strlen( buf ) );
+streamFlush( st );
+}
+
+/*************************************************************
+*   w a t c h
+*************************************************************
+* a thread per run that cancels it when the client sends the line
+* "#!cancel" or the connection fails. Unlike the Checker of theServer
+* other lines do not cancel, nor does a client that only shuts its
+* sending side down ( shutdown( SHUT_WR ), nc -N ): it still gets the
+* whole reply.
+*/
+struct KindWatch {
+   KindReader   *rd;
+   kin_solver   *solver;
+   volatile int  done;
+};
+
+void *watch( void *arg )
+{
+KindWatch *w = (KindWatch *) arg;
+KindReader *rd = w->rd;
+struct pollfd p;
+p.fd = rd->sock;
+while( ! w->done ) {
+// after the end of the stream only POLLHUP / POLLERR are of interest
+p.events = ( rd->closed ? 0 : POLLIN );
+p.revents = 0;
+if( poll( &p, 1, KIND_WATCH ) <= 0 ) {
+continue;
+}
+int cancel = 0;
+if( p.revents & POLLIN ) {
+int n = recv( rd->sock, rd->buf + rd->end, KIND_READ - rd->end, MSG_DONTWAIT );
+if( n > 0 ) {
+rd->end += n;
+cancel = cancelLine( rd );
+}
+else if( n == 0 ) {
+rd->closed = 1;
+}
+else {
+cancel = ( errno != EAGAIN && errno != EINTR );
+}
+}
+else if( p.revents & ( POLLHUP | POLLERR | POLLNVAL ) ) {
+cancel = 1;
+}
+if( cancel ) {
+kin_solver_cancel( w->solver );
+break;
+}
+}
+return 0;
+}
+
+void queueState( KindText *reply );
+void submit( KindJob *job );
+void finished( KindJob *job );
+
+/*************************************************************
+*   r e q u e s t
+*************************************************************
+* one transaction: kin.i01 lines up to "THE END", then every data
+* set of it is run and its kin.o02 text sent, then "THE END"
+*/
+struct KindRequest {
+   KindText input;
+   int      streaming;
+   int      binary;
+   int      digits;              // "#!digits", 0 the default
+   int      timeMajor;           // "#!rows"
+   int      batch;               // "#!batch"
+   int      mux;                 // "#!mux", the connection carries jobs
+   double   deadline;
+   char     client[ KIND_TAG ];  // "#!client <name>"
+};
+
+// a multiplexed connection: its jobs, running or waiting
+struct KindMux {
+   int              sock;
+   KindReader       rd;
+   char             client[ KIND_TAG ];
+   pthread_mutex_t  lock;        // of jobs and of sending
+   pthread_cond_t   idle;
+   KindJob         *jobs;
+};
+
+/*
+* a request, on a connection of its own or as a job of a multiplexed
+* one, from the client it came from until a worker has sent its reply
+*/
+struct KindJob {
+   char         tag[ KIND_TAG ]; // "" on a connection of its own
+   KindRequest  req;
+   KindText     reply;           // "#!stats" comes before the results
+   int          sock;
+   KindReader   rd;              // a connection of its own, for cancels
+   KindMux     *mux;
+   kin_solver  *solver;          // while it runs
+   int          cancelled;
+   KindJob     *next;            // of the multiplexed connection
+   // scheduling
+   int          client;          // in kindClients
+   double       cost;            // kin_model_cost of the data sets
+   double       bytes;           // the memory of the largest one
+   double       least;           // and what it takes at the least
+   double       queued;          // when
+   int          running;
+   KindJob     *nextJob;         // in kindJobs
+};
+
+/*
+* the directives and kin.i01 lines of a request, up to "THE END";
+* "#!mux" ends it at once
+* returns 0 when the stream ended first
+*/
+int readRequest( KindReader *rd, KindRequest *q, KindText *reply )
+{
+KindText line = { 0, 0, 0 };
+int complete = 0;
+while( readLine( rd, &line ) ) {
+if( strcasecmp( line.text, KIND_END ) == 0 ) {
+complete = 1;
+break;
+}
+if( q->input.length == 0 && strncmp( line.text, "#!", 2 ) == 0 ) {
+if( strcmp( line.text, KIND_MUX ) == 0 ) {
+q->mux = 1;
+complete = 1;
+break;
+}
+if( strcmp( line.text, KIND_STATS ) == 0 && kindCacheDir != 0 ) {
+cacheStats( reply );
+}
+if( strcmp( line.text, KIND_QUEUE_STATE ) == 0 ) {
+queueState( reply );
+}
+if( strcmp( line.text, KIND_STREAM ) == 0 ) {
+q->streaming = 1;
+}
+if( strcmp( line.text, KIND_BINARY ) == 0 ) {
+q->binary = 1;
+}
+if( strcmp( line.text, KIND_BATCH ) == 0 ) {
+q->batch = 1;
+}
+if( strcmp( line.text, KIND_ROWS ) == 0 ) {
+q->timeMajor = 1;
+}
+if( strncmp( line.text, KIND_DIGITS " ", strlen( KIND_DIGITS ) + 1 ) == 0 ) {
+q->digits = atoi( line.text + strlen( KIND_DIGITS ) + 1 );
+}
+if( strncmp( line.text, KIND_CLIENT " ", strlen( KIND_CLIENT ) + 1 ) == 0 ) {
+strncpy( q->client, line.text + strlen( KIND_CLIENT ) + 1, KIND_TAG - 1 );
+}
+if( strncmp( line.text, KIND_DEADLINE " ", strlen( KIND_DEADLINE ) + 1 ) == 0 ) {
+q->deadline = atof( line.text + strlen( KIND_DEADLINE ) + 1 );
+}
+continue;
+}
+textAppend( &q->input, line.text, line.length );
+textAppend( &q->input, "\n", 1 );
+}
+delete [] line.text;
+return complete;
+}
+
+/*
+* runs every data set of the job and sends the results after its
+* reply so far to out, then "THE END". A run is cancelled by the line
+* "#!cancel" ( "#!cancel <tag>" on a multiplexed connection ) or when
+* the connection fails
+*/
+void runRequest( KindJob *job, KindSink *out )
+{
+KindRequest *q = &job->req;
+KindText *reply = &job->reply;
+KindText packed = { 0, 0, 0 };
+KindStream st = { out, { 0, 0, 0 }, 0.0, 0.0 };
+double start = now();
+
+for( int dataSet = 1; q->input.length > 0; dataSet++ ) {
+if( job->cancelled ) {
+break;
+}
+KindModel *e = modelGet( q->input.text, q->input.length, dataSet );
+if( e == 0 ) {
+break;
+}
+char *key = 0;
+long keyLength = 0;
+if( kindCacheDir != 0 ) {
+// frames are kept apart from texts, and texts of other digits
+// or layout from the default ones, the key tells which
+char prefix[ 64 ] = "";
+if( q->binary ) {
+strcpy( prefix, KIND_BINARY "\n" );
+}
+else {
+if( q->digits != 0 ) {
+sprintf( prefix, KIND_DIGITS " %d\n", q->digits );
+}
+if( q->timeMajor ) {
+strcat( prefix, KIND_ROWS "\n" );
+}
+}
+int mark = strlen( prefix );
+keyLength = kin_model_key( e->model, 0, 0 ) + mark;
+key = new char[ keyLength + 1 ];
+strcpy( key, prefix );
+kin_model_key( e->model, key + mark, keyLength - mark + 1 );
+if( cacheGet( key, keyLength, q->binary ? &packed : reply ) ) {
+delete [] key;
+modelPut( e );
+continue;
+}
+}
+kin_solver *solver = kin_solver_new( e->model );
+if( solver == 0 ) {
+delete [] key;
+modelPut( e );
+break;
+}
+if( q->digits != 0 ) {
+kin_solver_digits( solver, q->digits );
+}
+// the kin.o02 text is formatted while the run goes on
+kin_solver_background( solver, ! q->binary );
+kin_solver_time_major( solver, q->timeMajor );
+if( q->streaming ) {
+char buf[ 64 ];
+sprintf( buf, "#!set %d %d\n", dataSet, kin_model_output_species( e->model, 0 ) );
+textAppend( &st.frames, buf, strlen( buf ) );
+st.start = st.flushed = now();
+kin_solver_stream( solver, streamRow, streamProgress, &st );
+}
+if( q->deadline > 0.0 ) {
+double left = q->deadline - ( now() - start );
+kin_solver_deadline( solver, left > 0.0 ? left : 1.0e-9 );
+}
+
+KindWatch w = { &job->rd, solver, 0 };
+pthread_t watcher;
+int watching = 0;
+if( job->mux != 0 ) {
+pthread_mutex_lock( &job->mux->lock );
+job->solver = solver;
+if( job->cancelled ) {
+kin_solver_cancel( solver );
+}
+pthread_mutex_unlock( &job->mux->lock );
+}
+else if( cancelLine( &job->rd ) ) {
+// sent after "THE END" already
+kin_solver_cancel( solver );
+}
+else {
+watching = pthread_create( &watcher, 0, watch, &w ) == 0;
+}
+int stopped = kin_solver_run( solver );
+w.done = 1;
+if( watching ) {
+pthread_join( watcher, 0 );
+}
+if( job->mux != 0 ) {
+pthread_mutex_lock( &job->mux->lock );
+job->solver = 0;
+pthread_mutex_unlock( &job->mux->lock );
+}
+
+if( q->streaming ) {
+streamFlush( &st );
+}
+long n;
+char *text;
+if( q->binary ) {
+n = kin_solver_pack( solver, 0, 0 );
+text = new char[ n + 1 ];
+kin_solver_pack( solver, text, n );
+textAppend( &packed, text, n );
+}
+else {
+n = kin_solver_report( solver, 0, 0 );
+text = new char[ n + 1 ];
+kin_solver_report( solver, text, n + 1 );
+textAppend( reply, text, n );
+}
+if( key != 0 && ! stopped ) {
+cachePut( key, keyLength, text, n );
+}
+delete [] text;
+delete [] key;
+kin_solver_free( solver );
+modelPut( e );
+if( stopped ) {
+break;
+}
+}
+
+if( q->binary ) {
+char buf[ 64 ];
+sprintf( buf, KIND_BINARY " %ld\n", packed.length );
+textAppend( reply, buf, strlen( buf ) );
+textAppend( reply, packed.text, packed.length );
+}
+textAppend( reply, KIND_END "\n", strlen( KIND_END ) + 1 );
+sinkSend( out, reply->text, reply->length );
+
+delete [] packed.text;
+delete [] st.frames.text;
+}
+
+/*
+* the work of the data sets of the job and the memory of the largest,
+* the sets run one after the other ( kin_model_estimate ); bytes is
+* its upper bound, least what it takes anyway
+*/
+void requestEstimate( KindJob *job )
+{
+KindRequest *q = &job->req;
+job->cost = 0.0;
+job->bytes = 0.0;
+job->least = 0.0;
+for( int dataSet = 1; q->input.length > 0; dataSet++ ) {
+KindModel *e = modelGet( q->input.text, q->input.length, dataSet );
+if( e == 0 ) {
+break;
+}
+kin_estimate est;
+if( kin_model_estimate( e->model, &est ) == 0 ) {
+job->cost += est.work;
+if( est.bytes > job->bytes ) {
+job->bytes = est.bytes;
+}
+if( est.least > job->least ) {
+job->least = est.least;
+}
+}
+modelPut( e );
+}
+}
+
+void freeJob( KindJob *job )
+{
+delete [] job->req.input.text;
+delete [] job->reply.text;
+delete job;
+}
+
+/*************************************************************
+*   m u l t i p l e x
+*************************************************************
+* a connection opened with "#!mux" carries any number of jobs, run
+* side by side. The client sends
+*    "#!job <tag>", then a request as on a connection of its own
+*                   ( directives, kin.i01 lines, "THE END" )
+*    "#!cancel <tag>" to stop that job
+* and gets, interleaved between the jobs, "#!frame <tag> <bytes>"
+* followed by that many bytes of what a connection of its own would
+* get, and "#!done <tag>" after the last frame of a job. When the
+* client closes its side the jobs sent are still answered.
+*/
+void muxRead( KindMux *m )
+{
+KindReader *rd = &m->rd;
+KindText line = { 0, 0, 0 };
+
+while( readLine( rd, &line ) ) {
+if( strncmp( line.text, KIND_JOB " ", strlen( KIND_JOB ) + 1 ) == 0 ) {
+KindJob *job = new KindJob;
+memset( job, 0, sizeof( KindJob ) );
+job->mux = m;
+job->sock = m->sock;
+strncpy( job->tag, line.text + strlen( KIND_JOB ) + 1, KIND_TAG - 1 );
+int ok = readRequest( rd, &job->req, &job->reply ) && ! job->req.mux;
+if( ! ok || job->tag[ 0 ] == 0 || strchr( job->tag, ' ' ) != 0 ) {
+freeJob( job );
+if( ! ok ) {
+break;
+}
+continue;
+}
+if( job->req.client[ 0 ] == 0 ) {
+strcpy( job->req.client, m->client );
+}
+pthread_mutex_lock( &m->lock );
+job->next = m->jobs;
+m->jobs = job;
+pthread_mutex_unlock( &m->lock );
+submit( job );
+}
+else if( strncmp( line.text, KIND_CANCEL " ", strlen( KIND_CANCEL ) + 1 ) == 0 ) {
+const char *tag = line.text + strlen( KIND_CANCEL ) + 1;
+pthread_mutex_lock( &m->lock );
+for( KindJob *job = m->jobs; job != 0; job = job->next ) {
+if( strcmp( job->tag, tag ) == 0 ) {
+job->cancelled = 1;
+if( job->solver != 0 ) {
+kin_solver_cancel( job->solver );
+}
+}
+}
+pthread_mutex_unlock( &m->lock );
+}
+}
+
+pthread_mutex_lock( &m->lock );
+while( m->jobs != 0 ) {
+pthread_cond_wait( &m->idle, &m->lock );
+}
+pthread_mutex_unlock( &m->lock );
+
+shutdown( m->sock, SHUT_WR );
+close( m->sock );
+pthread_mutex_destroy( &m->lock );
+pthread_cond_destroy( &m->idle );
+delete [] line.text;
+delete m;
+}
+
+/*
+* a worker runs the job and sends the reply, then closes the
+* connection of its own or tells the multiplexed one it is done
+*/
+void runJob( KindJob *job )
+{
+KindMux *m = job->mux;
+if( m == 0 ) {
+KindSink out = { job->sock, 0, 0 };
+runRequest( job, &out );
+finished( job );
+
+// what the client sent to cancel is read, closing on unread input
+// would reset the connection and lose the reply
+while( recv( job->sock, job->rd.buf, KIND_READ, MSG_DONTWAIT ) > 0 ) {
+}
+shutdown( job->sock, SHUT_WR );
+close( job->sock );
+freeJob( job );
+return;
+}
+
+KindSink out = { m->sock, job->tag, &m->lock };
+runRequest( job, &out );
+finished( job );
+
+char done[ 128 ];
+sprintf( done, KIND_DONE " %s\n", job->tag );
+pthread_mutex_lock( &m->lock );
+sendAll( m->sock, done, strlen( done ) );
+KindJob **p = &m->jobs;
+while( *p != job ) {
+p = &( *p )->next;
+}
+*p = job->next;
+pthread_cond_signal( &m->idle );
+pthread_mutex_unlock( &m->lock );
+freeJob( job );
+}
+
+/*
+* the thread of an accepted connection: reads its request and hands
+* it to the scheduler, or reads the jobs of a multiplexed one
+*/
+void *connection( void *arg )
+{
+KindJob *job = (KindJob *) arg;
+job->rd.sock = job->sock;
+job->rd.start = job->rd.end = 0;
+job->rd.closed = 0;
+
+struct sockaddr_in peer;
+socklen_t length = sizeof( peer );
+char address[ KIND_TAG ] = "local";
+if( getpeername( job->sock, (struct sockaddr *) &peer, &length ) == 0 ) {
+unsigned long a = ntohl( peer.sin_addr.s_addr );
+sprintf( address, "%lu.%lu.%lu.%lu", a >> 24, ( a >> 16 ) & 255, ( a >> 8 ) & 255, a & 255 );
+}
+
+readRequest( &job->rd, &job->req, &job->reply );
+if( job->req.mux ) {
+KindMux *m = new KindMux;
+m->sock = job->sock;
+m->rd = job->rd;         // with what was read past "#!mux"
+strcpy( m->client, job->req.client[ 0 ] != 0 ? job->req.client : address );
+m->jobs = 0;
+pthread_mutex_init( &m->lock, 0 );
+pthread_cond_init( &m->idle, 0 );
+freeJob( job );
+muxRead( m );
+return 0;
+}
+if( job->req.client[ 0 ] == 0 ) {
+strcpy( job->req.client, address );
+}
+submit( job );
+return 0;
+}
+
+/*************************************************************
+*   s c h e d u l e r
+*************************************************************
+* the jobs wait in kindJobs until a worker takes the next one:
+*    interactive jobs before batch ones ( "#!batch", or costing more
+*    than KIND_BATCH_COST ); a batch job that waited KIND_STARVE
+*    seconds counts as interactive
+*    then the client that ran the least work lately ( its usage,
+*    charged with the cost of every job it starts, halves every
+*    KIND_HALF_LIFE seconds ), so one client can't hold the pool
+*    then the cheapest job
+* Batch jobs get at most all workers but one, so that an interactive
+* job always finds one soon.
+* Admission: a job starts only when its memory ( kin_model_estimate )
+* fits into what the running ones leave of the limit, else it is
+* deferred; one deferred KIND_STARVE seconds holds back the others
+* until it fits. The memory is an upper bound ( the FSP space at its
+* limit ); a job only that bound of which is over the limit waits
+* until it runs alone. One that takes more than the limit even at the
+* least is rejected at once with a line
+* "#!rejected needs <n> MB, the limit is <m> MB". The queue is bounded:
+* while it is full no more connections are accepted, they wait in the
+* listen backlog.
+*/
+int isBatch( const KindJob *job )
+{
+return job->req.batch || job->cost > KIND_BATCH_COST;
+}
+
+// the usage of client c now, decayed; kindQueueLock held
+double clientUsage( int c, double t )
+{
+KindClient *k = kindClients + c;
+k->usage *= pow( 0.5, ( t - k->updated ) / KIND_HALF_LIFE );
+k->updated = t;
+return k->usage;
+}
+
+// the entry of the client named name, the least used one is reused;
+// kindQueueLock held
+int clientFind( const char *name, double t )
+{
+int slot = -1;
+for( int c = 0; c < KIND_CLIENTS; c++ ) {
+KindClient *k = kindClients + c;
+if( k->name[ 0 ] != 0 && strcmp( k->name, name ) == 0 ) {
+return c;
+}
+if( k->jobs > 0 || ( slot >= 0 && kindClients[ slot ].name[ 0 ] == 0 ) ) {
+continue;
+}
+if( slot < 0 || k->name[ 0 ] == 0 || clientUsage( c, t ) < clientUsage( slot, t ) ) {
+slot = c;
+}
+}
+if( slot < 0 ) {
+// all have jobs waiting or running: the last one shares its entry
+return KIND_CLIENTS - 1;
+}
+KindClient *k = kindClients + slot;
+strcpy( k->name, name );
+k->usage = 0.0;
+k->updated = t;
+return slot;
+}
+
+void submit( KindJob *job )
+{
+requestEstimate( job );
+if( job->least > kindMemoryLimit ) {
+// would never fit: answered at once, with nothing run
+char buf[ 128 ];
+snprintf( buf, sizeof( buf ), KIND_REJECTED " needs %.0f MB, the limit is %.0f MB\n",
+job->least / MB, kindMemoryLimit / MB );
+textAppend( &job->reply, buf, strlen( buf ) );
+job->req.input.length = 0;
+job->cost = job->bytes = job->least = 0.0;
+}
+else if( job->bytes > kindMemoryLimit ) {
+// may fit: it takes all there is, so it runs alone
+job->bytes = kindMemoryLimit;
+}
+pthread_mutex_lock( &kindQueueLock );
+while( kindWaiting >= kindQueueSize ) {
+pthread_cond_wait( &kindQueueRoom, &kindQueueLock );
+}
+job->queued = now();
+job->client = clientFind( job->req.client, job->queued );
+kindClients[ job->client ].jobs++;
+job->running = 0;
+job->nextJob = kindJobs;
+kindJobs = job;
+kindWaiting++;
+pthread_cond_signal( &kindQueueReady );
+pthread_mutex_unlock( &kindQueueLock );
+}
+
+// the next job for a worker, 0 if none may start; kindQueueLock held
+KindJob *schedule()
+{
+double t = now();
+double room = kindMemoryLimit - kindMemoryUsed;
+
+// a job deferred for memory long enough goes next: the others wait
+// for the memory it needs to be freed
+KindJob *oldest = 0;
+for( KindJob *job = kindJobs; job != 0; job = job->nextJob ) {
+if( ! job->running && job->bytes > room && t - job->queued >= KIND_STARVE
+&& ( oldest == 0 || job->queued < oldest->queued ) ) {
+oldest = job;
+}
+}
+
+KindJob *best = 0;
+int bestClass = 0;
+double bestUsage = 0.0;
+for( KindJob *job = kindJobs; job != 0; job = job->nextJob ) {
+if( job->running || job->bytes > room || ( oldest != 0 && job != oldest ) ) {
+continue;
+}
+int batch = isBatch( job ) && t - job->queued < KIND_STARVE;
+if( batch && kindWorkers > 1 && kindBatchRunning >= kindWorkers - 1 ) {
+continue;
+}
+double usage = clientUsage( job->client, t );
+if( best == 0 || batch < bestClass
+|| ( batch == bestClass && ( usage < bestUsage
+|| ( usage == bestUsage && job->cost < best->cost ) ) ) ) {
+best = job;
+bestClass = batch;
+bestUsage = usage;
+}
+}
+if( best != 0 ) {
+best->running = 1;
+kindWaiting--;
+kindMemoryUsed += best->bytes;
+if( isBatch( best ) ) {
+kindBatchRunning++;
+}
+clientUsage( best->client, t );
+kindClients[ best->client ].usage += best->cost;
+kindClients[ best->client ].running++;
+pthread_cond_signal( &kindQueueRoom );
+}
+return best;
+}
+
+void finished( KindJob *job )
+{
+pthread_mutex_lock( &kindQueueLock );
+KindJob **p = &kindJobs;
+while( *p != job ) {
+p = &( *p )->nextJob;
+}
+*p = job->nextJob;
+kindMemoryUsed -= job->bytes;
+if( isBatch( job ) ) {
+kindBatchRunning--;
+}
+kindClients[ job->client ].running--;
+kindClients[ job->client ].jobs--;
+// a batch job, or one waiting for memory, may start now
+pthread_cond_broadcast( &kindQueueReady );
+pthread_mutex_unlock( &kindQueueLock );
+}
+
+/*
+* the queue as text, for "#!queue": a line per job, running ones
+* first, then a line per client with jobs or usage
+*/
+void queueState( KindText *reply )
+{
+char buf[ 256 ];
+pthread_mutex_lock( &kindQueueLock );
+double t = now();
+snprintf( buf, sizeof( buf ), "workers %d\nwaiting %d\nbatch running %d\nmemory %.0f MB of %.0f MB\n",
+kindWorkers, kindWaiting, kindBatchRunning, kindMemoryUsed / MB, kindMemoryLimit / MB );
+textAppend( reply, buf, strlen( buf ) );
+for( int running = 1; running >= 0; running-- ) {
+for( KindJob *job = kindJobs; job != 0; job = job->nextJob ) {
+if( job->running != running ) {
+continue;
+}
+snprintf( buf, sizeof( buf ), "job %s %s %s %s %.3g %.1f MB %.1f\n", running ? "running" : "waiting",
+kindClients[ job->client ].name, job->tag[ 0 ] != 0 ? job->tag : "-",
+isBatch( job ) ? "batch" : "interactive", job->cost, job->bytes / MB, t - job->queued );
+textAppend( reply, buf, strlen( buf ) );
+}
+}
+for( int c = 0; c < KIND_CLIENTS; c++ ) {
+KindClient *k = kindClients + c;
+if( k->name[ 0 ] != 0 && ( k->jobs > 0 || clientUsage( c, t ) >= 1.0 ) ) {
+snprintf( buf, sizeof( buf ), "client %.*s usage %.3g jobs %d running %d\n", KIND_TAG, k->name, k->usage, k->jobs, k->running );
+textAppend( reply, buf, strlen( buf ) );
+}
+}
+pthread_mutex_unlock( &kindQueueLock );
+}
+
+/*************************************************************
+*   w o r k e r s
+*************************************************************/
+void *worker( void * )
+{
+for( ;; ) {
+pthread_mutex_lock( &kindQueueLock );
+KindJob *job;
+while( ( job = schedule() ) == 0 ) {
+pthread_cond_wait( &kindQueueReady, &kindQueueLock );
+}
+pthread_mutex_unlock( &kindQueueLock );
+
+runJob( job );
+}
+return 0;
+}
+
+int main( int argc, char **argv )
+{
+// three quarters of the machine unless -m says otherwise
+kindMemoryLimit = 0.75 * sysconf( _SC_PHYS_PAGES ) * sysconf( _SC_PAGESIZE );
+if( argc > 2 && strcmp( argv[ 1 ], "-m" ) == 0 ) {
+kindMemoryLimit = atof( argv[ 2 ] ) * MB;
+argv += 2;
+argc -= 2;
+}
+if( argc < 2 ) {
+cerr << "USAGE: kind [ -m <memory MB> ] <port> [ <workers> [ <cache directory> [ <cache MB> ] ] ]" << endl;
+return 1;
+}
+int port = atoi( argv[ 1 ] );
+int workers = argc > 2 ? atoi( argv[ 2 ] ) : 0;
+if( workers < 1 ) {
+workers = (int) sysconf( _SC_NPROCESSORS_ONLN );
+}
+if( workers < 1 ) {
+workers = 1;
+}
+kindWorkers = workers;
+kindQueueSize = KIND_QUEUE * workers;
+if( argc > 3 ) {
+long long mb = argc > 4 ? atoll( argv[ 4 ] ) : KIND_CACHE_MB;
+if( cacheOpen( argv[ 3 ], mb * 1024 * 1024 ) != 0 ) {
+return 1;
+}
+}
+
+// a client gone before its reply must not end the daemon
+signal( SIGPIPE, SIG_IGN );
+
+int server = socket( AF_INET, SOCK_STREAM, 0 );
+if( server < 0 ) {
+cerr << "Can't create socket." << endl;
+return 1;
+}
+int on = 1;
+setsockopt( server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+struct sockaddr_in addr;
+memset( &addr, 0, sizeof( addr ) );
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl( INADDR_ANY );
+addr.sin_port = htons( port );
+if( bind( server, (struct sockaddr *) &addr, sizeof( addr ) ) != 0
+|| listen( server, KIND_BACKLOG ) != 0 ) {
+cerr << "Can't bind to port " << port << endl;
+return 1;
+}
+
+for( int w = 0; w < workers; w++ ) {
+pthread_t thread;
+if( pthread_create( &thread, 0, worker, 0 ) != 0 ) {
+cerr << "Can't start worker " << w << endl;
+return 1;
+}
+pthread_detach( thread );
+}
+
+for( ;; ) {
+// while the queue is full the connections wait in the backlog
+pthread_mutex_lock( &kindQueueLock );
+while( kindWaiting >= kindQueueSize ) {
+pthread_cond_wait( &kindQueueRoom, &kindQueueLock );
+}
+pthread_mutex_unlock( &kindQueueLock );
+
+int sock = accept( server, 0, 0 );
+if( sock < 0 ) {
+continue;
+}
+KindJob *job = new KindJob;
+memset( job, 0, sizeof( KindJob ) );
+job->sock = sock;
+pthread_t reader;
+if( pthread_create( &reader, 0, connection, job ) != 0 ) {
+close( sock );
+freeJob( job );
+continue;
+}
+pthread_detach( reader );
+}
+}
@@ -0,0 +1,334 @@
+// kin: solves kinetic equations for arbitrary reaction networks,
+// reads kin.i01 and writes kin.o01, kin.o02, kin.o03 ( kin.o04 )
+//
+// The solver itself is libkin ( kin.cpp, libkin.h ), this is just the
+// executable around it: every data set of kin.i01 is read, run and
+// written in turn.
+//
+// usage: kin [ -d <directory> ] [ -b ] [ -c <bytes> ] [ -e ] [ -m <name> ] [ -o <times> ] [ -p <digits> ] [ -r ] [ -s ] [ -t <seconds> ] [ <lsodes> <output> <include> ]
+//        -d: the files are in <directory> instead of the working one
+//        -b: kin.b02 as well, the rows of kin.o02 as packed binary
+//            frames ( kin_solver_pack in libkin.h )
+//        -c: kin.c02 as well, the rows of kin.o02 as a column per
+//            species of 8 ( double ) or 4 ( float ) byte values, for
+//            readers that map the file ( kin_columns in libkin.h )
+//        -e: nothing is run, for every data set a line
+//            "#!estimate <data set> <bytes> <trajectory> <workspace> <work> <least>"
+//            ( kin_model_estimate in libkin.h ) goes to stdout
+//        -m: the results of data set n go to the shared memory segment
+//            <name>-n ( kin_solver_publish in libkin.h ) instead of
+//            kin.o02 .. kin.o04; with -b its report is the frame
+//        -o: only the state at the times in the file <times> ( numbers
+//            apart by blanks or lines, ascending ), for every data set
+//            the line "#!set <data set> <species>" and a line
+//            "#!observe <time> <x1> .. <xn>" per time to stdout, no
+//            trajectory and no kin.o02 ( kin_solver_observe in libkin.h )
+//        -p: significant digits of the numbers in the texts, 7 by
+//            default ( kin_solver_digits in libkin.h )
+//        -r: kin.o02 a line per time with a column per species
+//            ( kin_solver_time_major in libkin.h ), for gnuplot
+//        -t: wall clock limit of the whole run; at the limit, or on
+//            SIGTERM / SIGINT, the run stops at its next time step and
+//            the results up to there are written as usual
+//        -s: stream the rows and the progress to stdout during the run,
+//            as lines "#!set <data set> <species>",
+//            "#!row <time> <x1> .. <xn>" and "#!progress <done> <eta s>"
+
+#include "libkin.h"
+#include <iostream.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define DEBUG_EXECUTION_TIME 1
+
+// wall clock seconds
+double now()
+{
+struct timeval tv;
+gettimeofday( &tv, 0 );
+return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+/*************************************************************
+*   s t r e a m
+*************************************************************/
+double streamStart = 0.0;
+
+void streamRow( void *, double time, const double x[], int species )
+{
+printf( "#!row %.6E", time );
+for( int i = 0; i < species; i++ ) {
+printf( " %.6E", x[ i ] );
+}
+printf( "\n" );
+}
+
+void streamProgress( void *, double done )
+{
+double elapsed = now() - streamStart;
+double eta = ( done > 0.0 ? elapsed * ( 1.0 - done ) / done : -1.0 );
+printf( "#!progress %.2f %.1f\n", done, eta );
+fflush( stdout );
+}
+
+/*************************************************************
+*   o b s e r v e
+*************************************************************/
+// the numbers of file name, 0 when it cannot be read
+double *readTimes( const char *name, int *n )
+{
+FILE *f = fopen( name, "r" );
+if( f == 0 ) {
+cerr << "Couldn't open times file " << name << endl;
+return 0;
+}
+int size = 64;
+double *times = new double[ size ];
+double v;
+*n = 0;
+while( fscanf( f, "%lf", &v ) == 1 ) {
+if( *n == size ) {
+double *more = new double[ 2 * size ];
+memcpy( more, times, size * sizeof( double ) );
+delete [] times;
+times = more;
+size *= 2;
+}
+times[ ( *n )++ ] = v;
+}
+fclose( f );
+return times;
+}
+
+/*************************************************************
+*   s t o p
+*************************************************************/
+kin_solver *volatile runningSolver = 0;
+volatile int stopRequested = 0;
+
+void stopSignal( int )
+{
+stopRequested = 1;
+if( runningSolver != 0 ) {
+kin_solver_cancel( runningSolver );
+}
+}
+
+int main(int argc, char **argv)
+{
+
+double programStart = now();
+double limit = 0.0;
+int streaming = 0;
+int packed = 0;
+int columns = 0;
+int estimating = 0;
+int digits = 0;
+int timeMajor = 0;
+double *times = 0;
+int numberOfTimes = 0;
+const char *segment = 0;
+while( argc > 1 && argv[1][0] == '-' ) {
+if( argc > 2 && strcmp( argv[1], "-d" ) == 0 ) {
+if( kin_session( argv[2] ) != 0 ) {
+return 1;
+}
+argv += 2;
+argc -= 2;
+}
+else if( strcmp( argv[1], "-b" ) == 0 ) {
+packed = 1;
+argv++;
+argc--;
+}
+else if( argc > 2 && strcmp( argv[1], "-c" ) == 0 ) {
+columns = atoi( argv[2] );
+argv += 2;
+argc -= 2;
+}
+else if( argc > 2 && strcmp( argv[1], "-m" ) == 0 ) {
+segment = argv[2];
+argv += 2;
+argc -= 2;
+}
+else if( strcmp( argv[1], "-e" ) == 0 ) {
+estimating = 1;
+argv++;
+argc--;
+}
+else if( argc > 2 && strcmp( argv[1], "-o" ) == 0 ) {
+times = readTimes( argv[2], &numberOfTimes );
+if( times == 0 ) {
+return 1;
+}
+argv += 2;
+argc -= 2;
+}
+else if( argc > 2 && strcmp( argv[1], "-p" ) == 0 ) {
+digits = atoi( argv[2] );
+argv += 2;
+argc -= 2;
+}
+else if( strcmp( argv[1], "-r" ) == 0 ) {
+timeMajor = 1;
+argv++;
+argc--;
+}
+else if( strcmp( argv[1], "-s" ) == 0 ) {
+streaming = 1;
+argv++;
+argc--;
+}
+else if( argc > 2 && strcmp( argv[1], "-t" ) == 0 ) {
+limit = atof( argv[2] );
+argv += 2;
+argc -= 2;
+}
+else {
+cerr << "USAGE: kin [ -d <directory> ] [ -b ] [ -c <bytes> ] [ -e ] [ -m <name> ] [ -o <times> ] [ -p <digits> ] [ -r ] [ -s ] [ -t <seconds> ] [ <lsodes> <output> <include> ]" << endl;
+return 1;
+}
+}
+kin_lsodes( argv[1], argv[2], argv[3] );
+
+signal( SIGTERM, stopSignal );
+signal( SIGINT, stopSignal );
+
+clock_t start, end;
+double elapsed = 0.0;
+
+int retValue = 0;
+
+for( int dataSet = 1; retValue == 0 && ! stopRequested; dataSet++ ) {
+
+start = clock();
+kin_model *model = kin_model_load( dataSet );
+if( model == 0 ) {
+break;
+}
+end = clock();
+elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+if( DEBUG_EXECUTION_TIME ) {
+cerr << " readInputData time: " << elapsed <<endl;
+}
+
+if( estimating ) {
+kin_estimate e;
+if( kin_model_estimate( model, &e ) == 0 ) {
+printf( "#!estimate %d %.0f %.0f %.0f %.3E %.0f\n", dataSet, e.bytes, e.trajectory, e.workspace, e.work, e.least );
+}
+kin_model_free( model );
+continue;
+}
+
+start = clock();
+kin_solver *solver = kin_solver_new( model );
+if( solver == 0 ) {
+kin_model_free( model );
+return 1;
+}
+end = clock();
+elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+if( DEBUG_EXECUTION_TIME ) {
+cerr << " initializeBigMatrices time: " << elapsed <<endl;
+}
+
+// kin.o02 is formatted while the run goes on
+kin_solver_background( solver, 1 );
+kin_solver_time_major( solver, timeMajor );
+
+if( digits != 0 && kin_solver_digits( solver, digits ) != 0 ) {
+kin_solver_free( solver );
+kin_model_free( model );
+return 1;
+}
+
+if( streaming ) {
+printf( "#!set %d %d\n", dataSet, kin_model_output_species( model, 0 ) );
+kin_solver_stream( solver, streamRow, streamProgress, 0 );
+streamStart = now();
+}
+
+if( limit > 0.0 ) {
+double left = limit - ( now() - programStart );
+kin_solver_deadline( solver, left > 0.0 ? left : 1.0e-9 );
+}
+
+if( times != 0 ) {
+int species = kin_model_species_count( model );
+double *x = new double[ (long) numberOfTimes * species + 1 ];
+runningSolver = solver;
+if( stopRequested ) {
+kin_solver_cancel( solver );
+}
+int reached = kin_solver_observe( solver, times, numberOfTimes, x );
+runningSolver = 0;
+if( reached < 0 ) {
+retValue = 1;
+}
+else {
+printf( "#!set %d %d\n", dataSet, species );
+for( int k = 0; k < reached; k++ ) {
+printf( "#!observe %.6E", times[ k ] );
+for( int i = 0; i < species; i++ ) {
+printf( " %.6E", x[ (long) k * species + i ] );
+}
+printf( "\n" );
+}
+if( reached < numberOfTimes ) {
+stopRequested = 1;
+cerr << " data set " << dataSet << " stopped early, the results are partial" << endl;
+}
+}
+delete [] x;
+kin_solver_free( solver );
+kin_model_free( model );
+continue;
+}
+
+start = clock();
+runningSolver = solver;
+if( stopRequested ) {
+kin_solver_cancel( solver );
+}
+if( kin_solver_run( solver ) != 0 ) {
+stopRequested = 1;
+cerr << " data set " << dataSet << " stopped early, the results are partial" << endl;
+}
+runningSolver = 0;
+if( streaming ) {
+fflush( stdout );
+}
+end = clock();
+elapsed = ( (double) ( end - start ) ) / CLOCKS_PER_SEC;
+if( DEBUG_EXECUTION_TIME ) {
+cerr << " total integration time:  " << elapsed <<endl;
+}
+
+if( segment != 0 ) {
+char name[ 256 ];
+snprintf( name, sizeof( name ), "%s-%d", segment, dataSet );
+retValue = kin_solver_publish( solver, name, packed );
+}
+else {
+retValue = kin_solver_write( solver );
+if( retValue == 0 && packed ) {
+retValue = kin_solver_write_packed( solver );
+}
+}
+if( retValue == 0 && columns != 0 ) {
+retValue = kin_solver_write_columns( solver, columns );
+}
+
+kin_solver_free( solver );
+kin_model_free( model );
+}
+
+delete [] times;
+// theServer takes a nonzero exit for a failed run
+return retValue;
+}
@@ -0,0 +1,267 @@
+// libkin: the kin solver as a library
+//
+// A model is one data set of a kin.i01 text. It is read from the file,
+// from a memory buffer, or built species by species and reaction by
+// reaction. A solver runs a compiled model once, and the results come
+// back in caller buffers ( or as the kin.o02 text ) instead of files.
+// Any number of solvers may run one model, also in several threads,
+// as long as nobody changes the model meanwhile ( lsodes, jtime=6,
+// still goes through tmp.f in the working directory ).
+//
+// All functions returning int return 0 when ok. Errors are written to
+// stderr, as the kin executable does.
+
+#ifndef __libkin_h__
+#define __libkin_h__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   typedef struct KinModel kin_model;
+   typedef struct KinSolver kin_solver;
+
+   // arguments of the lsodes method ( jtime=6 ): directory of the
+   // lsodes sources, output path and include path
+   void kin_lsodes( const char *lsodes, const char *output, const char *include );
+
+   // the directory of kin.i01, kin.o0* and tmp.f from now on, so that
+   // jobs running side by side have a workspace each; 0 or "" for the
+   // working directory ( the default )
+   int kin_session( const char *dir );
+
+   // data set number dataSet ( 1, 2, .. ) of kin.i01, echoed to kin.o01
+   // as the executable does, compiled; 0 when there is no such set
+   kin_model *kin_model_load( int dataSet );
+
+   // data set number dataSet of the kin.i01 text in text[ 0 .. length-1 ],
+   // compiled; 0 when there is no such set
+   kin_model *kin_model_read( const char *text, long length, int dataSet );
+
+   // an empty model of species and reactions, to be filled by the
+   // calls below and compiled by kin_model_compile()
+   kin_model *kin_model_new( const char *title, int species, int reactions );
+   int kin_model_time( kin_model *model, double time0, double time1,
+                       int ntime, int ntskip, int jtime );
+   // species i = 1 .. species; jfix 0 or 1 ( pulses need kin.i01 text )
+   int kin_model_species( kin_model *model, int i, const char *name,
+                          double xspec0, int jfix );
+   // reaction r = 1 .. reactions, reactants and products by name
+   int kin_model_reaction( kin_model *model, int r, double rkfor, double rkbak,
+                           int jkin, int nipart, const char *const reactants[],
+                           int nopart, const char *const products[] );
+   // step-2 rate constants of a Michaelis-Menten reaction ( jkin=11 )
+   int kin_model_reaction2( kin_model *model, int r, double rkfor2, double rkbak2 );
+   // one option line as it may follow the reactions, e.g. "seed 7"
+   int kin_model_option( kin_model *model, const char *line );
+   int kin_model_compile( kin_model *model );
+
+   // new rate constants of reaction r of a compiled model, for fitting
+   // loops; no solver of the model may be running
+   int kin_model_rate( kin_model *model, int r, double rkfor, double rkbak );
+
+   // species of the model, including the moment species
+   int kin_model_species_count( const kin_model *model );
+   const char *kin_model_species_name( const kin_model *model, int i );
+
+   // the species of the outputs, those of the option line "select
+   // <name|number> .." or all: their number, and their numbers i into
+   // species[] unless 0. kin.o02 ( also kin_solver_report ), the rows
+   // of kin_solver_stream(), the frames and blocks below have only
+   // those, in this order; kin_solver_trajectory() has all.
+   int kin_model_output_species( const kin_model *model, int species[] );
+
+   // the canonical text of the compiled model into text[ 0 .. size-1 ]
+   // ( as kin_solver_report ): models with equal texts give equal
+   // results, input spacing and comment lines aside. A key for caches.
+   long kin_model_key( const kin_model *model, char *text, long size );
+
+   // the work of a run of the compiled model, roughly, in rate
+   // evaluations: for ordering jobs, short ones first
+   double kin_model_cost( const kin_model *model );
+
+   // what a solver of the compiled model will need, known before it
+   // is made: bytes of the rows kept, of the method's workspace
+   // ( Jacobian, FSP space, ensemble statistics ) and in all, and
+   // the work of kin_model_cost(). For admitting jobs to a machine.
+   // bytes is an upper bound: the FSP space is counted at its limit
+   // of states; least counts it at the box it starts with, the run
+   // takes that at least ( least == bytes for the other methods ).
+   typedef struct kin_estimate {
+      double trajectory;
+      double workspace;
+      double bytes;
+      double work;
+      double least;
+   } kin_estimate;
+   int kin_model_estimate( const kin_model *model, kin_estimate *estimate );
+
+   void kin_model_free( kin_model *model );
+
+   // a solver of the compiled model, run it once
+   kin_solver *kin_solver_new( const kin_model *model );
+
+   // 1 when the run stopped early, on kin_solver_cancel() or at the
+   // deadline; the results up to there are kept and written as usual
+   int kin_solver_run( kin_solver *solver );
+
+   // instead of kin_solver_run() for fitting: runs the model and puts
+   // the state at the times time[ 0 .. n-1 ] ( ascending, within time0
+   // .. time1 ) into x[ k * species + i - 1 ]. Between two time steps
+   // the state is interpolated linearly ( the stochastic methods give
+   // the one of the step before ). No rows are kept, so there is no
+   // trajectory and nothing to write afterwards. Returns the number of
+   // times reached, n unless the run stopped early; -1 on an error.
+   int kin_solver_observe( kin_solver *solver, const double time[], int n, double x[] );
+
+   // stops a run at its next time step ( an ensemble after the runs
+   // under way ); from any thread or a signal handler
+   void kin_solver_cancel( kin_solver *solver );
+
+   // wall clock seconds the next kin_solver_run() may take, 0 none
+   void kin_solver_deadline( kin_solver *solver, double seconds );
+
+   // the output rows of the run ( those of kin.o02 ): time[ row ] and
+   // x[ row * species + i - 1 ] for species i; ensemble runs give the
+   // means. At most rows rows are stored, the total number is returned.
+   // kin_solver_trajectory( solver, 0, 0, 0 ) just counts them.
+   int kin_solver_trajectory( kin_solver *solver, double time[],
+                              double x[], int rows );
+
+   // called during kin_solver_run(): row() with every output row as
+   // soon as it is computed ( time, x[ 0 .. species-1 ] as they will be
+   // in kin.o02, the output species ), progress() with the part of the run done, 0 .. 1,
+   // about every hundredth. Ensembles report progress by runs and
+   // give their rows at the end. Either function may be 0.
+   typedef void ( *kin_row_fn )( void *user, double time, const double x[], int species );
+   typedef void ( *kin_progress_fn )( void *user, double done );
+   void kin_solver_stream( kin_solver *solver, kin_row_fn row,
+                           kin_progress_fn progress, void *user );
+
+   // the net rate, forward minus backward, of reaction r in the state
+   // x[ 0 .. species-1 ] of all the species ( kin_model_species_count ),
+   // a row as kin_solver_trajectory() and kin_solver_observe() give it
+   // ( of an ensemble the means ), so that the rows give their fluxes
+   // without the run keeping them ( of jtime=7,8,9 from the
+   // propensities ). The rows of kin_solver_stream() hold only the
+   // output species: they will not do when "select" leaves some out.
+   // kin.o03 has those of the option line
+   // "fluxes <r1> <r2> ..|all [ extents ]", extents their integrals.
+   double kin_solver_flux( kin_solver *solver, int r, const double x[] );
+
+   // 1: a thread formats the kin.o02 text while the run computes it,
+   // kin_solver_write() and kin_solver_report() then only copy it out.
+   // Takes the memory of the text besides that of the rows. 0 default.
+   void kin_solver_background( kin_solver *solver, int on );
+
+   // 1: the kin.o02 text of the run ( also kin_solver_report ) as a line
+   // per time, itime, timei and a column per species ( of an ensemble
+   // the mean, variance and quantiles of each ) under a line of their
+   // names, as gnuplot reads it; 0 a block per species ( the default )
+   void kin_solver_time_major( kin_solver *solver, int on );
+
+   // significant digits of the numbers of the texts ( kin.o01 .. kin.o04,
+   // kin_solver_report ), 1 .. 17; a number takes digits + 9 columns.
+   // The default 7 gives the columns of 16 the files always had.
+   int kin_solver_digits( kin_solver *solver, int digits );
+
+   // the kin.o02 text of the run into text[ 0 .. size-1 ], 0 terminated;
+   // returns its length, longer than size-1 when it was cut
+   long kin_solver_report( kin_solver *solver, char *text, long size );
+
+   // the rows of kin_solver_trajectory() as a packed binary frame into
+   // data[ 0 .. size-1 ]; returns its length, longer than size when it
+   // was cut. A third to a tenth of the kin.o02 text, as exact ( floats
+   // keep the 7 digits of the text ). Integers are unsigned and little
+   // endian, u8 .. u32 by their bits:
+   //    "KINB"  u8 version ( 1 )  u32 bytes of the rest of the frame
+   //    u16 data set  u32 species ( the output ones )  u32 rows
+   //    u16 length and bytes of the title, then of each species name
+   //    1 + species columns, time first: u32 bytes, then the bits of
+   //    the rows' floats ( IEEE single ), most significant bit first:
+   //       the first value in 32 bits, for every next one v the XOR
+   //       x = v ^ previous as
+   //       0                        x == 0
+   //       1 0 <m bits>             the meaningful bits of x fit in the
+   //                                window of the last 1 1 case
+   //       1 1 <5: leading zeros> <5: m - 1> <m bits>
+   //                                a new window of m meaningful bits
+   //    the last byte of a column is padded with zero bits
+   long kin_solver_pack( kin_solver *solver, char *data, long size );
+
+   // kin.o01, kin.o02, kin.o03 ( kin.o04 ) as the executable writes them
+   int kin_solver_write( kin_solver *solver );
+
+   // the frame of kin_solver_pack() into kin.b02, after those of the
+   // data sets before
+   int kin_solver_write_packed( kin_solver *solver );
+
+   // the rows of kin_solver_trajectory() as a block of kin.c02, after
+   // those of the data sets before, for readers that map the file and
+   // take columns without parsing: this header, the rest at the byte
+   // offsets it gives from the header. Values are native, the block
+   // and the time column 8 byte aligned; the next block follows at
+   // size.
+   typedef struct kin_columns {
+      char      magic[ 4 ];        // "KINC"
+      int       version;           // 1
+      int       dataSet;
+      int       species;           // the output ones
+      int       rows;
+      int       bytes;             // of an x value: 8 double, 4 float
+      int       jtime;             // the method
+      int       ntime;             // the time grid of the model
+      int       ntskip;
+      int       halted;            // the run stopped early
+      int       runs;              // of an ensemble ( means ), else 0
+      int       reserved;
+      double    time0;
+      double    time1;
+      long long names;             // the title, then the species names,
+                                   // each 0 terminated
+      long long time;              // double time[ rows ]
+      long long x;                 // output species k at x + ( k - 1 ) * rows * bytes
+      long long size;              // of the block
+   } kin_columns;
+   int kin_solver_write_columns( kin_solver *solver, int bytes );
+
+   // the block of data set dataSet in kin.c02 as mapped or read to
+   // data[ 0 .. length-1 ], 0 when there is none
+   const kin_columns *kin_columns_find( const void *data, long length, int dataSet );
+
+   // a run published in POSIX shared memory: this header at offset 0,
+   // the rest at the byte offsets it gives. Values are native ( the
+   // consumer is on the same machine ), the doubles 8 byte aligned.
+   typedef struct kin_shm {
+      char      magic[ 4 ];        // "KINS", written last
+      int       version;           // 1
+      int       dataSet;
+      int       species;           // the output ones
+      int       rows;
+      int       halted;            // the run stopped early
+      long long names;             // the title, then the species names,
+                                   // each 0 terminated
+      long long time;              // double time[ rows ]
+      long long x;                 // double x[ row * species + k - 1 ]
+      long long report;            // the kin.o02 text, or with packed
+      long long reportLength;      // the frame of kin_solver_pack()
+      long long size;              // of the segment
+   } kin_shm;
+
+   // the rows of kin_solver_trajectory() and the report into the
+   // segment name ( "/name", shm_open ), created or replaced; the
+   // consumer unlinks it ( shm_unlink, or /dev/shm/name on Linux )
+   int kin_solver_publish( kin_solver *solver, const char *name, int packed );
+
+   // the segment name mapped read only, 0 when there is no complete
+   // one; kin_shm_detach() unmaps it
+   const kin_shm *kin_shm_attach( const char *name );
+   void kin_shm_detach( const kin_shm *shm );
+
+   void kin_solver_free( kin_solver *solver );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# golden: runs kin on the stock data set ( newVer/kin.i01 ) and compares
+# kin.o01 .. kin.o03 byte for byte with those kept in newVer; given
+# kinread ( kinread.cpp ), also reads kin.b02 and kin.c02 back
+#
+# usage: sh golden.sh <kin> [ <kinread> ]
+#        exits 0 when everything agrees
+
+if [ $# -lt 1 ]; then
+	echo "USAGE: sh golden.sh <kin> [ <kinread> ]" >&2
+	exit 1
+fi
+kin=`cd \`dirname $1\` && pwd`/`basename $1`
+kinread=""
+if [ $# -gt 1 ]; then
+	kinread=`cd \`dirname $2\` && pwd`/`basename $2`
+fi
+stock=`cd \`dirname $0\`/../newVer && pwd`
+work=${TMPDIR:-/tmp}/golden.$$
+mkdir -p $work || exit 1
+trap 'rm -rf $work' 0
+
+cp $stock/kin.i01 $work/
+if ! ( cd $work && $kin -b -c 8 >/dev/null 2>&1 ); then
+	echo "kin failed" >&2
+	exit 1
+fi
+
+failed=0
+for f in kin.o01 kin.o02 kin.o03; do
+	if cmp -s $stock/$f $work/$f; then
+		echo "$f ok"
+	else
+		echo "$f differs from $stock/$f"
+		failed=1
+	fi
+done
+
+if [ -n "$kinread" ]; then
+	$kinread $work || failed=1
+fi
+exit $failed
@@ -0,0 +1,272 @@
+// kinread: reads kin.b02 and kin.c02 back ( the formats of
+// kin_solver_pack and kin_columns in libkin.h ) and checks them
+// against the kin.o02 text of the same run, for the first data set
+//
+// usage: kinread [ <directory> ]
+//        the files of kin -b -c 8 ( or -c 4 ) in <directory>, the
+//        working one by default; kin.o02 a block per species ( no -r )
+//
+// Only the header is used, not the library: the reader follows the
+// formats as documented. Exits 0 when the rows agree, b02 to the
+// floats of c02 exactly and both to the 7 digits of the text.
+//
+// build: g++ -I../newVer kinread.cpp -o kinread
+
+#include "libkin.h"
+#include <iostream.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*************************************************************
+*   f i l e s
+*************************************************************/
+// the whole of file name, 0 when it cannot be read
+char *readFile( const char *dir, const char *name, long *length )
+{
+char path[ 1024 ];
+snprintf( path, sizeof( path ), "%s/%s", dir, name );
+FILE *f = fopen( path, "rb" );
+if( f == 0 ) {
+cerr << "Couldn't open " << path << endl;
+return 0;
+}
+fseek( f, 0, SEEK_END );
+*length = ftell( f );
+fseek( f, 0, SEEK_SET );
+// doubles of kin.c02 are read in place
+char *data = (char *) malloc( *length + 8 );
+if( fread( data, 1, *length, f ) != (size_t) *length ) {
+cerr << "Couldn't read " << path << endl;
+free( data );
+data = 0;
+}
+fclose( f );
+return data;
+}
+
+/*************************************************************
+*   t e x t
+*************************************************************
+* kin.o02, a block per species: lines "#" with the species number
+* after "#   ispec", then rows "itime time x"
+*/
+struct TextRows {
+   int     species;
+   int     rows;
+   double *time;              // time[ row ]
+   double *x;                 // x[ ( k - 1 ) * rows + row ]
+};
+
+int readText( const char *dir, TextRows *t )
+{
+long length;
+char *text = readFile( dir, "kin.o02", &length );
+if( text == 0 ) {
+return 1;
+}
+text[ length ] = 0;
+int size = 1024;
+t->species = 0;
+t->rows = 0;
+t->time = 0;
+t->x = (double *) malloc( size * sizeof( double ) );
+int n = 0;
+int row = 0;
+for( char *line = strtok( text, "\n" ); line != 0; line = strtok( 0, "\n" ) ) {
+if( strncmp( line, "#   ispec", 9 ) == 0 ) {
+if( t->species == 1 ) {
+t->rows = row;
+}
+t->species++;
+row = 0;
+continue;
+}
+int itime;
+double time, x;
+if( line[ 0 ] == '#' || sscanf( line, "%d %lf %lf", &itime, &time, &x ) != 3 ) {
+continue;
+}
+if( n == size ) {
+size *= 2;
+t->x = (double *) realloc( t->x, size * sizeof( double ) );
+}
+t->x[ n++ ] = x;
+if( t->species == 1 ) {
+t->time = (double *) realloc( t->time, ( row + 1 ) * sizeof( double ) );
+t->time[ row ] = time;
+}
+row++;
+}
+if( t->species == 1 ) {
+t->rows = row;
+}
+free( text );
+if( t->species == 0 || n != t->species * t->rows ) {
+cerr << "kin.o02: " << n << " values, not " << t->species << " species of " << t->rows << " rows" << endl;
+return 1;
+}
+return 0;
+}
+
+// a of b to the 7 digits of the text
+int agrees( double a, double b )
+{
+return fabs( a - b ) <= 1.0e-6 * fabs( b ) + 1.0e-30;
+}
+
+/*************************************************************
+*   f r a m e s
+*************************************************************/
+struct BitReader {
+   const unsigned char *p;
+   long                 bit;
+};
+
+unsigned int bits( BitReader *r, int n )
+{
+unsigned int v = 0;
+for( int i = 0; i < n; i++, r->bit++ ) {
+v = ( v << 1 ) | ( ( r->p[ r->bit >> 3 ] >> ( 7 - ( r->bit & 7 ) ) ) & 1 );
+}
+return v;
+}
+
+unsigned int le( const unsigned char *p, int bytes )
+{
+unsigned int v = 0;
+for( int i = bytes - 1; i >= 0; i-- ) {
+v = ( v << 8 ) | p[ i ];
+}
+return v;
+}
+
+// rows floats of a column, XOR coded
+void readColumn( const unsigned char *p, int rows, float out[] )
+{
+BitReader r = { p, 0 };
+unsigned int previous = 0;
+int lead = 0;
+int meaningful = 32;
+for( int k = 0; k < rows; k++ ) {
+if( k == 0 ) {
+previous = bits( &r, 32 );
+}
+else if( bits( &r, 1 ) == 1 ) {
+if( bits( &r, 1 ) == 1 ) {
+lead = bits( &r, 5 );
+meaningful = bits( &r, 5 ) + 1;
+}
+previous ^= bits( &r, meaningful ) << ( 32 - lead - meaningful );
+}
+memcpy( out + k, &previous, sizeof( float ) );
+}
+}
+
+/*
+* the first frame of kin.b02: time[ row ], x[ ( k - 1 ) * rows + row ]
+* returns the number of rows, -1 on an error
+*/
+int readFrame( const char *dir, int *species, float **time, float **x )
+{
+long length;
+const unsigned char *data = (const unsigned char *) readFile( dir, "kin.b02", &length );
+if( data == 0 ) {
+return -1;
+}
+if( length < 9 || memcmp( data, "KINB", 4 ) != 0 || data[ 4 ] != 1 ) {
+cerr << "kin.b02: no frame of version 1" << endl;
+return -1;
+}
+const unsigned char *end = data + 9 + le( data + 5, 4 );
+const unsigned char *p = data + 9;
+p += 2;                              // data set
+*species = le( p, 4 );
+int rows = le( p + 4, 4 );
+p += 8;
+for( int k = 0; k <= *species; k++ ) {
+p += 2 + le( p, 2 );                 // the title and the names
+}
+*time = new float[ rows + 1 ];
+*x = new float[ (long) *species * rows + 1 ];
+for( int k = 0; k <= *species; k++ ) {
+int bytes = le( p, 4 );
+readColumn( p + 4, rows, k == 0 ? *time : *x + (long) ( k - 1 ) * rows );
+p += 4 + bytes;
+}
+if( p != end ) {
+cerr << "kin.b02: the columns end at " << ( p - data ) << ", the frame at " << ( end - data ) << endl;
+rows = -1;
+}
+free( (void *) data );
+return rows;
+}
+
+int main( int argc, char **argv )
+{
+const char *dir = ( argc > 1 ? argv[ 1 ] : "." );
+TextRows t;
+if( readText( dir, &t ) != 0 ) {
+return 1;
+}
+int bad = 0;
+
+// kin.b02
+int species;
+float *ftime, *fx;
+int rows = readFrame( dir, &species, &ftime, &fx );
+if( rows < 0 ) {
+return 1;
+}
+if( species != t.species || rows != t.rows ) {
+cerr << "kin.b02: " << species << " species of " << rows << " rows, kin.o02 " << t.species << " of " << t.rows << endl;
+return 1;
+}
+for( int r = 0; r < rows; r++ ) {
+bad += ! agrees( ftime[ r ], t.time[ r ] );
+for( int k = 0; k < species; k++ ) {
+bad += ! agrees( fx[ (long) k * rows + r ], t.x[ (long) k * rows + r ] );
+}
+}
+printf( "kin.b02 %d species %d rows, %d differ from kin.o02\n", species, rows, bad );
+
+// kin.c02
+long length;
+char *data = readFile( dir, "kin.c02", &length );
+if( data == 0 ) {
+return 1;
+}
+const kin_columns *c = (const kin_columns *) data;
+if( length < (long) sizeof( kin_columns ) || memcmp( c->magic, "KINC", 4 ) != 0
+|| c->version != 1 || c->size > length ) {
+cerr << "kin.c02: no block of version 1" << endl;
+return 1;
+}
+if( c->species != t.species || c->rows != t.rows || ( c->bytes != 8 && c->bytes != 4 ) ) {
+cerr << "kin.c02: " << c->species << " species of " << c->rows << " rows of " << c->bytes << " bytes" << endl;
+return 1;
+}
+const double *ctime = (const double *) ( data + c->time );
+int differ = 0;
+int exact = 0;
+for( int r = 0; r < c->rows; r++ ) {
+differ += ! agrees( ctime[ r ], t.time[ r ] );
+exact += ( (float) ctime[ r ] != ftime[ r ] );
+for( int k = 0; k < c->species; k++ ) {
+const char *column = data + c->x + (long) k * c->rows * c->bytes;
+double v = ( c->bytes == 8 ? ( (const double *) column )[ r ] : ( (const float *) column )[ r ] );
+differ += ! agrees( v, t.x[ (long) k * t.rows + r ] );
+exact += ( (float) v != fx[ (long) k * rows + r ] );
+}
+}
+printf( "kin.c02 %d species %d rows, %d differ from kin.o02, %d from kin.b02\n", c->species, c->rows, differ, exact );
+bad += differ + exact;
+
+free( data );
+delete [] ftime;
+delete [] fx;
+free( t.time );
+free( t.x );
+return bad != 0;
+}
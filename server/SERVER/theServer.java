@@ -1,43 +1,93 @@
 import java.util.*;
 import java.net.*;
 import java.io.*;
+import java.util.concurrent.*;
+import java.nio.*;
+import java.nio.channels.*;
 
 /**
  *
  */ 
 public class theServer {
 
+	static final int QUEUE_PER_WORKER = 4;		// connections waiting, per worker
+	static final String JOBS_DIR = "jobs";		// a directory per job in here
+
 	/**
 	 *
 	 */
 	public static void main (String [] args) {
-		if( args.length != 2 ) {
+		if( args.length != 2 && args.length != 3 ) {
 			System.err.println("USAGE: provide an integer which is the port number we will bind to.");
 			System.err.println("       The third parameter is the path to the SOLVER.");
+			System.err.println("       An optional fourth one is the memory in MB the running solvers may take.");
 			System.err.println("Example:");
 			System.err.println("        java theServer 8888 \"tmpSolver\";  USE THIS FOR TESTING");
 			System.err.println("        java theServer 8888 kin;            THIS IS THE REAL KINSOLVER");
 			System.exit(-1);
 		}
+		if( args.length == 3 ) {
+			memoryLimit = Long.parseLong(args[2]) * 1024 * 1024;
+		}
 		new theServer(Integer.parseInt(args[0]), args[1]);		
 	}
 
+	static long memoryLimit = Long.MAX_VALUE;	// bytes the running solvers may take ( kin -e estimates )
+	static long memoryUsed = 0;
+
+	/**
+	 * Waits until a solver needing bytes fits into the memory limit next to the running
+	 * ones. bytes is an upper bound ( kin -e ), least what the solver takes anyway: one
+	 * over the limit only by its bound takes all there is and runs alone, one whose
+	 * least is over the limit is never admitted.
+	 * @return the bytes admitted, -1 when least is over the limit
+	 */
+	static synchronized long admit(long bytes, long least) throws InterruptedException {
+		if( least > memoryLimit ) {
+			return -1;
+		}
+		bytes = Math.min(bytes, memoryLimit);
+		while( memoryUsed + bytes > memoryLimit ) {
+			theServer.class.wait();
+		}
+		memoryUsed += bytes;
+		return bytes;
+	}
+
+	static synchronized void release(long bytes) {
+		memoryUsed -= bytes;
+		theServer.class.notifyAll();
+	}
+
 	/**
 	 * Binds to the specified port and loops forever accepting connections.
 	 * Each new connection is handled by a separate thread.
 	 * @param portNum the port number we will bind to.
 	 */
 	public theServer(int portNum, String solverBin) {
-		Random rand = new Random(System.nanoTime());
-		String ff = new String(rand.nextInt(100000) + "_" + System.nanoTime()+ ".txt");		// TEMP FILE NAME
+		/*
+		 * One worker per core takes the connections from a bounded queue.
+		 * When the queue is full we stop accepting, the clients then wait
+		 * in the listen backlog instead of all running at once.
+		 */
+		int workers = Runtime.getRuntime().availableProcessors();
+		BlockingQueue<Socket> jobs = new ArrayBlockingQueue<Socket>(QUEUE_PER_WORKER * workers);
+		File jobsDir = new File(JOBS_DIR);
+		jobsDir.mkdirs();
+		for( int i = 0; i < workers; i++ ) {
+			new theServerWorker(jobs, jobsDir, solverBin).start();
+		}
+
 		try {
        			ServerSocket serverSocket = new ServerSocket(portNum);
 			while( true ) {
        				Socket connectSock = serverSocket.accept();
-
-				//theServerChild sc = new theServerChild(connectSock, ff, solverBin);
-				theServerChild sc = new theServerChild(connectSock, "kin.i01", solverBin);	// HARDCODED NAME !!!!!
-				sc.start();
+				try {
+					jobs.put(connectSock);
+				}
+				catch (InterruptedException e) {
+					connectSock.close();
+				}
 			}
 		}
      		catch (SocketException se) {
@@ -55,22 +105,184 @@ public class theServer {
 
 
 
-class theServerChild extends Thread {
+class theServerWorker extends Thread {
+	BlockingQueue<Socket> jobs = null;
+	File jobsDir = null;
+	String solverBin = null;
+
+	/**
+	 * Runs the connections of the queue, one after the other.
+	 */
+	theServerWorker(BlockingQueue<Socket> jobs, File jobsDir, String solverBin) {
+		this.jobs = jobs;
+		this.jobsDir = jobsDir;
+		this.solverBin = solverBin;
+	}
+
+	public void run() {
+		while( true ) {
+			Socket connectSock = null;
+			try {
+				connectSock = jobs.take();
+			}
+			catch (InterruptedException e) {
+				continue;
+			}
+			new theServerChild(connectSock, jobsDir, solverBin).run();
+			Thread.interrupted();		// a late cancel must not hit the next job
+		}
+	}
+}
+
+
+
+
+class theServerChild {
   	Socket connectSock;
+	File jobsDir = null;
+	File jobDir = null;
 	String tmp_inputFile = null;
 	String solverBin = null;
+	Thread worker = null;
+	Process process = null;
+	boolean streaming = false;		// the client asked for "#!stream"
+	String deadline = null;			// seconds, "#!deadline <seconds>"
+	boolean binary = false;			// the client asked for "#!binary"
+	String digits = null;			// of the texts, "#!digits <n>"
+	boolean timeMajor = false;		// the client asked for "#!rows"
+	String segment = null;			// the results in shared memory, /dev/shm/<segment>-<data set>
+	long admitted = 0;			// bytes of theServer.memoryLimit held by this job
+
+	static final File SHM_DIR = new File("/dev/shm");
 
 	/**
 	 * We will handle the new connection.
 	 * @param connectSock is the connected socket to the client.
-	 * @param thmp_inputFile is the file name of the incoming data, the client sends us data and we store it in this file.
+	 * @param jobsDir is where the directory of this job goes: the client sends us data and we store it
+	 *                in kin.i01 there, the solver writes its kin.o0* files next to it.
 	 */
-	theServerChild(Socket connectSock, String tmp_inputFile, String solverBin) {
+	theServerChild(Socket connectSock, File jobsDir, String solverBin) {
 		this.connectSock = connectSock;
-		this.tmp_inputFile = tmp_inputFile;
+		this.jobsDir = jobsDir;
 		this.solverBin = solverBin;
 	}
 
+	/**
+	 * The client asked to stop: interrupts the worker while it waits for the solver,
+	 * and stops the solver, also while its stream is being forwarded.
+	 */
+	synchronized void cancel() {
+		if( worker != null ) {
+			worker.interrupt();
+			if( process != null ) {
+				process.destroy();
+			}
+		}
+	}
+
+	synchronized void running(Thread t) {
+		worker = t;
+		if( t == null ) {
+			process = null;
+		}
+	}
+
+	synchronized void started(Process p) {
+		process = p;
+	}
+
+	/**
+	 * Deletes the directory of the job and the files in it.
+	 */
+	void cleanUp() {
+		if( jobDir == null ) {
+			return;
+		}
+		for( int set = 1; segment != null && new File(SHM_DIR, segment + "-" + set).delete(); set++ ) {
+		}
+		File [] files = jobDir.listFiles();
+		for( int i = 0; files != null && i < files.length; i++ ) {
+			files[i].delete();
+		}
+		jobDir.delete();
+	}
+
+	/**
+	 * The memory the solver estimates for the largest data set of the job, from the lines
+	 * "#!estimate <data set> <bytes> .." of "kin -e"; 0 when it gives none.
+	 */
+	// the bytes of the largest data set and what it takes at the least ( kin -e )
+	long [] estimate() throws InterruptedException {
+		long [] bytes = { 0, 0 };
+		try {
+			String [] cmdArgs = { solverBin, "-d", jobDir.getPath(), "-e" };
+			Process p = Runtime.getRuntime().exec(cmdArgs, null, new File("."));
+			BufferedReader er = new BufferedReader(new InputStreamReader(p.getInputStream()));
+			String eLine = null;
+			while( (eLine = er.readLine()) != null ) {
+				String [] f = eLine.trim().split("\\s+");
+				if( f.length >= 3 && f[0].equals("#!estimate") ) {
+					long upper = (long) Double.parseDouble(f[2]);
+					bytes[0] = Math.max(bytes[0], upper);
+					bytes[1] = Math.max(bytes[1], f.length >= 7 ? (long) Double.parseDouble(f[6]) : upper);
+				}
+			}
+			er.close();
+			p.waitFor();
+		}
+		catch (IOException e) {
+			System.out.println("SERVER no estimate: " + e);
+		}
+		catch (NumberFormatException e) {
+			System.out.println("SERVER no estimate: " + e);
+		}
+		return bytes;
+	}
+
+	/**
+	 * Sends the reports the solver published in shared memory ( kin_shm in libkin.h ),
+	 * straight from the mapped segments: the kin.o02 text, or with "#!binary" the line
+	 * "#!binary <bytes>" and the frames.
+	 */
+	void sendSegments(PrintStream out) throws IOException {
+		Vector<ByteBuffer> reports = new Vector<ByteBuffer>();
+		long total = 0;
+		for( int set = 1; ; set++ ) {
+			File f = new File(SHM_DIR, segment + "-" + set);
+			if( ! f.exists() ) {
+				break;
+			}
+			RandomAccessFile raf = new RandomAccessFile(f, "r");
+			try {
+				MappedByteBuffer seg = raf.getChannel().map(FileChannel.MapMode.READ_ONLY, 0, raf.length());
+				seg.order(ByteOrder.nativeOrder());
+				if( seg.get(0) != 'K' || seg.get(1) != 'I' || seg.get(2) != 'N' || seg.get(3) != 'S' ) {
+					break;
+				}
+				int report = (int) seg.getLong(48);
+				int reportLength = (int) seg.getLong(56);
+				seg.position(report);
+				seg.limit(report + reportLength);
+				reports.add(seg.slice());
+				total += reportLength;
+			}
+			finally {
+				raf.close();		// the mapping stays valid
+			}
+		}
+		if( binary ) {
+			out.println("#!binary " + total);
+		}
+		out.flush();
+		WritableByteChannel channel = Channels.newChannel(connectSock.getOutputStream());
+		for( int k = 0; k < reports.size(); k++ ) {
+			ByteBuffer r = reports.get(k);
+			while( r.hasRemaining() ) {
+				channel.write(r);
+			}
+		}
+	}
+
 	public void run() {
 		BufferedReader in = null;
 		PrintStream out = null;
@@ -80,6 +292,13 @@ class theServerChild extends Thread {
        			in = new BufferedReader(new InputStreamReader(connectSock.getInputStream()));
        			out = new PrintStream(connectSock.getOutputStream());
 
+			jobDir = File.createTempFile("job", "", jobsDir);
+			jobDir.delete();
+			if( ! jobDir.mkdir() ) {
+				throw new IOException("can't create " + jobDir);
+			}
+			tmp_inputFile = new File(jobDir, "kin.i01").getPath();
+
 			fw = new PrintWriter(new FileWriter(tmp_inputFile));
 
        			while (true) {
@@ -93,6 +312,34 @@ class theServerChild extends Thread {
          			if (aLine.equalsIgnoreCase("THE END")) {
 					break;
          			}
+				else if( aLine.startsWith("#!") ) {
+					// directives come before the input file
+					if( aLine.equalsIgnoreCase("#!stream") ) {
+						streaming = true;
+					}
+					if( aLine.equalsIgnoreCase("#!binary") ) {
+						binary = true;
+					}
+					if( aLine.equalsIgnoreCase("#!rows") ) {
+						timeMajor = true;
+					}
+					if( aLine.startsWith("#!digits ") ) {
+						try {
+							digits = "" + Integer.parseInt(aLine.substring(9).trim());
+						}
+						catch (NumberFormatException ne) {
+							System.out.println("SERVER bad digits: " + aLine);
+						}
+					}
+					if( aLine.startsWith("#!deadline ") ) {
+						try {
+							deadline = "" + Double.parseDouble(aLine.substring(11).trim());
+						}
+						catch (NumberFormatException ne) {
+							System.out.println("SERVER bad deadline: " + aLine);
+						}
+					}
+				}
 				else {
 					fw.println(aLine);		// store this to a file
 				}
@@ -121,9 +368,31 @@ class theServerChild extends Thread {
 			 *    we should abort the solver
 			 */	
 
+			running(Thread.currentThread());
 			Checker ch = new Checker(this, connectSock, in);
 			ch.start();
 
+			/*
+			 * Admission: the solver estimates the memory of every data set ( kin -e ),
+			 * the largest has to fit next to the running solvers, else we wait;
+			 * the estimate is an upper bound, one larger than the limit even at
+			 * the least is rejected.
+			 */
+			try {
+				long [] need = estimate();
+				admitted = theServer.admit(need[0], need[1]);
+				if( admitted < 0 ) {
+					admitted = 0;
+					out.println("#!rejected needs " + need[1] / (1024 * 1024) + " MB, the limit is "
+						+ theServer.memoryLimit / (1024 * 1024) + " MB");
+					return;
+				}
+			}
+			catch (InterruptedException e) {
+				// cancelled while waiting
+				return;
+			}
+
 
 
 
@@ -131,26 +400,82 @@ class theServerChild extends Thread {
 
 			try {
 				//String [] cmdArgs = { "java", "tmpSolver" };
-				String [] cmdArgs = { solverBin };
+				Vector<String> cmd = new Vector<String>();
+				cmd.add(solverBin);
+				cmd.add("-d");
+				cmd.add(jobDir.getPath());
+				if( streaming ) {
+					cmd.add("-s");
+				}
+				if( binary ) {
+					cmd.add("-b");
+				}
+				if( SHM_DIR.isDirectory() ) {
+					// the results come through shared memory, not kin.o02
+					segment = "kin-" + jobDir.getName();
+					cmd.add("-m");
+					cmd.add("/" + segment);
+				}
+				if( timeMajor ) {
+					cmd.add("-r");
+				}
+				if( digits != null ) {
+					cmd.add("-p");
+					cmd.add(digits);
+				}
+				if( deadline != null ) {
+					cmd.add("-t");
+					cmd.add(deadline);
+				}
+				String [] cmdArgs = cmd.toArray(new String[0]);
 
 				Process process = null;
+				int exitVal = 0;
 				process = Runtime.getRuntime().exec(cmdArgs, null, new File("."));
+				started(process);
 				try {
-					int exitVal = process.waitFor();
-
-					if( exitVal != 0 ) {
-						System.out.println("SERVER error in exec (return code): " + exitVal);
-						return;
+					if( streaming ) {
+						// forward the "#!" lines of the solver as they come
+						BufferedReader sr = new BufferedReader(new InputStreamReader(process.getInputStream()));
+						String sLine = null;
+						try {
+							while( (sLine = sr.readLine()) != null ) {
+								if( sLine.startsWith("#!") ) {
+									out.println(sLine);
+									out.flush();
+								}
+							}
+						}
+						catch (IOException se) {
+							// the solver was stopped, its results follow
+						}
+						sr.close();
 					}
+					exitVal = process.waitFor();
+					running(null);
 				}
 				catch (InterruptedException e) {
 					// user on client pressed the interrupt button
 					// and the checker in this file throu an exception because of the failed read (test failed read).
-					// We catch the exception and we kill the solver process.
-					// 
+					// We stop the solver: on SIGTERM ( destroy ) it ends at its next
+					// time step and still writes its results up to there, which we send.
 					//
 					//System.out.println("SERVER Interrupted: " + e);
+					running(null);
 					process.destroy();
+					while( true ) {
+						try {
+							exitVal = process.waitFor();
+							break;
+						}
+						catch (InterruptedException ie) {
+							// a second cancel, keep waiting for the partial results
+						}
+					}
+				}
+
+				if( exitVal != 0 ) {
+					System.out.println("SERVER error in exec (return code): " + exitVal);
 					return;
 				}
 			}
@@ -170,7 +495,26 @@ class theServerChild extends Thread {
 			/*
 			 * and here sends results back
 			 */
-			br = new BufferedReader( new FileReader("kin.o02"));	// LEON for now use this hardcoded name
+			if( segment != null ) {
+				sendSegments(out);
+				return;
+			}
+			if( binary ) {
+				// the packed frames of kin.b02: "#!binary <bytes>", then the bytes
+				File packed = new File(jobDir, "kin.b02");
+				byte [] frames = new byte[(int) packed.length()];
+				DataInputStream pin = new DataInputStream(new FileInputStream(packed));
+				try {
+					pin.readFully(frames);
+				}
+				finally {
+					pin.close();
+				}
+				out.println("#!binary " + frames.length);
+				out.write(frames, 0, frames.length);
+				return;
+			}
+			br = new BufferedReader( new FileReader(new File(jobDir, "kin.o02")));
 
 
 
@@ -191,32 +535,32 @@ class theServerChild extends Thread {
      		}
 
 		finally {
+			running(null);
+			theServer.release(admitted);
+			admitted = 0;
 			try {
-				File fin_tmp = new File(tmp_inputFile);
-
-				out.println("THE END");		// indicate the end of the transaction
+				if( out != null ) out.println("THE END");		// indicate the end of the transaction
 
-				fin_tmp.delete();
 				if( in != null )  in.close();
 				if( out != null ) out.close();
 				connectSock.close();
 
-				// LEON HERE WE SHOULD DELETE THE FILE NAME pointed to by br.
 				if(br != null) br.close();
 			}
 			catch(IOException e) {
 				System.out.println("in finally (server): " + e);
 			}
+			cleanUp();
 			//System.out.println("DONE TRANSACTION");
 		}
 	}
 }
 
 class Checker extends Thread {
-	Thread parentth = null;
+	theServerChild parentth = null;
 	Socket s = null;
 	BufferedReader in = null;
-	Checker(Thread parentth, Socket s, BufferedReader in) {
+	Checker(theServerChild parentth, Socket s, BufferedReader in) {
 		this.parentth = parentth;
 		this.s = s;
 		this.in = in;
@@ -230,7 +574,7 @@ class Checker extends Thread {
 				char []buf = new char[2];
 				int h = in.read(buf, 0, 1);
 				//System.out.println("return of read: " + h);
-				parentth.interrupt();
+				parentth.cancel();
 				return;
 			}
      			catch (IOException ioe) {
@@ -238,7 +582,7 @@ class Checker extends Thread {
 				//
 				//
        				//System.out.println("LEON SERVER CHECKER IO Exception. " + ioe);
-				parentth.interrupt();		// in this case I don't think this hurts. (don't think we need it though).
+				parentth.cancel();		// in this case I don't think this hurts. (don't think we need it though).
 				return;
      			}
 			catch(InterruptedException ie) {